@@ -1,25 +1,590 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #define REPORT_FILE "report.txt"
+#define KMSG_FILE "/dev/kmsg"
+#define GENERAL_CLASS "General"
+
+#define READ_BUFFER_SIZE (64 * 1024)
+#define INITIAL_TABLE_SIZE 256
+#define FOLLOW_MAX_ENTRIES 128      /* entries kept per class in follow mode */
+#define DEFAULT_INTERVAL_MS 1000    /* report rewrite period in follow mode */
+#define MAX_EPOLL_EVENTS 8
+
+struct logClass {
+    char *name;
+    char **entries;          /* ring buffer when maxEntries > 0 */
+    size_t first;
+    size_t count;
+    size_t capacity;
+    unsigned long total;     /* entries ever seen, including evicted ones */
+    unsigned long lastTotal; /* total at the previous rate tick */
+    double rate;             /* entries per second over the last tick */
+};
+
+struct classTable {
+    struct logClass **slots; /* open addressing, power of two sized */
+    size_t size;
+    struct logClass **order; /* classes in order of first appearance */
+    size_t length;
+    size_t orderCapacity;
+    size_t maxEntries;       /* 0 keeps every entry */
+};
+
+struct outBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+static struct classTable table;
+static char *currentHeader = NULL; /* class of a "<class>:" header line */
 
 void analizeLog(char *logFile, char *report);
+int followLog(char *source, char *report, int intervalMs);
 
-int main(int argc, char **argv) {
+static void *xmalloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    return ptr;
+}
 
-    if (argc < 2) {
-	printf("Usage:./dmesg-analizer.o logfile.txt\n");
-	return 1;
+static void *xrealloc(void *old, size_t size) {
+    void *ptr = realloc(old, size);
+    if (ptr == NULL) {
+	perror("realloc");
+	exit(1);
     }
+    return ptr;
+}
 
-    analizeLog(argv[1], REPORT_FILE);
+static char *copyString(const char *str, size_t length) {
+    char *copy = xmalloc(length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/* FNV-1a */
+static size_t hashString(const char *str, size_t length) {
+    size_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++) {
+	hash ^= (unsigned char) str[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void initTable(size_t maxEntries) {
+    table.size = INITIAL_TABLE_SIZE;
+    table.slots = calloc(table.size, sizeof(struct logClass *));
+    table.orderCapacity = 64;
+    table.order = xmalloc(table.orderCapacity * sizeof(struct logClass *));
+    table.length = 0;
+    table.maxEntries = maxEntries;
+    if (table.slots == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+}
+
+static void growTable() {
+    struct logClass **old = table.slots;
+    size_t oldSize = table.size;
+    size_t i;
+
+    table.size *= 2;
+    table.slots = calloc(table.size, sizeof(struct logClass *));
+    if (table.slots == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    for (i = 0; i < oldSize; i++) {
+	if (old[i] != NULL) {
+	    size_t index = hashString(old[i]->name, strlen(old[i]->name)) & (table.size - 1);
+	    while (table.slots[index] != NULL)
+		index = (index + 1) & (table.size - 1);
+	    table.slots[index] = old[i];
+	}
+    }
+    free(old);
+}
+
+static struct logClass *findClass(const char *name, size_t length) {
+    size_t index;
+    struct logClass *class;
+
+    if (table.length * 2 >= table.size)
+	growTable();
+
+    index = hashString(name, length) & (table.size - 1);
+    while ((class = table.slots[index]) != NULL) {
+	if (strncmp(class->name, name, length) == 0 && class->name[length] == '\0')
+	    return class;
+	index = (index + 1) & (table.size - 1);
+    }
+
+    class = calloc(1, sizeof(struct logClass));
+    if (class == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    class->name = copyString(name, length);
+    table.slots[index] = class;
+
+    if (table.length == table.orderCapacity) {
+	table.orderCapacity *= 2;
+	table.order = xrealloc(table.order, table.orderCapacity * sizeof(struct logClass *));
+    }
+    table.order[table.length++] = class;
+    return class;
+}
+
+static void addEntry(struct logClass *class, const char *entry, size_t length) {
+    char *copy = copyString(entry, length);
+
+    class->total++;
+    if (table.maxEntries > 0 && class->count == table.maxEntries) {
+	/* ring is full, overwrite the oldest entry */
+	free(class->entries[class->first]);
+	class->entries[class->first] = copy;
+	class->first = (class->first + 1) % class->capacity;
+	return;
+    }
+    if (class->count == class->capacity) {
+	size_t capacity = class->capacity == 0 ? 8 : class->capacity * 2;
+	if (table.maxEntries > 0 && capacity > table.maxEntries)
+	    capacity = table.maxEntries;
+	class->entries = xrealloc(class->entries, capacity * sizeof(char *));
+	class->capacity = capacity;
+    }
+    class->entries[(class->first + class->count) % class->capacity] = copy;
+    class->count++;
+}
+
+/*
+ * Classifies a single "[ timestamp] message" line. Messages are split on
+ * the first ": ", a message ending in ':' becomes a header for the
+ * indented lines that follow it and anything else goes to General.
+ */
+static void classifyLine(const char *line, size_t length) {
+    const char *message = line, *end = line + length, *sep;
+    char entry[READ_BUFFER_SIZE];
+    size_t stampLength = 0, entryLength;
+    struct logClass *class;
+
+    if (length > 0 && line[length - 1] == '\r')
+	end--;
+    if (line == end)
+	return;
+
+    if (*line == '[') {
+	const char *close = memchr(line, ']', end - line);
+	if (close != NULL) {
+	    stampLength = close - line + 1;
+	    message = close + 1;
+	    if (message < end && *message == ' ')
+		message++;
+	}
+    }
+
+    /* indented lines continue the last header */
+    if (currentHeader != NULL && message < end && *message == ' ') {
+	addEntry(findClass(currentHeader, strlen(currentHeader)), line, end - line);
+	return;
+    }
+    free(currentHeader);
+    currentHeader = NULL;
 
+    if (end > message && end[-1] == ':' && memmem(message, end - message, ": ", 2) == NULL) {
+	currentHeader = copyString(message, end - message - 1);
+	findClass(currentHeader, strlen(currentHeader));
+	return;
+    }
+
+    for (sep = message; sep + 1 < end; sep++)
+	if (sep[0] == ':' && sep[1] == ' ')
+	    break;
+
+    if (sep + 1 < end && sep > message) {
+	class = findClass(message, sep - message);
+	sep += 2;
+	entryLength = stampLength + 1 + (end - sep);
+	if (entryLength >= sizeof(entry))
+	    entryLength = sizeof(entry) - 1;
+	memcpy(entry, line, stampLength);
+	entry[stampLength] = ' ';
+	memcpy(entry + stampLength + 1, sep, entryLength - stampLength - 1);
+	addEntry(class, entry, entryLength);
+    } else {
+	addEntry(findClass(GENERAL_CLASS, strlen(GENERAL_CLASS)), line, end - line);
+    }
+}
+
+static void appendOut(struct outBuffer *out, const char *data, size_t length) {
+    if (out->length + length > out->capacity) {
+	while (out->length + length > out->capacity)
+	    out->capacity = out->capacity == 0 ? READ_BUFFER_SIZE : out->capacity * 2;
+	out->data = xrealloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+static void appendString(struct outBuffer *out, const char *str) {
+    appendOut(out, str, strlen(str));
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+    while (length > 0) {
+	ssize_t written = write(fd, data, length);
+	if (written < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	data += written;
+	length -= written;
+    }
     return 0;
 }
 
+/*
+ * Writes the report into a temporary file next to the destination and
+ * renames it, so readers never observe a partially written report.
+ */
+static int writeReport(char *report, int withStats) {
+    struct outBuffer out = {NULL, 0, 0};
+    char tmpName[4096], line[512];
+    size_t i, j;
+    int fd;
+
+    if (withStats) {
+	appendString(&out, "Summary:\n");
+	for (i = 0; i < table.length; i++) {
+	    struct logClass *class = table.order[i];
+	    snprintf(line, sizeof(line), "  %s: count=%lu rate=%.2f/s\n",
+		     class->name, class->total, class->rate);
+	    appendString(&out, line);
+	}
+    }
+    for (i = 0; i < table.length; i++) {
+	struct logClass *class = table.order[i];
+	appendString(&out, class->name);
+	appendString(&out, ":\n");
+	for (j = 0; j < class->count; j++) {
+	    appendString(&out, "  ");
+	    appendString(&out, class->entries[(class->first + j) % class->capacity]);
+	    appendString(&out, "\n");
+	}
+    }
+
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", report);
+    fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	perror(tmpName);
+	free(out.data);
+	return -1;
+    }
+    if (writeAll(fd, out.data, out.length) < 0 || close(fd) < 0) {
+	perror(tmpName);
+	unlink(tmpName);
+	free(out.data);
+	return -1;
+    }
+    free(out.data);
+    if (rename(tmpName, report) < 0) {
+	perror(report);
+	unlink(tmpName);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * Splits buffered data into lines and classifies the complete ones,
+ * returning how many bytes were consumed.
+ */
+static size_t consumeLines(char *data, size_t length) {
+    char *start = data, *end = data + length, *newline;
+
+    while (start < end && (newline = memchr(start, '\n', end - start)) != NULL) {
+	classifyLine(start, newline - start);
+	start = newline + 1;
+    }
+    return start - data;
+}
+
+/*
+ * /dev/kmsg hands out one "prio,seq,usec,flags;message" record per read,
+ * optionally followed by " KEY=value" dictionary lines.
+ */
+static void consumeKmsgRecord(char *record, size_t length) {
+    char line[READ_BUFFER_SIZE];
+    char *message = memchr(record, ';', length), *newline;
+    unsigned long long usec = 0;
+    int lineLength;
+
+    if (message == NULL)
+	return;
+    sscanf(record, "%*u,%*u,%llu", &usec);
+    message++;
+    newline = memchr(message, '\n', record + length - message);
+    if (newline == NULL)
+	newline = record + length;
+
+    lineLength = snprintf(line, sizeof(line), "[%5llu.%06llu] %.*s",
+			  usec / 1000000, usec % 1000000, (int) (newline - message), message);
+    if (lineLength >= (int) sizeof(line))
+	lineLength = sizeof(line) - 1;
+    classifyLine(line, lineLength);
+}
+
 void analizeLog(char *logFile, char *report) {
+    char *buffer = xmalloc(READ_BUFFER_SIZE);
+    size_t pending = 0, used;
+    ssize_t bytes;
+    int fd;
+
     printf("Generating Report from: [%s] log file\n", logFile);
 
-    // Implement your solution here.
+    fd = open(logFile, O_RDONLY);
+    if (fd < 0) {
+	perror(logFile);
+	free(buffer);
+	return;
+    }
+
+    initTable(0);
+    while ((bytes = read(fd, buffer + pending, READ_BUFFER_SIZE - pending)) > 0) {
+	pending += bytes;
+	used = consumeLines(buffer, pending);
+	if (used == 0 && pending == READ_BUFFER_SIZE)
+	    used = pending; /* overlong line, drop it */
+	memmove(buffer, buffer + used, pending - used);
+	pending -= used;
+    }
+    if (bytes < 0)
+	perror(logFile);
+    if (pending > 0)
+	classifyLine(buffer, pending);
+    close(fd);
+    free(buffer);
+
+    if (writeReport(report, 0) == 0)
+	printf("Report is generated at: [%s]\n", report);
+}
+
+static double elapsedSeconds(struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
 
+/* Updates per-class rates, returns non-zero when any of them changed. */
+static int updateRates(double seconds) {
+    int changed = 0;
+    size_t i;
+
+    for (i = 0; i < table.length; i++) {
+	struct logClass *class = table.order[i];
+	double rate = seconds > 0 ? (class->total - class->lastTotal) / seconds : 0;
+	if (rate != class->rate)
+	    changed = 1;
+	class->rate = rate;
+	class->lastTotal = class->total;
+    }
+    return changed;
+}
+
+/*
+ * Follows a log source and keeps the report up to date. The source can be
+ * /dev/kmsg, a FIFO or a regular file being appended to; regular files
+ * can't be polled, so an inotify watch on them drives the reads instead.
+ */
+int followLog(char *source, char *report, int intervalMs) {
+    struct epoll_event event, events[MAX_EPOLL_EVENTS];
+    struct itimerspec interval;
+    struct timespec lastTick;
+    struct stat info;
+    sigset_t mask;
+    char *buffer = xmalloc(READ_BUFFER_SIZE);
+    size_t pending = 0, used;
+    off_t offset = 0;
+    int isKmsg = strcmp(source, KMSG_FILE) == 0;
+    int epfd, fd, watchFd = -1, timerFd, signalFd;
+    int running = 1, dirty = 1, drain, i, ready;
+
+    fd = open(source, O_RDONLY | O_NONBLOCK);
+    if (fd < 0 || fstat(fd, &info) < 0) {
+	perror(source);
+	free(buffer);
+	return 1;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    interval.it_interval.tv_sec = intervalMs / 1000;
+    interval.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+    interval.it_value = interval.it_interval;
+    timerfd_settime(timerFd, 0, &interval, NULL);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0 || timerFd < 0 || signalFd < 0) {
+	perror("followLog");
+	free(buffer);
+	return 1;
+    }
+
+    event.events = EPOLLIN;
+    if (S_ISREG(info.st_mode)) {
+	watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watchFd < 0 || inotify_add_watch(watchFd, source, IN_MODIFY) < 0) {
+	    perror(source);
+	    free(buffer);
+	    return 1;
+	}
+	event.data.fd = watchFd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, watchFd, &event);
+    } else {
+	event.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+    }
+    event.data.fd = timerFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &event);
+    event.data.fd = signalFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, signalFd, &event);
+
+    initTable(FOLLOW_MAX_ENTRIES);
+    clock_gettime(CLOCK_MONOTONIC, &lastTick);
+    printf("Following: [%s], report at: [%s]\n", source, report);
+
+    /* regular files have no initial readiness event, read what is there */
+    drain = S_ISREG(info.st_mode);
+
+    while (running) {
+	if (drain) {
+	    ssize_t bytes;
+	    if (watchFd >= 0 && fstat(fd, &info) == 0 && info.st_size < offset) {
+		/* truncated or rotated in place, start over */
+		lseek(fd, 0, SEEK_SET);
+		offset = 0;
+		pending = 0;
+	    }
+	    while ((bytes = read(fd, buffer + pending, READ_BUFFER_SIZE - pending)) != 0) {
+		if (bytes < 0) {
+		    if (errno == EINTR)
+			continue;
+		    if (errno == EPIPE && isKmsg)
+			continue; /* ring buffer overran us, next read resyncs */
+		    if (errno != EAGAIN)
+			perror(source);
+		    break;
+		}
+		offset += bytes;
+		dirty = 1;
+		if (isKmsg) {
+		    consumeKmsgRecord(buffer, bytes);
+		    continue;
+		}
+		pending += bytes;
+		used = consumeLines(buffer, pending);
+		if (used == 0 && pending == READ_BUFFER_SIZE)
+		    used = pending;
+		memmove(buffer, buffer + used, pending - used);
+		pending -= used;
+	    }
+	    if (bytes == 0 && watchFd < 0)
+		running = 0; /* last FIFO writer is gone */
+	    drain = 0;
+	}
+	if (!running)
+	    break;
+
+	ready = epoll_wait(epfd, events, MAX_EPOLL_EVENTS, -1);
+	if (ready < 0 && errno != EINTR) {
+	    perror("epoll_wait");
+	    break;
+	}
+	for (i = 0; i < ready; i++) {
+	    int readyFd = events[i].data.fd;
+	    if (readyFd == fd) {
+		drain = 1;
+	    } else if (readyFd == watchFd) {
+		char watchEvents[4096];
+		while (read(watchFd, watchEvents, sizeof(watchEvents)) > 0)
+		    ;
+		drain = 1;
+	    } else if (readyFd == timerFd) {
+		unsigned long long expirations;
+		read(timerFd, &expirations, sizeof(expirations));
+		if (updateRates(elapsedSeconds(&lastTick)))
+		    dirty = 1;
+		clock_gettime(CLOCK_MONOTONIC, &lastTick);
+		if (dirty && writeReport(report, 1) == 0)
+		    dirty = 0;
+	    } else if (readyFd == signalFd) {
+		running = 0;
+	    }
+	}
+    }
+
+    if (pending > 0)
+	classifyLine(buffer, pending);
+    updateRates(elapsedSeconds(&lastTick));
+    writeReport(report, 1);
     printf("Report is generated at: [%s]\n", report);
+
+    close(fd);
+    if (watchFd >= 0)
+	close(watchFd);
+    close(timerFd);
+    close(signalFd);
+    close(epfd);
+    free(buffer);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2) {
+	printf("Usage:./dmesg-analizer.o logfile.txt\n");
+	printf("      ./dmesg-analizer.o --follow [source] [interval_ms]\n");
+	return 1;
+    }
+
+    if (strcmp(argv[1], "--follow") == 0) {
+	char *source = argc > 2 ? argv[2] : KMSG_FILE;
+	int intervalMs = argc > 3 ? atoi(argv[3]) : DEFAULT_INTERVAL_MS;
+	if (intervalMs <= 0) {
+	    printf("Invalid interval: %s\n", argv[3]);
+	    return 1;
+	}
+	return followLog(source, REPORT_FILE, intervalMs);
+    }
+
+    analizeLog(argv[1], REPORT_FILE);
+
+    return 0;
 }
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "city.h"
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+/* Sizes are rounded up to whole blocks, so the street pattern wraps evenly. */
+int initCity(struct city *c, int width, int height, int semaphores, unsigned seed) {
+    int x, y, i, j, t, intersections, *order;
+
+    c->width = (width + 2 * BLOCK - 1) / (2 * BLOCK) * 2 * BLOCK;
+    c->height = (height + 2 * BLOCK - 1) / (2 * BLOCK) * 2 * BLOCK;
+    c->ways = xcalloc((size_t) c->width * c->height, 1);
+    c->occupant = xcalloc((size_t) c->width * c->height, sizeof(atomic_int));
+    c->semaphoreAt = xcalloc((size_t) c->width * c->height, sizeof(int));
+
+    for (y = 0; y < c->height; y++) {
+	for (x = 0; x < c->width; x++) {
+	    int cell = y * c->width + x;
+	    c->semaphoreAt[cell] = -1;
+	    if (y % BLOCK == 0)
+		c->ways[cell] |= (y / BLOCK) % 2 == 0 ? EAST : WEST;
+	    if (x % BLOCK == 0)
+		c->ways[cell] |= (x / BLOCK) % 2 == 0 ? SOUTH : NORTH;
+	}
+    }
+
+    /* semaphores go on a random subset of the intersections */
+    intersections = (c->width / BLOCK) * (c->height / BLOCK);
+    if (semaphores > intersections)
+	semaphores = intersections;
+    if (semaphores < 0)
+	semaphores = 0;
+    order = xcalloc(intersections, sizeof(int));
+    for (i = 0; i < intersections; i++)
+	order[i] = i;
+    for (i = 0; i < semaphores; i++) {
+	j = i + rand_r(&seed) % (intersections - i);
+	t = order[i];
+	order[i] = order[j];
+	order[j] = t;
+    }
+    c->semaphoreCount = semaphores;
+    c->semaphoreCells = xcalloc(semaphores + 1, sizeof(int));
+    c->green = xcalloc(semaphores + 1, sizeof(atomic_int));
+    for (i = 0; i < semaphores; i++) {
+	x = order[i] % (c->width / BLOCK) * BLOCK;
+	y = order[i] / (c->width / BLOCK) * BLOCK;
+	c->semaphoreCells[i] = y * c->width + x;
+	c->semaphoreAt[y * c->width + x] = i;
+	atomic_init(&c->green[i], i % 2 == 0 ? HORIZONTAL : VERTICAL);
+    }
+    free(order);
+    return 0;
+}
+
+void freeCity(struct city *c) {
+    free(c->ways);
+    free(c->occupant);
+    free(c->semaphoreAt);
+    free(c->semaphoreCells);
+    free(c->green);
+}
+
+/* The cell one step away, wrapping around the edges. */
+int nextCell(const struct city *c, int cell, int way) {
+    int x = cell % c->width, y = cell / c->width;
+
+    switch (way) {
+    case EAST:
+	x = x + 1 == c->width ? 0 : x + 1;
+	break;
+    case WEST:
+	x = x == 0 ? c->width - 1 : x - 1;
+	break;
+    case SOUTH:
+	y = y + 1 == c->height ? 0 : y + 1;
+	break;
+    default:
+	y = y == 0 ? c->height - 1 : y - 1;
+    }
+    return y * c->width + x;
+}
+
+/* Whether a car travelling way may drive into cell now. */
+int mayEnter(const struct city *c, int cell, int way) {
+    int s = c->semaphoreAt[cell];
+    return s < 0 || (atomic_load_explicit(&c->green[s], memory_order_relaxed) & way) != 0;
+}
+
+/* Takes cell for car if it is free. */
+int claimCell(struct city *c, int cell, int car) {
+    int expected = NO_CAR;
+    return atomic_compare_exchange_strong_explicit(&c->occupant[cell], &expected, car + 1,
+						   memory_order_acquire, memory_order_relaxed);
+}
+
+void releaseCell(struct city *c, int cell) {
+    atomic_store_explicit(&c->occupant[cell], NO_CAR, memory_order_release);
+}
+
+/* The car in cell, or -1. */
+int carAt(const struct city *c, int cell) {
+    return atomic_load_explicit(&c->occupant[cell], memory_order_relaxed) - 1;
+}
+
+/* Cars in the depth cells before a semaphore on its axis street. */
+int queuedCars(const struct city *c, int semaphore, int axis, int depth) {
+    int cell = c->semaphoreCells[semaphore], way = c->ways[cell] & axis, back, queued = 0;
+
+    back = way == EAST ? WEST : way == WEST ? EAST : way == SOUTH ? NORTH : SOUTH;
+    while (depth-- > 0) {
+	cell = nextCell(c, cell, back);
+	queued += carAt(c, cell) >= 0;
+    }
+    return queued;
+}
+
+/*
+ * Shortest route from one street cell to another, following street
+ * directions. Fills route with up to max cells, both ends included, and
+ * returns its length, or 0 when it does not fit.
+ */
+int findRoute(const struct city *c, int from, int to, int *route, int max) {
+    int cells = c->width * c->height, head = 0, tail = 0, cell, next, way, length, i;
+    int *previous = xcalloc(cells, sizeof(int)), *queue = xcalloc(cells, sizeof(int));
+
+    for (i = 0; i < cells; i++)
+	previous[i] = -1;
+    previous[from] = from;
+    queue[tail++] = from;
+    while (head < tail && previous[to] < 0) {
+	cell = queue[head++];
+	for (way = EAST; way <= NORTH; way <<= 1) {
+	    if (!(c->ways[cell] & way))
+		continue;
+	    next = nextCell(c, cell, way);
+	    if (previous[next] < 0) {
+		previous[next] = cell;
+		queue[tail++] = next;
+	    }
+	}
+    }
+
+    length = 0;
+    if (previous[to] >= 0) {
+	for (cell = to; cell != from; cell = previous[cell])
+	    length++;
+	length++;
+	if (length > max) {
+	    length = 0;
+	} else {
+	    for (cell = to, i = length - 1; i >= 0; cell = previous[cell], i--)
+		route[i] = cell;
+	}
+    }
+    free(previous);
+    free(queue);
+    return length;
+}
@@ -0,0 +1,40 @@
+// City map shared by the car and semaphore threads
+//
+// The map is a flat grid. Every BLOCK rows there is a one-way street
+// running east or west, and every BLOCK columns one running south or
+// north, alternating. Streets wrap around the city edges like a ring
+// road, so every street cell can reach every other one.
+//
+// Occupancy is one atomic car id per cell. A car claims the next cell
+// with a single compare-and-swap, and finds the car ahead by reading the
+// cell it failed to claim. Moving never takes a map-wide lock.
+
+#include <stdatomic.h>
+
+#define BLOCK 8
+#define NO_CAR 0
+
+enum way {EAST = 1, WEST = 2, SOUTH = 4, NORTH = 8};
+
+#define HORIZONTAL (EAST | WEST)
+#define VERTICAL (SOUTH | NORTH)
+
+struct city {
+    int width, height;
+    unsigned char *ways;            /* ways a car may leave each cell by, 0 off street */
+    atomic_int *occupant;           /* car id + 1, or NO_CAR */
+    int *semaphoreAt;               /* semaphore of an intersection cell, or -1 */
+    int semaphoreCount;
+    int *semaphoreCells;
+    atomic_int *green;              /* HORIZONTAL or VERTICAL per semaphore */
+};
+
+int initCity(struct city *c, int width, int height, int semaphores, unsigned seed);
+void freeCity(struct city *c);
+int nextCell(const struct city *c, int cell, int way);
+int mayEnter(const struct city *c, int cell, int way);
+int claimCell(struct city *c, int cell, int car);
+void releaseCell(struct city *c, int cell);
+int carAt(const struct city *c, int cell);
+int queuedCars(const struct city *c, int semaphore, int axis, int depth);
+int findRoute(const struct city *c, int from, int to, int *route, int max);
@@ -0,0 +1,32 @@
+# city-traffic build & test automation
+
+APP_NAME=traffic
+LIB_NAME=city
+CORE_DIR=../sim-core
+
+build:
+	gcc -c ${LIB_NAME}.c -o ${LIB_NAME}.o
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/replay.c -o replay.o
+	gcc -I${CORE_DIR} -c ${APP_NAME}.c -o ${APP_NAME}.o
+	gcc ${LIB_NAME}.o replay.o ${APP_NAME}.o -o ${APP_NAME} -lpthread
+test: build
+	@echo Test 1
+	./${APP_NAME} -c 5 -s 4 -r 1
+	@echo Test 2
+	./${APP_NAME} -b 1 -c 1000 -t 4
+	@echo Test 3 - record a run and replay it on one thread
+	./${APP_NAME} -c 20 -s 4 -r 3 -o run.log
+	./${APP_NAME} -i run.log
+	@echo Test 4 - failed
+	-./${APP_NAME} -c 0
+bench:
+	gcc -O2 -I${CORE_DIR} ${LIB_NAME}.c ${CORE_DIR}/replay.c ${APP_NAME}.c -o ${APP_NAME}_bench.o -lpthread
+	@echo Benchmark - cell CAS against a global map mutex
+	./${APP_NAME}_bench.o -b 2 -s 64 -c 1000
+	./${APP_NAME}_bench.o -b 2 -s 64 -c 1000 -l
+	./${APP_NAME}_bench.o -b 2 -s 64 -c 10000 -t 4
+	./${APP_NAME}_bench.o -b 2 -s 64 -c 10000 -t 4 -l
+	./${APP_NAME}_bench.o -b 2 -s 64 -c 100000 -t 4
+	./${APP_NAME}_bench.o -b 2 -s 64 -c 100000 -t 4 -l
+clean:
+	rm -rf *.o ${APP_NAME} run.log
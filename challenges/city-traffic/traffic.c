@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "city.h"
+#include "replay.h"
+
+#define DEFAULT_CARS 10
+#define DEFAULT_SEMAPHORES 8
+#define DEFAULT_WIDTH 48
+#define DEFAULT_HEIGHT 24
+#define MIN_SPEED 2                 /* cells per second */
+#define MAX_SPEED 40
+#define ACCELERATION 2              /* speed gained per free move */
+#define MIN_GREEN_MS 300
+#define MAX_GREEN_MS 1500
+#define QUEUE_DEPTH 4               /* cells a semaphore looks back */
+#define STATUS_MS 500
+#define THREAD_STACK (64 * 1024)
+
+/* Recorded map changes */
+enum event {MOVE, PARK, SWITCH};
+
+struct car {
+    int id;
+    int maxSpeed;
+    atomic_int speed;               /* cells per second, read by the car behind */
+    int *route;
+    int length;
+    int position;                   /* index in route */
+    double startMs, finishMs;
+    atomic_int done;
+};
+
+/* A benchmark car: drives forever, turning at random at intersections. */
+struct cruiser {
+    int cell;
+    uint64_t rng;
+};
+
+struct benchThread {
+    pthread_t thread;
+    int first, last;                /* cruisers driven by this thread */
+    long moves;
+};
+
+static struct city city;
+static struct car *cars;
+static struct cruiser *cruisers;
+static atomic_int running = 1;
+static int globalLock;
+static pthread_mutex_t mapLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t startLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
+static int started;
+static struct simLog *recording;    /* semaphores' tracks first, then the cars' */
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void sleepMs(double ms) {
+    struct timespec t = {(time_t) (ms / 1e3), (long) ((ms - (time_t) (ms / 1e3) * 1e3) * 1e6)};
+    nanosleep(&t, NULL);
+}
+
+/* Small stacks, so tens of thousands of car threads fit. */
+static int startThread(pthread_t *thread, void *(*run)(void *), void *arg) {
+    pthread_attr_t attr;
+    int error;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK);
+    error = pthread_create(thread, &attr, run, arg);
+    pthread_attr_destroy(&attr);
+    return error;
+}
+
+/* The way from a cell to its neighbor next. */
+static int wayTo(int cell, int next) {
+    int x = cell % city.width, nx = next % city.width;
+
+    if (cell / city.width == next / city.width)
+	return nx == (x + 1) % city.width ? EAST : WEST;
+    return next / city.width == (cell / city.width + 1) % city.height ? SOUTH : NORTH;
+}
+
+/*
+ * Gives green to the other axis once the current one had its minimum
+ * time and has fewer cars waiting, or when it reaches its maximum.
+ */
+static void *runSemaphore(void *arg) {
+    int s = (int) (intptr_t) arg, axis, other;
+    double since = monotonicMs(), green;
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+	sleepMs(MIN_GREEN_MS / 6.0);
+	green = monotonicMs() - since;
+	axis = atomic_load_explicit(&city.green[s], memory_order_relaxed);
+	other = axis == HORIZONTAL ? VERTICAL : HORIZONTAL;
+	if (green < MIN_GREEN_MS)
+	    continue;
+	if (green >= MAX_GREEN_MS
+	    || queuedCars(&city, s, other, QUEUE_DEPTH) > queuedCars(&city, s, axis, QUEUE_DEPTH)) {
+	    atomic_store_explicit(&city.green[s], other, memory_order_relaxed);
+	    if (recording)
+		simRecord(recording, s, s, SWITCH, other, 0);
+	    since = monotonicMs();
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Drives one car along its route. A car that cannot claim the next
+ * cell matches the speed of the car in it; a free move accelerates it
+ * back towards its own maximum.
+ */
+static void *driveCar(void *arg) {
+    struct car *car = arg;
+    int cell, next, way, ahead, speed, aheadSpeed;
+
+    car->startMs = monotonicMs();
+    while (car->position < car->length - 1) {
+	cell = car->route[car->position];
+	next = car->route[car->position + 1];
+	way = wayTo(cell, next);
+	speed = atomic_load_explicit(&car->speed, memory_order_relaxed);
+
+	if (!mayEnter(&city, next, way)) {
+	    speed = 0;
+	} else if (claimCell(&city, next, car->id)) {
+	    if (recording)
+		simRecord(recording, city.semaphoreCount + car->id, car->id, MOVE, cell, next);
+	    releaseCell(&city, cell);
+	    car->position++;
+	    speed = speed + ACCELERATION < car->maxSpeed ? speed + ACCELERATION : car->maxSpeed;
+	} else if ((ahead = carAt(&city, next)) >= 0) {
+	    aheadSpeed = atomic_load_explicit(&cars[ahead].speed, memory_order_relaxed);
+	    if (aheadSpeed < speed)
+		speed = aheadSpeed;
+	}
+	atomic_store_explicit(&car->speed, speed, memory_order_relaxed);
+	sleepMs(1e3 / (speed > MIN_SPEED ? speed : MIN_SPEED));
+    }
+    if (recording)
+	simRecord(recording, city.semaphoreCount + car->id, car->id, PARK, car->route[car->position], 0);
+    releaseCell(&city, car->route[car->position]);
+    atomic_store_explicit(&car->speed, 0, memory_order_relaxed);
+    car->finishMs = monotonicMs();
+    atomic_store(&car->done, 1);
+    return NULL;
+}
+
+static int randomStreetCell(uint64_t *rng) {
+    int cell;
+
+    do
+	cell = simRandom(rng) % (city.width * city.height);
+    while (city.ways[cell] == 0);
+    return cell;
+}
+
+/* Prints a route as the cells where it starts, turns and ends. */
+static void printRoute(const struct car *car) {
+    int i;
+
+    printf("Car %d (max %d cells/s) finished in %.1f s:", car->id, car->maxSpeed,
+	   (car->finishMs - car->startMs) / 1e3);
+    for (i = 0; i < car->length; i++) {
+	if (i == 0 || i == car->length - 1
+	    || wayTo(car->route[i - 1], car->route[i]) != wayTo(car->route[i], car->route[i + 1]))
+	    printf("%s(%d,%d)", i == 0 ? " " : " -> ",
+		   car->route[i] % city.width, car->route[i] / city.width);
+    }
+    printf("\n");
+}
+
+/*
+ * Parks every car on its start cell and plans its route. Each car draws
+ * from its own random stream, so a replay places them the same way.
+ */
+static int placeCars(int carCount, unsigned seed) {
+    int maxRoute = city.width * city.height, i, from, to;
+    uint64_t rng;
+
+    cars = calloc(carCount, sizeof(struct car));
+    if (cars == NULL) {
+	perror("calloc");
+	return 1;
+    }
+    for (i = 0; i < carCount; i++) {
+	struct car *car = &cars[i];
+	car->id = i;
+	rng = simRandomSeed(seed, i);
+	car->maxSpeed = MIN_SPEED + 1 + simRandom(&rng) % (MAX_SPEED - MIN_SPEED);
+	car->route = malloc(maxRoute * sizeof(int));
+	if (car->route == NULL) {
+	    perror("malloc");
+	    return 1;
+	}
+	do
+	    from = randomStreetCell(&rng);
+	while (!claimCell(&city, from, i));
+	do
+	    to = randomStreetCell(&rng);
+	while (to == from);
+	car->length = findRoute(&city, from, to, car->route, maxRoute);
+	if (car->length == 0) {
+	    fprintf(stderr, "No route for car %d\n", i);
+	    return 1;
+	}
+	printf("Car %d: (%d,%d) to (%d,%d), %d cells, max speed %d cells/s\n", i,
+	       from % city.width, from / city.width, to % city.width, to / city.width,
+	       car->length - 1, car->maxSpeed);
+    }
+    return 0;
+}
+
+static void freeCars(int carCount) {
+    int i;
+
+    for (i = 0; i < carCount; i++)
+	free(cars[i].route);
+    free(cars);
+}
+
+/* The map, the lights and how far each car got. */
+static uint64_t cityChecksum(int carCount) {
+    uint64_t hash = SIM_HASH_START;
+    int i, cells = city.width * city.height, value;
+
+    for (i = 0; i < cells; i++) {
+	value = carAt(&city, i);
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    for (i = 0; i < city.semaphoreCount; i++) {
+	value = atomic_load(&city.green[i]);
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    for (i = 0; i < carCount; i++)
+	hash = simHash(hash, &cars[i].position, sizeof(int));
+    return hash;
+}
+
+static int simulate(int carCount, unsigned seed, const char *logPath) {
+    pthread_t *carThreads = calloc(carCount, sizeof(pthread_t));
+    pthread_t *semaphoreThreads = calloc(city.semaphoreCount + 1, sizeof(pthread_t));
+    int i, finished = 0, status = 0;
+    double start = monotonicMs();
+
+    if (carThreads == NULL || semaphoreThreads == NULL) {
+	perror("calloc");
+	return 1;
+    }
+    if (placeCars(carCount, seed) != 0)
+	return 1;
+
+    for (i = 0; i < city.semaphoreCount; i++)
+	if (startThread(&semaphoreThreads[i], runSemaphore, (void *) (intptr_t) i) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    for (i = 0; i < carCount; i++)
+	if (startThread(&carThreads[i], driveCar, &cars[i]) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+
+    while (finished < carCount) {
+	sleepMs(STATUS_MS);
+	printf("[%5.1fs] speeds:", (monotonicMs() - start) / 1e3);
+	for (i = 0, finished = 0; i < carCount; i++) {
+	    if (atomic_load(&cars[i].done))
+		finished++;
+	    else
+		printf(" %d:%d", i, atomic_load_explicit(&cars[i].speed, memory_order_relaxed));
+	}
+	printf("  finished %d/%d\n", finished, carCount);
+    }
+
+    for (i = 0; i < carCount; i++)
+	pthread_join(carThreads[i], NULL);
+    atomic_store(&running, 0);
+    for (i = 0; i < city.semaphoreCount; i++)
+	pthread_join(semaphoreThreads[i], NULL);
+    for (i = 0; i < carCount; i++)
+	printRoute(&cars[i]);
+    if (recording)
+	status = simLogSave(recording, logPath, cityChecksum(carCount)) != 0;
+    freeCars(carCount);
+    free(carThreads);
+    free(semaphoreThreads);
+    return status;
+}
+
+/*
+ * Rebuilds the recorded city and applies its log on this thread alone.
+ * Every move must start where the car is and end on a free cell of its
+ * route, otherwise the log does not describe a possible run.
+ */
+static int replay(struct simLog *log) {
+    int carCount = log->params[0], i, status = 0;
+    struct simEvent *e;
+    struct car *car;
+    double start;
+
+    if (placeCars(carCount, log->seed) != 0)
+	return 1;
+    start = monotonicMs();
+    for (i = 0; i < log->count && status == 0; i++) {
+	e = &log->events[i];
+	if (e->kind == SWITCH) {
+	    if (e->entity < 0 || e->entity >= city.semaphoreCount)
+		status = 1;
+	    else
+		atomic_store_explicit(&city.green[e->entity], e->a, memory_order_relaxed);
+	    continue;
+	}
+	car = e->entity >= 0 && e->entity < carCount ? &cars[e->entity] : NULL;
+	if (car == NULL || car->position >= car->length || car->route[car->position] != e->a
+	    || carAt(&city, e->a) != car->id) {
+	    status = 1;
+	} else if (e->kind == PARK) {
+	    releaseCell(&city, e->a);
+	} else if (car->position + 1 >= car->length || car->route[car->position + 1] != e->b
+		   || !claimCell(&city, e->b, car->id)) {
+	    status = 1;
+	} else {
+	    releaseCell(&city, e->a);
+	    car->position++;
+	}
+    }
+    if (status != 0)
+	fprintf(stderr, "Replay diverged at event %d of %ld\n", i - 1, log->count);
+    else
+	status = simLogCheck(log, cityChecksum(carCount), monotonicMs() - start);
+    freeCars(carCount);
+    return status;
+}
+
+/* One move attempt for a benchmark car, 1 if it moved. */
+static int cruise(struct cruiser *car, int id) {
+    int ways = city.ways[car->cell], way, next, moved = 0;
+
+    way = ways;
+    if ((ways & HORIZONTAL) && (ways & VERTICAL))
+	way = simRandom(&car->rng) & 1 ? ways & VERTICAL : ways & HORIZONTAL;
+    next = nextCell(&city, car->cell, way);
+    if (!mayEnter(&city, next, way))
+	return 0;
+
+    if (globalLock) {
+	pthread_mutex_lock(&mapLock);
+	if (carAt(&city, next) < 0) {
+	    atomic_store_explicit(&city.occupant[next], id + 1, memory_order_relaxed);
+	    atomic_store_explicit(&city.occupant[car->cell], NO_CAR, memory_order_relaxed);
+	    moved = 1;
+	}
+	pthread_mutex_unlock(&mapLock);
+    } else if (claimCell(&city, next, id)) {
+	releaseCell(&city, car->cell);
+	moved = 1;
+    }
+    if (moved)
+	car->cell = next;
+    return moved;
+}
+
+static void *driveCruisers(void *arg) {
+    struct benchThread *t = arg;
+    long moved;
+    int i;
+
+    pthread_mutex_lock(&startLock);
+    while (!started)
+	pthread_cond_wait(&startCond, &startLock);
+    pthread_mutex_unlock(&startLock);
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+	for (i = t->first, moved = 0; i < t->last; i++)
+	    moved += cruise(&cruisers[i], i);
+	t->moves += moved;
+	if (moved == 0)
+	    sched_yield();
+    }
+    return NULL;
+}
+
+/*
+ * Headless benchmark: carCount cars drive at full speed for the given
+ * seconds, split over threadCount threads, and the successful moves are
+ * counted. The city is sized to keep about one car per five street cells.
+ * Threads wait until all of them exist, so creating them is not timed.
+ */
+static int bench(int carCount, int threadCount, double seconds, unsigned seed) {
+    struct benchThread *threads = calloc(threadCount, sizeof(struct benchThread));
+    pthread_t *semaphoreThreads = calloc(city.semaphoreCount + 1, sizeof(pthread_t));
+    long moves = 0;
+    double start, elapsed;
+    int i, cell, error = 0;
+
+    cruisers = calloc(carCount, sizeof(struct cruiser));
+    if (threads == NULL || semaphoreThreads == NULL || cruisers == NULL) {
+	perror("calloc");
+	return 1;
+    }
+    for (i = 0; i < carCount; i++) {
+	cruisers[i].rng = simRandomSeed(seed, i);
+	do
+	    cell = randomStreetCell(&cruisers[i].rng);
+	while (!claimCell(&city, cell, i));
+	cruisers[i].cell = cell;
+    }
+
+    for (i = 0; i < city.semaphoreCount; i++)
+	if (startThread(&semaphoreThreads[i], runSemaphore, (void *) (intptr_t) i) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    for (i = 0; i < threadCount; i++) {
+	threads[i].first = (long) carCount * i / threadCount;
+	threads[i].last = (long) carCount * (i + 1) / threadCount;
+	error = startThread(&threads[i].thread, driveCruisers, &threads[i]);
+	if (error != 0) {
+	    fprintf(stderr, "pthread_create: %s, started %d of %d car threads\n",
+		    strerror(error), i, threadCount);
+	    threadCount = i;
+	    atomic_store(&running, 0);
+	}
+    }
+
+    pthread_mutex_lock(&startLock);
+    started = 1;
+    pthread_cond_broadcast(&startCond);
+    pthread_mutex_unlock(&startLock);
+    start = monotonicMs();
+    if (error == 0)
+	sleepMs(seconds * 1e3);
+    atomic_store(&running, 0);
+    for (i = 0; i < threadCount; i++) {
+	pthread_join(threads[i].thread, NULL);
+	moves += threads[i].moves;
+    }
+    elapsed = (monotonicMs() - start) / 1e3;
+    for (i = 0; i < city.semaphoreCount; i++)
+	pthread_join(semaphoreThreads[i], NULL);
+
+    if (error == 0)
+	printf("%d cars, %d threads, %dx%d city, %s: %.2f M moves/s\n", carCount, threadCount,
+	       city.width, city.height, globalLock ? "global mutex" : "cell CAS",
+	       moves / elapsed / 1e6);
+    free(threads);
+    free(semaphoreThreads);
+    free(cruisers);
+    return error != 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./traffic [-c cars] [-s semaphores] [-m width height] [-r seed] [-o log_file]\n");
+    fprintf(stderr, "       ./traffic -i log_file\n");
+    fprintf(stderr, "       ./traffic -b seconds [-c cars] [-t threads] [-s semaphores] [-l]\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, carCount = DEFAULT_CARS, semaphores = DEFAULT_SEMAPHORES, threadCount = 0;
+    int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT, side, status;
+    double seconds = 0;
+    unsigned seed = time(NULL);
+    char *recordPath = NULL, *replayPath = NULL;
+    struct simLog log;
+
+    while ((opt = getopt(argc, argv, "c:s:m:r:b:t:lo:i:")) != -1) {
+	switch (opt) {
+	case 'c':
+	    carCount = atoi(optarg);
+	    break;
+	case 's':
+	    semaphores = atoi(optarg);
+	    break;
+	case 'm':
+	    if (optind >= argc) {
+		usage();
+		return 1;
+	    }
+	    width = atoi(optarg);
+	    height = atoi(argv[optind++]);
+	    break;
+	case 'r':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	case 'b':
+	    seconds = atof(optarg);
+	    break;
+	case 't':
+	    threadCount = atoi(optarg);
+	    break;
+	case 'l':
+	    globalLock = 1;
+	    break;
+	case 'o':
+	    recordPath = optarg;
+	    break;
+	case 'i':
+	    replayPath = optarg;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc || carCount <= 0 || semaphores < 0 || width <= 0 || height <= 0
+	|| seconds < 0 || threadCount < 0 || (recordPath && (seconds > 0 || replayPath))) {
+	usage();
+	return 1;
+    }
+
+    if (replayPath) {
+	if (simLogLoad(&log, replayPath) != 0)
+	    return 1;
+	initCity(&city, log.params[2], log.params[3], log.params[1], log.seed);
+	status = replay(&log);
+	simLogFree(&log);
+    } else if (seconds > 0) {
+	if (threadCount == 0 || threadCount > carCount)
+	    threadCount = carCount;
+	for (side = 2 * BLOCK; (long) side * side * 2 / BLOCK < 5L * carCount; side += 2 * BLOCK)
+	    ;
+	initCity(&city, side, side, semaphores, seed);
+	status = bench(carCount, threadCount, seconds, seed);
+    } else {
+	initCity(&city, width, height, semaphores, seed);
+	if (carCount > city.width * city.height * 2 / BLOCK / 2) {
+	    fprintf(stderr, "Too many cars for a %dx%d city\n", city.width, city.height);
+	    return 1;
+	}
+	if (recordPath) {
+	    if (simLogInit(&log, city.semaphoreCount + carCount, seed,
+			   (int32_t[SIM_LOG_PARAMS]) {carCount, semaphores, width, height}) != 0)
+		return 1;
+	    recording = &log;
+	}
+	status = simulate(carCount, seed, recordPath);
+	if (recording)
+	    simLogFree(recording);
+    }
+    freeCity(&city);
+    return status;
+}
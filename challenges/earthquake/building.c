@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "building.h"
+
+#define ROOM_WIDTH 10
+#define ROOM_HEIGHT 6
+#define DOOR_WIDTH 2
+
+/* New cells found by one worker during a BFS wavefront */
+struct waveBuffer {
+    int *cells;
+    int count, capacity;
+};
+
+struct wave {
+    struct building *b;
+    const int *frontier;
+    int level;
+    struct waveBuffer *buffers;
+};
+
+/* A cell and its distance, for the repair queue */
+struct reach {
+    int cell, distance;
+};
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+/* Opens a door at a random spot of the wall cells from..to (inclusive). */
+static void openDoor(struct building *b, int from, int to, int stride, unsigned *seed) {
+    int length = (to - from) / stride + 1, at, i;
+
+    if (length <= 0)
+	return;
+    at = rand_r(seed) % length;
+    for (i = 0; i < DOOR_WIDTH && at + i < length; i++)
+	b->tiles[from + (at + i) * stride] = FLOOR;
+}
+
+int initBuilding(struct building *b, int width, int height, int exits, unsigned seed) {
+    int x, y, x0, y0, cell, placed, attempts, inward;
+
+    b->width = width < 8 ? 8 : width;
+    b->height = height < 8 ? 8 : height;
+    b->tiles = xcalloc((size_t) b->width * b->height, 1);
+    b->distance = xcalloc((size_t) b->width * b->height, sizeof(atomic_int));
+    b->next = xcalloc((size_t) b->width * b->height, sizeof(atomic_uchar));
+    b->occupant = xcalloc((size_t) b->width * b->height, sizeof(atomic_int));
+    b->exits = xcalloc(exits > 0 ? exits : 1, sizeof(int));
+    b->exitCount = 0;
+
+    /* outer walls, then a grid of rooms with a door in every wall */
+    for (y = 0; y < b->height; y++)
+	for (x = 0; x < b->width; x++)
+	    if (x == 0 || y == 0 || x == b->width - 1 || y == b->height - 1
+		|| (x % ROOM_WIDTH == 0 && x < b->width - 3)
+		|| (y % ROOM_HEIGHT == 0 && y < b->height - 3))
+		b->tiles[y * b->width + x] = WALL;
+    for (y0 = 0; y0 < b->height - 1; y0 = y) {
+	for (y = y0 + 1; b->tiles[y * b->width + 1] != WALL; y++)
+	    ;
+	for (x0 = 0; x0 < b->width - 1; x0 = x) {
+	    for (x = x0 + 1; b->tiles[(y0 + 1) * b->width + x] != WALL; x++)
+		;
+	    /* room (x0, y0) to (x, y): doors east and south unless on the outer wall */
+	    if (x < b->width - 1)
+		openDoor(b, (y0 + 1) * b->width + x, (y - 1) * b->width + x, b->width, &seed);
+	    if (y < b->height - 1)
+		openDoor(b, y * b->width + x0 + 1, y * b->width + x - 1, 1, &seed);
+	}
+    }
+
+    /* exits on the outer wall, next to a floor cell */
+    for (placed = 0, attempts = 0; placed < exits && attempts < 100 * exits + 1000; attempts++) {
+	switch (rand_r(&seed) % 4) {
+	case 0:
+	    x = 1 + rand_r(&seed) % (b->width - 2), y = 0, inward = b->width;
+	    break;
+	case 1:
+	    x = 1 + rand_r(&seed) % (b->width - 2), y = b->height - 1, inward = -b->width;
+	    break;
+	case 2:
+	    x = 0, y = 1 + rand_r(&seed) % (b->height - 2), inward = 1;
+	    break;
+	default:
+	    x = b->width - 1, y = 1 + rand_r(&seed) % (b->height - 2), inward = -1;
+	}
+	cell = y * b->width + x;
+	if (b->tiles[cell] != WALL || b->tiles[cell + inward] != FLOOR)
+	    continue;
+	b->tiles[cell] = EXIT;
+	b->exits[placed++] = cell;
+    }
+    b->exitCount = placed;
+    return placed == exits ? 0 : -1;
+}
+
+void freeBuilding(struct building *b) {
+    free(b->tiles);
+    free(b->distance);
+    free(b->next);
+    free(b->occupant);
+    free(b->exits);
+}
+
+/* The cell one step away, or -1 off the map. */
+int neighbor(const struct building *b, int cell, int step) {
+    int x = cell % b->width, y = cell / b->width;
+
+    switch (step) {
+    case STEP_EAST:
+	return x + 1 < b->width ? cell + 1 : -1;
+    case STEP_WEST:
+	return x > 0 ? cell - 1 : -1;
+    case STEP_SOUTH:
+	return y + 1 < b->height ? cell + b->width : -1;
+    case STEP_NORTH:
+	return y > 0 ? cell - b->width : -1;
+    }
+    return -1;
+}
+
+static int walkable(const struct building *b, int cell) {
+    return cell >= 0 && b->tiles[cell] != WALL;
+}
+
+static int distanceOf(const struct building *b, int cell) {
+    return atomic_load_explicit(&b->distance[cell], memory_order_relaxed);
+}
+
+/* The first step, in step order, that gets one cell closer to an exit. */
+static int bestStep(const struct building *b, int cell) {
+    int d = distanceOf(b, cell), step, n;
+
+    if (b->tiles[cell] != FLOOR || d == UNREACHABLE)
+	return STEP_NONE;
+    for (step = STEP_EAST; step < STEP_NONE; step++) {
+	n = neighbor(b, cell, step);
+	if (walkable(b, n) && distanceOf(b, n) == d - 1)
+	    return step;
+    }
+    return STEP_NONE;
+}
+
+static void pushCell(struct waveBuffer *buffer, int cell) {
+    if (buffer->count == buffer->capacity) {
+	buffer->capacity = buffer->capacity > 0 ? 2 * buffer->capacity : 1024;
+	buffer->cells = realloc(buffer->cells, buffer->capacity * sizeof(int));
+	if (buffer->cells == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    buffer->cells[buffer->count++] = cell;
+}
+
+/* Claims the unvisited neighbors of a slice of the frontier. */
+static void expandRange(void *arg, int first, int last, int worker) {
+    struct wave *wave = arg;
+    struct building *b = wave->b;
+    int i, step, n, expected;
+
+    for (i = first; i < last; i++) {
+	for (step = STEP_EAST; step < STEP_NONE; step++) {
+	    n = neighbor(b, wave->frontier[i], step);
+	    if (!walkable(b, n) || distanceOf(b, n) != UNREACHABLE)
+		continue;
+	    expected = UNREACHABLE;
+	    if (atomic_compare_exchange_strong_explicit(&b->distance[n], &expected, wave->level + 1,
+							memory_order_relaxed, memory_order_relaxed))
+		pushCell(&wave->buffers[worker], n);
+	}
+    }
+}
+
+static void resetRange(void *arg, int first, int last, int worker) {
+    struct building *b = arg;
+    int i;
+
+    (void) worker;
+    for (i = first; i < last; i++)
+	atomic_store_explicit(&b->distance[i], UNREACHABLE, memory_order_relaxed);
+}
+
+static void directRange(void *arg, int first, int last, int worker) {
+    struct building *b = arg;
+    int i;
+
+    (void) worker;
+    for (i = first; i < last; i++)
+	atomic_store_explicit(&b->next[i], bestStep(b, i), memory_order_relaxed);
+}
+
+/*
+ * Multi-source BFS from every exit. Each wavefront is split over the
+ * pool; a compare-and-swap on the distance makes sure only one worker
+ * adds a cell to the next wavefront.
+ */
+void buildFlowField(struct building *b, struct simPool *pool) {
+    int cells = b->width * b->height, threads = simThreads(pool), count, i, w;
+    int *frontier = xcalloc(cells, sizeof(int));
+    struct wave wave;
+
+    simParallel(pool, 0, cells, resetRange, b);
+    for (i = 0; i < b->exitCount; i++) {
+	atomic_store_explicit(&b->distance[b->exits[i]], 0, memory_order_relaxed);
+	frontier[i] = b->exits[i];
+    }
+    wave.b = b;
+    wave.frontier = frontier;
+    wave.buffers = xcalloc(threads, sizeof(struct waveBuffer));
+    for (count = b->exitCount, wave.level = 0; count > 0; wave.level++) {
+	simParallel(pool, 0, count, expandRange, &wave);
+	for (w = 0, count = 0; w < threads; w++) {
+	    if (wave.buffers[w].count == 0)
+		continue;
+	    memcpy(frontier + count, wave.buffers[w].cells, wave.buffers[w].count * sizeof(int));
+	    count += wave.buffers[w].count;
+	    wave.buffers[w].count = 0;
+	}
+    }
+    simParallel(pool, 0, cells, directRange, b);
+
+    for (w = 0; w < threads; w++)
+	free(wave.buffers[w].cells);
+    free(wave.buffers);
+    free(frontier);
+}
+
+static int compareReach(const void *a, const void *b) {
+    return ((const struct reach *) a)->distance - ((const struct reach *) b)->distance;
+}
+
+/*
+ * Turns a free floor cell into debris. The cells whose next steps lead
+ * through it lose their distance. Each gets the best distance offered by
+ * an unaffected neighbor, and a BFS from those seeds, in distance order,
+ * repairs the rest. Returns the number of cells rerouted, or -1 when the
+ * cell is not free floor.
+ */
+int blockCell(struct building *b, int cell) {
+    int expected = NO_PERSON, count = 1, seedCount = 0, head, tail = 0, s = 0, i, step, n, d;
+    int *affected;
+    struct reach *seeds, *queue, current;
+
+    if (b->tiles[cell] != FLOOR
+	|| !atomic_compare_exchange_strong(&b->occupant[cell], &expected, DEBRIS))
+	return -1;
+    b->tiles[cell] = WALL;
+    affected = xcalloc((size_t) b->width * b->height, sizeof(int));
+    affected[0] = cell;
+    atomic_store_explicit(&b->distance[cell], UNREACHABLE, memory_order_relaxed);
+    atomic_store_explicit(&b->next[cell], STEP_NONE, memory_order_relaxed);
+
+    for (head = 0; head < count; head++) {
+	for (step = STEP_EAST; step < STEP_NONE; step++) {
+	    n = neighbor(b, affected[head], step);
+	    if (n < 0 || b->tiles[n] != FLOOR || distanceOf(b, n) == UNREACHABLE
+		|| neighbor(b, n, atomic_load_explicit(&b->next[n], memory_order_relaxed))
+		   != affected[head])
+		continue;
+	    atomic_store_explicit(&b->distance[n], UNREACHABLE, memory_order_relaxed);
+	    affected[count++] = n;
+	}
+    }
+
+    seeds = xcalloc(count, sizeof(struct reach));
+    queue = xcalloc(count, sizeof(struct reach));
+    for (i = 1; i < count; i++) {
+	int best = UNREACHABLE;
+	for (step = STEP_EAST; step < STEP_NONE; step++) {
+	    n = neighbor(b, affected[i], step);
+	    if (walkable(b, n) && distanceOf(b, n) != UNREACHABLE && distanceOf(b, n) + 1 < best)
+		best = distanceOf(b, n) + 1;
+	}
+	if (best != UNREACHABLE) {
+	    atomic_store_explicit(&b->distance[affected[i]], best, memory_order_relaxed);
+	    seeds[seedCount].cell = affected[i];
+	    seeds[seedCount++].distance = best;
+	}
+    }
+    qsort(seeds, seedCount, sizeof(struct reach), compareReach);
+
+    /* merge the sorted seeds with the BFS queue, smallest distance first */
+    for (head = 0; s < seedCount || head < tail;) {
+	if (head == tail || (s < seedCount && seeds[s].distance <= queue[head].distance))
+	    current = seeds[s++];
+	else
+	    current = queue[head++];
+	if (current.distance != distanceOf(b, current.cell))
+	    continue;
+	for (step = STEP_EAST; step < STEP_NONE; step++) {
+	    n = neighbor(b, current.cell, step);
+	    d = current.distance + 1;
+	    if (n < 0 || b->tiles[n] != FLOOR || distanceOf(b, n) <= d)
+		continue;
+	    atomic_store_explicit(&b->distance[n], d, memory_order_relaxed);
+	    queue[tail].cell = n;
+	    queue[tail++].distance = d;
+	}
+    }
+
+    for (i = 1; i < count; i++)
+	atomic_store_explicit(&b->next[affected[i]], bestStep(b, affected[i]), memory_order_relaxed);
+    free(affected);
+    free(seeds);
+    free(queue);
+    return count - 1;
+}
+
+/* The cell a person in cell should walk to, or -1 when there is no way out. */
+int nextStep(const struct building *b, int cell) {
+    return neighbor(b, cell, atomic_load_explicit(&b->next[cell], memory_order_relaxed));
+}
+
+int claimCell(struct building *b, int cell, int person) {
+    int expected = NO_PERSON;
+    return atomic_compare_exchange_strong_explicit(&b->occupant[cell], &expected, person + 1,
+						   memory_order_acquire, memory_order_relaxed);
+}
+
+void releaseCell(struct building *b, int cell) {
+    atomic_store_explicit(&b->occupant[cell], NO_PERSON, memory_order_release);
+}
+
+/* The person in cell, or -1 for nobody or debris. */
+int personAt(const struct building *b, int cell) {
+    int occupant = atomic_load_explicit(&b->occupant[cell], memory_order_relaxed);
+    return occupant > 0 ? occupant - 1 : -1;
+}
+
+void printBuilding(const struct building *b) {
+    char *line = xcalloc(b->width + 2, 1);
+    int x, y, cell;
+
+    for (y = 0; y < b->height; y++) {
+	for (x = 0; x < b->width; x++) {
+	    cell = y * b->width + x;
+	    if (b->tiles[cell] == EXIT)
+		line[x] = 'E';
+	    else if (atomic_load_explicit(&b->occupant[cell], memory_order_relaxed) == DEBRIS)
+		line[x] = 'x';
+	    else if (b->tiles[cell] == WALL)
+		line[x] = '#';
+	    else
+		line[x] = personAt(b, cell) >= 0 ? 'o' : ' ';
+	}
+	line[x] = '\n';
+	fputs(line, stdout);
+    }
+    free(line);
+}
@@ -0,0 +1,44 @@
+// Building floor and evacuation flow field
+//
+// The floor is a grid of rooms with doors, surrounded by walls, with
+// the emergency exits on the outer wall. buildFlowField runs one BFS
+// from all exits at once, a wavefront at a time on the simulation pool.
+// It records each cell's walking distance to its nearest exit and the
+// direction of its next step, one byte per cell, so a person finds
+// their next move with one lookup instead of searching for a route.
+//
+// blockCell drops debris on a floor cell. It repairs only the cells
+// whose route went through that cell, so an aftershock does not
+// rebuild the whole field.
+
+#include <stdatomic.h>
+#include <limits.h>
+#include "simcore.h"
+
+#define UNREACHABLE INT_MAX
+#define NO_PERSON 0
+#define DEBRIS -1                   /* occupant of a blocked cell */
+
+enum tile {FLOOR, WALL, EXIT};
+enum step {STEP_EAST, STEP_WEST, STEP_SOUTH, STEP_NORTH, STEP_NONE};
+
+struct building {
+    int width, height;
+    unsigned char *tiles;
+    atomic_int *distance;           /* steps to the nearest exit */
+    atomic_uchar *next;             /* enum step towards it */
+    atomic_int *occupant;           /* person id + 1, NO_PERSON or DEBRIS */
+    int exitCount;
+    int *exits;
+};
+
+int initBuilding(struct building *b, int width, int height, int exits, unsigned seed);
+void freeBuilding(struct building *b);
+int neighbor(const struct building *b, int cell, int step);
+void buildFlowField(struct building *b, struct simPool *pool);
+int blockCell(struct building *b, int cell);
+int nextStep(const struct building *b, int cell);
+int claimCell(struct building *b, int cell, int person);
+void releaseCell(struct building *b, int cell);
+int personAt(const struct building *b, int cell);
+void printBuilding(const struct building *b);
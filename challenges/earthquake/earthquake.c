@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "building.h"
+#include "replay.h"
+
+#define DEFAULT_PEOPLE 20
+#define DEFAULT_EXITS 3
+#define DEFAULT_WIDTH 60
+#define DEFAULT_HEIGHT 20
+#define DEFAULT_TIMEOUT 10          /* seconds to get out */
+#define MIN_SPEED 1                 /* cells per second */
+#define MAX_SPEED 8
+#define STATUS_MS 500
+#define THREAD_STACK (64 * 1024)
+#define TICK_SECONDS 0.1            /* simulated time per benchmark tick */
+#define BENCH_BLOCKS 100
+#define NO_CLAIM INT_MAX
+
+/* Recorded map changes */
+enum event {STEP, ESCAPE, COLLAPSE};
+
+struct person {
+    int id;
+    int cell;
+    int maxSpeed;
+    atomic_int speed;               /* cells per second, read by the person behind */
+    atomic_int safe;
+    double outMs;
+};
+
+/* Benchmark people, in structure-of-arrays form */
+struct crowd {
+    int count;
+    int *cell;
+    int *want;                      /* cell proposed this tick, or -1 */
+    float *maxSpeed, *speed, *nextSpeed, *progress;
+    unsigned char *safe;
+    atomic_int *claim;              /* lowest id proposing a cell, or NO_CLAIM */
+    long moves;
+};
+
+static struct building building;
+static struct person *people;
+static struct crowd crowd;
+static atomic_int running = 1;
+static struct simLog *recording;    /* a track per person, then the main thread's */
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void sleepMs(double ms) {
+    struct timespec t = {(time_t) (ms / 1e3), (long) ((ms - (time_t) (ms / 1e3) * 1e3) * 1e6)};
+    nanosleep(&t, NULL);
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+static int randomFreeFloor(uint64_t *rng) {
+    int cell;
+
+    do
+	cell = simRandom(rng) % (building.width * building.height);
+    while (building.tiles[cell] != FLOOR || personAt(&building, cell) >= 0
+	   || atomic_load(&building.occupant[cell]) == DEBRIS);
+    return cell;
+}
+
+/*
+ * One person walking out. The next step comes from the flow field. A
+ * person who cannot take the next cell matches the speed of whoever is
+ * in it.
+ */
+static void *walkOut(void *arg) {
+    struct person *p = arg;
+    int next, ahead, speed, aheadSpeed;
+    double start = monotonicMs();
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+	speed = atomic_load_explicit(&p->speed, memory_order_relaxed);
+	next = nextStep(&building, p->cell);
+	if (next < 0) {
+	    speed = 0;
+	} else if (building.tiles[next] == EXIT) {
+	    if (recording)
+		simRecord(recording, p->id, p->id, ESCAPE, p->cell, next);
+	    releaseCell(&building, p->cell);
+	    p->outMs = monotonicMs() - start;
+	    atomic_store(&p->safe, 1);
+	    break;
+	} else if (claimCell(&building, next, p->id)) {
+	    if (recording)
+		simRecord(recording, p->id, p->id, STEP, p->cell, next);
+	    releaseCell(&building, p->cell);
+	    p->cell = next;
+	    speed = speed < p->maxSpeed ? speed + 1 : p->maxSpeed;
+	} else if ((ahead = personAt(&building, next)) >= 0) {
+	    aheadSpeed = atomic_load_explicit(&people[ahead].speed, memory_order_relaxed);
+	    if (aheadSpeed < speed)
+		speed = aheadSpeed;
+	}
+	atomic_store_explicit(&p->speed, speed, memory_order_relaxed);
+	sleepMs(1e3 / (speed > MIN_SPEED ? speed : MIN_SPEED));
+    }
+    atomic_store_explicit(&p->speed, 0, memory_order_relaxed);
+    return NULL;
+}
+
+/* Each person draws from their own random stream, so a replay places them the same way. */
+static void placePeople(int count, unsigned seed) {
+    uint64_t rng;
+    int i;
+
+    people = xcalloc(count, sizeof(struct person));
+    for (i = 0; i < count; i++) {
+	rng = simRandomSeed(seed, i);
+	people[i].id = i;
+	people[i].maxSpeed = MIN_SPEED + simRandom(&rng) % (MAX_SPEED - MIN_SPEED + 1);
+	people[i].cell = randomFreeFloor(&rng);
+	claimCell(&building, people[i].cell, i);
+    }
+}
+
+/* The floor, the flow field and where everyone is. */
+static uint64_t buildingChecksum(int count) {
+    uint64_t hash = SIM_HASH_START;
+    int i, cells = building.width * building.height, value;
+
+    for (i = 0; i < cells; i++) {
+	value = atomic_load(&building.occupant[i]) << 8 | atomic_load(&building.next[i]);
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    for (i = 0; i < count; i++) {
+	value = people[i].safe ? -1 : people[i].cell;
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    return hash;
+}
+
+/* A thread per person, with debris falling every status period. */
+static int simulate(int count, int debris, double timeout, struct simPool *pool, unsigned seed,
+		    const char *logPath) {
+    pthread_t *threads = xcalloc(count, sizeof(pthread_t));
+    pthread_attr_t attr;
+    double start;
+    int i, safe = 0, cell, rerouted, status = 0;
+    uint64_t rng = simRandomSeed(seed, count);
+
+    buildFlowField(&building, pool);
+    placePeople(count, seed);
+    printBuilding(&building);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK);
+    for (i = 0; i < count; i++)
+	if (pthread_create(&threads[i], &attr, walkOut, &people[i]) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    pthread_attr_destroy(&attr);
+
+    start = monotonicMs();
+    while (safe < count && monotonicMs() - start < timeout * 1e3) {
+	sleepMs(STATUS_MS);
+	if (debris-- > 0) {
+	    cell = randomFreeFloor(&rng);
+	    rerouted = blockCell(&building, cell);
+	    if (rerouted >= 0 && recording)
+		simRecord(recording, count, -1, COLLAPSE, cell, 0);
+	    if (rerouted >= 0)
+		printf("Debris at (%d,%d), %d cells rerouted\n", cell % building.width,
+		       cell / building.width, rerouted);
+	}
+	for (i = 0, safe = 0; i < count; i++)
+	    safe += atomic_load(&people[i].safe);
+	printf("[%5.1fs] safe %d, inside %d\n", (monotonicMs() - start) / 1e3, safe, count - safe);
+    }
+    atomic_store(&running, 0);
+    for (i = 0; i < count; i++)
+	pthread_join(threads[i], NULL);
+
+    printBuilding(&building);
+    for (i = 0, safe = 0; i < count; i++) {
+	if (people[i].safe) {
+	    printf("Person %d (%d cells/s): safe after %.1f s\n", i, people[i].maxSpeed,
+		   people[i].outMs / 1e3);
+	    safe++;
+	} else {
+	    printf("Person %d (%d cells/s): trapped at (%d,%d)\n", i, people[i].maxSpeed,
+		   people[i].cell % building.width, people[i].cell / building.width);
+	}
+    }
+    printf("Safe people: %d, trapped people: %d\n", safe, count - safe);
+    if (recording)
+	status = simLogSave(recording, logPath, buildingChecksum(count)) != 0;
+    free(threads);
+    free(people);
+    return status;
+}
+
+/*
+ * Rebuilds the recorded building and applies its log on this thread
+ * alone, repairing the flow field after each piece of debris. Every step
+ * must start where the person is and end on a free neighbor.
+ */
+static int replay(struct simLog *log, struct simPool *pool) {
+    int count = log->params[0], i, safe, status = 0, adjacent, step;
+    struct simEvent *e;
+    struct person *p;
+    double start;
+
+    buildFlowField(&building, pool);
+    placePeople(count, log->seed);
+    start = monotonicMs();
+    for (i = 0; i < log->count && status == 0; i++) {
+	e = &log->events[i];
+	if (e->kind == COLLAPSE) {
+	    status = e->a < 0 || e->a >= building.width * building.height || blockCell(&building, e->a) < 0;
+	    continue;
+	}
+	p = e->entity >= 0 && e->entity < count ? &people[e->entity] : NULL;
+	for (step = STEP_EAST, adjacent = 0; p != NULL && p->cell == e->a && step < STEP_NONE; step++)
+	    adjacent |= neighbor(&building, e->a, step) == e->b && e->b >= 0;
+	if (p == NULL || p->safe || p->cell != e->a || !adjacent) {
+	    status = 1;
+	} else if (e->kind == ESCAPE) {
+	    if (building.tiles[e->b] != EXIT) {
+		status = 1;
+	    } else {
+		releaseCell(&building, e->a);
+		p->safe = 1;
+	    }
+	} else if (!claimCell(&building, e->b, p->id)) {
+	    status = 1;
+	} else {
+	    releaseCell(&building, e->a);
+	    p->cell = e->b;
+	}
+    }
+    if (status != 0) {
+	fprintf(stderr, "Replay diverged at event %d of %ld\n", i - 1, log->count);
+    } else {
+	printBuilding(&building);
+	for (i = 0, safe = 0; i < count; i++)
+	    safe += people[i].safe;
+	printf("Safe people: %d, trapped people: %d\n", safe, count - safe);
+	status = simLogCheck(log, buildingChecksum(count), monotonicMs() - start);
+    }
+    free(people);
+    return status;
+}
+
+/* Tick phase 1: people with enough progress propose their next cell. */
+static void proposeRange(void *arg, int first, int last, int worker) {
+    int i, next, current;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++) {
+	crowd.want[i] = -1;
+	crowd.nextSpeed[i] = crowd.speed[i];
+	if (crowd.safe[i])
+	    continue;
+	crowd.progress[i] += crowd.speed[i] * TICK_SECONDS;
+	if (crowd.progress[i] < 1)
+	    continue;
+	next = nextStep(&building, crowd.cell[i]);
+	if (next < 0 || atomic_load_explicit(&building.occupant[next], memory_order_relaxed) != NO_PERSON)
+	    continue;
+	crowd.want[i] = next;
+	current = atomic_load_explicit(&crowd.claim[next], memory_order_relaxed);
+	while (i < current
+	       && !atomic_compare_exchange_weak_explicit(&crowd.claim[next], &current, i,
+							 memory_order_relaxed, memory_order_relaxed))
+	    ;
+    }
+}
+
+/*
+ * Tick phase 2: the lowest id wins each cell. Everyone else who wanted
+ * to move matches the speed of the person in front of them.
+ */
+static void resolveRange(void *arg, int first, int last, int worker) {
+    long moves = 0;
+    int i, next, ahead;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++) {
+	if (crowd.safe[i] || crowd.progress[i] < 1)
+	    continue;
+	next = crowd.want[i];
+	if (next >= 0 && atomic_load_explicit(&crowd.claim[next], memory_order_relaxed) == i) {
+	    crowd.progress[i] -= 1;
+	    crowd.nextSpeed[i] = crowd.speed[i] < crowd.maxSpeed[i] ? crowd.speed[i] + 1 : crowd.maxSpeed[i];
+	    moves++;
+	    continue;
+	}
+	crowd.want[i] = -1;
+	crowd.progress[i] = 1;
+	next = nextStep(&building, crowd.cell[i]);
+	ahead = next >= 0 ? personAt(&building, next) : -1;
+	if (ahead >= 0 && crowd.speed[ahead] < crowd.speed[i])
+	    crowd.nextSpeed[i] = crowd.speed[ahead] > MIN_SPEED ? crowd.speed[ahead] : MIN_SPEED;
+    }
+    __atomic_fetch_add(&crowd.moves, moves, __ATOMIC_RELAXED);
+}
+
+/* Tick phase 3: move the winners, clear the claims, swap speeds. */
+static void applyRange(void *arg, int first, int last, int worker) {
+    int i, next;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++) {
+	crowd.speed[i] = crowd.nextSpeed[i];
+	next = crowd.want[i];
+	if (next < 0)
+	    continue;
+	atomic_store_explicit(&crowd.claim[next], NO_CLAIM, memory_order_relaxed);
+	atomic_store_explicit(&building.occupant[crowd.cell[i]], NO_PERSON, memory_order_relaxed);
+	if (building.tiles[next] == EXIT) {
+	    crowd.safe[i] = 1;
+	} else {
+	    atomic_store_explicit(&building.occupant[next], i + 1, memory_order_relaxed);
+	    crowd.cell[i] = next;
+	}
+    }
+}
+
+/*
+ * Headless benchmark: count people in a building sized for them, moved
+ * in ticks on the pool. Every claimed cell has exactly one winner, who
+ * clears the claim as it moves, and the result is the same for any
+ * number of workers.
+ */
+static int bench(int count, int exits, double timeout, struct simPool *pool, unsigned seed) {
+    int cells, side, i, ticks, maxTicks = timeout / TICK_SECONDS, safe = 0, blocked = 0;
+    double start, fieldMs, blockMs, tickMs;
+    uint64_t rng = simRandomSeed(seed, count);
+
+    for (side = 16; (long) side * side < 3L * count; side += 8)
+	;
+    if (initBuilding(&building, side, side, exits, seed) < 0) {
+	fprintf(stderr, "Cannot place %d exits\n", exits);
+	return 1;
+    }
+    cells = building.width * building.height;
+    start = monotonicMs();
+    buildFlowField(&building, pool);
+    fieldMs = monotonicMs() - start;
+
+    /* debris on random cells, repaired one at a time */
+    start = monotonicMs();
+    for (i = 0; i < BENCH_BLOCKS; i++)
+	blocked += blockCell(&building, randomFreeFloor(&rng)) >= 0;
+    blockMs = (monotonicMs() - start) / BENCH_BLOCKS;
+
+    crowd.count = count;
+    crowd.cell = xcalloc(count, sizeof(int));
+    crowd.want = xcalloc(count, sizeof(int));
+    crowd.maxSpeed = xcalloc(count, sizeof(float));
+    crowd.speed = xcalloc(count, sizeof(float));
+    crowd.nextSpeed = xcalloc(count, sizeof(float));
+    crowd.progress = xcalloc(count, sizeof(float));
+    crowd.safe = xcalloc(count, 1);
+    crowd.claim = xcalloc(cells, sizeof(atomic_int));
+    for (i = 0; i < cells; i++)
+	atomic_init(&crowd.claim[i], NO_CLAIM);
+    for (i = 0; i < count; i++) {
+	rng = simRandomSeed(seed, i);
+	crowd.maxSpeed[i] = crowd.speed[i] = MIN_SPEED + simRandom(&rng) % (MAX_SPEED - MIN_SPEED + 1);
+	crowd.cell[i] = randomFreeFloor(&rng);
+	claimCell(&building, crowd.cell[i], i);
+    }
+
+    start = monotonicMs();
+    for (ticks = 0; ticks < maxTicks && safe < count; ticks++) {
+	simParallel(pool, 0, count, proposeRange, NULL);
+	simParallel(pool, 0, count, resolveRange, NULL);
+	simParallel(pool, 0, count, applyRange, NULL);
+	if (ticks % 10 == 9)
+	    for (i = 0, safe = 0; i < count; i++)
+		safe += crowd.safe[i];
+    }
+    tickMs = monotonicMs() - start;
+    for (i = 0, safe = 0; i < count; i++)
+	safe += crowd.safe[i];
+
+    printf("%d people, %dx%d building, %d exits, %d threads\n", count, building.width,
+	   building.height, building.exitCount, simThreads(pool));
+    printf("  flow field: %.1f ms, debris repair: %.3f ms each (%d blocked)\n", fieldMs, blockMs,
+	   blocked);
+    printf("  %d ticks (%.1f s simulated): %.0f ticks/s, %.2f M people/s, %.2f M moves/s\n",
+	   ticks, ticks * TICK_SECONDS, ticks / (tickMs / 1e3),
+	   (double) ticks * count / (tickMs / 1e3) / 1e6, crowd.moves / (tickMs / 1e3) / 1e6);
+    printf("  safe people: %d, trapped people: %d\n", safe, count - safe);
+    free(crowd.cell);
+    free(crowd.want);
+    free(crowd.maxSpeed);
+    free(crowd.speed);
+    free(crowd.nextSpeed);
+    free(crowd.progress);
+    free(crowd.safe);
+    free(crowd.claim);
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./earthquake [-p people] [-e exits] [-m width height] [-d debris]\n");
+    fprintf(stderr, "                    [-T timeout_s] [-t threads] [-r seed] [-o log_file] [-b]\n");
+    fprintf(stderr, "       ./earthquake -i log_file\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, count = DEFAULT_PEOPLE, exits = DEFAULT_EXITS, debris = 0, threads = 2, benchMode = 0;
+    int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT, status;
+    double timeout = DEFAULT_TIMEOUT;
+    unsigned seed = time(NULL);
+    char *recordPath = NULL, *replayPath = NULL;
+    struct simPool *pool;
+    struct simLog log;
+
+    while ((opt = getopt(argc, argv, "p:e:m:d:T:t:r:bo:i:")) != -1) {
+	switch (opt) {
+	case 'p':
+	    count = atoi(optarg);
+	    break;
+	case 'e':
+	    exits = atoi(optarg);
+	    break;
+	case 'm':
+	    if (optind >= argc) {
+		usage();
+		return 1;
+	    }
+	    width = atoi(optarg);
+	    height = atoi(argv[optind++]);
+	    break;
+	case 'd':
+	    debris = atoi(optarg);
+	    break;
+	case 'T':
+	    timeout = atof(optarg);
+	    break;
+	case 't':
+	    threads = atoi(optarg);
+	    break;
+	case 'r':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	case 'b':
+	    benchMode = 1;
+	    break;
+	case 'o':
+	    recordPath = optarg;
+	    break;
+	case 'i':
+	    replayPath = optarg;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc || count <= 0 || exits <= 0 || width <= 0 || height <= 0 || debris < 0
+	|| timeout <= 0 || threads <= 0 || (recordPath && (benchMode || replayPath))) {
+	usage();
+	return 1;
+    }
+    pool = simStart(threads);
+    if (pool == NULL) {
+	fprintf(stderr, "Cannot start %d worker threads\n", threads);
+	return 1;
+    }
+
+    if (replayPath) {
+	if (simLogLoad(&log, replayPath) != 0) {
+	    status = 1;
+	} else if (initBuilding(&building, log.params[2], log.params[3], log.params[1], log.seed) < 0) {
+	    fprintf(stderr, "Cannot rebuild the recorded building\n");
+	    status = 1;
+	} else {
+	    status = replay(&log, pool);
+	}
+	simLogFree(&log);
+    } else if (benchMode) {
+	status = bench(count, exits, timeout, pool, seed);
+    } else if (initBuilding(&building, width, height, exits, seed) < 0) {
+	fprintf(stderr, "Cannot place %d exits\n", exits);
+	status = 1;
+    } else if (count > building.width * building.height / 3) {
+	fprintf(stderr, "Too many people for a %dx%d building\n", building.width, building.height);
+	status = 1;
+    } else if (recordPath && simLogInit(&log, count + 1, seed,
+					(int32_t[SIM_LOG_PARAMS]) {count, exits, width, height}) != 0) {
+	status = 1;
+    } else {
+	recording = recordPath ? &log : NULL;
+	status = simulate(count, debris, timeout, pool, seed, recordPath);
+	if (recording)
+	    simLogFree(recording);
+    }
+    freeBuilding(&building);
+    simStop(pool);
+    return status;
+}
@@ -0,0 +1,33 @@
+# earthquake build & test automation
+
+APP_NAME=earthquake
+LIB_NAME=building
+CORE_DIR=../sim-core
+CORE_NAME=simcore
+
+build:
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/${CORE_NAME}.c -o ${CORE_NAME}.o
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/replay.c -o replay.o
+	gcc -I${CORE_DIR} -c ${LIB_NAME}.c -o ${LIB_NAME}.o
+	gcc -I${CORE_DIR} -c ${APP_NAME}.c -o ${APP_NAME}.o
+	gcc ${CORE_NAME}.o replay.o ${LIB_NAME}.o ${APP_NAME}.o -o ${APP_NAME} -lpthread
+test: build
+	@echo Test 1
+	./${APP_NAME} -p 20 -e 3 -T 5 -r 1
+	@echo Test 2 - falling debris
+	./${APP_NAME} -p 20 -e 2 -d 5 -T 5 -r 2
+	@echo Test 3
+	./${APP_NAME} -b -p 10000 -e 16 -T 10 -r 1
+	@echo Test 4 - record a run and replay it on one thread
+	./${APP_NAME} -p 40 -e 2 -d 5 -T 5 -r 3 -o run.log
+	./${APP_NAME} -i run.log
+	@echo Test 5 - failed
+	-./${APP_NAME} -p 0
+bench:
+	gcc -O2 -I${CORE_DIR} ${CORE_DIR}/${CORE_NAME}.c ${CORE_DIR}/replay.c ${LIB_NAME}.c ${APP_NAME}.c -o ${APP_NAME}_bench.o -lpthread
+	@echo Benchmark - evacuation ticks on the flow field
+	./${APP_NAME}_bench.o -b -p 10000 -e 64 -t 4 -r 1
+	./${APP_NAME}_bench.o -b -p 100000 -e 64 -t 4 -r 1
+	./${APP_NAME}_bench.o -b -p 1000000 -e 64 -t 4 -r 1 -T 5
+clean:
+	rm -rf *.o ${APP_NAME} run.log
@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "telemetry.h"
+#include "replay.h"
+
+#define DEFAULT_CARS 8
+#define DEFAULT_LAPS 2
+#define DEFAULT_TIMEOUT 60          /* seconds, or the benchmark length with -b */
+#define BENCH_SECONDS 3
+#define LANES 3
+#define TRACK_CELLS 120             /* at least; longer tracks for more cars */
+#define CELL_METERS 25.0
+#define MIN_MAX_SPEED 60.0          /* m/s */
+#define MAX_MAX_SPEED 90.0
+#define CURVE_SPEED 40.0
+#define ACCELERATION 8.0            /* m/s^2 */
+#define BRAKING 20.0
+#define LOOKAHEAD 2                 /* cells a driver watches ahead */
+#define TICK_MS 10
+#define TIME_SCALE 20               /* simulated seconds per real second */
+#define BENCH_DT 0.05               /* simulated seconds per benchmark update */
+#define DISPLAY_MS 500
+#define BENCH_DISPLAY_MS 20
+#define DISPLAY_ROWS 10
+#define PODIUM 3
+#define THREAD_STACK (64 * 1024)
+#define NO_CAR 0
+
+/* Recorded track changes */
+enum event {LANE, ADVANCE, FINISH};
+
+struct car {
+    int id;
+    pthread_t thread;
+    uint64_t rng;
+    double maxSpeed, speed, distance, raceSeconds;
+    int lane, cell, finished;
+    long updates;
+};
+
+static struct car *cars;
+static struct telemetry *telemetry;
+static struct snapshot *board;      /* the display's copy */
+static atomic_int *occupant;        /* car id + 1 per lane and cell */
+static float *speedLimit;           /* per cell */
+static int carCount, laps, cells, benchMode, locked;
+static double trackMeters;
+static atomic_int running = 1;
+static pthread_mutex_t scoreboardLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t startLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startLight = PTHREAD_COND_INITIALIZER;
+static int green;
+static struct simLog *recording;    /* a track per car */
+
+/* Display statistics */
+static long refreshes, readRetries;
+static double refreshMs, maxRefreshMs, staleMs;
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void sleepMs(double ms) {
+    struct timespec t = {(time_t) (ms / 1e3), (long) ((ms - (time_t) (ms / 1e3) * 1e3) * 1e6)};
+    nanosleep(&t, NULL);
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+/* With -l every record goes through one global lock instead of its seqlock. */
+static void publish(struct car *c) {
+    struct snapshot s = {c->id, c->distance, c->raceSeconds, monotonicMs(), c->speed,
+			 c->distance < 0 ? 1 : (int) (c->distance / trackMeters) + 1, c->lane,
+			 !benchMode && c->distance >= laps * trackMeters};
+
+    if (s.lap > laps && !benchMode)
+	s.lap = laps;
+    if (locked)
+	pthread_mutex_lock(&scoreboardLock);
+    publishTelemetry(&telemetry[c->id], &s);
+    if (locked)
+	pthread_mutex_unlock(&scoreboardLock);
+}
+
+static int readCar(int id, struct snapshot *s) {
+    int retries;
+
+    if (locked)
+	pthread_mutex_lock(&scoreboardLock);
+    retries = readTelemetry(&telemetry[id], s);
+    if (locked)
+	pthread_mutex_unlock(&scoreboardLock);
+    s->car = id;
+    return retries;
+}
+
+static int cellAt(double distance) {
+    int cell = (int) floor(distance / CELL_METERS) % cells;
+    return cell < 0 ? cell + cells : cell;
+}
+
+static int claimSlot(int lane, int cell, int id) {
+    int expected = NO_CAR;
+    return atomic_compare_exchange_strong(&occupant[lane * cells + cell], &expected, id + 1);
+}
+
+static void releaseSlot(int lane, int cell) {
+    atomic_store(&occupant[lane * cells + cell], NO_CAR);
+}
+
+/* The nearest car ahead in a lane within LOOKAHEAD cells, or -1. */
+static int carAhead(int lane, int cell) {
+    int k, other;
+
+    for (k = 1; k <= LOOKAHEAD; k++)
+	if ((other = atomic_load(&occupant[lane * cells + (cell + k) % cells]) - 1) >= 0)
+	    return other;
+    return -1;
+}
+
+/*
+ * One update of a car: speed up towards its own top speed and the
+ * curve's limit. When a slower car is ahead, move to a free lane next
+ * to it or slow down behind it.
+ */
+static void drive(struct car *c, double dt) {
+    double limit = c->maxSpeed < speedLimit[c->cell] ? c->maxSpeed : speedLimit[c->cell];
+    struct snapshot other;
+    int ahead, lane, next, side, k, changed;
+
+    c->speed += (c->speed < limit ? ACCELERATION : -BRAKING) * dt;
+    if (c->speed > limit && c->speed - BRAKING * dt < limit)
+	c->speed = limit;
+    if ((ahead = carAhead(c->lane, c->cell)) >= 0) {
+	readCar(ahead, &other);
+	if (other.speed < c->speed) {
+	    side = simRandom(&c->rng) % 2 ? 1 : -1;
+	    for (k = 0, changed = 0; k < 2 && !changed; k++, side = -side) {
+		lane = c->lane + side;
+		if (lane < 0 || lane >= LANES || carAhead(lane, c->cell) >= 0
+		    || !claimSlot(lane, c->cell, c->id))
+		    continue;
+		if (recording)
+		    simRecord(recording, c->id, c->id, LANE, c->cell, lane);
+		releaseSlot(c->lane, c->cell);
+		c->lane = lane;
+		changed = 1;
+	    }
+	    if (!changed)
+		c->speed = other.speed;
+	}
+    }
+    c->distance += c->speed * dt;
+    c->raceSeconds += dt;
+    next = cellAt(c->distance);
+    if (next != c->cell) {
+	if (claimSlot(c->lane, next, c->id)) {
+	    if (recording)
+		simRecord(recording, c->id, c->id, ADVANCE, c->cell, next);
+	    releaseSlot(c->lane, c->cell);
+	    c->cell = next;
+	} else {
+	    /* blocked: wait at the end of the current cell */
+	    c->distance = floor(c->distance / CELL_METERS) * CELL_METERS - 0.01;
+	    c->speed /= 2;
+	}
+    }
+    c->updates++;
+}
+
+static void *race(void *arg) {
+    struct car *c = arg;
+    double dt = benchMode ? BENCH_DT : TICK_MS / 1e3 * TIME_SCALE;
+
+    pthread_mutex_lock(&startLock);
+    while (!green)
+	pthread_cond_wait(&startLight, &startLock);
+    pthread_mutex_unlock(&startLock);
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+	drive(c, dt);
+	if (!benchMode && c->distance >= laps * trackMeters) {
+	    c->finished = 1;
+	    if (recording)
+		simRecord(recording, c->id, c->id, FINISH, c->cell, c->updates);
+	    releaseSlot(c->lane, c->cell);
+	    publish(c);
+	    break;
+	}
+	publish(c);
+	if (!benchMode)
+	    sleepMs(TICK_MS);
+    }
+    return NULL;
+}
+
+/* Snapshots every car and ranks the leaders, without stopping anyone. */
+static void refresh() {
+    double start = monotonicMs(), taken, elapsed, stale = 0;
+    int i, live = 0;
+
+    if (locked)
+	pthread_mutex_lock(&scoreboardLock);
+    for (i = 0; i < carCount; i++) {
+	readRetries += readTelemetry(&telemetry[i], &board[i]);
+	board[i].car = i;
+    }
+    if (locked)
+	pthread_mutex_unlock(&scoreboardLock);
+    taken = monotonicMs();
+    for (i = 0; i < carCount; i++)
+	if (!board[i].finished && board[i].updatedMs > 0) {
+	    stale += taken - board[i].updatedMs;
+	    live++;
+	}
+    rankTop(board, carCount, DISPLAY_ROWS);
+    elapsed = monotonicMs() - start;
+    refreshes++;
+    refreshMs += elapsed;
+    maxRefreshMs = elapsed > maxRefreshMs ? elapsed : maxRefreshMs;
+    staleMs += live > 0 ? stale / live : 0;
+}
+
+static void printBoard(double seconds) {
+    int i;
+
+    printf("[%5.1fs]  Pos  Car  Lap    Speed      Time  Lane\n", seconds);
+    for (i = 0; i < carCount && i < DISPLAY_ROWS; i++)
+	printf("          %3d  %3d  %d/%d  %4.0f km/h  %7.1fs  %d%s\n", i + 1, board[i].car,
+	       board[i].lap, laps, board[i].speed * 3.6, board[i].raceSeconds, board[i].lane,
+	       board[i].finished ? "  finished" : "");
+}
+
+/* The reader thread: refreshes the board until the race is over. */
+static void *display(void *arg) {
+    double start = monotonicMs(), next = start, period = benchMode ? BENCH_DISPLAY_MS : DISPLAY_MS;
+
+    (void) arg;
+    while (atomic_load(&running)) {
+	refresh();
+	if (!benchMode)
+	    printBoard((monotonicMs() - start) / 1e3);
+	next += period;
+	if (next > monotonicMs())
+	    sleepMs(next - monotonicMs());
+    }
+    return NULL;
+}
+
+/*
+ * Straights with a few curves, and the cars lined up behind the start.
+ * Each car draws from its own random stream, so a replay gets the same
+ * cars.
+ */
+static void buildTrack(unsigned seed) {
+    int i, lane, cell;
+
+    cells = carCount > TRACK_CELLS ? carCount : TRACK_CELLS;
+    trackMeters = cells * CELL_METERS;
+    speedLimit = xcalloc(cells, sizeof(float));
+    occupant = xcalloc((size_t) LANES * cells, sizeof(atomic_int));
+    for (i = 0; i < cells; i++)
+	speedLimit[i] = i % 40 >= 30 ? CURVE_SPEED : MAX_MAX_SPEED;
+    cars = xcalloc(carCount, sizeof(struct car));
+    telemetry = aligned_alloc(CACHE_LINE, carCount * sizeof(struct telemetry));
+    board = xcalloc(carCount, sizeof(struct snapshot));
+    if (telemetry == NULL) {
+	perror("aligned_alloc");
+	exit(1);
+    }
+    for (i = 0; i < carCount; i++) {
+	cars[i].id = i;
+	cars[i].rng = simRandomSeed(seed, i);
+	cars[i].maxSpeed = MIN_MAX_SPEED + simRandom(&cars[i].rng) % (int) (MAX_MAX_SPEED - MIN_MAX_SPEED + 1);
+	lane = i % LANES;
+	cell = cells - 1 - i / LANES;
+	cars[i].lane = lane;
+	cars[i].cell = cell;
+	cars[i].distance = (cell - cells + 0.5) * CELL_METERS;
+	claimSlot(lane, cell, i);
+	atomic_init(&telemetry[i].sequence, 0);
+	publish(&cars[i]);
+	atomic_store(&telemetry[i].updatedMs, 0.0);
+    }
+}
+
+static void freeTrack() {
+    free(speedLimit);
+    free(occupant);
+    free(cars);
+    free(telemetry);
+    free(board);
+}
+
+/* Final standings for the finished cars, by race time. */
+static void printPodium() {
+    int i, finished = 0;
+
+    for (i = 0; i < carCount; i++)
+	readCar(i, &board[i]);
+    rankTop(board, carCount, PODIUM);
+    printf("Top %d\n", PODIUM);
+    for (i = 0; i < carCount && i < PODIUM; i++) {
+	if (board[i].finished)
+	    printf("  %d. car %d in %.1f s (top speed %.0f km/h)\n", i + 1, board[i].car,
+		   board[i].raceSeconds, cars[board[i].car].maxSpeed * 3.6);
+	else
+	    printf("  %d. car %d, did not finish (lap %d)\n", i + 1, board[i].car, board[i].lap);
+    }
+    for (i = 0; i < carCount; i++)
+	finished += board[i].finished;
+    printf("Finished cars: %d of %d\n", finished, carCount);
+}
+
+/* The slots and each car's place, with the race length of the finished ones. */
+static uint64_t trackChecksum() {
+    uint64_t hash = SIM_HASH_START;
+    int i, value;
+
+    for (i = 0; i < LANES * cells; i++) {
+	value = atomic_load(&occupant[i]);
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    for (i = 0; i < carCount; i++) {
+	value = cars[i].finished ? -(int) cars[i].updates : cars[i].lane * cells + cars[i].cell;
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    return hash;
+}
+
+/*
+ * Applies a recorded race on this thread alone. Lane changes and moves
+ * must start from the car's slot and end on a free one. The cars'
+ * telemetry is published from the replayed state, so the podium is the
+ * recorded one.
+ */
+static int replay(struct simLog *log) {
+    double dt = TICK_MS / 1e3 * TIME_SCALE, start = monotonicMs();
+    int i, status = 0;
+    struct simEvent *e;
+    struct car *c;
+
+    for (i = 0; i < log->count && status == 0; i++) {
+	e = &log->events[i];
+	c = e->entity >= 0 && e->entity < carCount ? &cars[e->entity] : NULL;
+	if (c == NULL || c->finished || e->a != c->cell) {
+	    status = 1;
+	} else if (e->kind == LANE) {
+	    if (e->b < 0 || e->b >= LANES || abs(e->b - c->lane) != 1 || !claimSlot(e->b, c->cell, c->id)) {
+		status = 1;
+	    } else {
+		releaseSlot(c->lane, c->cell);
+		c->lane = e->b;
+	    }
+	} else if (e->kind == ADVANCE) {
+	    if (e->b < 0 || e->b >= cells || !claimSlot(c->lane, e->b, c->id)) {
+		status = 1;
+	    } else {
+		releaseSlot(c->lane, c->cell);
+		c->distance += (e->b - c->cell + cells) % cells * CELL_METERS;
+		c->cell = e->b;
+	    }
+	} else {
+	    releaseSlot(c->lane, c->cell);
+	    c->finished = 1;
+	    c->updates = e->b;
+	    c->distance = laps * trackMeters;
+	    c->raceSeconds = c->updates * dt;
+	}
+    }
+    if (status != 0) {
+	fprintf(stderr, "Replay diverged at event %d of %ld\n", i - 1, log->count);
+	return 1;
+    }
+    for (i = 0; i < carCount; i++)
+	publish(&cars[i]);
+    printPodium();
+    return simLogCheck(log, trackChecksum(), monotonicMs() - start);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./grandprix [-c cars] [-L laps] [-T timeout_s] [-r seed] [-l] [-o log_file] [-b]\n");
+    fprintf(stderr, "       ./grandprix -i log_file\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, i, created, finished, status;
+    double timeout = 0, start, elapsed;
+    unsigned seed = time(NULL);
+    long updates = 0;
+    char *recordPath = NULL, *replayPath = NULL;
+    struct simLog log;
+    pthread_attr_t attr;
+    pthread_t reader;
+    struct snapshot s;
+
+    carCount = DEFAULT_CARS;
+    laps = DEFAULT_LAPS;
+    while ((opt = getopt(argc, argv, "c:L:T:r:lbo:i:")) != -1) {
+	switch (opt) {
+	case 'c':
+	    carCount = atoi(optarg);
+	    break;
+	case 'L':
+	    laps = atoi(optarg);
+	    break;
+	case 'T':
+	    timeout = atof(optarg);
+	    break;
+	case 'r':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	case 'l':
+	    locked = 1;
+	    break;
+	case 'b':
+	    benchMode = 1;
+	    break;
+	case 'o':
+	    recordPath = optarg;
+	    break;
+	case 'i':
+	    replayPath = optarg;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc || carCount <= 0 || laps <= 0 || timeout < 0
+	|| (recordPath && (benchMode || replayPath))) {
+	usage();
+	return 1;
+    }
+    if (replayPath) {
+	if (simLogLoad(&log, replayPath) != 0 || log.params[0] <= 0 || log.params[1] <= 0)
+	    return 1;
+	carCount = log.params[0];
+	laps = log.params[1];
+	buildTrack(log.seed);
+	status = replay(&log);
+	simLogFree(&log);
+	freeTrack();
+	return status;
+    }
+    if (timeout == 0)
+	timeout = benchMode ? BENCH_SECONDS : DEFAULT_TIMEOUT;
+    buildTrack(seed);
+    if (recordPath) {
+	if (simLogInit(&log, carCount, seed, (int32_t[SIM_LOG_PARAMS]) {carCount, laps}) != 0)
+	    return 1;
+	recording = &log;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK);
+    for (created = 0; created < carCount; created++)
+	if (pthread_create(&cars[created].thread, &attr, race, &cars[created]) != 0) {
+	    perror("pthread_create");
+	    break;
+	}
+    pthread_attr_destroy(&attr);
+    if (created < carCount) {
+	fprintf(stderr, "Only %d of %d cars could start\n", created, carCount);
+	atomic_store(&running, 0);
+    }
+    if (pthread_create(&reader, NULL, display, NULL) != 0) {
+	perror("pthread_create");
+	atomic_store(&running, 0);
+    }
+    pthread_mutex_lock(&startLock);
+    green = 1;
+    pthread_cond_broadcast(&startLight);
+    pthread_mutex_unlock(&startLock);
+
+    start = monotonicMs();
+    do {
+	sleepMs(benchMode ? timeout * 1e3 : DISPLAY_MS);
+	for (i = 0, finished = 0; i < carCount; i++) {
+	    readCar(i, &s);
+	    finished += s.finished;
+	}
+    } while (!benchMode && finished < created && monotonicMs() - start < timeout * 1e3
+	     && atomic_load(&running));
+    elapsed = monotonicMs() - start;
+    atomic_store(&running, 0);
+    for (i = 0; i < created; i++) {
+	pthread_join(cars[i].thread, NULL);
+	updates += cars[i].updates;
+    }
+    pthread_join(reader, NULL);
+
+    if (!benchMode) {
+	refresh();
+	printBoard(elapsed / 1e3);
+	printPodium();
+    }
+    printf("%d cars, %s telemetry: %.0f updates/s (%.0f per car)\n", carCount,
+	   locked ? "locked" : "seqlock", updates / (elapsed / 1e3), updates / (elapsed / 1e3) / carCount);
+    printf("  display: %ld refreshes, %.3f ms avg, %.3f ms max, %.2f ms stale, %ld read retries\n",
+	   refreshes, refreshMs / (refreshes > 0 ? refreshes : 1), maxRefreshMs,
+	   staleMs / (refreshes > 0 ? refreshes : 1), readRetries);
+    status = created < carCount;
+    if (recording) {
+	status |= simLogSave(recording, recordPath, trackChecksum()) != 0;
+	simLogFree(recording);
+    }
+    freeTrack();
+    return status;
+}
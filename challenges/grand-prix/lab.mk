@@ -0,0 +1,34 @@
+# grand-prix build & test automation
+
+APP_NAME=grandprix
+LIB_NAME=telemetry
+CORE_DIR=../sim-core
+
+build:
+	gcc -c ${LIB_NAME}.c -o ${LIB_NAME}.o
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/replay.c -o replay.o
+	gcc -I${CORE_DIR} -c ${APP_NAME}.c -o ${APP_NAME}.o
+	gcc ${LIB_NAME}.o replay.o ${APP_NAME}.o -o ${APP_NAME} -lpthread -lm
+test: build
+	@echo Test 1
+	./${APP_NAME} -c 8 -L 1 -r 1
+	@echo Test 2 - locked scoreboard
+	./${APP_NAME} -c 8 -L 1 -r 2 -l
+	@echo Test 3
+	./${APP_NAME} -b -c 200 -T 1 -r 1
+	@echo Test 4 - record a race and replay it on one thread
+	./${APP_NAME} -c 12 -L 1 -r 3 -o run.log
+	./${APP_NAME} -i run.log
+	@echo Test 5 - failed
+	-./${APP_NAME} -c 0
+bench:
+	gcc -O2 -I${CORE_DIR} ${LIB_NAME}.c ${CORE_DIR}/replay.c ${APP_NAME}.c -o ${APP_NAME}_bench.o -lpthread -lm
+	@echo Benchmark - seqlock telemetry against a locked scoreboard
+	./${APP_NAME}_bench.o -b -c 100 -r 1
+	./${APP_NAME}_bench.o -b -c 100 -r 1 -l
+	./${APP_NAME}_bench.o -b -c 1000 -r 1
+	./${APP_NAME}_bench.o -b -c 1000 -r 1 -l
+	./${APP_NAME}_bench.o -b -c 5000 -r 1
+	./${APP_NAME}_bench.o -b -c 5000 -r 1 -l
+clean:
+	rm -rf *.o ${APP_NAME} run.log
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <sched.h>
+#include "telemetry.h"
+
+#define SPINS_BEFORE_YIELD 64
+
+/* Only the car owning the record calls this. */
+void publishTelemetry(struct telemetry *t, const struct snapshot *s) {
+    unsigned sequence = atomic_load_explicit(&t->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&t->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&t->distance, s->distance, memory_order_relaxed);
+    atomic_store_explicit(&t->raceSeconds, s->raceSeconds, memory_order_relaxed);
+    atomic_store_explicit(&t->updatedMs, s->updatedMs, memory_order_relaxed);
+    atomic_store_explicit(&t->speed, s->speed, memory_order_relaxed);
+    atomic_store_explicit(&t->lap, s->lap, memory_order_relaxed);
+    atomic_store_explicit(&t->lane, s->lane, memory_order_relaxed);
+    atomic_store_explicit(&t->finished, s->finished, memory_order_relaxed);
+    atomic_store_explicit(&t->sequence, sequence + 2, memory_order_release);
+}
+
+/* Copies a consistent record into s; returns how many tries failed. */
+int readTelemetry(struct telemetry *t, struct snapshot *s) {
+    unsigned before, after;
+    int retries;
+
+    for (retries = 0;; retries++) {
+	/* a writer preempted mid-publish needs the CPU to finish */
+	if (retries > 0 && retries % SPINS_BEFORE_YIELD == 0)
+	    sched_yield();
+	before = atomic_load_explicit(&t->sequence, memory_order_acquire);
+	if (before & 1)
+	    continue;
+	s->distance = atomic_load_explicit(&t->distance, memory_order_relaxed);
+	s->raceSeconds = atomic_load_explicit(&t->raceSeconds, memory_order_relaxed);
+	s->updatedMs = atomic_load_explicit(&t->updatedMs, memory_order_relaxed);
+	s->speed = atomic_load_explicit(&t->speed, memory_order_relaxed);
+	s->lap = atomic_load_explicit(&t->lap, memory_order_relaxed);
+	s->lane = atomic_load_explicit(&t->lane, memory_order_relaxed);
+	s->finished = atomic_load_explicit(&t->finished, memory_order_relaxed);
+	atomic_thread_fence(memory_order_acquire);
+	after = atomic_load_explicit(&t->sequence, memory_order_relaxed);
+	if (before == after)
+	    return retries;
+    }
+}
+
+/* Finished cars by time, then the others by distance, then by car. */
+static int ahead(const struct snapshot *a, const struct snapshot *b) {
+    if (a->finished != b->finished)
+	return a->finished;
+    if (a->finished && a->raceSeconds != b->raceSeconds)
+	return a->raceSeconds < b->raceSeconds;
+    if (!a->finished && a->distance != b->distance)
+	return a->distance > b->distance;
+    return a->car < b->car;
+}
+
+static void swap(struct snapshot *a, struct snapshot *b) {
+    struct snapshot t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static int compareCars(const void *a, const void *b) {
+    return ahead(a, b) ? -1 : ahead(b, a) ? 1 : 0;
+}
+
+/*
+ * Moves the top leaders of cars to the front, in race order. The rest
+ * stay in no particular order.
+ */
+void rankTop(struct snapshot *cars, int count, int top) {
+    int first = 0, last = count - 1, i, store;
+
+    if (top > count)
+	top = count;
+    while (first < last) {
+	swap(&cars[(first + last) / 2], &cars[last]);
+	for (i = store = first; i < last; i++)
+	    if (ahead(&cars[i], &cars[last]))
+		swap(&cars[i], &cars[store++]);
+	swap(&cars[store], &cars[last]);
+	if (store == top)
+	    break;
+	if (store < top)
+	    first = store + 1;
+	else
+	    last = store - 1;
+    }
+    qsort(cars, top, sizeof(struct snapshot), compareCars);
+}
@@ -0,0 +1,35 @@
+// Per-car telemetry published with a seqlock
+//
+// Every car owns one record, on its own cache line, and is its only
+// writer. publishTelemetry makes the sequence odd, stores the fields and
+// makes it even again. readTelemetry copies the fields and tries again
+// if the sequence was odd or changed meanwhile. Readers never block the
+// car and cars never wait for readers, so the display can take a
+// snapshot of every car as often as it likes.
+//
+// rankTop orders only the leading part of a snapshot array: a
+// quickselect puts the top cars first and only those are sorted.
+
+#include <stdatomic.h>
+
+#define CACHE_LINE 64
+
+struct telemetry {
+    _Alignas(CACHE_LINE) atomic_uint sequence;
+    _Atomic double distance;        /* meters from the start line */
+    _Atomic double raceSeconds;
+    _Atomic double updatedMs;       /* wall clock of the last publish */
+    _Atomic float speed;            /* m/s */
+    atomic_int lap, lane, finished;
+};
+
+struct snapshot {
+    int car;
+    double distance, raceSeconds, updatedMs;
+    float speed;
+    int lap, lane, finished;
+};
+
+void publishTelemetry(struct telemetry *t, const struct snapshot *s);
+int readTelemetry(struct telemetry *t, struct snapshot *s);
+void rankTop(struct snapshot *cars, int count, int top);
@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "terrain.h"
+#include "replay.h"
+
+#define DEFAULT_BALLS 50
+#define DEFAULT_WIDTH 60
+#define DEFAULT_HEIGHT 24
+#define DEFAULT_TIMEOUT 20          /* seconds before rolling balls are stopped */
+#define RAIN_MS 1000                /* balls land within this time */
+#define CELL_METERS 10.0
+#define GRAVITY 9.81
+#define MIN_SPEED 2.0               /* m/s */
+#define FRICTION 0.9                /* speed kept per cell */
+#define TIME_SCALE 20               /* simulated seconds per real second */
+#define MAX_BOUNCES 8               /* collisions before a ball gives up */
+#define MAX_PRINT_WIDTH 120
+#define STATUS_MS 500
+#define THREAD_STACK (64 * 1024)
+#define RAIN_TICKS 100              /* benchmark balls land within these ticks */
+#define NO_CLAIM INT32_MAX
+#define CACHE_LINE 64
+
+/* Recorded map changes */
+enum event {LAND, ROLL, SINK, REST};
+
+enum state {FALLING, ROLLING, RESTING, SUNK};
+
+struct ball {
+    int id;
+    int cell;
+    uint64_t rng;
+    int delayMs;
+    int bounces;
+    atomic_int bumped;              /* set by a ball that ran into this one */
+    atomic_int side;                /* enum side once stopped, or -1 */
+};
+
+/* Benchmark balls, in structure-of-arrays form */
+struct rain {
+    int count;
+    int *cell;
+    int *landTick;
+    int *landCell;
+    int *want;                      /* cell proposed this tick, or -1 */
+    unsigned char *state, *side, *bumped, *collided, *jumping, *bounces;
+    atomic_uchar *bumpedNext;       /* set by balls running into this one */
+    atomic_int *claim;              /* lowest id proposing a cell, or NO_CLAIM */
+    atomic_int *basin;              /* rolling balls per root this tick */
+    atomic_int *resting;            /* stopped balls per root */
+    int tick;
+    unsigned seed;
+};
+
+/* Per-worker counters, one cache line each, merged at the end */
+struct tally {
+    _Alignas(CACHE_LINE) long jumped;
+    long stepped;
+    long collisions;
+    long sides[SIDES];
+};
+
+static struct terrain terrain;
+static struct ball *balls;
+static struct rain rain;
+static struct tally *tallies;
+static int *landCells, landCount;
+static atomic_int running = 1;
+static struct simLog *recording;    /* a track per ball */
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void sleepMs(double ms) {
+    struct timespec t = {(time_t) (ms / 1e3), (long) ((ms - (time_t) (ms / 1e3) * 1e3) * 1e6)};
+    nanosleep(&t, NULL);
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+/* Random number for ball i on a tick, the same whichever worker asks. */
+static unsigned ballRandom(unsigned seed, int i, int tick) {
+    uint64_t x = ((uint64_t) seed << 32 ^ (uint64_t) i << 20 ^ tick) + 0x9e3779b97f4a7c15ULL;
+
+    x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ x >> 27) * 0x94d049bb133111ebULL;
+    return (unsigned) (x ^ x >> 31);
+}
+
+static void findLand() {
+    int cell, cells = terrain.width * terrain.height;
+
+    landCells = xcalloc(cells, sizeof(int));
+    for (cell = 0, landCount = 0; cell < cells; cell++)
+	if (!isSea(&terrain, cell))
+	    landCells[landCount++] = cell;
+}
+
+/* Tell the ball in cell, if it is still rolling, that it was hit. */
+static void bump(int cell) {
+    int other = ballAt(&terrain, cell);
+
+    if (other >= 0 && atomic_load_explicit(&balls[other].side, memory_order_relaxed) < 0)
+	atomic_store_explicit(&balls[other].bumped, 1, memory_order_relaxed);
+}
+
+/*
+ * One ball rolling down. It follows the precomputed successors, gaining
+ * speed on the way down. After a collision it takes one step in a random
+ * direction, uphill or not.
+ */
+static void *rollDown(void *arg) {
+    struct ball *b = arg;
+    int next, side = VALLEY;
+    double speed = 0, drop;
+
+    sleepMs(b->delayMs);
+    while (!claimCell(&terrain, b->cell, b->id)) {
+	bump(b->cell);
+	b->cell = landCells[simRandom(&b->rng) % landCount];
+    }
+    if (recording)
+	simRecord(recording, b->id, b->id, LAND, b->cell, 0);
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+	if (atomic_exchange_explicit(&b->bumped, 0, memory_order_relaxed) && b->bounces < MAX_BOUNCES) {
+	    next = neighborCell(&terrain, b->cell, simRandom(&b->rng));
+	    b->bounces++;
+	} else {
+	    next = terrain.successor[b->cell];
+	    if (next == b->cell)
+		break;
+	}
+	if (isSea(&terrain, next)) {
+	    side = restingSide(&terrain, next);
+	    if (recording)
+		simRecord(recording, b->id, b->id, SINK, b->cell, side);
+	    releaseCell(&terrain, b->cell);
+	    break;
+	}
+	if (!claimCell(&terrain, next, b->id)) {
+	    bump(next);
+	    if (b->bounces >= MAX_BOUNCES)
+		break;
+	    atomic_store_explicit(&b->bumped, 1, memory_order_relaxed);
+	    sleepMs(1e3 * CELL_METERS / MIN_SPEED / TIME_SCALE);
+	    continue;
+	}
+	if (recording)
+	    simRecord(recording, b->id, b->id, ROLL, b->cell, next);
+	releaseCell(&terrain, b->cell);
+	drop = terrain.heights[b->cell] - terrain.heights[next];
+	speed = FRICTION * sqrt(fmax(speed * speed + 2 * GRAVITY * drop, 0));
+	b->cell = next;
+	sleepMs(1e3 * CELL_METERS / fmax(speed, MIN_SPEED) / TIME_SCALE);
+    }
+    if (recording && side == VALLEY)
+	simRecord(recording, b->id, b->id, REST, b->cell, 0);
+    atomic_store(&b->side, side);
+    return NULL;
+}
+
+static int countStopped(int count, long sides[SIDES]) {
+    int i, side, stopped = 0;
+
+    for (side = 0; side < SIDES; side++)
+	sides[side] = 0;
+    for (i = 0; i < count; i++)
+	if ((side = atomic_load(&balls[i].side)) >= 0) {
+	    sides[side]++;
+	    stopped++;
+	}
+    return stopped;
+}
+
+static void printSides(const long sides[SIDES]) {
+    int side;
+
+    for (side = 0; side < SIDES - 1; side++)
+	printf("Balls in the %s: %ld\n", sideNames[side], sides[side]);
+    printf("Balls trapped on the island: %ld\n", sides[VALLEY]);
+}
+
+/* Each ball draws from its own random stream, so a replay drops them the same way. */
+static void dropBalls(int count, unsigned seed) {
+    int i;
+
+    balls = xcalloc(count, sizeof(struct ball));
+    for (i = 0; i < count; i++) {
+	balls[i].id = i;
+	balls[i].rng = simRandomSeed(seed, i);
+	balls[i].delayMs = simRandom(&balls[i].rng) % RAIN_MS;
+	balls[i].cell = landCells[simRandom(&balls[i].rng) % landCount];
+	atomic_init(&balls[i].side, -1);
+    }
+}
+
+/* The occupied cells and where each ball ended. */
+static uint64_t islandChecksum(int count) {
+    uint64_t hash = SIM_HASH_START;
+    int i, cells = terrain.width * terrain.height, value;
+
+    for (i = 0; i < cells; i++) {
+	value = ballAt(&terrain, i);
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    for (i = 0; i < count; i++) {
+	value = atomic_load(&balls[i].side) == VALLEY ? balls[i].cell : -1 - atomic_load(&balls[i].side);
+	hash = simHash(hash, &value, sizeof(value));
+    }
+    return hash;
+}
+
+/* A thread per ball. Each one records where it ended, merged here. */
+static int simulate(int count, double timeout, unsigned seed, const char *logPath) {
+    pthread_t *threads = xcalloc(count, sizeof(pthread_t));
+    pthread_attr_t attr;
+    long sides[SIDES];
+    double start;
+    int i, stopped = 0, status = 0;
+
+    dropBalls(count, seed);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK);
+    for (i = 0; i < count; i++)
+	if (pthread_create(&threads[i], &attr, rollDown, &balls[i]) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    pthread_attr_destroy(&attr);
+
+    start = monotonicMs();
+    while (stopped < count && monotonicMs() - start < timeout * 1e3) {
+	sleepMs(STATUS_MS);
+	stopped = countStopped(count, sides);
+	printf("[%5.1fs] rolling %d, in the sea %ld, stopped on land %ld\n",
+	       (monotonicMs() - start) / 1e3, count - stopped,
+	       sides[NORTH_SEA] + sides[SOUTH_SEA] + sides[EAST_SEA] + sides[WEST_SEA], sides[VALLEY]);
+    }
+    atomic_store(&running, 0);
+    for (i = 0; i < count; i++)
+	pthread_join(threads[i], NULL);
+
+    if (terrain.width <= MAX_PRINT_WIDTH)
+	printTerrain(&terrain);
+    countStopped(count, sides);
+    printSides(sides);
+    if (recording)
+	status = simLogSave(recording, logPath, islandChecksum(count)) != 0;
+    free(threads);
+    free(balls);
+    return status;
+}
+
+/*
+ * Drops the recorded balls on the rebuilt island and applies the log on
+ * this thread alone. A ball must land on a free cell and roll from where
+ * it is to a free neighbor.
+ */
+static int replay(struct simLog *log) {
+    int count = log->params[0], i, direction, adjacent, status = 0;
+    long sides[SIDES];
+    struct simEvent *e;
+    struct ball *b;
+    double start;
+
+    dropBalls(count, log->seed);
+    start = monotonicMs();
+    for (i = 0; i < log->count && status == 0; i++) {
+	e = &log->events[i];
+	b = e->entity >= 0 && e->entity < count ? &balls[e->entity] : NULL;
+	if (b == NULL || atomic_load(&b->side) >= 0 || e->a < 0 || e->a >= terrain.width * terrain.height
+	    || (e->kind != LAND && ballAt(&terrain, e->a) != b->id)) {
+	    status = 1;
+	} else if (e->kind == LAND) {
+	    status = !claimCell(&terrain, e->a, b->id);
+	    b->cell = e->a;
+	} else if (e->kind == ROLL) {
+	    for (direction = 0, adjacent = 0; direction < 4; direction++)
+		adjacent |= neighborCell(&terrain, e->a, direction) == e->b && e->b >= 0;
+	    if (!adjacent || !claimCell(&terrain, e->b, b->id)) {
+		status = 1;
+	    } else {
+		releaseCell(&terrain, e->a);
+		b->cell = e->b;
+	    }
+	} else if (e->kind == SINK) {
+	    releaseCell(&terrain, e->a);
+	    atomic_store(&b->side, e->b);
+	} else {
+	    atomic_store(&b->side, VALLEY);
+	}
+    }
+    if (status != 0) {
+	fprintf(stderr, "Replay diverged at event %d of %ld\n", i - 1, log->count);
+    } else {
+	if (terrain.width <= MAX_PRINT_WIDTH)
+	    printTerrain(&terrain);
+	countStopped(count, sides);
+	printSides(sides);
+	status = simLogCheck(log, islandChecksum(count), monotonicMs() - start);
+    }
+    free(balls);
+    return status;
+}
+
+/* Tick phase 1: count the rolling balls in each basin. */
+static void countRange(void *arg, int first, int last, int worker) {
+    int i;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++)
+	if (rain.state[i] == ROLLING)
+	    atomic_fetch_add_explicit(&rain.basin[terrain.root[rain.cell[i]]], 1, memory_order_relaxed);
+}
+
+static void propose(int i, int cell) {
+    int current = atomic_load_explicit(&rain.claim[cell], memory_order_relaxed);
+
+    rain.want[i] = cell;
+    while (i < current
+	   && !atomic_compare_exchange_weak_explicit(&rain.claim[cell], &current, i,
+						     memory_order_relaxed, memory_order_relaxed))
+	;
+}
+
+/*
+ * Tick phase 2: a ball alone in its basin, and not bumped, jumps to the
+ * root of its slope. The others propose their next cell, and a ball
+ * that finds its next cell taken bumps the one in it.
+ */
+static void proposeRange(void *arg, int first, int last, int worker) {
+    struct tally *tally = &tallies[worker];
+    int i, cell, next, root, other;
+
+    (void) arg;
+    for (i = first; i < last; i++) {
+	rain.want[i] = -1;
+	rain.jumping[i] = 0;
+	rain.collided[i] = 0;
+	if (rain.state[i] == FALLING) {
+	    if (rain.landTick[i] != rain.tick)
+		continue;
+	    next = rain.landCell[i];
+	} else if (rain.state[i] == ROLLING) {
+	    cell = rain.cell[i];
+	    root = terrain.root[cell];
+	    if (!rain.bumped[i]
+		&& atomic_load_explicit(&rain.basin[root], memory_order_relaxed) == 1
+		&& atomic_load_explicit(&rain.resting[root], memory_order_relaxed) == 0) {
+		next = root;
+		rain.jumping[i] = 1;
+	    } else if (rain.bumped[i] && rain.bounces[i] < MAX_BOUNCES) {
+		next = neighborCell(&terrain, cell, ballRandom(rain.seed, i, rain.tick));
+		rain.bounces[i]++;
+	    } else {
+		next = terrain.successor[cell];
+	    }
+	} else {
+	    continue;
+	}
+	if (isSea(&terrain, next)) {
+	    rain.want[i] = next;
+	    continue;
+	}
+	if ((other = ballAt(&terrain, next)) >= 0) {
+	    rain.collided[i] = 1;
+	    tally->collisions++;
+	    if (rain.state[other] == ROLLING)
+		atomic_store_explicit(&rain.bumpedNext[other], 1, memory_order_relaxed);
+	    continue;
+	}
+	propose(i, next);
+    }
+}
+
+/* Tick phase 3: the lowest id wins each cell, the others were hit. */
+static void resolveRange(void *arg, int first, int last, int worker) {
+    struct tally *tally = &tallies[worker];
+    int i, next;
+
+    (void) arg;
+    for (i = first; i < last; i++) {
+	next = rain.want[i];
+	if (next < 0 || isSea(&terrain, next)
+	    || atomic_load_explicit(&rain.claim[next], memory_order_relaxed) == i)
+	    continue;
+	rain.want[i] = -1;
+	rain.jumping[i] = 0;
+	rain.collided[i] = 1;
+	tally->collisions++;
+    }
+}
+
+static void stop(int i, int side, struct tally *tally) {
+    rain.state[i] = side == VALLEY ? RESTING : SUNK;
+    rain.side[i] = side;
+    tally->sides[side]++;
+    if (side == VALLEY)
+	atomic_fetch_add_explicit(&rain.resting[terrain.root[rain.cell[i]]], 1, memory_order_relaxed);
+}
+
+/* Tick phase 4: move the winners and stop the balls at the end of their slope. */
+static void applyRange(void *arg, int first, int last, int worker) {
+    struct tally *tally = &tallies[worker];
+    int i, next;
+
+    (void) arg;
+    for (i = first; i < last; i++) {
+	next = rain.want[i];
+	if (rain.state[i] == ROLLING)
+	    atomic_store_explicit(&rain.basin[terrain.root[rain.cell[i]]], 0, memory_order_relaxed);
+	rain.bumped[i] = atomic_exchange_explicit(&rain.bumpedNext[i], 0, memory_order_relaxed)
+	    || rain.collided[i];
+	if (next < 0) {
+	    if (rain.state[i] == FALLING && rain.landTick[i] == rain.tick) {
+		/* landed on another ball, try elsewhere next tick */
+		rain.landTick[i]++;
+		rain.landCell[i] = landCells[ballRandom(rain.seed, i, rain.tick) % landCount];
+	    } else if (rain.state[i] == ROLLING
+		       && ((rain.collided[i] && rain.bounces[i] >= MAX_BOUNCES)
+			   || terrain.successor[rain.cell[i]] == rain.cell[i])) {
+		stop(i, VALLEY, tally);
+	    }
+	    continue;
+	}
+	if (rain.jumping[i])
+	    tally->jumped++;
+	else if (rain.state[i] == ROLLING)
+	    tally->stepped++;
+	if (rain.state[i] == ROLLING)
+	    atomic_store_explicit(&terrain.occupant[rain.cell[i]], NO_BALL, memory_order_relaxed);
+	rain.state[i] = ROLLING;
+	rain.cell[i] = next;
+	if (isSea(&terrain, next)) {
+	    stop(i, restingSide(&terrain, next), tally);
+	    continue;
+	}
+	atomic_store_explicit(&rain.claim[next], NO_CLAIM, memory_order_relaxed);
+	atomic_store_explicit(&terrain.occupant[next], i + 1, memory_order_relaxed);
+	if (terrain.successor[next] == next)
+	    stop(i, VALLEY, tally);
+    }
+}
+
+/*
+ * Headless benchmark: count balls raining on an island sized for them,
+ * moved one cell per tick on the pool. Speed is not simulated here. The
+ * result is the same for any number of workers.
+ */
+static int bench(int count, int width, int height, struct simPool *pool, unsigned seed) {
+    int cells, i, side, stopped = 0, workers = simThreads(pool);
+    double start, terrainMs, descentMs, tickMs;
+    long jumped = 0, stepped = 0, collisions = 0, sides[SIDES] = {0};
+
+    if (width <= 0)
+	for (width = height = 64; (long) width * height < 4L * count; width += 32, height += 32)
+	    ;
+    start = monotonicMs();
+    initTerrain(&terrain, width, height, seed, pool);
+    terrainMs = monotonicMs() - start;
+    start = monotonicMs();
+    buildDescent(&terrain, pool);
+    descentMs = monotonicMs() - start;
+    findLand();
+    if (landCount < count) {
+	fprintf(stderr, "Too many balls for %d land cells\n", landCount);
+	free(landCells);
+	return 1;
+    }
+
+    cells = terrain.width * terrain.height;
+    rain.count = count;
+    rain.seed = seed;
+    rain.cell = xcalloc(count, sizeof(int));
+    rain.landTick = xcalloc(count, sizeof(int));
+    rain.landCell = xcalloc(count, sizeof(int));
+    rain.want = xcalloc(count, sizeof(int));
+    rain.state = xcalloc(count, 1);
+    rain.side = xcalloc(count, 1);
+    rain.bumped = xcalloc(count, 1);
+    rain.collided = xcalloc(count, 1);
+    rain.jumping = xcalloc(count, 1);
+    rain.bounces = xcalloc(count, 1);
+    rain.bumpedNext = xcalloc(count, sizeof(atomic_uchar));
+    rain.claim = xcalloc(cells, sizeof(atomic_int));
+    rain.basin = xcalloc(cells, sizeof(atomic_int));
+    rain.resting = xcalloc(cells, sizeof(atomic_int));
+    tallies = aligned_alloc(CACHE_LINE, workers * sizeof(struct tally));
+    if (tallies == NULL) {
+	perror("aligned_alloc");
+	exit(1);
+    }
+    memset(tallies, 0, workers * sizeof(struct tally));
+    for (i = 0; i < cells; i++)
+	atomic_init(&rain.claim[i], NO_CLAIM);
+    for (i = 0; i < count; i++) {
+	rain.landTick[i] = rand_r(&seed) % RAIN_TICKS;
+	rain.landCell[i] = landCells[rand_r(&seed) % landCount];
+    }
+
+    start = monotonicMs();
+    for (rain.tick = 0; stopped < count; rain.tick++) {
+	simParallel(pool, 0, count, countRange, NULL);
+	simParallel(pool, 0, count, proposeRange, NULL);
+	simParallel(pool, 0, count, resolveRange, NULL);
+	simParallel(pool, 0, count, applyRange, NULL);
+	for (i = 0, stopped = 0; i < workers; i++)
+	    for (side = 0; side < SIDES; side++)
+		stopped += tallies[i].sides[side];
+    }
+    tickMs = monotonicMs() - start;
+    for (i = 0; i < workers; i++) {
+	jumped += tallies[i].jumped;
+	stepped += tallies[i].stepped;
+	collisions += tallies[i].collisions;
+	for (side = 0; side < SIDES; side++)
+	    sides[side] += tallies[i].sides[side];
+    }
+
+    printf("%d balls, %dx%d island (%d land cells), %d threads\n", count, terrain.width,
+	   terrain.height, landCount, workers);
+    printf("  terrain: %.1f ms, descent field: %.1f ms (%d jumping rounds)\n", terrainMs, descentMs,
+	   terrain.rounds);
+    printf("  %d ticks: %.2f M balls/s, %ld jumps, %ld steps, %ld collisions\n", rain.tick,
+	   (double) rain.tick * count / (tickMs / 1e3) / 1e6, jumped, stepped, collisions);
+    printSides(sides);
+    free(rain.cell);
+    free(rain.landTick);
+    free(rain.landCell);
+    free(rain.want);
+    free(rain.state);
+    free(rain.side);
+    free(rain.bumped);
+    free(rain.collided);
+    free(rain.jumping);
+    free(rain.bounces);
+    free(rain.bumpedNext);
+    free(rain.claim);
+    free(rain.basin);
+    free(rain.resting);
+    free(tallies);
+    free(landCells);
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./island [-n balls] [-m width height] [-T timeout_s] [-t threads]\n");
+    fprintf(stderr, "                [-r seed] [-o log_file] [-b]\n");
+    fprintf(stderr, "       ./island -i log_file\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, count = DEFAULT_BALLS, threads = 2, benchMode = 0, sized = 0;
+    int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT, status;
+    double timeout = DEFAULT_TIMEOUT;
+    unsigned seed = time(NULL);
+    char *recordPath = NULL, *replayPath = NULL;
+    struct simPool *pool;
+    struct simLog log;
+
+    while ((opt = getopt(argc, argv, "n:m:T:t:r:bo:i:")) != -1) {
+	switch (opt) {
+	case 'n':
+	    count = atoi(optarg);
+	    break;
+	case 'm':
+	    if (optind >= argc) {
+		usage();
+		return 1;
+	    }
+	    width = atoi(optarg);
+	    height = atoi(argv[optind++]);
+	    sized = 1;
+	    break;
+	case 'T':
+	    timeout = atof(optarg);
+	    break;
+	case 't':
+	    threads = atoi(optarg);
+	    break;
+	case 'r':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	case 'b':
+	    benchMode = 1;
+	    break;
+	case 'o':
+	    recordPath = optarg;
+	    break;
+	case 'i':
+	    replayPath = optarg;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc || count <= 0 || width <= 0 || height <= 0 || timeout <= 0 || threads <= 0
+	|| (recordPath && (benchMode || replayPath))) {
+	usage();
+	return 1;
+    }
+    pool = simStart(threads);
+    if (pool == NULL) {
+	fprintf(stderr, "Cannot start %d worker threads\n", threads);
+	return 1;
+    }
+
+    if (replayPath) {
+	if (simLogLoad(&log, replayPath) != 0) {
+	    status = 1;
+	} else {
+	    initTerrain(&terrain, log.params[1], log.params[2], log.seed, pool);
+	    buildDescent(&terrain, pool);
+	    findLand();
+	    status = replay(&log);
+	    free(landCells);
+	}
+	simLogFree(&log);
+    } else if (benchMode) {
+	status = bench(count, sized ? width : 0, height, pool, seed);
+    } else {
+	initTerrain(&terrain, width, height, seed, pool);
+	buildDescent(&terrain, pool);
+	findLand();
+	if (count > landCount / 2) {
+	    fprintf(stderr, "Too many balls for %d land cells\n", landCount);
+	    status = 1;
+	} else if (recordPath && simLogInit(&log, count, seed,
+					    (int32_t[SIM_LOG_PARAMS]) {count, width, height}) != 0) {
+	    status = 1;
+	} else {
+	    recording = recordPath ? &log : NULL;
+	    status = simulate(count, timeout, seed, recordPath);
+	    if (recording)
+		simLogFree(recording);
+	}
+	free(landCells);
+    }
+    freeTerrain(&terrain);
+    simStop(pool);
+    return status;
+}
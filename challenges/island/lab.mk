@@ -0,0 +1,33 @@
+# island build & test automation
+
+APP_NAME=island
+LIB_NAME=terrain
+CORE_DIR=../sim-core
+CORE_NAME=simcore
+
+build:
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/${CORE_NAME}.c -o ${CORE_NAME}.o
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/replay.c -o replay.o
+	gcc -I${CORE_DIR} -c ${LIB_NAME}.c -o ${LIB_NAME}.o
+	gcc -I${CORE_DIR} -c ${APP_NAME}.c -o ${APP_NAME}.o
+	gcc ${CORE_NAME}.o replay.o ${LIB_NAME}.o ${APP_NAME}.o -o ${APP_NAME} -lpthread -lm
+test: build
+	@echo Test 1
+	./${APP_NAME} -n 30 -r 1
+	@echo Test 2 - crowded island
+	./${APP_NAME} -n 200 -m 40 20 -r 2
+	@echo Test 3
+	./${APP_NAME} -b -n 10000 -r 1
+	@echo Test 4 - record a run and replay it on one thread
+	./${APP_NAME} -n 200 -m 40 20 -r 3 -o run.log
+	./${APP_NAME} -i run.log
+	@echo Test 5 - failed
+	-./${APP_NAME} -n 0
+bench:
+	gcc -O2 -I${CORE_DIR} ${CORE_DIR}/${CORE_NAME}.c ${CORE_DIR}/replay.c ${LIB_NAME}.c ${APP_NAME}.c -o ${APP_NAME}_bench.o -lpthread -lm
+	@echo Benchmark - raining balls on the descent field
+	./${APP_NAME}_bench.o -b -n 10000 -t 4 -r 1
+	./${APP_NAME}_bench.o -b -n 100000 -t 4 -r 1
+	./${APP_NAME}_bench.o -b -n 1000000 -t 4 -r 1
+clean:
+	rm -rf *.o ${APP_NAME} run.log
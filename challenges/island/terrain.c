@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "terrain.h"
+
+#define OCTAVES 4
+#define HEIGHT_SCALE 100.0f         /* meters at the island's center */
+
+const char *sideNames[SIDES] = {"north sea", "south sea", "east sea", "west sea", "valleys"};
+
+/* Random lattices for value noise, one per octave */
+struct noise {
+    int size[OCTAVES];
+    float spacing[OCTAVES];
+    float *lattice[OCTAVES];
+};
+
+struct shape {
+    struct terrain *t;
+    struct noise *noise;
+};
+
+struct jump {
+    const int *from;
+    int *to;
+    atomic_int changed;
+};
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+static float sampleNoise(const struct noise *noise, int octave, float x, float y) {
+    int size = noise->size[octave], ix, iy;
+    const float *l = noise->lattice[octave];
+    float fx, fy, top, bottom;
+
+    x /= noise->spacing[octave];
+    y /= noise->spacing[octave];
+    ix = (int) x;
+    iy = (int) y;
+    fx = x - ix;
+    fy = y - iy;
+    fx = fx * fx * (3 - 2 * fx);
+    fy = fy * fy * (3 - 2 * fy);
+    top = l[iy * size + ix] + (l[iy * size + ix + 1] - l[iy * size + ix]) * fx;
+    bottom = l[(iy + 1) * size + ix] + (l[(iy + 1) * size + ix + 1] - l[(iy + 1) * size + ix]) * fx;
+    return top + (bottom - top) * fy;
+}
+
+/* A dome falling into the sea at the edges, roughened by value noise. */
+static void shapeRange(void *arg, int first, int last, int worker) {
+    struct shape *shape = arg;
+    struct terrain *t = shape->t;
+    float dx, dy, n, amplitude;
+    int cell, x, y, octave;
+
+    (void) worker;
+    for (cell = first; cell < last; cell++) {
+	x = cell % t->width;
+	y = cell / t->width;
+	if (x == 0 || y == 0 || x == t->width - 1 || y == t->height - 1) {
+	    t->heights[cell] = -HEIGHT_SCALE;
+	    continue;
+	}
+	dx = (x - t->width / 2.0f) / (t->width / 2.0f);
+	dy = (y - t->height / 2.0f) / (t->height / 2.0f);
+	for (octave = 0, n = 0, amplitude = 0.5f; octave < OCTAVES; octave++, amplitude /= 2)
+	    n += amplitude * sampleNoise(shape->noise, octave, x, y);
+	t->heights[cell] = HEIGHT_SCALE * (1 - 1.4f * (dx * dx + dy * dy) + n);
+    }
+}
+
+void initTerrain(struct terrain *t, int width, int height, unsigned seed, struct simPool *pool) {
+    struct noise noise;
+    struct shape shape = {t, &noise};
+    int octave, i, cells;
+    float spacing = (width > height ? width : height) / 4.0f;
+
+    t->width = width < 8 ? 8 : width;
+    t->height = height < 8 ? 8 : height;
+    cells = t->width * t->height;
+    t->heights = xcalloc(cells, sizeof(float));
+    t->successor = xcalloc(cells, sizeof(int));
+    t->root = xcalloc(cells, sizeof(int));
+    t->occupant = xcalloc(cells, sizeof(atomic_int));
+    for (octave = 0; octave < OCTAVES; octave++, spacing /= 2) {
+	noise.spacing[octave] = spacing < 1 ? 1 : spacing;
+	noise.size[octave] = (t->width > t->height ? t->width : t->height) / noise.spacing[octave] + 2;
+	noise.lattice[octave] = xcalloc(noise.size[octave] * noise.size[octave], sizeof(float));
+	for (i = 0; i < noise.size[octave] * noise.size[octave]; i++)
+	    noise.lattice[octave][i] = rand_r(&seed) / (RAND_MAX / 2.0f) - 1;
+    }
+    simParallel(pool, 0, cells, shapeRange, &shape);
+    for (octave = 0; octave < OCTAVES; octave++)
+	free(noise.lattice[octave]);
+}
+
+void freeTerrain(struct terrain *t) {
+    free(t->heights);
+    free(t->successor);
+    free(t->root);
+    free(t->occupant);
+}
+
+int isSea(const struct terrain *t, int cell) {
+    return t->heights[cell] < 0;
+}
+
+/* North, south, east and west; -1 off the map. */
+int neighborCell(const struct terrain *t, int cell, int direction) {
+    int x = cell % t->width, y = cell / t->width;
+
+    switch (direction & 3) {
+    case 0:
+	return y > 0 ? cell - t->width : -1;
+    case 1:
+	return y + 1 < t->height ? cell + t->width : -1;
+    case 2:
+	return x + 1 < t->width ? cell + 1 : -1;
+    default:
+	return x > 0 ? cell - 1 : -1;
+    }
+}
+
+/* Lowest neighbor by (height, index) below the cell, sea cells stay. */
+static void successorRange(void *arg, int first, int last, int worker) {
+    struct terrain *t = arg;
+    int cell, best, direction, n;
+
+    (void) worker;
+    for (cell = first; cell < last; cell++) {
+	best = cell;
+	if (!isSea(t, cell)) {
+	    for (direction = 0; direction < 4; direction++) {
+		n = neighborCell(t, cell, direction);
+		if (t->heights[n] < t->heights[best]
+		    || (t->heights[n] == t->heights[best] && n < best))
+		    best = n;
+	    }
+	}
+	t->successor[cell] = best;
+	t->root[cell] = best;
+    }
+}
+
+static void jumpRange(void *arg, int first, int last, int worker) {
+    struct jump *jump = arg;
+    int cell, changed = 0;
+
+    (void) worker;
+    for (cell = first; cell < last; cell++) {
+	jump->to[cell] = jump->from[jump->from[cell]];
+	changed |= jump->to[cell] != jump->from[cell];
+    }
+    if (changed)
+	atomic_store_explicit(&jump->changed, 1, memory_order_relaxed);
+}
+
+void buildDescent(struct terrain *t, struct simPool *pool) {
+    int cells = t->width * t->height, *scratch = xcalloc(cells, sizeof(int)), *swap;
+    struct jump jump;
+
+    simParallel(pool, 0, cells, successorRange, t);
+    jump.from = t->root;
+    jump.to = scratch;
+    t->rounds = 0;
+    do {
+	atomic_store(&jump.changed, 0);
+	simParallel(pool, 0, cells, jumpRange, &jump);
+	swap = (int *) jump.from;
+	jump.from = jump.to;
+	jump.to = swap;
+	t->rounds++;
+    } while (atomic_load(&jump.changed));
+    if (jump.from != t->root) {
+	free(t->root);
+	t->root = (int *) jump.from;
+    } else {
+	free(scratch);
+    }
+}
+
+/* Which sea a ball from cell ends in, or VALLEY when it stops on land. */
+int restingSide(const struct terrain *t, int cell) {
+    int root = t->root[cell];
+    float dx = (root % t->width - t->width / 2.0f) / t->width;
+    float dy = (root / t->width - t->height / 2.0f) / t->height;
+
+    if (!isSea(t, root))
+	return VALLEY;
+    if (fabsf(dx) > fabsf(dy))
+	return dx > 0 ? EAST_SEA : WEST_SEA;
+    return dy > 0 ? SOUTH_SEA : NORTH_SEA;
+}
+
+int claimCell(struct terrain *t, int cell, int ball) {
+    int expected = NO_BALL;
+    return atomic_compare_exchange_strong_explicit(&t->occupant[cell], &expected, ball + 1,
+						   memory_order_acquire, memory_order_relaxed);
+}
+
+void releaseCell(struct terrain *t, int cell) {
+    atomic_store_explicit(&t->occupant[cell], NO_BALL, memory_order_release);
+}
+
+/* The ball in cell, or -1. */
+int ballAt(const struct terrain *t, int cell) {
+    return atomic_load_explicit(&t->occupant[cell], memory_order_relaxed) - 1;
+}
+
+/* Sea as '~', land by height, balls as 'o'. */
+void printTerrain(const struct terrain *t) {
+    static const char levels[] = ".,:;-=+*#%@";
+    char *line = xcalloc(t->width + 2, 1);
+    int x, y, cell, level;
+
+    for (y = 0; y < t->height; y++) {
+	for (x = 0; x < t->width; x++) {
+	    cell = y * t->width + x;
+	    level = t->heights[cell] / HEIGHT_SCALE * (sizeof(levels) - 2);
+	    if (ballAt(t, cell) >= 0)
+		line[x] = 'o';
+	    else if (isSea(t, cell))
+		line[x] = '~';
+	    else
+		line[x] = levels[level < 0 ? 0 : level > 10 ? 10 : level];
+	}
+	line[x] = '\n';
+	fputs(line, stdout);
+    }
+    free(line);
+}
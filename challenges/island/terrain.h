@@ -0,0 +1,42 @@
+// Island heightmap and descent field
+//
+// Heights below zero are sea, and the map edges are always sea. A ball
+// rolls from a cell to its lowest neighbor that is not higher.
+// buildDescent precomputes that successor for every cell, with ties
+// broken by cell index so the successors form a forest. It then finds
+// every cell's root, the sea cell or valley its ball ends in, by
+// pointer jumping: each round replaces root[c] with root[root[c]], so
+// the depth of the deepest slope only costs log2 rounds, all run in
+// parallel on the simulation pool.
+//
+// Two balls following successors can only meet if they share a root, so
+// a ball alone in its basin can skip straight to the end of its slope.
+
+#include <stdatomic.h>
+#include "simcore.h"
+
+#define NO_BALL 0
+
+enum side {NORTH_SEA, SOUTH_SEA, EAST_SEA, WEST_SEA, VALLEY, SIDES};
+
+struct terrain {
+    int width, height;
+    float *heights;
+    int *successor;                 /* lowest neighbor not above, or the cell itself */
+    int *root;                      /* where a ball from the cell comes to rest */
+    atomic_int *occupant;           /* ball id + 1, or NO_BALL */
+    int rounds;                     /* pointer jumping rounds of the last build */
+};
+
+extern const char *sideNames[SIDES];
+
+void initTerrain(struct terrain *t, int width, int height, unsigned seed, struct simPool *pool);
+void freeTerrain(struct terrain *t);
+void buildDescent(struct terrain *t, struct simPool *pool);
+int isSea(const struct terrain *t, int cell);
+int restingSide(const struct terrain *t, int cell);
+int neighborCell(const struct terrain *t, int cell, int direction);
+int claimCell(struct terrain *t, int cell, int ball);
+void releaseCell(struct terrain *t, int cell);
+int ballAt(const struct terrain *t, int cell);
+void printTerrain(const struct terrain *t);
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "frames.h"
+
+int framesInit(struct frameStats *stats, int capacity) {
+    stats->count = 0;
+    stats->capacity = capacity > 0 ? capacity : 1;
+    stats->ms = calloc(stats->capacity, sizeof(float));
+    return stats->ms == NULL ? -1 : 0;
+}
+
+/* Doubles the buffer when full, or drops the frame if that fails. */
+void framesAdd(struct frameStats *stats, double ms) {
+    float *grown;
+
+    if (stats->count == stats->capacity) {
+	grown = realloc(stats->ms, 2 * stats->capacity * sizeof(float));
+	if (grown == NULL)
+	    return;
+	stats->ms = grown;
+	stats->capacity *= 2;
+    }
+    stats->ms[stats->count++] = ms;
+}
+
+static int compareMs(const void *a, const void *b) {
+    float x = *(const float *) a, y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+/* Sorts the recorded frames. */
+void framesReport(struct frameStats *stats, const char *label, double budgetMs) {
+    double total = 0;
+    int i, over = 0;
+
+    if (stats->count == 0) {
+	printf("  %s: no frames\n", label);
+	return;
+    }
+    qsort(stats->ms, stats->count, sizeof(float), compareMs);
+    for (i = 0; i < stats->count; i++) {
+	total += stats->ms[i];
+	over += stats->ms[i] > budgetMs;
+    }
+    printf("  %s: %d frames, avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms, %d over %.1f ms\n",
+	   label, stats->count, total / stats->count, stats->ms[stats->count / 2],
+	   stats->ms[(int) (stats->count * 0.99)], stats->ms[stats->count - 1], over, budgetMs);
+}
+
+void framesFree(struct frameStats *stats) {
+    free(stats->ms);
+    stats->ms = NULL;
+}
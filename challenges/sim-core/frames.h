@@ -0,0 +1,15 @@
+// Frame time recorder for the game loops
+//
+// framesAdd keeps every frame's time. framesReport prints the average,
+// median, 99th percentile and worst frame, and how many frames missed
+// their budget, such as 16.7 ms for a 60 Hz tick.
+
+struct frameStats {
+    int count, capacity;
+    float *ms;
+};
+
+int framesInit(struct frameStats *stats, int capacity);
+void framesAdd(struct frameStats *stats, double ms);
+void framesReport(struct frameStats *stats, const char *label, double budgetMs);
+void framesFree(struct frameStats *stats);
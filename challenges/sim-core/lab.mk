@@ -0,0 +1,36 @@
+# sim-core build & test automation
+
+APP_NAME=simbench
+LIB_NAME=simcore
+
+build:
+	gcc -c ${LIB_NAME}.c -o ${LIB_NAME}.o
+	gcc -c spatial.c -o spatial.o
+	gcc -c frames.c -o frames.o
+	gcc -c render.c -o render.o
+	gcc -c replay.c -o replay.o
+	gcc -c ${APP_NAME}.c -o ${APP_NAME}.o
+	gcc ${LIB_NAME}.o ${APP_NAME}.o -o ${APP_NAME} -lpthread
+test: build
+	@echo Test 1 - same checksum for any worker count
+	./${APP_NAME} -m soa -n 5000 -t 1
+	./${APP_NAME} -m soa -n 5000 -t 4
+	@echo Test 2 - entity-as-thread layer, same checksum again
+	./${APP_NAME} -m entities -n 5000 -t 2
+	@echo Test 3
+	./${APP_NAME} -m threads -n 500
+	@echo Test 4 - failed
+	-./${APP_NAME} -m fibers
+bench:
+	gcc -O2 ${LIB_NAME}.c ${APP_NAME}.c -o ${APP_NAME}_bench.o -lpthread
+	@echo Benchmark - thread per entity against the tick-based core
+	./${APP_NAME}_bench.o -m threads -n 1000
+	./${APP_NAME}_bench.o -m entities -n 1000 -t 4
+	./${APP_NAME}_bench.o -m soa -n 1000 -t 4
+	./${APP_NAME}_bench.o -m threads -n 10000
+	./${APP_NAME}_bench.o -m entities -n 10000 -t 4
+	./${APP_NAME}_bench.o -m soa -n 10000 -t 4
+	./${APP_NAME}_bench.o -m entities -n 100000 -t 4 -k 20
+	./${APP_NAME}_bench.o -m soa -n 1000000 -t 4 -k 20
+clean:
+	rm -rf *.o ${APP_NAME}
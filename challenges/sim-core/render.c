@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "render.h"
+
+#define MAX_ESCAPE 16               /* longest cursor sequence */
+#define FRAME_SLACK 0.9             /* a tick just short of the cap still draws */
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/* A maxFps of 0 draws every frame. */
+int renderInit(struct renderer *r, int width, int height, int fd, double maxFps) {
+    memset(r, 0, sizeof(*r));
+    r->width = width;
+    r->height = height;
+    r->fd = fd >= 0 && isatty(fd) ? fd : -1;
+    r->minFrameMs = maxFps > 0 ? 1e3 / maxFps : 0;
+    r->lastFrameMs = -1e9;
+    r->front = malloc((size_t) width * height);
+    r->back = malloc((size_t) width * height);
+    /* worst case: every cell behind its own cursor move */
+    r->outCapacity = (size_t) width * height * (MAX_ESCAPE + 1) + 64;
+    r->out = malloc(r->outCapacity);
+    if (r->front == NULL || r->back == NULL || r->out == NULL) {
+	renderFree(r);
+	return -1;
+    }
+    memset(r->front, ' ', (size_t) width * height);
+    renderClear(r);
+    return 0;
+}
+
+void renderClear(struct renderer *r) {
+    memset(r->back, ' ', (size_t) r->width * r->height);
+}
+
+void renderPut(struct renderer *r, int x, int y, char c) {
+    if (x >= 0 && y >= 0 && x < r->width && y < r->height)
+	r->back[y * r->width + x] = c;
+}
+
+/* Clipped at the right edge. */
+void renderText(struct renderer *r, int x, int y, const char *text) {
+    for (; *text != '\0'; text++, x++)
+	renderPut(r, x, y, *text);
+}
+
+/*
+ * Appends what takes the cursor from (*cx, *cy) to (x, y): the cells in
+ * between when that is shorter than an escape sequence.
+ */
+static size_t moveCursor(const struct renderer *r, char *out, int *cx, int *cy, int x, int y) {
+    size_t n;
+
+    if (*cy == y && *cx == x)
+	return 0;
+    if (*cy == y && *cx < x && x - *cx <= 4) {
+	memcpy(out, &r->back[y * r->width + *cx], x - *cx);
+	n = x - *cx;
+    } else if (*cy == y && *cx < x) {
+	n = sprintf(out, "\033[%dC", x - *cx);
+    } else {
+	n = sprintf(out, "\033[%d;%dH", y + 1, x + 1);
+    }
+    *cx = x;
+    *cy = y;
+    return n;
+}
+
+static void writeAll(int fd, const char *p, size_t n) {
+    ssize_t written;
+
+    while (n > 0 && (written = write(fd, p, n)) > 0) {
+	p += written;
+	n -= written;
+    }
+}
+
+/*
+ * Applies a frame's bytes to the emulated screen, the way a terminal
+ * would. Only the sequences renderFrame emits are understood.
+ */
+static void playBack(struct renderer *r, const char *p, size_t n) {
+    const char *end = p + n;
+    int params[2], count;
+
+    while (p < end) {
+	if (*p != '\033') {
+	    if (r->shownX < r->width && r->shownY < r->height)
+		r->shown[r->shownY * r->width + r->shownX] = *p;
+	    r->shownX++;
+	    p++;
+	    continue;
+	}
+	p += 2;                     /* ESC [ */
+	if (p < end && *p == '?')
+	    p++;
+	params[0] = params[1] = 0;
+	for (count = 0; p < end && (*p == ';' || (*p >= '0' && *p <= '9')); p++)
+	    if (*p == ';')
+		count++;
+	    else if (count < 2)
+		params[count] = params[count] * 10 + *p - '0';
+	if (p == end)
+	    break;
+	if (*p == 'H') {
+	    r->shownY = params[0] > 0 ? params[0] - 1 : 0;
+	    r->shownX = params[1] > 0 ? params[1] - 1 : 0;
+	} else if (*p == 'C') {
+	    r->shownX += params[0] > 0 ? params[0] : 1;
+	} else if (*p == 'J' && params[0] == 2) {
+	    memset(r->shown, ' ', (size_t) r->width * r->height);
+	}
+	p++;
+    }
+}
+
+/*
+ * Draws the back buffer, or skips it if the last frame was drawn less
+ * than the frame cap ago. Returns the bytes sent, or -1 when skipped.
+ */
+int renderFrame(struct renderer *r) {
+    double start = monotonicMs();
+    size_t n = 0;
+    int x, y, cx = -1, cy = -1, cell;
+
+    if (start - r->lastFrameMs < r->minFrameMs * FRAME_SLACK) {
+	r->skipped++;
+	return -1;
+    }
+    r->lastFrameMs = start;
+    if (!r->started || r->fullRedraw) {
+	n += sprintf(r->out, "\033[?25l\033[H%s", r->started ? "" : "\033[2J");
+	cx = cy = 0;
+	r->started = 1;
+    }
+    for (y = 0; y < r->height; y++)
+	for (x = 0; x < r->width; x++) {
+	    cell = y * r->width + x;
+	    if (r->front[cell] == r->back[cell] && !r->fullRedraw)
+		continue;
+	    n += moveCursor(r, &r->out[n], &cx, &cy, x, y);
+	    r->out[n++] = r->back[cell];
+	    cx++;
+	}
+    memcpy(r->front, r->back, (size_t) r->width * r->height);
+    if (r->fd >= 0 && n > 0)
+	writeAll(r->fd, r->out, n);
+    if (r->capture != NULL && r->shown == NULL && (r->shown = malloc((size_t) r->width * r->height)) != NULL)
+	memset(r->shown, ' ', (size_t) r->width * r->height);
+    if (r->capture != NULL && r->shown != NULL) {
+	playBack(r, r->out, n);
+	for (y = 0; y < r->height; y++)
+	    fprintf(r->capture, "%.*s\n", r->width, &r->shown[y * r->width]);
+	fprintf(r->capture, "--\n");
+    }
+    r->frames++;
+    r->bytes += n;
+    r->renderMs += monotonicMs() - start;
+    return n;
+}
+
+void renderReport(const struct renderer *r) {
+    long frames = r->frames > 0 ? r->frames : 1;
+
+    printf("  render: %ld frames drawn, %ld skipped by the frame cap, %.0f bytes/frame, %.3f ms/frame\n",
+	   r->frames, r->skipped, (double) r->bytes / frames, r->renderMs / frames);
+}
+
+/* Leaves the cursor below the board. */
+void renderFree(struct renderer *r) {
+    char done[32];
+    int n;
+
+    if (r->fd >= 0 && r->started) {
+	n = sprintf(done, "\033[%d;1H\033[?25h", r->height + 1);
+	writeAll(r->fd, done, n);
+    }
+    free(r->front);
+    free(r->back);
+    free(r->out);
+    free(r->shown);
+    r->front = r->back = r->out = r->shown = NULL;
+}
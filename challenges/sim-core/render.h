@@ -0,0 +1,41 @@
+// Diff-based terminal renderer for the game challenges
+//
+// A game draws each frame into the back buffer, one character per cell.
+// renderFrame compares it with the front buffer, what the terminal
+// shows now, and emits only the cells that changed. Short gaps on the
+// same row are rewritten in place, longer ones get a cursor move, and
+// the whole frame goes out in a single write. Frames closer together
+// than the frame cap are skipped, so the game can tick faster than the
+// terminal redraws.
+//
+// Without a terminal, frames are counted but not written. With a capture
+// file, the bytes of every drawn frame are also played back on an
+// emulated screen, and that screen is appended to the file as plain
+// text. The capture shows what a terminal would display, so a diffed run
+// and a full-redraw run of the same frames must capture the same text.
+
+#include <stdio.h>
+
+struct renderer {
+    int width, height;
+    char *front, *back;
+    char *out;                      /* escape sequences of one frame */
+    size_t outCapacity;
+    int fd;                         /* terminal, or -1 when headless */
+    FILE *capture;
+    char *shown;                    /* the emulated screen behind capture */
+    int shownX, shownY;
+    int fullRedraw;                 /* for comparison: rewrite every cell */
+    int started;
+    double minFrameMs, lastFrameMs;
+    long frames, skipped, bytes;
+    double renderMs;
+};
+
+int renderInit(struct renderer *r, int width, int height, int fd, double maxFps);
+void renderClear(struct renderer *r);
+void renderPut(struct renderer *r, int x, int y, char c);
+void renderText(struct renderer *r, int x, int y, const char *text);
+int renderFrame(struct renderer *r);
+void renderReport(const struct renderer *r);
+void renderFree(struct renderer *r);
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+#define LOG_MAGIC "SIMLOG1"
+#define TRACK_CAPACITY 256
+#define CACHE_LINE 64
+
+struct recorded {
+    uint64_t sequence;
+    struct simEvent event;
+};
+
+/* One thread's events, on its own cache line */
+struct simTrack {
+    _Alignas(CACHE_LINE) struct recorded *events;
+    long count, capacity;
+};
+
+struct header {
+    char magic[8];
+    uint32_t seed;
+    int32_t params[SIM_LOG_PARAMS];
+    uint64_t checksum;
+    int64_t count;
+};
+
+static uint64_t mix(uint64_t x) {
+    x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ x >> 27) * 0x94d049bb133111ebULL;
+    return x ^ x >> 31;
+}
+
+uint64_t simRandomSeed(uint32_t seed, int entity) {
+    return mix((uint64_t) seed << 32 | (uint32_t) entity);
+}
+
+/* splitmix64, upper half */
+uint32_t simRandom(uint64_t *state) {
+    *state += 0x9e3779b97f4a7c15ULL;
+    return mix(*state) >> 32;
+}
+
+/* FNV-1a, starting from SIM_HASH_START */
+uint64_t simHash(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *p = data;
+
+    while (size-- > 0)
+	hash = (hash ^ *p++) * 0x100000001b3ULL;
+    return hash;
+}
+
+int simLogInit(struct simLog *log, int tracks, uint32_t seed, const int32_t params[SIM_LOG_PARAMS]) {
+    memset(log, 0, sizeof(*log));
+    log->seed = seed;
+    memcpy(log->params, params, sizeof(log->params));
+    atomic_init(&log->sequence, 0);
+    log->tracks = aligned_alloc(CACHE_LINE, tracks * sizeof(struct simTrack));
+    if (log->tracks == NULL) {
+	perror("aligned_alloc");
+	return -1;
+    }
+    memset(log->tracks, 0, tracks * sizeof(struct simTrack));
+    log->trackCount = tracks;
+    return 0;
+}
+
+/* Only the thread that owns the track may call this. */
+void simRecord(struct simLog *log, int track, int entity, int kind, int a, int b) {
+    struct simTrack *t = &log->tracks[track];
+    struct recorded *grown;
+
+    if (t->count == t->capacity) {
+	t->capacity = t->capacity > 0 ? 2 * t->capacity : TRACK_CAPACITY;
+	grown = realloc(t->events, t->capacity * sizeof(struct recorded));
+	if (grown == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+	t->events = grown;
+    }
+    t->events[t->count].sequence = atomic_fetch_add(&log->sequence, 1);
+    t->events[t->count].event = (struct simEvent) {entity, kind, a, b};
+    t->count++;
+}
+
+static int compareSequence(const void *a, const void *b) {
+    uint64_t x = ((const struct recorded *) a)->sequence, y = ((const struct recorded *) b)->sequence;
+    return (x > y) - (x < y);
+}
+
+/* Merges the tracks in sequence order, once every recording thread is done. */
+int simLogSave(struct simLog *log, const char *path, uint64_t checksum) {
+    struct header h = {LOG_MAGIC, log->seed, {0}, checksum, 0};
+    struct recorded *all;
+    FILE *file;
+    long i, t;
+
+    for (t = 0, log->count = 0; t < log->trackCount; t++)
+	log->count += log->tracks[t].count;
+    all = malloc((log->count + 1) * sizeof(struct recorded));
+    log->events = malloc((log->count + 1) * sizeof(struct simEvent));
+    if (all == NULL || log->events == NULL) {
+	perror("malloc");
+	free(all);
+	return -1;
+    }
+    for (t = 0, i = 0; t < log->trackCount; t++) {
+	memcpy(&all[i], log->tracks[t].events, log->tracks[t].count * sizeof(struct recorded));
+	i += log->tracks[t].count;
+    }
+    qsort(all, log->count, sizeof(struct recorded), compareSequence);
+    for (i = 0; i < log->count; i++)
+	log->events[i] = all[i].event;
+    free(all);
+
+    log->checksum = checksum;
+    memcpy(h.params, log->params, sizeof(h.params));
+    h.count = log->count;
+    if ((file = fopen(path, "wb")) == NULL) {
+	perror(path);
+	return -1;
+    }
+    if (fwrite(&h, sizeof(h), 1, file) != 1
+	|| fwrite(log->events, sizeof(struct simEvent), log->count, file) != (size_t) log->count) {
+	perror(path);
+	fclose(file);
+	return -1;
+    }
+    fclose(file);
+    printf("Recorded %ld events to %s, final state %016llx\n", log->count, path,
+	   (unsigned long long) checksum);
+    return 0;
+}
+
+int simLogLoad(struct simLog *log, const char *path) {
+    struct header h;
+    FILE *file;
+
+    memset(log, 0, sizeof(*log));
+    if ((file = fopen(path, "rb")) == NULL) {
+	perror(path);
+	return -1;
+    }
+    if (fread(&h, sizeof(h), 1, file) != 1 || memcmp(h.magic, LOG_MAGIC, sizeof(h.magic)) != 0
+	|| h.count < 0) {
+	fprintf(stderr, "%s: not a simulation log\n", path);
+	fclose(file);
+	return -1;
+    }
+    log->events = malloc((h.count + 1) * sizeof(struct simEvent));
+    if (log->events == NULL) {
+	perror("malloc");
+	fclose(file);
+	return -1;
+    }
+    if (fread(log->events, sizeof(struct simEvent), h.count, file) != (size_t) h.count) {
+	fprintf(stderr, "%s: truncated log\n", path);
+	free(log->events);
+	log->events = NULL;
+	fclose(file);
+	return -1;
+    }
+    fclose(file);
+    log->seed = h.seed;
+    memcpy(log->params, h.params, sizeof(log->params));
+    log->checksum = h.checksum;
+    log->count = h.count;
+    return 0;
+}
+
+/* Reports the replay and returns 0 when it ended where the recording did. */
+int simLogCheck(const struct simLog *log, uint64_t checksum, double ms) {
+    printf("Replayed %ld events in %.1f ms (%.2f M events/s), final state %016llx: %s\n",
+	   log->count, ms, ms > 0 ? log->count / ms / 1e3 : 0, (unsigned long long) checksum,
+	   checksum == log->checksum ? "same as recorded" : "DIFFERENT from the recording");
+    return checksum != log->checksum;
+}
+
+void simLogFree(struct simLog *log) {
+    int t;
+
+    for (t = 0; t < log->trackCount; t++)
+	free(log->tracks[t].events);
+    free(log->tracks);
+    free(log->events);
+    log->tracks = NULL;
+    log->events = NULL;
+    log->trackCount = 0;
+}
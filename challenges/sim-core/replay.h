@@ -0,0 +1,52 @@
+// Deterministic record and replay of thread-per-entity runs
+//
+// simRandom gives every entity its own random stream, seeded from the
+// run's seed and the entity id only. What an entity draws then does not
+// depend on how the threads interleave or on how many entities exist.
+//
+// A recording logs every change to the shared map as a fixed-size
+// event. Each thread appends to its own track, so recording takes no
+// lock. The order comes from a global sequence number, taken after the
+// compare-and-swap that claims a cell and before the store that frees
+// the old one. Whoever claims a cell next therefore always gets a later
+// number. simLogSave merges the tracks into one binary log, with the
+// run's seed, its parameters and a checksum of its final state.
+//
+// simLogLoad reads a log back. The caller rebuilds the map from the
+// seed and parameters, applies the events in order on one thread and
+// compares its final state with the recording in simLogCheck.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define SIM_LOG_PARAMS 8
+#define SIM_HASH_START 0xcbf29ce484222325ULL
+
+struct simEvent {
+    int32_t entity, kind, a, b;
+};
+
+struct simTrack;
+
+struct simLog {
+    uint32_t seed;
+    int32_t params[SIM_LOG_PARAMS];
+    uint64_t checksum;              /* of the recorded run's final state */
+    long count;
+    struct simEvent *events;        /* in order, once saved or loaded */
+    atomic_ulong sequence;
+    struct simTrack *tracks;
+    int trackCount;
+};
+
+uint64_t simRandomSeed(uint32_t seed, int entity);
+uint32_t simRandom(uint64_t *state);
+uint64_t simHash(uint64_t hash, const void *data, size_t size);
+
+int simLogInit(struct simLog *log, int tracks, uint32_t seed, const int32_t params[SIM_LOG_PARAMS]);
+void simRecord(struct simLog *log, int track, int entity, int kind, int a, int b);
+int simLogSave(struct simLog *log, const char *path, uint64_t checksum);
+int simLogLoad(struct simLog *log, const char *path);
+int simLogCheck(const struct simLog *log, uint64_t checksum, double ms);
+void simLogFree(struct simLog *log);
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "simcore.h"
+
+#define DEFAULT_ENTITIES 10000
+#define DEFAULT_TICKS 100
+#define THREAD_STACK (64 * 1024)
+#define NO_CLAIM INT_MAX
+
+/*
+ * Entities random-walk on a wrapping grid about a quarter full, one
+ * step per tick, never two in the same cell.
+ */
+struct world {
+    int side, count;
+    int *position, *nextPosition;   /* current and next cell of each entity */
+    int *want;                      /* cell proposed this tick */
+    unsigned *rng;
+    atomic_int *occupant;           /* entity id + 1, or 0 */
+    atomic_int *claim;              /* lowest id proposing a cell, or NO_CLAIM */
+};
+
+static struct world world;
+static pthread_barrier_t tickBarrier;
+static long tickCount;
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+static int randomNeighbor(int i) {
+    unsigned r = world.rng[i];
+    int cell = world.position[i], x = cell % world.side, y = cell / world.side;
+
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    world.rng[i] = r;
+    switch (r & 3) {
+    case 0:
+	x = x + 1 == world.side ? 0 : x + 1;
+	break;
+    case 1:
+	x = x == 0 ? world.side - 1 : x - 1;
+	break;
+    case 2:
+	y = y + 1 == world.side ? 0 : y + 1;
+	break;
+    default:
+	y = y == 0 ? world.side - 1 : y - 1;
+    }
+    return y * world.side + x;
+}
+
+/* Tick phase 1: propose a free neighbor, keeping the lowest id per cell. */
+static void propose(int i) {
+    int target = randomNeighbor(i), current;
+
+    world.want[i] = world.position[i];
+    if (atomic_load_explicit(&world.occupant[target], memory_order_relaxed) != 0)
+	return;
+    world.want[i] = target;
+    current = atomic_load_explicit(&world.claim[target], memory_order_relaxed);
+    while (i < current
+	   && !atomic_compare_exchange_weak_explicit(&world.claim[target], &current, i,
+						     memory_order_relaxed, memory_order_relaxed))
+	;
+}
+
+static void proposeRange(void *arg, int first, int last, int worker) {
+    int i;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++)
+	propose(i);
+}
+
+/* Tick phase 2: winners move into the next state. */
+static void resolveRange(void *arg, int first, int last, int worker) {
+    int i, want;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++) {
+	want = world.want[i];
+	world.nextPosition[i] = want;
+	if (want != world.position[i]
+	    && atomic_load_explicit(&world.claim[want], memory_order_relaxed) != i)
+	    world.nextPosition[i] = world.position[i];
+    }
+}
+
+/*
+ * Tick phase 3: update occupancy and clear claims. A cell is written
+ * only by the entity leaving it or the one winner entering it.
+ */
+static void applyRange(void *arg, int first, int last, int worker) {
+    int i, from, to;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++) {
+	from = world.position[i];
+	to = world.nextPosition[i];
+	if (world.want[i] != from)
+	    atomic_store_explicit(&world.claim[world.want[i]], NO_CLAIM, memory_order_relaxed);
+	if (to != from) {
+	    atomic_store_explicit(&world.occupant[from], 0, memory_order_relaxed);
+	    atomic_store_explicit(&world.occupant[to], i + 1, memory_order_relaxed);
+	}
+    }
+}
+
+static void endTick(struct simPool *pool) {
+    int *swap;
+
+    simParallel(pool, 0, world.count, resolveRange, NULL);
+    simParallel(pool, 0, world.count, applyRange, NULL);
+    swap = world.position;
+    world.position = world.nextPosition;
+    world.nextPosition = swap;
+}
+
+/* Entity-as-thread version of an entity: one proposal per tick. */
+static void *walk(void *arg) {
+    int i = (int) (intptr_t) arg;
+
+    for (;;) {
+	propose(i);
+	simYield();
+    }
+    return NULL;
+}
+
+/* Thread per entity: claim the next cell directly, then wait for the tick. */
+static void *walkThread(void *arg) {
+    int i = (int) (intptr_t) arg, target, expected;
+    long tick;
+
+    pthread_barrier_wait(&tickBarrier);
+    for (tick = 0; tick < tickCount; tick++) {
+	target = randomNeighbor(i);
+	expected = 0;
+	if (atomic_compare_exchange_strong(&world.occupant[target], &expected, i + 1)) {
+	    atomic_store(&world.occupant[world.position[i]], 0);
+	    world.position[i] = target;
+	}
+	pthread_barrier_wait(&tickBarrier);
+    }
+    return NULL;
+}
+
+static void initWorld(int count, unsigned seed) {
+    int i, cell;
+
+    for (world.side = 2; (long) world.side * world.side < 4L * count; world.side++)
+	;
+    world.count = count;
+    world.position = xcalloc(count, sizeof(int));
+    world.nextPosition = xcalloc(count, sizeof(int));
+    world.want = xcalloc(count, sizeof(int));
+    world.rng = xcalloc(count, sizeof(unsigned));
+    world.occupant = xcalloc((size_t) world.side * world.side, sizeof(atomic_int));
+    world.claim = xcalloc((size_t) world.side * world.side, sizeof(atomic_int));
+    for (i = 0; i < world.side * world.side; i++)
+	atomic_init(&world.claim[i], NO_CLAIM);
+    for (i = 0; i < count; i++) {
+	do
+	    cell = rand_r(&seed) % (world.side * world.side);
+	while (atomic_load(&world.occupant[cell]) != 0);
+	atomic_store(&world.occupant[cell], i + 1);
+	world.position[i] = cell;
+	world.rng[i] = rand_r(&seed) | 1;
+    }
+}
+
+static unsigned long checksum() {
+    unsigned long sum = 0;
+    int i;
+
+    for (i = 0; i < world.count; i++)
+	sum = sum * 1000003 + world.position[i];
+    return sum;
+}
+
+static int runThreads(int count) {
+    pthread_t *threads = xcalloc(count, sizeof(pthread_t));
+    pthread_attr_t attr;
+    long tick;
+    int i, error;
+
+    pthread_barrier_init(&tickBarrier, NULL, count + 1);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK);
+    for (i = 0; i < count; i++) {
+	error = pthread_create(&threads[i], &attr, walkThread, (void *) (intptr_t) i);
+	if (error != 0) {
+	    fprintf(stderr, "pthread_create: %s, after %d threads\n", strerror(error), i);
+	    exit(1);
+	}
+    }
+    pthread_attr_destroy(&attr);
+    pthread_barrier_wait(&tickBarrier);
+    for (tick = 0; tick < tickCount; tick++)
+	pthread_barrier_wait(&tickBarrier);
+    for (i = 0; i < count; i++)
+	pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&tickBarrier);
+    free(threads);
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./simbench [-m soa|entities|threads] [-n entities] [-t threads] [-k ticks] [-r seed]\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, count = DEFAULT_ENTITIES, threads = 1, i;
+    char *mode = "soa";
+    unsigned seed = 1;
+    struct simPool *pool = NULL;
+    struct simEntities entities;
+    double start, elapsed;
+    long tick;
+
+    tickCount = DEFAULT_TICKS;
+    while ((opt = getopt(argc, argv, "m:n:t:k:r:")) != -1) {
+	switch (opt) {
+	case 'm':
+	    mode = optarg;
+	    break;
+	case 'n':
+	    count = atoi(optarg);
+	    break;
+	case 't':
+	    threads = atoi(optarg);
+	    break;
+	case 'k':
+	    tickCount = atol(optarg);
+	    break;
+	case 'r':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc || count <= 0 || threads <= 0 || tickCount <= 0
+	|| (strcmp(mode, "soa") != 0 && strcmp(mode, "entities") != 0
+	    && strcmp(mode, "threads") != 0)) {
+	usage();
+	return 1;
+    }
+
+    initWorld(count, seed);
+    if (strcmp(mode, "threads") == 0) {
+	threads = count;
+	start = monotonicMs();
+	runThreads(count);
+	elapsed = monotonicMs() - start;
+    } else {
+	pool = simStart(threads);
+	if (pool == NULL) {
+	    fprintf(stderr, "Cannot start %d worker threads\n", threads);
+	    return 1;
+	}
+	simEntitiesInit(&entities);
+	if (strcmp(mode, "entities") == 0)
+	    for (i = 0; i < count; i++)
+		if (simEntityCreate(&entities, walk, (void *) (intptr_t) i) < 0) {
+		    fprintf(stderr, "Cannot create entity %d\n", i);
+		    return 1;
+		}
+	start = monotonicMs();
+	for (tick = 0; tick < tickCount; tick++) {
+	    if (entities.count > 0)
+		simEntitiesTick(pool, &entities);
+	    else
+		simParallel(pool, 0, count, proposeRange, NULL);
+	    endTick(pool);
+	}
+	elapsed = monotonicMs() - start;
+	simEntitiesFree(&entities);
+	simStop(pool);
+    }
+
+    printf("%-8s %7d entities, %5d threads, %ld ticks: %8.2f M entity-ticks/s, checksum %016lx\n",
+	   mode, count, threads, tickCount, count * (double) tickCount / elapsed / 1e3, checksum());
+    return 0;
+}
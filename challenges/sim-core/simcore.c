@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "simcore.h"
+
+struct simWorker {
+    struct simPool *pool;
+    int index;
+    pthread_t thread;
+};
+
+struct simPool {
+    int threads;
+    struct simWorker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    long generation;                /* bumped for every simParallel call */
+    int pending;                    /* helpers still busy with it */
+    int stopping;
+    simRangeFunc func;
+    void *arg;
+    int first, last;
+};
+
+/* Worker w always gets the same slice of a range. */
+static void runSlice(struct simPool *pool, int w) {
+    long count = pool->last - pool->first;
+    int first = pool->first + count * w / pool->threads;
+    int last = pool->first + count * (w + 1) / pool->threads;
+
+    if (first < last)
+	pool->func(pool->arg, first, last, w);
+}
+
+static void *runWorker(void *arg) {
+    struct simWorker *worker = arg;
+    struct simPool *pool = worker->pool;
+    long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+	while (pool->generation == seen && !pool->stopping)
+	    pthread_cond_wait(&pool->work, &pool->lock);
+	if (pool->stopping)
+	    break;
+	seen = pool->generation;
+	pthread_mutex_unlock(&pool->lock);
+	runSlice(pool, worker->index);
+	pthread_mutex_lock(&pool->lock);
+	if (--pool->pending == 0)
+	    pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Starts threads - 1 helpers; the calling thread is worker 0. */
+struct simPool *simStart(int threads) {
+    struct simPool *pool = calloc(1, sizeof(struct simPool));
+    int i;
+
+    if (pool == NULL || threads < 1)
+	return NULL;
+    pool->threads = threads;
+    pool->workers = calloc(threads, sizeof(struct simWorker));
+    if (pool->workers == NULL) {
+	free(pool);
+	return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 1; i < threads; i++) {
+	pool->workers[i].pool = pool;
+	pool->workers[i].index = i;
+	if (pthread_create(&pool->workers[i].thread, NULL, runWorker, &pool->workers[i]) != 0) {
+	    perror("pthread_create");
+	    pool->threads = i;
+	    simStop(pool);
+	    return NULL;
+	}
+    }
+    return pool;
+}
+
+int simThreads(const struct simPool *pool) {
+    return pool->threads;
+}
+
+/* Runs func over [first, last) on all workers and waits for them. */
+void simParallel(struct simPool *pool, int first, int last, simRangeFunc func, void *arg) {
+    pool->func = func;
+    pool->arg = arg;
+    pool->first = first;
+    pool->last = last;
+    if (pool->threads > 1) {
+	pthread_mutex_lock(&pool->lock);
+	pool->pending = pool->threads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+    }
+    runSlice(pool, 0);
+    if (pool->threads > 1) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+	    pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void simStop(struct simPool *pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->threads; i++)
+	pthread_join(pool->workers[i].thread, NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+/*
+ * Entities switch with the worker that resumed them. Slices are fixed
+ * per worker, so an entity always runs on the same thread and its
+ * thread-local state stays valid.
+ */
+static __thread ucontext_t workerContext;
+static __thread struct simEntity *currentEntity;
+
+void simEntitiesInit(struct simEntities *set) {
+    set->entities = NULL;
+    set->count = set->capacity = 0;
+}
+
+static void runEntity() {
+    struct simEntity *entity = currentEntity;
+
+    entity->result = entity->start(entity->arg);
+    entity->finished = 1;
+    setcontext(&workerContext);
+}
+
+/* Like pthread_create, but the entity only runs inside simEntitiesTick. */
+int simEntityCreate(struct simEntities *set, void *(*start)(void *), void *arg) {
+    struct simEntity *entity;
+
+    if (set->count == set->capacity) {
+	int capacity = set->capacity > 0 ? 2 * set->capacity : 64;
+	struct simEntity **entities = realloc(set->entities, capacity * sizeof(struct simEntity *));
+	if (entities == NULL)
+	    return -1;
+	set->entities = entities;
+	set->capacity = capacity;
+    }
+    /* a context points into itself, so entities are never moved */
+    entity = malloc(sizeof(struct simEntity));
+    if (entity == NULL)
+	return -1;
+    entity->start = start;
+    entity->arg = arg;
+    entity->result = NULL;
+    entity->finished = 0;
+    entity->stack = malloc(SIM_ENTITY_STACK);
+    if (entity->stack == NULL || getcontext(&entity->context) < 0) {
+	free(entity->stack);
+	free(entity);
+	return -1;
+    }
+    entity->context.uc_stack.ss_sp = entity->stack;
+    entity->context.uc_stack.ss_size = SIM_ENTITY_STACK;
+    entity->context.uc_link = NULL;
+    makecontext(&entity->context, runEntity, 0);
+    set->entities[set->count++] = entity;
+    return 0;
+}
+
+/* Ends the calling entity's turn; it continues from here next tick. */
+void simYield(void) {
+    struct simEntity *entity = currentEntity;
+    swapcontext(&entity->context, &workerContext);
+}
+
+static void resumeEntities(void *arg, int first, int last, int worker) {
+    struct simEntities *set = arg;
+    int i;
+
+    (void) worker;
+    for (i = first; i < last; i++) {
+	if (set->entities[i]->finished)
+	    continue;
+	currentEntity = set->entities[i];
+	swapcontext(&workerContext, &currentEntity->context);
+    }
+}
+
+/*
+ * Resumes every live entity once, in parallel on the pool. Returns the
+ * number still running.
+ */
+int simEntitiesTick(struct simPool *pool, struct simEntities *set) {
+    int i, alive = 0;
+
+    simParallel(pool, 0, set->count, resumeEntities, set);
+    for (i = 0; i < set->count; i++)
+	alive += !set->entities[i]->finished;
+    return alive;
+}
+
+/* Entities still running are dropped with their stacks. */
+void simEntitiesFree(struct simEntities *set) {
+    int i;
+
+    for (i = 0; i < set->count; i++) {
+	free(set->entities[i]->stack);
+	free(set->entities[i]);
+    }
+    free(set->entities);
+    simEntitiesInit(set);
+}
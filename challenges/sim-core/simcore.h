@@ -0,0 +1,50 @@
+// Tick-based simulation core shared by the challenges
+//
+// A fixed pool of worker threads advances all entities one tick at a
+// time instead of running one OS thread per entity. simParallel splits a
+// range of entities into one contiguous slice per worker, always the
+// same slice for the same worker. Entities are kept in structure-of-
+// arrays form by the caller. A tick reads the current state and writes
+// the next one, and the buffers swap between ticks. Conflicts are then
+// settled by entity id, so results do not depend on the thread count.
+//
+// Code written as one thread per entity can keep that shape: an entity
+// created with simEntityCreate runs its function on its own small stack.
+// Calling simYield ends its turn for the tick. simEntitiesTick resumes
+// every entity once per tick on the pool.
+
+#include <ucontext.h>
+
+#define SIM_ENTITY_STACK (32 * 1024)
+
+struct simPool;
+
+/* Handles entities [first, last) on the given worker, 0 being the caller. */
+typedef void (*simRangeFunc)(void *arg, int first, int last, int worker);
+
+struct simPool *simStart(int threads);
+int simThreads(const struct simPool *pool);
+void simParallel(struct simPool *pool, int first, int last, simRangeFunc func, void *arg);
+void simStop(struct simPool *pool);
+
+/* Entity-as-thread compatibility layer */
+
+struct simEntity {
+    ucontext_t context;
+    void *(*start)(void *);
+    void *arg;
+    void *result;
+    int finished;
+    char *stack;
+};
+
+struct simEntities {
+    struct simEntity **entities;
+    int count, capacity;
+};
+
+void simEntitiesInit(struct simEntities *set);
+int simEntityCreate(struct simEntities *set, void *(*start)(void *), void *arg);
+void simYield(void);
+int simEntitiesTick(struct simPool *pool, struct simEntities *set);
+void simEntitiesFree(struct simEntities *set);
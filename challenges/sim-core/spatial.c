@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include "spatial.h"
+
+int spatialInit(struct spatialGrid *grid, float width, float height, float cellSize, int capacity,
+		int workers) {
+    int buckets;
+
+    memset(grid, 0, sizeof(*grid));
+    if (cellSize <= 0 || width <= 0 || height <= 0 || capacity < 0 || workers < 1)
+	return -1;
+    grid->cellSize = cellSize;
+    grid->columns = (int) (width / cellSize) + 1;
+    grid->rows = (int) (height / cellSize) + 1;
+    grid->workers = workers;
+    grid->capacity = capacity;
+    buckets = grid->columns * grid->rows;
+    grid->start = calloc(buckets + 1, sizeof(int));
+    grid->entries = calloc(capacity + 1, sizeof(int));
+    grid->bucket = calloc(capacity + 1, sizeof(int));
+    grid->counts = calloc((size_t) buckets * workers, sizeof(int));
+    if (grid->start == NULL || grid->entries == NULL || grid->bucket == NULL || grid->counts == NULL) {
+	spatialFree(grid);
+	return -1;
+    }
+    return 0;
+}
+
+void spatialFree(struct spatialGrid *grid) {
+    free(grid->start);
+    free(grid->entries);
+    free(grid->bucket);
+    free(grid->counts);
+    grid->start = grid->entries = grid->bucket = grid->counts = NULL;
+}
+
+static int column(const struct spatialGrid *grid, float x) {
+    int c = (int) (x / grid->cellSize);
+    return c < 0 ? 0 : c >= grid->columns ? grid->columns - 1 : c;
+}
+
+static int row(const struct spatialGrid *grid, float y) {
+    int r = (int) (y / grid->cellSize);
+    return r < 0 ? 0 : r >= grid->rows ? grid->rows - 1 : r;
+}
+
+/* Clears every worker's count of a range of buckets. */
+static void clearRange(void *arg, int first, int last, int worker) {
+    struct spatialGrid *grid = arg;
+    int buckets = grid->columns * grid->rows, w;
+
+    (void) worker;
+    for (w = 0; w < grid->workers; w++)
+	memset(&grid->counts[(size_t) w * buckets + first], 0, (last - first) * sizeof(int));
+}
+
+static void countRange(void *arg, int first, int last, int worker) {
+    struct spatialGrid *grid = arg;
+    int *counts = &grid->counts[(size_t) worker * grid->columns * grid->rows], i, b;
+
+    for (i = first; i < last; i++) {
+	b = row(grid, grid->y[i]) * grid->columns + column(grid, grid->x[i]);
+	grid->bucket[i] = b;
+	counts[b]++;
+    }
+}
+
+/* Total of each bucket over the workers, into start[] before the scan. */
+static void totalRange(void *arg, int first, int last, int worker) {
+    struct spatialGrid *grid = arg;
+    int buckets = grid->columns * grid->rows, b, w, total;
+
+    (void) worker;
+    for (b = first; b < last; b++) {
+	for (w = 0, total = 0; w < grid->workers; w++)
+	    total += grid->counts[(size_t) w * buckets + b];
+	grid->start[b] = total;
+    }
+}
+
+/* Turns each worker's count into where it writes in the bucket. */
+static void offsetRange(void *arg, int first, int last, int worker) {
+    struct spatialGrid *grid = arg;
+    int buckets = grid->columns * grid->rows, b, w, next, count;
+
+    (void) worker;
+    for (b = first; b < last; b++) {
+	for (w = 0, next = grid->start[b]; w < grid->workers; w++) {
+	    count = grid->counts[(size_t) w * buckets + b];
+	    grid->counts[(size_t) w * buckets + b] = next;
+	    next += count;
+	}
+    }
+}
+
+/* Same slices as countRange, so each worker fills what it counted. */
+static void scatterRange(void *arg, int first, int last, int worker) {
+    struct spatialGrid *grid = arg;
+    int *offsets = &grid->counts[(size_t) worker * grid->columns * grid->rows], i;
+
+    for (i = first; i < last; i++)
+	grid->entries[offsets[grid->bucket[i]]++] = i;
+}
+
+/* Makes room for count entities, keeping the old buffers if it cannot. */
+static int growGrid(struct spatialGrid *grid, int count) {
+    int *entries, *bucket;
+
+    entries = realloc(grid->entries, (count + 1) * sizeof(int));
+    if (entries == NULL)
+	return -1;
+    grid->entries = entries;
+    bucket = realloc(grid->bucket, (count + 1) * sizeof(int));
+    if (bucket == NULL)
+	return -1;
+    grid->bucket = bucket;
+    grid->capacity = count;
+    return 0;
+}
+
+/*
+ * Sorts entities [0, count) by bucket. Positions must stay valid for
+ * queries. Returns -1 if the grid had to grow and could not, and then
+ * only the first capacity entities are indexed.
+ */
+int spatialBuild(struct spatialGrid *grid, struct simPool *pool, const float *x, const float *y,
+		 int count) {
+    int buckets = grid->columns * grid->rows, b, sum, total, status = 0;
+
+    if (count > grid->capacity && growGrid(grid, count) < 0)
+	status = -1;
+    grid->x = x;
+    grid->y = y;
+    grid->count = count < grid->capacity ? count : grid->capacity;
+    simParallel(pool, 0, buckets, clearRange, grid);
+    simParallel(pool, 0, grid->count, countRange, grid);
+    simParallel(pool, 0, buckets, totalRange, grid);
+    for (b = 0, sum = 0; b < buckets; b++) {
+	total = grid->start[b];
+	grid->start[b] = sum;
+	sum += total;
+    }
+    grid->start[buckets] = sum;
+    simParallel(pool, 0, buckets, offsetRange, grid);
+    simParallel(pool, 0, grid->count, scatterRange, grid);
+    return status;
+}
+
+/*
+ * Writes up to max ids from the buckets within radius of (x, y) and
+ * returns how many there are. Callers check the actual distance.
+ */
+int spatialQuery(const struct spatialGrid *grid, float x, float y, float radius, int *ids, int max) {
+    int c, r, i, found = 0;
+    int c0 = column(grid, x - radius), c1 = column(grid, x + radius);
+    int r0 = row(grid, y - radius), r1 = row(grid, y + radius);
+
+    for (r = r0; r <= r1; r++)
+	for (c = c0; c <= c1; c++)
+	    for (i = grid->start[r * grid->columns + c]; i < grid->start[r * grid->columns + c + 1]; i++) {
+		if (found < max)
+		    ids[found] = grid->entries[i];
+		found++;
+	    }
+    return found;
+}
+
+/*
+ * spatialQuery into a buffer that grows until every candidate fits.
+ * *ids starts out NULL or malloc'd with *capacity entries, and the
+ * caller frees it. Returns the count, or -1 if the buffer cannot grow.
+ */
+int spatialQueryAll(const struct spatialGrid *grid, float x, float y, float radius, int **ids,
+		    int *capacity) {
+    int found = spatialQuery(grid, x, y, radius, *ids, *capacity), *grown;
+
+    if (found <= *capacity)
+	return found;
+    grown = realloc(*ids, (found > 2 * *capacity ? found : 2 * *capacity) * sizeof(int));
+    if (grown == NULL)
+	return -1;
+    *ids = grown;
+    *capacity = found > 2 * *capacity ? found : 2 * *capacity;
+    return spatialQuery(grid, x, y, radius, *ids, *capacity);
+}
@@ -0,0 +1,41 @@
+// Uniform grid spatial hash, rebuilt every frame
+//
+// The world is cut into square buckets of a fixed size, and entities
+// are sorted by bucket with a counting sort on the simulation pool: each
+// worker counts its slice of entities per bucket, the counts become
+// offsets, and each worker scatters its slice into its own part of every
+// bucket. Entities keep their id order inside a bucket, so the result
+// does not depend on the number of workers.
+//
+// A query looks only at the buckets a circle touches. With buckets about
+// the size of the largest collision radius, that is at most four.
+//
+// Nothing is dropped silently. spatialBuild grows the grid past the
+// capacity given to spatialInit when more entities show up, and returns
+// -1 only if that allocation fails, in which case just the first
+// capacity entities are indexed. spatialQuery reports every candidate in
+// its count even past max, and spatialQueryAll grows the caller's buffer
+// until they all fit, however dense the crowd.
+
+#include "simcore.h"
+
+struct spatialGrid {
+    float cellSize;
+    int columns, rows;
+    int workers, capacity;
+    int *start;                     /* first entry of each bucket, buckets + 1 */
+    int *entries;                   /* entity ids, sorted by bucket */
+    int *bucket;                    /* bucket of each entity */
+    int *counts;                    /* per worker and bucket, then scatter offsets */
+    const float *x, *y;             /* positions of the last build */
+    int count;
+};
+
+int spatialInit(struct spatialGrid *grid, float width, float height, float cellSize, int capacity,
+		int workers);
+void spatialFree(struct spatialGrid *grid);
+int spatialBuild(struct spatialGrid *grid, struct simPool *pool, const float *x, const float *y,
+		 int count);
+int spatialQuery(const struct spatialGrid *grid, float x, float y, float radius, int *ids, int max);
+int spatialQueryAll(const struct spatialGrid *grid, float x, float y, float radius, int **ids,
+		    int *capacity);
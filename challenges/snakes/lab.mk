@@ -0,0 +1,32 @@
+# snakes build & test automation
+
+APP_NAME=snakes
+CORE_DIR=../sim-core
+CORE_NAME=simcore
+
+build:
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/${CORE_NAME}.c -o ${CORE_NAME}.o
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/spatial.c -o spatial.o
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/frames.c -o frames.o
+	gcc -I${CORE_DIR} -c ${CORE_DIR}/render.c -o render.o
+	gcc -I${CORE_DIR} -c ${APP_NAME}.c -o ${APP_NAME}.o
+	gcc ${CORE_NAME}.o spatial.o frames.o render.o ${APP_NAME}.o -o ${APP_NAME} -lpthread -lm
+test: build
+	@echo Test 1 - autoplay
+	./${APP_NAME} -a -n 6 -f 30 -T 3 -r 1
+	@echo Test 2 - diffed and full redraws show the same screens
+	./${APP_NAME} -a -n 6 -f 30 -T 3 -r 1 -F 0 -o capture.txt
+	./${APP_NAME} -a -n 6 -f 30 -T 3 -r 1 -F 0 -R -o capture_full.txt
+	cmp capture.txt capture_full.txt
+	@echo Test 3 - headless stress at 60 Hz
+	./${APP_NAME} -b -n 10000 -T 2 -r 1
+	@echo Test 4 - failed
+	-./${APP_NAME} -n -1
+bench:
+	gcc -O2 -I${CORE_DIR} ${CORE_DIR}/${CORE_NAME}.c ${CORE_DIR}/spatial.c ${CORE_DIR}/frames.c ${CORE_DIR}/render.c ${APP_NAME}.c -o ${APP_NAME}_bench.o -lpthread -lm
+	@echo Benchmark - spatial hash collisions at a 60 Hz tick
+	./${APP_NAME}_bench.o -b -n 10000 -t 4 -r 1
+	./${APP_NAME}_bench.o -b -n 30000 -t 4 -r 1
+	./${APP_NAME}_bench.o -b -n 100000 -t 4 -r 1
+clean:
+	rm -rf *.o ${APP_NAME} capture.txt capture_full.txt
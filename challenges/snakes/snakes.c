@@ -0,0 +1,597 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <stdatomic.h>
+#include "spatial.h"
+#include "frames.h"
+#include "render.h"
+
+#define DEFAULT_ENEMIES 6
+#define DEFAULT_FOOD 30
+#define DEFAULT_WIDTH 60
+#define DEFAULT_HEIGHT 22
+#define DEFAULT_SECONDS 120         /* game length, or simulated seconds with -b */
+#define BENCH_SECONDS 10
+#define PLAY_HZ 8
+#define DEFAULT_FPS 30             /* frame cap, apart from the tick */
+#define STATUS_WIDTH 72
+#define BENCH_HZ 60
+#define MAX_LENGTH 32
+#define START_LENGTH 4
+#define TURN_CHANCE 6               /* one in this many steps turns */
+#define MAX_HITS 10
+#define BUCKET_SIZE 4.0f
+#define HIT_RADIUS 0.4f
+#define PLAYER 0
+
+enum tile {EMPTY, WALL};
+enum phase {PHASE_SNAKES, PHASE_HASH, PHASE_COLLIDE, PHASE_RENDER, PHASES};
+
+static const char *phaseNames[PHASES] = {"snakes", "hash build", "collisions", "render"};
+static const int dx[4] = {0, 1, 0, -1}, dy[4] = {-1, 0, 1, 0};
+
+/* The layout every snake shares; snake 0 is the player */
+struct game {
+    int width, height;
+    unsigned char *tiles;
+    atomic_uchar *food;
+    atomic_int foodLeft;
+    int snakes;
+    int *body;                      /* MAX_LENGTH cells per snake, a ring */
+    int *head, *length, *growing, *direction;
+    unsigned *seed;
+    unsigned char *bumped;          /* hit something last frame, turns */
+    int segments;
+    int *offset;                    /* first segment of each snake, snakes + 1 */
+    float *sx, *sy;                 /* segment centers, head first */
+    int *owner;
+    int *hitBy;                     /* lowest snake whose segment the head is on, or -1 */
+    int hits, score, crashed;
+    atomic_long candidates;
+    struct spatialGrid grid;
+};
+
+static struct game game;
+static struct termios savedTerminal;
+static int rawTerminal;
+static double maxFps = DEFAULT_FPS;
+static FILE *capture;               /* headless: frames go here as text */
+static int fullRedraw;
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void sleepMs(double ms) {
+    struct timespec t = {(time_t) (ms / 1e3), (long) ((ms - (time_t) (ms / 1e3) * 1e3) * 1e6)};
+    nanosleep(&t, NULL);
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+static void restoreTerminal() {
+    if (rawTerminal)
+	tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+}
+
+/* Keys arrive one at a time without waiting for enter. */
+static void openKeyboard() {
+    struct termios raw;
+
+    if (tcgetattr(STDIN_FILENO, &savedTerminal) < 0)
+	return;
+    raw = savedTerminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0)
+	rawTerminal = 1;
+}
+
+static int readKey() {
+    unsigned char key;
+    return rawTerminal && read(STDIN_FILENO, &key, 1) == 1 ? key : -1;
+}
+
+/* The k-th cell of snake s, counting from its head. */
+static int cellOf(int s, int k) {
+    return game.body[s * MAX_LENGTH + (game.head[s] - k + MAX_LENGTH) % MAX_LENGTH];
+}
+
+static int step(int cell, int direction) {
+    return cell + dy[direction] * game.width + dx[direction];
+}
+
+static void moveSnake(int s, int next) {
+    game.head[s] = (game.head[s] + 1) % MAX_LENGTH;
+    game.body[s * MAX_LENGTH + game.head[s]] = next;
+    if (atomic_exchange_explicit(&game.food[next], 0, memory_order_relaxed)) {
+	atomic_fetch_sub_explicit(&game.foodLeft, 1, memory_order_relaxed);
+	game.growing[s]++;
+	if (s == PLAYER)
+	    game.score++;
+    }
+    if (game.growing[s] > 0 && game.length[s] < MAX_LENGTH) {
+	game.length[s]++;
+	game.growing[s]--;
+    }
+}
+
+/* An enemy's move: straight on, sometimes turning, never into a wall. */
+static void stepEnemy(int s) {
+    unsigned *seed = &game.seed[s];
+    int direction = game.direction[s], tries, next;
+
+    if (game.bumped[s] || rand_r(seed) % TURN_CHANCE == 0)
+	direction = (direction + (rand_r(seed) % 2 ? 1 : 3)) % 4;
+    for (tries = 0; tries < 4; tries++, direction = (direction + 1) % 4) {
+	next = step(cellOf(s, 0), direction);
+	if (direction != (game.direction[s] + 2) % 4 && game.tiles[next] != WALL)
+	    break;
+    }
+    if (tries == 4)
+	return;
+    game.direction[s] = direction;
+    moveSnake(s, next);
+}
+
+/* Enemy as its own thread of control, on the entity layer. */
+static void *enemyThread(void *arg) {
+    int s = (int) (intptr_t) arg;
+
+    for (;;) {
+	stepEnemy(s);
+	simYield();
+    }
+    return NULL;
+}
+
+/* Benchmark snakes, the first one included, all move on their own. */
+static void enemyRange(void *arg, int first, int last, int worker) {
+    int s;
+
+    (void) arg;
+    (void) worker;
+    for (s = first; s < last; s++)
+	stepEnemy(s);
+}
+
+/* Turns towards the nearest food, avoiding walls and reversing. */
+static void autopilot() {
+    int cell = cellOf(PLAYER, 0), best = -1, bestDistance = 0, c, d, distance, direction;
+    int x = cell % game.width, y = cell / game.width;
+
+    for (c = 0; c < game.width * game.height; c++)
+	if (atomic_load_explicit(&game.food[c], memory_order_relaxed)) {
+	    distance = abs(c % game.width - x) + abs(c / game.width - y);
+	    if (best < 0 || distance < bestDistance) {
+		best = c;
+		bestDistance = distance;
+	    }
+	}
+    if (best < 0)
+	return;
+    for (d = 0, direction = -1; d < 4; d++) {
+	c = step(cell, d);
+	if (d == (game.direction[PLAYER] + 2) % 4 || game.tiles[c] == WALL)
+	    continue;
+	distance = abs(c % game.width - best % game.width) + abs(c / game.width - best / game.width);
+	if (direction < 0 || distance < bestDistance) {
+	    direction = d;
+	    bestDistance = distance;
+	}
+    }
+    if (direction >= 0)
+	game.direction[PLAYER] = direction;
+}
+
+/* Returns 0 to quit. */
+static int handleKeys() {
+    static const char keys[] = "wdsa", arrows[] = "ACBD";
+    int key, d;
+
+    while ((key = readKey()) >= 0) {
+	if (key == 'q')
+	    return 0;
+	for (d = 0; d < 4; d++)
+	    if ((key == keys[d] || key == arrows[d]) && d != (game.direction[PLAYER] + 2) % 4)
+		game.direction[PLAYER] = d;
+    }
+    return 1;
+}
+
+static void movePlayer() {
+    int next = step(cellOf(PLAYER, 0), game.direction[PLAYER]);
+
+    if (game.tiles[next] == WALL)
+	game.crashed = 1;
+    else
+	moveSnake(PLAYER, next);
+}
+
+/* Every snake's segments, head first, into the arrays the hash sorts. */
+static void gatherRange(void *arg, int first, int last, int worker) {
+    int s, k, cell, i;
+
+    (void) arg;
+    (void) worker;
+    for (s = first; s < last; s++)
+	for (k = 0, i = game.offset[s]; k < game.length[s]; k++, i++) {
+	    cell = cellOf(s, k);
+	    game.sx[i] = cell % game.width + 0.5f;
+	    game.sy[i] = cell / game.width + 0.5f;
+	    game.owner[i] = s;
+	}
+}
+
+/* Each head looks for other segments on its cell in the nearby buckets. */
+static void collideRange(void *arg, int first, int last, int worker) {
+    int *ids = NULL, capacity = 0, s, k, found, i;
+    long candidates = 0;
+    float x, y;
+
+    (void) arg;
+    (void) worker;
+    for (s = first; s < last; s++) {
+	x = game.sx[game.offset[s]];
+	y = game.sy[game.offset[s]];
+	if ((found = spatialQueryAll(&game.grid, x, y, HIT_RADIUS, &ids, &capacity)) < 0) {
+	    perror("spatialQueryAll");
+	    exit(1);
+	}
+	candidates += found;
+	game.hitBy[s] = -1;
+	for (k = 0; k < found; k++) {
+	    i = ids[k];
+	    if (i != game.offset[s] && game.sx[i] == x && game.sy[i] == y
+		&& (game.hitBy[s] < 0 || game.owner[i] < game.hitBy[s]))
+		game.hitBy[s] = game.owner[i];
+	}
+    }
+    free(ids);
+    atomic_fetch_add_explicit(&game.candidates, candidates, memory_order_relaxed);
+}
+
+/* The player is hit by running into a snake or by a snake running into it. */
+static void applyHits() {
+    int s;
+
+    for (s = 0; s < game.snakes; s++) {
+	game.bumped[s] = game.hitBy[s] >= 0;
+	if (s == PLAYER ? game.hitBy[s] >= 0 : game.hitBy[s] == PLAYER)
+	    game.hits++;
+    }
+}
+
+/*
+ * One frame: enemies move, the segments are hashed, and every head is
+ * checked against them. Returns the frame time.
+ */
+static double frame(struct simPool *pool, struct simEntities *entities, double phaseMs[PHASES]) {
+    double start = monotonicMs(), t;
+    int s;
+
+    if (entities != NULL)
+	simEntitiesTick(pool, entities);
+    else
+	simParallel(pool, 0, game.snakes, enemyRange, NULL);
+    t = monotonicMs();
+    phaseMs[PHASE_SNAKES] += t - start;
+
+    for (s = 0, game.segments = 0; s < game.snakes; s++) {
+	game.offset[s] = game.segments;
+	game.segments += game.length[s];
+    }
+    game.offset[s] = game.segments;
+    simParallel(pool, 0, game.snakes, gatherRange, NULL);
+    if (spatialBuild(&game.grid, pool, game.sx, game.sy, game.segments) < 0) {
+	perror("spatialBuild");
+	exit(1);
+    }
+    phaseMs[PHASE_HASH] += monotonicMs() - t;
+    t = monotonicMs();
+
+    simParallel(pool, 0, game.snakes, collideRange, NULL);
+    applyHits();
+    phaseMs[PHASE_COLLIDE] += monotonicMs() - t;
+    return monotonicMs() - start;
+}
+
+/* Draws the board into the renderer, which sends only what changed. */
+static void render(struct renderer *view) {
+    char status[128];
+    int x, y, s, k, cell;
+
+    for (y = 0; y < game.height; y++)
+	for (x = 0; x < game.width; x++) {
+	    cell = y * game.width + x;
+	    renderPut(view, x, y, game.tiles[cell] == WALL ? '#'
+		      : atomic_load_explicit(&game.food[cell], memory_order_relaxed) ? '*' : ' ');
+	}
+    for (s = game.snakes - 1; s >= 0; s--)
+	for (k = game.length[s] - 1; k >= 0; k--) {
+	    cell = cellOf(s, k);
+	    renderPut(view, cell % game.width, cell / game.width, s == PLAYER ? (k ? 'o' : '@') : (k ? 'x' : 'X'));
+	}
+    snprintf(status, sizeof(status), "Score %d  Length %d  Hits %d/%d  Food %d  (wasd move, q quit)",
+	     game.score, game.length[PLAYER], game.hits, MAX_HITS, atomic_load(&game.foodLeft));
+    renderText(view, 0, game.height, status);
+    renderFrame(view);
+}
+
+/* Border walls and short bars spread over the layout. */
+static void initGame(int snakes, int food, int width, int height, unsigned seed, int workers) {
+    int x, y, s, cell, cells = width * height;
+
+    game.width = width;
+    game.height = height;
+    game.tiles = xcalloc(cells, 1);
+    game.food = xcalloc(cells, sizeof(atomic_uchar));
+    for (y = 0; y < height; y++)
+	for (x = 0; x < width; x++)
+	    if (x == 0 || y == 0 || x == width - 1 || y == height - 1
+		|| (y % 12 == 6 && x % 24 >= 6 && x % 24 < 18))
+		game.tiles[y * width + x] = WALL;
+    game.snakes = snakes;
+    game.body = xcalloc((size_t) snakes * MAX_LENGTH, sizeof(int));
+    game.head = xcalloc(snakes, sizeof(int));
+    game.length = xcalloc(snakes, sizeof(int));
+    game.growing = xcalloc(snakes, sizeof(int));
+    game.direction = xcalloc(snakes, sizeof(int));
+    game.seed = xcalloc(snakes, sizeof(unsigned));
+    game.bumped = xcalloc(snakes, 1);
+    game.offset = xcalloc(snakes + 1, sizeof(int));
+    game.sx = xcalloc((size_t) snakes * MAX_LENGTH, sizeof(float));
+    game.sy = xcalloc((size_t) snakes * MAX_LENGTH, sizeof(float));
+    game.owner = xcalloc((size_t) snakes * MAX_LENGTH, sizeof(int));
+    game.hitBy = xcalloc(snakes, sizeof(int));
+    for (s = 0; s < snakes; s++) {
+	do
+	    cell = rand_r(&seed) % cells;
+	while (game.tiles[cell] == WALL);
+	game.body[s * MAX_LENGTH] = cell;
+	game.length[s] = 1;
+	game.growing[s] = START_LENGTH - 1;
+	game.direction[s] = rand_r(&seed) % 4;
+	game.seed[s] = rand_r(&seed);
+    }
+    for (atomic_init(&game.foodLeft, 0); atomic_load(&game.foodLeft) < food;) {
+	cell = rand_r(&seed) % cells;
+	if (game.tiles[cell] != WALL && !atomic_load(&game.food[cell])) {
+	    atomic_store(&game.food[cell], 1);
+	    atomic_fetch_add(&game.foodLeft, 1);
+	}
+    }
+    if (spatialInit(&game.grid, width, height, BUCKET_SIZE, snakes * MAX_LENGTH, workers) < 0) {
+	perror("spatialInit");
+	exit(1);
+    }
+}
+
+static void freeGame() {
+    free(game.tiles);
+    free(game.food);
+    free(game.body);
+    free(game.head);
+    free(game.length);
+    free(game.growing);
+    free(game.direction);
+    free(game.seed);
+    free(game.bumped);
+    free(game.offset);
+    free(game.sx);
+    free(game.sy);
+    free(game.owner);
+    free(game.hitBy);
+    spatialFree(&game.grid);
+}
+
+static int longestEnemy() {
+    int s, longest = 0;
+
+    for (s = 1; s < game.snakes; s++)
+	if (game.length[s] > longest)
+	    longest = game.length[s];
+    return longest;
+}
+
+/* Every enemy is an entity on the pool; the main thread is the player. */
+static int play(int enemies, int food, int width, int height, double seconds, int autoplay,
+		struct simPool *pool, unsigned seed) {
+    struct simEntities entities;
+    struct frameStats stats;
+    double phaseMs[PHASES] = {0}, start, next, t, renderStart;
+    struct renderer view;
+    int s, frames, running = 1;
+
+    initGame(enemies + 1, food, width, height, seed, simThreads(pool));
+    simEntitiesInit(&entities);
+    for (s = 1; s <= enemies; s++)
+	if (simEntityCreate(&entities, enemyThread, (void *) (intptr_t) s) < 0) {
+	    perror("simEntityCreate");
+	    exit(1);
+	}
+    if (!autoplay && isatty(STDIN_FILENO))
+	openKeyboard();
+    if (renderInit(&view, width > STATUS_WIDTH ? width : STATUS_WIDTH, height + 1, capture != NULL ? -1 : STDOUT_FILENO, maxFps) < 0) {
+	perror("renderInit");
+	exit(1);
+    }
+    view.capture = capture;
+    view.fullRedraw = fullRedraw;
+    fflush(stdout);
+    framesInit(&stats, seconds * PLAY_HZ);
+
+    start = next = monotonicMs();
+    for (frames = 0; running && frames < seconds * PLAY_HZ; frames++) {
+	if (rawTerminal)
+	    running = handleKeys();
+	else
+	    autopilot();
+	t = monotonicMs();
+	movePlayer();
+	frame(pool, &entities, phaseMs);
+	renderStart = monotonicMs();
+	render(&view);
+	phaseMs[PHASE_RENDER] += monotonicMs() - renderStart;
+	framesAdd(&stats, monotonicMs() - t);
+	if (game.crashed || game.hits >= MAX_HITS || atomic_load(&game.foodLeft) == 0)
+	    break;
+	next += 1e3 / PLAY_HZ;
+	if (next > monotonicMs())
+	    sleepMs(next - monotonicMs());
+    }
+    restoreTerminal();
+    renderFree(&view);
+
+    if (game.crashed)
+	printf("Game over: the snake ran into a wall\n");
+    else if (game.hits >= MAX_HITS)
+	printf("Game over: the snake was hit %d times\n", game.hits);
+    else if (atomic_load(&game.foodLeft) > 0)
+	printf("Time is up\n");
+    else if (game.length[PLAYER] > longestEnemy())
+	printf("You win: all food eaten and yours is the longest snake\n");
+    else
+	printf("Game over: all food eaten, but an enemy snake is longer\n");
+    printf("Score: %d, length %d, longest enemy %d, %.1f s\n", game.score, game.length[PLAYER],
+	   longestEnemy(), (monotonicMs() - start) / 1e3);
+    framesReport(&stats, "frame", 1e3 / PLAY_HZ);
+    for (s = 0; s < PHASES; s++)
+	printf("  %s: %.3f ms/frame\n", phaseNames[s], phaseMs[s] / (frames > 0 ? frames : 1));
+    renderReport(&view);
+    framesFree(&stats);
+    simEntitiesFree(&entities);
+    freeGame();
+    return 0;
+}
+
+/*
+ * Headless stress test: count snakes on a layout sized for them, moved
+ * and checked at a fixed 60 Hz tick run as fast as it goes.
+ */
+static int bench(int snakes, double seconds, struct simPool *pool, unsigned seed) {
+    struct frameStats stats;
+    double phaseMs[PHASES] = {0}, start;
+    long segments = 0, hits = 0;
+    int s, i, frames = seconds * BENCH_HZ, side;
+
+    for (side = DEFAULT_WIDTH; (long) side * side < 16L * snakes; side *= 2)
+	;
+    initGame(snakes, 2 * snakes, side, side, seed, simThreads(pool));
+    framesInit(&stats, frames);
+    start = monotonicMs();
+    for (i = 0; i < frames; i++) {
+	framesAdd(&stats, frame(pool, NULL, phaseMs));
+	segments += game.segments;
+	for (s = 0; s < snakes; s++)
+	    hits += game.hitBy[s] >= 0;
+    }
+
+    printf("%d snakes, %dx%d layout, %d threads\n", snakes, side, side, simThreads(pool));
+    printf("  %d frames in %.1f ms, %.0f segments/frame, %.0f candidates/frame, %.1f hits/frame\n",
+	   frames, monotonicMs() - start, (double) segments / frames, (double) game.candidates / frames,
+	   (double) hits / frames);
+    framesReport(&stats, "frame", 1e3 / BENCH_HZ);
+    for (i = 0; i < PHASE_RENDER; i++)
+	printf("  %s: %.3f ms/frame\n", phaseNames[i], phaseMs[i] / frames);
+    printf("  food left %d, longest snake %d\n", atomic_load(&game.foodLeft), longestEnemy());
+    framesFree(&stats);
+    freeGame();
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./snakes [-n enemies] [-f food] [-m width height] [-T seconds]\n");
+    fprintf(stderr, "                [-t threads] [-r seed] [-a] [-F fps] [-o capture_file] [-R] [-b]\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, enemies = DEFAULT_ENEMIES, food = DEFAULT_FOOD, threads = 2, benchMode = 0, autoplay = 0;
+    int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT, status;
+    double seconds = 0;
+    unsigned seed = time(NULL);
+    struct simPool *pool;
+
+    while ((opt = getopt(argc, argv, "n:f:m:T:t:r:aF:o:Rb")) != -1) {
+	switch (opt) {
+	case 'n':
+	    enemies = atoi(optarg);
+	    break;
+	case 'f':
+	    food = atoi(optarg);
+	    break;
+	case 'm':
+	    if (optind >= argc) {
+		usage();
+		return 1;
+	    }
+	    width = atoi(optarg);
+	    height = atoi(argv[optind++]);
+	    break;
+	case 'T':
+	    seconds = atof(optarg);
+	    break;
+	case 't':
+	    threads = atoi(optarg);
+	    break;
+	case 'r':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	case 'a':
+	    autoplay = 1;
+	    break;
+	case 'F':
+	    maxFps = atof(optarg);
+	    break;
+	case 'o':
+	    capture = fopen(optarg, "w");
+	    if (capture == NULL) {
+		perror(optarg);
+		return 1;
+	    }
+	    break;
+	case 'R':
+	    fullRedraw = 1;
+	    break;
+	case 'b':
+	    benchMode = 1;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc || enemies < 0 || food <= 0 || width < 16 || height < 8 || seconds < 0
+	|| threads <= 0 || (!benchMode && food > width * height / 4)) {
+	usage();
+	return 1;
+    }
+    pool = simStart(threads);
+    if (pool == NULL) {
+	fprintf(stderr, "Cannot start %d worker threads\n", threads);
+	return 1;
+    }
+    if (benchMode)
+	status = bench(enemies + 1, seconds > 0 ? seconds : BENCH_SECONDS, pool, seed);
+    else
+	status = play(enemies, food, width, height, seconds > 0 ? seconds : DEFAULT_SECONDS, autoplay,
+		      pool, seed);
+    simStop(pool);
+    if (capture != NULL)
+	fclose(capture);
+    return status;
+}
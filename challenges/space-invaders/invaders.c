@@ -0,0 +1,591 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <stdatomic.h>
+#include "spatial.h"
+#include "frames.h"
+#include "render.h"
+
+#define DEFAULT_INVADERS 24
+#define DEFAULT_WIDTH 60
+#define DEFAULT_HEIGHT 22
+#define DEFAULT_SECONDS 60          /* game length, or simulated seconds with -b */
+#define BENCH_SECONDS 10
+#define PLAY_HZ 60
+#define DEFAULT_FPS 30             /* frame cap, apart from the tick */
+#define STATUS_WIDTH 72
+#define BENCH_HZ 60
+#define INVADER_SPEED 4.0f          /* cells per second */
+#define BULLET_SPEED 20.0f
+#define SHOOTER_SPEED 30.0f
+#define FIRE_PER_SECOND 0.05f       /* shots per invader */
+#define COOLDOWN_SECONDS 0.25f
+#define HIT_RADIUS 0.6f
+#define BUCKET_SIZE 2.0f
+#define SHOOTER_BUCKET_SIZE 8.0f     /* shooters are few and on one row */
+#define MAX_HITS 10
+#define BENCH_INVADERS_PER_SHOOTER 256
+#define BENCH_HEIGHT 60
+
+enum phase {PHASE_INVADERS, PHASE_HASH, PHASE_COLLIDE, PHASE_RENDER, PHASES};
+
+static const char *phaseNames[PHASES] = {"invaders", "hash build", "collisions", "render"};
+
+/* The layout every invader and shooter shares, in structure-of-arrays form */
+struct game {
+    int width, height;
+    float dt;
+    int invaders, aliveCount;
+    float *x, *y;
+    unsigned char *alive;
+    unsigned *seed;
+    int *aliveIds;                  /* live invaders gathered for the hash */
+    float *aliveX, *aliveY;
+    int bullets, capacity;
+    float *bx, *by, *bvy;           /* upwards bullets belong to the shooters */
+    int *target;                    /* invader hit, -2 - shooter, or -1 */
+    atomic_int spawned;             /* invader shots this frame */
+    float *spawnX, *spawnY;
+    int shooters;
+    float *shooterX, *shooterY, *shooterV, *cooldown;
+    int hits, score;
+    atomic_long candidates;         /* collision candidates looked at */
+    struct spatialGrid invaderGrid, shooterGrid;
+};
+
+static struct game game;
+static struct termios savedTerminal;
+static int rawTerminal;
+static double maxFps = DEFAULT_FPS;
+static FILE *capture;               /* headless: frames go here as text */
+static int fullRedraw;
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void sleepMs(double ms) {
+    struct timespec t = {(time_t) (ms / 1e3), (long) ((ms - (time_t) (ms / 1e3) * 1e3) * 1e6)};
+    nanosleep(&t, NULL);
+}
+
+static void *xcalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    return p;
+}
+
+static void restoreTerminal() {
+    if (rawTerminal)
+	tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+}
+
+/* Keys arrive one at a time without waiting for enter. */
+static void openKeyboard() {
+    struct termios raw;
+
+    if (tcgetattr(STDIN_FILENO, &savedTerminal) < 0)
+	return;
+    raw = savedTerminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0)
+	rawTerminal = 1;
+}
+
+static int readKey() {
+    unsigned char key;
+    return rawTerminal && read(STDIN_FILENO, &key, 1) == 1 ? key : -1;
+}
+
+static float clampf(float v, float low, float high) {
+    return v < low ? low : v > high ? high : v;
+}
+
+/* One invader's move for this frame: a random walk, and maybe a shot. */
+static void stepInvader(int i) {
+    unsigned *seed = &game.seed[i];
+    int k;
+
+    game.x[i] = clampf(game.x[i] + (rand_r(seed) % 3 - 1) * INVADER_SPEED * game.dt, 0,
+		       game.width - 1);
+    if (rand_r(seed) % 8 == 0)
+	game.y[i] = clampf(game.y[i] + (rand_r(seed) % 3 - 1) * INVADER_SPEED * game.dt, 1,
+			   game.height * 0.6f);
+    if (rand_r(seed) < FIRE_PER_SECOND * game.dt * RAND_MAX) {
+	k = atomic_fetch_add_explicit(&game.spawned, 1, memory_order_relaxed);
+	if (k < game.invaders) {
+	    game.spawnX[k] = game.x[i];
+	    game.spawnY[k] = game.y[i] + 1;
+	}
+    }
+}
+
+/* Invader as its own thread of control, on the entity layer. */
+static void *invaderThread(void *arg) {
+    int i = (int) (intptr_t) arg;
+
+    while (game.alive[i]) {
+	stepInvader(i);
+	simYield();
+    }
+    return NULL;
+}
+
+static void invaderRange(void *arg, int first, int last, int worker) {
+    int i;
+
+    (void) arg;
+    (void) worker;
+    for (i = first; i < last; i++)
+	if (game.alive[i])
+	    stepInvader(i);
+}
+
+static void addBullet(float x, float y, float vy) {
+    if (game.bullets == game.capacity)
+	return;
+    game.bx[game.bullets] = x;
+    game.by[game.bullets] = y;
+    game.bvy[game.bullets] = vy;
+    game.bullets++;
+}
+
+static void fire(int s) {
+    if (game.cooldown[s] > 0)
+	return;
+    addBullet(game.shooterX[s], game.shooterY[s] - 1, -BULLET_SPEED);
+    game.cooldown[s] = COOLDOWN_SECONDS;
+}
+
+/* Heads for the lowest invader and fires once under it. */
+static void autopilot(int s) {
+    int i, best = -1;
+    float dx;
+
+    for (i = 0; i < game.aliveCount; i++)
+	if (best < 0 || fabsf(game.aliveX[i] - game.shooterX[s]) < fabsf(game.aliveX[best] - game.shooterX[s]))
+	    best = i;
+    if (best < 0)
+	return;
+    dx = game.aliveX[best] - game.shooterX[s];
+    game.shooterX[s] += clampf(dx, -SHOOTER_SPEED * game.dt, SHOOTER_SPEED * game.dt);
+    if (fabsf(dx) < 1)
+	fire(s);
+}
+
+/* Benchmark shooters sweep the bottom row and fire whenever they can. */
+static void patrol(int s) {
+    game.shooterX[s] += game.shooterV[s] * game.dt;
+    if (game.shooterX[s] <= 0 || game.shooterX[s] >= game.width - 1)
+	game.shooterV[s] = -game.shooterV[s];
+    fire(s);
+}
+
+/* Returns 0 to quit. */
+static int handleKeys() {
+    int key;
+
+    while ((key = readKey()) >= 0) {
+	if (key == 'q')
+	    return 0;
+	if (key == 'a' || key == 'D')
+	    game.shooterX[0] -= 1;
+	else if (key == 'd' || key == 'C')
+	    game.shooterX[0] += 1;
+	else if (key == ' ')
+	    fire(0);
+    }
+    return 1;
+}
+
+/* Invader shots join the bullets; live invaders are gathered. */
+static void collectFrame() {
+    int i, s, spawned = atomic_exchange(&game.spawned, 0);
+
+    for (i = 0; i < spawned && i < game.invaders; i++)
+	addBullet(game.spawnX[i], game.spawnY[i], BULLET_SPEED);
+    for (s = 0; s < game.shooters; s++)
+	game.cooldown[s] -= game.dt;
+    for (i = 0, game.aliveCount = 0; i < game.invaders; i++)
+	if (game.alive[i]) {
+	    game.aliveIds[game.aliveCount] = i;
+	    game.aliveX[game.aliveCount] = game.x[i];
+	    game.aliveY[game.aliveCount] = game.y[i];
+	    game.aliveCount++;
+	}
+}
+
+/*
+ * Moves each bullet and finds what it hits from the nearby buckets: the
+ * lowest invader id for shooter bullets, the lowest shooter otherwise.
+ */
+static void collideRange(void *arg, int first, int last, int worker) {
+    int *ids = NULL, capacity = 0, b, k, found, hit;
+    long candidates = 0;
+    const float *tx, *ty;
+
+    (void) arg;
+    (void) worker;
+    for (b = first; b < last; b++) {
+	game.by[b] += game.bvy[b] * game.dt;
+	game.target[b] = -1;
+	if (game.bvy[b] < 0) {
+	    found = spatialQueryAll(&game.invaderGrid, game.bx[b], game.by[b], HIT_RADIUS, &ids, &capacity);
+	    tx = game.aliveX;
+	    ty = game.aliveY;
+	} else {
+	    found = spatialQueryAll(&game.shooterGrid, game.bx[b], game.by[b], HIT_RADIUS, &ids, &capacity);
+	    tx = game.shooterX;
+	    ty = game.shooterY;
+	}
+	if (found < 0) {
+	    perror("spatialQueryAll");
+	    exit(1);
+	}
+	candidates += found;
+	for (k = 0, hit = -1; k < found; k++)
+	    if (fabsf(tx[ids[k]] - game.bx[b]) < HIT_RADIUS && fabsf(ty[ids[k]] - game.by[b]) < HIT_RADIUS
+		&& (hit < 0 || ids[k] < hit))
+		hit = ids[k];
+	if (hit >= 0)
+	    game.target[b] = game.bvy[b] < 0 ? game.aliveIds[hit] : -2 - hit;
+    }
+    free(ids);
+    atomic_fetch_add_explicit(&game.candidates, candidates, memory_order_relaxed);
+}
+
+/* Hits in bullet order, so two bullets cannot kill one invader. */
+static void applyHits() {
+    int b, kept = 0, target;
+
+    for (b = 0; b < game.bullets; b++) {
+	target = game.target[b];
+	if (target >= 0 && game.alive[target]) {
+	    game.alive[target] = 0;
+	    game.score++;
+	    continue;
+	}
+	if (target <= -2) {
+	    game.hits++;
+	    continue;
+	}
+	if (game.by[b] < 0 || game.by[b] >= game.height)
+	    continue;
+	game.bx[kept] = game.bx[b];
+	game.by[kept] = game.by[b];
+	game.bvy[kept] = game.bvy[b];
+	kept++;
+    }
+    game.bullets = kept;
+}
+
+/* Draws the board into the renderer, which sends only what changed. */
+static void render(struct renderer *view) {
+    char status[128];
+    int i;
+
+    renderClear(view);
+    for (i = 0; i < game.bullets; i++)
+	renderPut(view, game.bx[i], game.by[i], game.bvy[i] < 0 ? '|' : '!');
+    for (i = 0; i < game.aliveCount; i++)
+	renderPut(view, game.aliveX[i], game.aliveY[i], 'W');
+    for (i = 0; i < game.shooters; i++)
+	renderPut(view, game.shooterX[i], game.shooterY[i], 'A');
+    snprintf(status, sizeof(status), "Score %d  Hits %d/%d  Invaders %d  (a/d move, space fire, q quit)",
+	     game.score, game.hits, MAX_HITS, game.aliveCount);
+    renderText(view, 0, game.height, status);
+    renderFrame(view);
+}
+
+static void initGame(int invaders, int shooters, int width, int height, int hz, unsigned seed,
+		     int workers) {
+    int i, columns;
+
+    game.width = width;
+    game.height = height;
+    game.dt = 1.0f / hz;
+    game.invaders = invaders;
+    game.x = xcalloc(invaders, sizeof(float));
+    game.y = xcalloc(invaders, sizeof(float));
+    game.alive = xcalloc(invaders, 1);
+    game.seed = xcalloc(invaders, sizeof(unsigned));
+    game.aliveIds = xcalloc(invaders, sizeof(int));
+    game.aliveX = xcalloc(invaders, sizeof(float));
+    game.aliveY = xcalloc(invaders, sizeof(float));
+    game.capacity = 2 * invaders + 64 * shooters;
+    game.bx = xcalloc(game.capacity, sizeof(float));
+    game.by = xcalloc(game.capacity, sizeof(float));
+    game.bvy = xcalloc(game.capacity, sizeof(float));
+    game.target = xcalloc(game.capacity, sizeof(int));
+    game.spawnX = xcalloc(invaders, sizeof(float));
+    game.spawnY = xcalloc(invaders, sizeof(float));
+    game.shooters = shooters;
+    game.shooterX = xcalloc(shooters, sizeof(float));
+    game.shooterY = xcalloc(shooters, sizeof(float));
+    game.shooterV = xcalloc(shooters, sizeof(float));
+    game.cooldown = xcalloc(shooters, sizeof(float));
+
+    /* a formation on the upper part of the layout */
+    columns = width / 3 > 0 ? width / 3 : 1;
+    for (i = 0; i < invaders; i++) {
+	game.x[i] = 1 + (i % columns) * 3 % (width - 1);
+	game.y[i] = clampf(1 + i / columns * 2 % (int) (height * 0.6f), 1, height * 0.6f);
+	game.alive[i] = 1;
+	game.seed[i] = rand_r(&seed);
+    }
+    for (i = 0; i < shooters; i++) {
+	game.shooterX[i] = (i + 0.5f) * width / shooters;
+	game.shooterY[i] = height - 1;
+	game.shooterV[i] = i % 2 ? SHOOTER_SPEED : -SHOOTER_SPEED;
+    }
+    if (spatialInit(&game.invaderGrid, width, height, BUCKET_SIZE, invaders, workers) < 0
+	|| spatialInit(&game.shooterGrid, width, height, SHOOTER_BUCKET_SIZE, shooters, workers) < 0) {
+	perror("spatialInit");
+	exit(1);
+    }
+}
+
+static void freeGame() {
+    free(game.x);
+    free(game.y);
+    free(game.alive);
+    free(game.seed);
+    free(game.aliveIds);
+    free(game.aliveX);
+    free(game.aliveY);
+    free(game.bx);
+    free(game.by);
+    free(game.bvy);
+    free(game.target);
+    free(game.spawnX);
+    free(game.spawnY);
+    free(game.shooterX);
+    free(game.shooterY);
+    free(game.shooterV);
+    free(game.cooldown);
+    spatialFree(&game.invaderGrid);
+    spatialFree(&game.shooterGrid);
+}
+
+/*
+ * One frame: invaders move, bullets move and are checked against the
+ * spatial hashes, and hits are applied. Returns the frame time.
+ */
+static double frame(struct simPool *pool, struct simEntities *entities, double phaseMs[PHASES]) {
+    double start = monotonicMs(), t;
+    int s;
+
+    if (entities != NULL)
+	simEntitiesTick(pool, entities);
+    else
+	simParallel(pool, 0, game.invaders, invaderRange, NULL);
+    t = monotonicMs();
+    phaseMs[PHASE_INVADERS] += t - start;
+
+    collectFrame();
+    for (s = entities != NULL; s < game.shooters; s++)
+	patrol(s);
+    for (s = 0; s < game.shooters; s++)
+	game.shooterX[s] = clampf(game.shooterX[s], 0, game.width - 1);
+    if (spatialBuild(&game.invaderGrid, pool, game.aliveX, game.aliveY, game.aliveCount) < 0
+	|| spatialBuild(&game.shooterGrid, pool, game.shooterX, game.shooterY, game.shooters) < 0) {
+	perror("spatialBuild");
+	exit(1);
+    }
+    phaseMs[PHASE_HASH] += monotonicMs() - t;
+    t = monotonicMs();
+
+    simParallel(pool, 0, game.bullets, collideRange, NULL);
+    applyHits();
+    phaseMs[PHASE_COLLIDE] += monotonicMs() - t;
+    return monotonicMs() - start;
+}
+
+/* Every invader is an entity on the pool; the main thread is the shooter. */
+static int play(int invaders, int width, int height, double seconds, int autoplay,
+		struct simPool *pool, unsigned seed) {
+    struct simEntities entities;
+    struct frameStats stats;
+    double phaseMs[PHASES] = {0}, start, next, t, frameStart;
+    struct renderer view;
+    int i, frames, running = 1;
+
+    initGame(invaders, 1, width, height, PLAY_HZ, seed, simThreads(pool));
+    simEntitiesInit(&entities);
+    for (i = 0; i < invaders; i++)
+	if (simEntityCreate(&entities, invaderThread, (void *) (intptr_t) i) < 0) {
+	    perror("simEntityCreate");
+	    exit(1);
+	}
+    if (!autoplay && isatty(STDIN_FILENO))
+	openKeyboard();
+    if (renderInit(&view, width > STATUS_WIDTH ? width : STATUS_WIDTH, height + 1, capture != NULL ? -1 : STDOUT_FILENO, maxFps) < 0) {
+	perror("renderInit");
+	exit(1);
+    }
+    view.capture = capture;
+    view.fullRedraw = fullRedraw;
+    fflush(stdout);
+    framesInit(&stats, seconds * PLAY_HZ);
+
+    start = next = monotonicMs();
+    for (frames = 0; running && frames < seconds * PLAY_HZ; frames++) {
+	if (rawTerminal)
+	    running = handleKeys();
+	else
+	    autopilot(0);
+	t = monotonicMs();
+	frame(pool, &entities, phaseMs);
+	frameStart = monotonicMs();
+	render(&view);
+	phaseMs[PHASE_RENDER] += monotonicMs() - frameStart;
+	framesAdd(&stats, monotonicMs() - t);
+	if (game.hits >= MAX_HITS || game.aliveCount == 0)
+	    break;
+	next += 1e3 / PLAY_HZ;
+	if (next > monotonicMs())
+	    sleepMs(next - monotonicMs());
+    }
+    restoreTerminal();
+    renderFree(&view);
+
+    if (game.hits >= MAX_HITS)
+	printf("Game over: the shooter was hit %d times\n", game.hits);
+    else if (game.aliveCount == 0)
+	printf("You win: every invader is down\n");
+    else
+	printf("Time is up\n");
+    printf("Score: %d, invaders left: %d, %.1f s\n", game.score, game.aliveCount,
+	   (monotonicMs() - start) / 1e3);
+    framesReport(&stats, "frame", 1e3 / PLAY_HZ);
+    for (i = 0; i < PHASES; i++)
+	printf("  %s: %.3f ms/frame\n", phaseNames[i], phaseMs[i] / (frames > 0 ? frames : 1));
+    renderReport(&view);
+    framesFree(&stats);
+    simEntitiesFree(&entities);
+    freeGame();
+    return 0;
+}
+
+/*
+ * Headless stress test: count invaders on a wide layout sized for them and
+ * a shooter for every BENCH_INVADERS_PER_SHOOTER, at a fixed 60 Hz tick
+ * run as fast as it goes.
+ */
+static int bench(int invaders, double seconds, struct simPool *pool, unsigned seed) {
+    struct frameStats stats;
+    double phaseMs[PHASES] = {0}, start;
+    long bullets = 0;
+    int i, frames = seconds * BENCH_HZ, width, shooters = invaders / BENCH_INVADERS_PER_SHOOTER + 1;
+
+    for (width = DEFAULT_WIDTH; width * BENCH_HEIGHT * 0.6f < 4.0f * invaders; width *= 2)
+	;
+    initGame(invaders, shooters, width, BENCH_HEIGHT, BENCH_HZ, seed, simThreads(pool));
+    framesInit(&stats, frames);
+    start = monotonicMs();
+    for (i = 0; i < frames; i++) {
+	framesAdd(&stats, frame(pool, NULL, phaseMs));
+	bullets += game.bullets;
+    }
+
+    printf("%d invaders, %d shooters, %dx%d layout, %d threads\n", invaders, shooters, width, BENCH_HEIGHT,
+	   simThreads(pool));
+    printf("  %d frames in %.1f ms, %.0f bullets/frame, %.0f candidates/frame\n", frames,
+	   monotonicMs() - start, (double) bullets / frames, (double) game.candidates / frames);
+    framesReport(&stats, "frame", 1e3 / BENCH_HZ);
+    for (i = 0; i < PHASE_RENDER; i++)
+	printf("  %s: %.3f ms/frame\n", phaseNames[i], phaseMs[i] / frames);
+    printf("  score %d, shooter hits %d, invaders left %d\n", game.score, game.hits, game.aliveCount);
+    framesFree(&stats);
+    freeGame();
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./invaders [-n invaders] [-m width height] [-T seconds] [-t threads]\n");
+    fprintf(stderr, "                  [-r seed] [-a] [-F fps] [-o capture_file] [-R] [-b]\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, invaders = DEFAULT_INVADERS, threads = 2, benchMode = 0, autoplay = 0;
+    int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT, status;
+    double seconds = 0;
+    unsigned seed = time(NULL);
+    struct simPool *pool;
+
+    while ((opt = getopt(argc, argv, "n:m:T:t:r:aF:o:Rb")) != -1) {
+	switch (opt) {
+	case 'n':
+	    invaders = atoi(optarg);
+	    break;
+	case 'm':
+	    if (optind >= argc) {
+		usage();
+		return 1;
+	    }
+	    width = atoi(optarg);
+	    height = atoi(argv[optind++]);
+	    break;
+	case 'T':
+	    seconds = atof(optarg);
+	    break;
+	case 't':
+	    threads = atoi(optarg);
+	    break;
+	case 'r':
+	    seed = strtoul(optarg, NULL, 10);
+	    break;
+	case 'a':
+	    autoplay = 1;
+	    break;
+	case 'F':
+	    maxFps = atof(optarg);
+	    break;
+	case 'o':
+	    capture = fopen(optarg, "w");
+	    if (capture == NULL) {
+		perror(optarg);
+		return 1;
+	    }
+	    break;
+	case 'R':
+	    fullRedraw = 1;
+	    break;
+	case 'b':
+	    benchMode = 1;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc || invaders <= 0 || width < 8 || height < 8 || seconds < 0 || threads <= 0) {
+	usage();
+	return 1;
+    }
+    pool = simStart(threads);
+    if (pool == NULL) {
+	fprintf(stderr, "Cannot start %d worker threads\n", threads);
+	return 1;
+    }
+    if (benchMode)
+	status = bench(invaders, seconds > 0 ? seconds : BENCH_SECONDS, pool, seed);
+    else
+	status = play(invaders, width, height, seconds > 0 ? seconds : DEFAULT_SECONDS, autoplay, pool, seed);
+    simStop(pool);
+    if (capture != NULL)
+	fclose(capture);
+    return status;
+}
@@ -1,17 +1,254 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define   LOWER  0       /* lower limit of table */
-#define   UPPER  300     /* upper limit */
-#define   STEP   20      /* step size */
+#define   BATCH_ROWS    4096            /* rows converted per batch */
+#define   OUTPUT_SIZE   (1 << 20)       /* bytes written per write() */
+#define   MAX_ROW       48              /* longest formatted row */
+#define   MAX_DEGREES   300000000       /* keeps tenths of Celsius in an int */
+#define   BENCH_ROWS    10000000
 
-/* print Fahrenheit-Celsius table */
+/* Rows are collected here and written out in large blocks. */
+struct writer {
+    int fd;
+    size_t length;
+    char buffer[OUTPUT_SIZE];
+};
 
-int main()
+static void flushWriter(struct writer *w) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < w->length) {
+	n = write(w->fd, w->buffer + done, w->length - done);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("write");
+	    exit(1);
+	}
+	done += n;
+    }
+    w->length = 0;
+}
+
+/* fahrenheit[i] = start + i * step, four at a time */
+void fillFahrenheit(int *fahrenheit, int start, int step, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    __m128i values = _mm_setr_epi32(start, start + step, start + 2 * step, start + 3 * step);
+    __m128i stride = _mm_set1_epi32(4 * step);
+
+    for (; i + 4 <= count; i += 4) {
+	_mm_storeu_si128((__m128i *) (fahrenheit + i), values);
+	values = _mm_add_epi32(values, stride);
+    }
+#endif
+    for (; i < count; i++)
+	fahrenheit[i] = start + i * step;
+}
+
+/*
+ * Converts to tenths of a degree Celsius, rounded to nearest like
+ * printf("%.1f"). 50 * (f - 32) / 9 is never exactly halfway between
+ * two tenths, so the double result always rounds the same way.
+ */
+void convertToCelsius(const int *fahrenheit, int *tenths, int count) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128d freezing = _mm_set1_pd(32.0), scale = _mm_set1_pd(50.0 / 9.0);
+
+    for (; i + 4 <= count; i += 4) {
+	__m128i f = _mm_loadu_si128((const __m128i *) (fahrenheit + i));
+	__m128d low = _mm_cvtepi32_pd(f);
+	__m128d high = _mm_cvtepi32_pd(_mm_shuffle_epi32(f, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m128i lowTenths = _mm_cvtpd_epi32(_mm_mul_pd(_mm_sub_pd(low, freezing), scale));
+	__m128i highTenths = _mm_cvtpd_epi32(_mm_mul_pd(_mm_sub_pd(high, freezing), scale));
+	_mm_storeu_si128((__m128i *) (tenths + i), _mm_unpacklo_epi64(lowTenths, highTenths));
+    }
+#endif
+    for (; i < count; i++) {
+	long n = 50L * (fahrenheit[i] - 32);
+	tenths[i] = n >= 0 ? (n + 4) / 9 : -((-n + 4) / 9);
+    }
+}
+
+/*
+ * Writes value right-aligned in width characters, with decimals digits
+ * after the point (value is scaled by 10^decimals). Returns the end.
+ */
+static char *formatFixed(char *out, long value, int decimals, int width) {
+    char digits[24];
+    unsigned long magnitude = value < 0 ? -(unsigned long) value : (unsigned long) value;
+    int length = 0, i;
+
+    do {
+	digits[length++] = '0' + magnitude % 10;
+	magnitude /= 10;
+	if (length == decimals)
+	    digits[length++] = '.';
+    } while (magnitude > 0 || length <= decimals + (decimals > 0));
+    if (value < 0)
+	digits[length++] = '-';
+    for (i = length; i < width; i++)
+	*out++ = ' ';
+    while (length > 0)
+	*out++ = digits[--length];
+    return out;
+}
+
+/* Same text as printf("Fahrenheit: %3d, Celsius: %6.1f\n", ...) per row. */
+size_t formatRows(const int *fahrenheit, const int *tenths, int count, char *out) {
+    char *pos = out;
+    int i;
+
+    for (i = 0; i < count; i++) {
+	memcpy(pos, "Fahrenheit: ", 12);
+	pos = formatFixed(pos + 12, fahrenheit[i], 0, 3);
+	memcpy(pos, ", Celsius: ", 11);
+	pos = formatFixed(pos + 11, tenths[i], 1, 6);
+	*pos++ = '\n';
+    }
+    return pos - out;
+}
+
+/* Prints count rows from start in steps of step, a batch at a time. */
+static void printTable(struct writer *w, int start, int step, long count) {
+    int fahrenheit[BATCH_ROWS], tenths[BATCH_ROWS];
+    int rows;
+
+    while (count > 0) {
+	rows = count < BATCH_ROWS ? count : BATCH_ROWS;
+	fillFahrenheit(fahrenheit, start, step, rows);
+	convertToCelsius(fahrenheit, tenths, rows);
+	if (w->length + (size_t) rows * MAX_ROW > OUTPUT_SIZE)
+	    flushWriter(w);
+	w->length += formatRows(fahrenheit, tenths, rows, w->buffer + w->length);
+	start += rows * step;
+	count -= rows;
+    }
+    flushWriter(w);
+}
+
+static int parseDegrees(const char *arg, int *value) {
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || n < -MAX_DEGREES || n > MAX_DEGREES) {
+	fprintf(stderr, "Invalid number of degrees: %s\n", arg);
+	return -1;
+    }
+    *value = n;
+    return 0;
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Prints the same range to /dev/null with the original printf loop and
+ * with the batch path, after checking both produce the same text.
+ */
+static int bench(long rows) {
+    static struct writer w;
+    char expected[MAX_ROW], actual[MAX_ROW];
+    int fahrenheit[BATCH_ROWS], tenths[BATCH_ROWS], start = -(int) (rows / 2), count, j;
+    double begin, printfTime, batchTime;
+    FILE *devNull = fopen("/dev/null", "w");
+    long i;
+
+    w.fd = open("/dev/null", O_WRONLY);
+    if (devNull == NULL || w.fd < 0) {
+	perror("/dev/null");
+	return 1;
+    }
+    /* BATCH_ROWS - 1 is not a multiple of 4, so the vector loop and the scalar tail both run */
+    for (i = 0; i < rows; i += count) {
+	count = rows - i < BATCH_ROWS - 1 ? rows - i : BATCH_ROWS - 1;
+	fillFahrenheit(fahrenheit, start + i, 1, count);
+	convertToCelsius(fahrenheit, tenths, count);
+	for (j = 0; j < count; j++) {
+	    snprintf(expected, sizeof(expected), "Fahrenheit: %3d, Celsius: %6.1f\n",
+		     (int) (start + i + j), (5.0/9.0)*(start + i + j - 32));
+	    actual[formatRows(&fahrenheit[j], &tenths[j], 1, actual)] = '\0';
+	    if (strcmp(expected, actual) != 0) {
+		fprintf(stderr, "Mismatch: %s vs %s", expected, actual);
+		return 1;
+	    }
+	}
+    }
+
+    begin = seconds();
+    for (i = 0; i < rows; i++)
+	fprintf(devNull, "Fahrenheit: %3d, Celsius: %6.1f\n", (int) (start + i),
+		(5.0/9.0)*(start + i - 32));
+    fflush(devNull);
+    printfTime = seconds() - begin;
+
+    begin = seconds();
+    printTable(&w, start, 1, rows);
+    batchTime = seconds() - begin;
+
+    printf("%ld rows\n", rows);
+    printf("printf loop : %8.1f ms, %6.1f M rows/s\n", printfTime * 1e3, rows / printfTime / 1e6);
+    printf("batch       : %8.1f ms, %6.1f M rows/s\n", batchTime * 1e3, rows / batchTime / 1e6);
+    fclose(devNull);
+    close(w.fd);
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./fahrenheit_celsius <fahrenheit_degrees>\n");
+    fprintf(stderr, "       ./fahrenheit_celsius <start> <end> <increment>\n");
+    fprintf(stderr, "       ./fahrenheit_celsius -bench [rows]\n");
+}
+
+int main(int argc, char **argv)
 {
-    int fahr;
+    static struct writer w;
+    int start, end, step;
+    long count;
 
-    for (fahr = LOWER; fahr <= UPPER; fahr = fahr + STEP)
-	printf("Fahrenheit: %3d, Celcius: %6.1f\n", fahr, (5.0/9.0)*(fahr-32));
+    if (argc >= 2 && strcmp(argv[1], "-bench") == 0) {
+	count = argc > 2 ? atol(argv[2]) : BENCH_ROWS;
+	if (argc > 3 || count <= 0 || count > 2L * MAX_DEGREES) {
+	    usage();
+	    return 1;
+	}
+	return bench(count);
+    }
 
+    w.fd = STDOUT_FILENO;
+    if (argc == 2) {
+	if (parseDegrees(argv[1], &start) < 0)
+	    return 1;
+	printTable(&w, start, 1, 1);
+	return 0;
+    }
+    if (argc != 4) {
+	usage();
+	return 1;
+    }
+    if (parseDegrees(argv[1], &start) < 0 || parseDegrees(argv[2], &end) < 0
+	|| parseDegrees(argv[3], &step) < 0)
+	return 1;
+    if (step == 0 || ((long) end - start) * step < 0) {
+	fprintf(stderr, "The increment must move from %d towards %d\n", start, end);
+	return 1;
+    }
+    count = ((long) end - start) / step + 1;
+    printTable(&w, start, step, count);
     return 0;
 }
@@ -11,3 +11,7 @@ test: build
 	./fahrenheit_celsius.o 0 100 20
 clean:
 	rm -rf *.o
+bench:
+	gcc -O2 fahrenheit_celsius.c -o fahrenheit_celsius_bench.o
+	@echo Benchmark - printf loop against batch conversion
+	./fahrenheit_celsius_bench.o -bench
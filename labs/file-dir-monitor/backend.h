@@ -0,0 +1,21 @@
+// Event backends
+//
+// A backend turns kernel notifications for the tree under root into
+// coalescer calls. The event loop only polls the descriptor returned by
+// start() and hands whatever it reads to handleEvents().
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "coalesce.h"
+
+struct backend {
+    const char *name;
+    int (*start)(const char *root, int windowMs);   /* pollable fd, -1 on error */
+    int (*handleEvents)(char *buffer, ssize_t length);  /* -1 once root is gone */
+    size_t (*countMarks)();
+    void (*stop)();
+    movedOutFunc movedOut;
+};
+
+extern const struct backend inotifyBackend;
+extern const struct backend fanotifyBackend;
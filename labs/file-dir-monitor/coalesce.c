@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "logger.h"
+#include "coalesce.h"
+
+#define MAX_PENDING 65536
+
+/*
+ * Everything seen for one path during its window. Only where the path
+ * started and where it ended up matter: created and removed again is
+ * nothing, removed and created again is a modification.
+ */
+struct change {
+    char *path;
+    char *oldPath;      /* set for renames, which are never merged */
+    int isDir;
+    int existedBefore;
+    int existsNow;
+    int modified;
+    int flushing;       /* set while its directory is being flushed */
+    int movedAway;      /* inside a new directory that was moved, until it is paired */
+    long long firstSeen;
+};
+
+/* An IN_MOVED_FROM waiting for the IN_MOVED_TO with its cookie. */
+struct move {
+    uint32_t cookie;
+    int isDir;
+    int wd;
+    char *name;
+    char *path;
+    int created;        /* created in the window it moved out of, nothing to log */
+    long long seen;
+};
+
+struct dirCount {
+    const char *dir;
+    size_t length;
+    int created, modified, removed, renamed, transient;
+    int due;            /* a change in it is past its window */
+    int reported;
+};
+
+struct text {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+static int window = DEFAULT_WINDOW_MS;
+static int detailLimit = DEFAULT_DETAIL_LIMIT;
+static movedOutFunc onMovedOut = NULL;
+
+static struct change *pending = NULL;
+static size_t numPending = 0, pendingCapacity = 0;
+static struct move *moves = NULL;
+static size_t numMoves = 0, moveCapacity = 0;
+
+/* path -> index in pending, open addressing, rebuilt after each flush */
+static int *pathIndex = NULL;
+static size_t indexSlots = 0;
+
+static void *xrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+	errorf("Out of memory");
+	exit(1);
+    }
+    return ptr;
+}
+
+static char *xstrdup(const char *s) {
+    char *copy = strdup(s);
+    if (copy == NULL) {
+	errorf("Out of memory");
+	exit(1);
+    }
+    return copy;
+}
+
+long long monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint32_t hashString(const char *s, size_t length) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++) {
+	hash ^= (unsigned char) s[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t indexSlot(const char *path) {
+    size_t slot = hashString(path, strlen(path)) & (indexSlots - 1);
+    while (pathIndex[slot] != -1 && strcmp(pending[pathIndex[slot]].path, path) != 0)
+	slot = (slot + 1) & (indexSlots - 1);
+    return slot;
+}
+
+static void rebuildIndex() {
+    size_t i;
+
+    if (indexSlots < 1024 || numPending * 4 < indexSlots) {
+	indexSlots = 1024;
+    }
+    while (numPending * 2 >= indexSlots)
+	indexSlots *= 2;
+    pathIndex = xrealloc(pathIndex, indexSlots * sizeof(int));
+    memset(pathIndex, -1, indexSlots * sizeof(int));
+    for (i = 0; i < numPending; i++)
+	if (pending[i].oldPath == NULL)
+	    pathIndex[indexSlot(pending[i].path)] = i;
+}
+
+static struct change *newChange(const char *path, int isDir) {
+    struct change *change;
+
+    if (numPending == pendingCapacity) {
+	pendingCapacity = pendingCapacity == 0 ? 256 : pendingCapacity * 2;
+	pending = xrealloc(pending, pendingCapacity * sizeof(struct change));
+    }
+    change = &pending[numPending++];
+    memset(change, 0, sizeof(*change));
+    change->path = xstrdup(path);
+    change->isDir = isDir;
+    change->firstSeen = monotonicMs();
+    return change;
+}
+
+void initCoalescer(int windowMs, int limit, movedOutFunc movedOut) {
+    window = windowMs;
+    detailLimit = limit;
+    onMovedOut = movedOut;
+    rebuildIndex();
+}
+
+/* Merges a create, modify or remove into the pending change of its path. */
+void addChange(enum changeType type, int isDir, const char *path) {
+    struct change *change;
+    size_t slot = indexSlot(path);
+
+    if (pathIndex[slot] == -1) {
+	change = newChange(path, isDir);
+	change->existedBefore = type != CHANGE_CREATE;
+	change->existsNow = 1;
+	if (numPending * 2 >= indexSlots)
+	    rebuildIndex();
+	else
+	    pathIndex[slot] = numPending - 1;
+    } else {
+	change = &pending[pathIndex[slot]];
+	if (type == CHANGE_CREATE && !change->existsNow && change->existedBefore)
+	    change->modified = 1;
+    }
+    change->isDir = isDir;
+    if (type == CHANGE_REMOVE)
+	change->existsNow = 0;
+    else if (type == CHANGE_CREATE)
+	change->existsNow = 1;
+    else
+	change->modified = 1;
+}
+
+/* Whether path lies inside the directory dir. */
+static int isBelow(const char *path, const char *dir, size_t length) {
+    return strncmp(path, dir, length) == 0 && path[length] == '/';
+}
+
+/* Everything pending inside a new directory that moved goes with it. */
+static void hideDescendants(const char *dir) {
+    size_t i, length = strlen(dir);
+
+    for (i = 0; i < numPending; i++)
+	if (pending[i].oldPath == NULL && pending[i].existsNow && isBelow(pending[i].path, dir, length)) {
+	    pending[i].existsNow = 0;
+	    pending[i].movedAway = 1;
+	}
+}
+
+/* A new directory came back under another name: so did what was created in it. */
+static void showDescendants(const char *oldDir, const char *newDir) {
+    size_t i, count = numPending, length = strlen(oldDir);
+    char *path;
+
+    for (i = 0; i < count; i++) {
+	if (!pending[i].movedAway || !isBelow(pending[i].path, oldDir, length))
+	    continue;
+	pending[i].movedAway = 0;
+	path = xrealloc(NULL, strlen(newDir) + strlen(pending[i].path + length) + 1);
+	sprintf(path, "%s%s", newDir, pending[i].path + length);
+	addChange(CHANGE_CREATE, pending[i].isDir, path);
+	free(path);
+    }
+}
+
+/*
+ * Holds an IN_MOVED_FROM until its pair shows up. An entry created in
+ * this window is dropped from the pending changes right away, so if it
+ * never comes back it vanishes like one created and deleted again.
+ */
+void addMovedFrom(uint32_t cookie, int isDir, int wd, const char *name, const char *path) {
+    struct move *move;
+    size_t slot = indexSlot(path);
+
+    if (numMoves == moveCapacity) {
+	moveCapacity = moveCapacity == 0 ? 64 : moveCapacity * 2;
+	moves = xrealloc(moves, moveCapacity * sizeof(struct move));
+    }
+    move = &moves[numMoves++];
+    move->cookie = cookie;
+    move->isDir = isDir;
+    move->wd = wd;
+    move->name = xstrdup(name);
+    move->path = xstrdup(path);
+    move->seen = monotonicMs();
+    move->created = pathIndex[slot] != -1 && !pending[pathIndex[slot]].existedBefore
+		    && pending[pathIndex[slot]].existsNow;
+    if (move->created) {
+	pending[pathIndex[slot]].existsNow = 0;
+	if (isDir)
+	    hideDescendants(path);
+    }
+}
+
+/*
+ * Queues a rename. A file that was created inside the window and then
+ * renamed is just created under its new name.
+ */
+void addRename(int isDir, const char *oldPath, const char *newPath) {
+    struct change *change;
+    size_t slot = indexSlot(oldPath);
+
+    if (pathIndex[slot] != -1 && !pending[pathIndex[slot]].existedBefore
+	&& pending[pathIndex[slot]].existsNow) {
+	pending[pathIndex[slot]].existsNow = 0;
+	addChange(CHANGE_CREATE, isDir, newPath);
+    } else {
+	change = newChange(newPath, isDir);
+	change->oldPath = xstrdup(oldPath);
+    }
+}
+
+/*
+ * Pairs an IN_MOVED_TO with its IN_MOVED_FROM, which may have come in an
+ * earlier read. On a match the rename is queued, the source is handed
+ * back so the caller can move its watch, and 1 is returned.
+ */
+int addMovedTo(uint32_t cookie, int isDir, const char *path, int *fromWd, char **fromName) {
+    struct move move;
+    size_t i;
+
+    for (i = numMoves; i > 0; i--)
+	if (moves[i - 1].cookie == cookie)
+	    break;
+    if (i == 0)
+	return 0;
+    move = moves[i - 1];
+    memmove(&moves[i - 1], &moves[i], (numMoves - i) * sizeof(struct move));
+    numMoves--;
+
+    if (move.created) {
+	addChange(CHANGE_CREATE, isDir, path);
+	if (isDir)
+	    showDescendants(move.path, path);
+    } else
+	addRename(isDir, move.path, path);
+    free(move.path);
+    *fromWd = move.wd;
+    *fromName = move.name;
+    return 1;
+}
+
+static void appendText(struct text *text, const char *format, ...) {
+    va_list args;
+    int length;
+
+    for (;;) {
+	va_start(args, format);
+	length = vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+	va_end(args);
+	if (text->length + length < text->capacity)
+	    break;
+	text->capacity = text->capacity == 0 ? 4096 : text->capacity * 2;
+	while (text->length + length >= text->capacity)
+	    text->capacity *= 2;
+	text->data = xrealloc(text->data, text->capacity);
+    }
+    text->length += length;
+}
+
+static const char *kind(int isDir) {
+    return isDir ? "Directory" : "File";
+}
+
+static struct dirCount *findDir(struct dirCount *dirs, size_t slots, const char *path) {
+    const char *slash = strrchr(path, '/');
+    size_t length = slash == NULL ? 0 : slash - path;
+    size_t slot = hashString(path, length) & (slots - 1);
+
+    while (dirs[slot].dir != NULL &&
+	   (dirs[slot].length != length || memcmp(dirs[slot].dir, path, length) != 0))
+	slot = (slot + 1) & (slots - 1);
+    if (dirs[slot].dir == NULL) {
+	dirs[slot].dir = path;
+	dirs[slot].length = length;
+    }
+    return &dirs[slot];
+}
+
+static void countChange(struct dirCount *dir, const struct change *change) {
+    if (change->oldPath != NULL)
+	dir->renamed++;
+    else if (!change->existedBefore && change->existsNow)
+	dir->created++;
+    else if (change->existedBefore && !change->existsNow)
+	dir->removed++;
+    else if (change->existedBefore)
+	dir->modified++;
+    else
+	dir->transient++;
+}
+
+static void describeChange(struct text *text, const struct change *change) {
+    const char *type;
+
+    if (change->oldPath != NULL) {
+	appendText(text, "- [%s - Rename] - %s -> %s\n", kind(change->isDir),
+		   change->oldPath, change->path);
+	return;
+    }
+    if (!change->existedBefore && change->existsNow)
+	type = "Create";
+    else if (change->existedBefore && !change->existsNow)
+	type = "Removal";
+    else if (change->existedBefore && change->modified)
+	type = "Modify";
+    else
+	return;
+    appendText(text, "- [%s - %s] - %s\n", kind(change->isDir), type, change->path);
+}
+
+static void describeDir(struct text *text, const struct dirCount *dir) {
+    appendText(text, "- [Summary] - %.*s%s: %d created, %d modified, %d removed, %d renamed",
+	       (int) dir->length, dir->dir, dir->length == 0 ? "." : "",
+	       dir->created, dir->modified, dir->removed, dir->renamed);
+    if (dir->transient > 0)
+	appendText(text, ", %d short-lived", dir->transient);
+    appendText(text, "\n");
+}
+
+/*
+ * Logs every directory that has a change whose window is over (all of
+ * them when all is set). Once one change of a directory is due, the
+ * whole batch pending for that directory goes out with it, so a burst
+ * is logged together rather than a few entries at a time. The lines of
+ * one flush go out in a single logger call, and a directory with more
+ * than detailLimit changes gets one summary line instead.
+ */
+void flushChanges(int all) {
+    long long now = monotonicMs();
+    struct dirCount *dirs, *dir;
+    struct text text = {NULL, 0, 0};
+    size_t i, kept, slots;
+    int total, due = 0;
+
+    /* a burst too long for the window still has to be bounded */
+    if (numPending >= MAX_PENDING)
+	all = 1;
+
+    for (i = 0, kept = 0; i < numMoves; i++) {
+	if (all || moves[i].seen + window <= now) {
+	    struct change *change;
+	    if (onMovedOut != NULL)
+		onMovedOut(moves[i].wd, moves[i].name, moves[i].isDir);
+	    if (!moves[i].created) {
+		change = newChange(moves[i].path, moves[i].isDir);
+		change->existedBefore = 1;
+		change->firstSeen = moves[i].seen;
+		due = 1;
+	    }
+	    free(moves[i].path);
+	    free(moves[i].name);
+	} else {
+	    moves[kept++] = moves[i];
+	}
+    }
+    numMoves = kept;
+
+    /* pending is in arrival order, apart from the moves just added, which are due */
+    if (numPending == 0 || !(all || due || pending[0].firstSeen + window <= now))
+	return;
+
+    for (slots = 16; slots < numPending * 2; slots *= 2)
+	;
+    dirs = calloc(slots, sizeof(struct dirCount));
+    if (dirs == NULL) {
+	errorf("Out of memory");
+	exit(1);
+    }
+    for (i = 0; i < numPending; i++) {
+	dir = findDir(dirs, slots, pending[i].path);
+	countChange(dir, &pending[i]);
+	if (all || pending[i].firstSeen + window <= now)
+	    dir->due = 1;
+    }
+
+    for (i = 0; i < numPending; i++) {
+	dir = findDir(dirs, slots, pending[i].path);
+	if (!(pending[i].flushing = dir->due))
+	    continue;
+	total = dir->created + dir->modified + dir->removed + dir->renamed + dir->transient;
+	if (total <= detailLimit) {
+	    describeChange(&text, &pending[i]);
+	} else if (!dir->reported) {
+	    describeDir(&text, dir);
+	    dir->reported = 1;
+	}
+    }
+
+    /* the directory counts point into the paths, free them last */
+    for (i = 0, kept = 0; i < numPending; i++) {
+	if (!pending[i].flushing) {
+	    pending[kept++] = pending[i];
+	    continue;
+	}
+	free(pending[i].path);
+	free(pending[i].oldPath);
+    }
+    numPending = kept;
+    rebuildIndex();
+
+    if (text.length > 0) {
+	text.data[text.length - 1] = '\0';
+	infof("%s", text.data);
+    }
+    free(text.data);
+    free(dirs);
+}
+
+/* Milliseconds until the oldest pending change is due, -1 if none. */
+int nextFlushTimeout() {
+    long long oldest = -1, due;
+
+    if (numPending > 0)
+	oldest = pending[0].firstSeen;
+    if (numMoves > 0 && (oldest < 0 || moves[0].seen < oldest))
+	oldest = moves[0].seen;
+    if (oldest < 0)
+	return -1;
+    due = oldest + window - monotonicMs();
+    return due < 0 ? 0 : (int) due;
+}
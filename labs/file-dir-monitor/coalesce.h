@@ -0,0 +1,28 @@
+// Event coalescing
+//
+// Raw events are held for a short window so that bursts on the same path
+// collapse into one line, IN_MOVED_FROM/IN_MOVED_TO pairs become a single
+// rename and busy directories are summarized instead of listed.
+
+#include <stdint.h>
+
+#define DEFAULT_WINDOW_MS 200
+#define DEFAULT_DETAIL_LIMIT 20
+
+enum changeType {
+    CHANGE_CREATE,
+    CHANGE_MODIFY,
+    CHANGE_REMOVE,
+};
+
+/* Called when a moved-out entry's window expires without its pair. */
+typedef void (*movedOutFunc)(int wd, const char *name, int isDir);
+
+void initCoalescer(int windowMs, int detailLimit, movedOutFunc movedOut);
+void addChange(enum changeType type, int isDir, const char *path);
+void addMovedFrom(uint32_t cookie, int isDir, int wd, const char *name, const char *path);
+int addMovedTo(uint32_t cookie, int isDir, const char *path, int *fromWd, char **fromName);
+void addRename(int isDir, const char *oldPath, const char *newPath);
+void flushChanges(int all);
+int nextFlushTimeout();
+long long monotonicMs();
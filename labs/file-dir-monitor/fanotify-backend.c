@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include "logger.h"
+#include "backend.h"
+
+#define CACHE_SLOTS 4096
+#define PATH_SIZE 4096
+
+#ifdef FAN_RENAME
+#define MARK_EVENTS (FAN_CREATE | FAN_DELETE | FAN_RENAME | FAN_CLOSE_WRITE | FAN_ONDIR)
+#else
+/* no rename records before Linux 5.17, moves are a removal and a creation */
+#define MARK_EVENTS (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_CLOSE_WRITE | \
+		     FAN_ONDIR)
+#endif
+
+/* directory file handle -> absolute path, as found when it was opened */
+struct cachedDir {
+    struct file_handle *handle;
+    char *path;
+};
+
+static int fanotifyFd = -1;
+static int mountFd = -1;
+static char rootPath[PATH_MAX];
+static size_t rootLength;
+static struct cachedDir cache[CACHE_SLOTS];
+
+static size_t handleSize(const struct file_handle *handle) {
+    return sizeof(struct file_handle) + handle->handle_bytes;
+}
+
+static uint32_t hashHandle(const struct file_handle *handle) {
+    const unsigned char *bytes = (const unsigned char *) handle;
+    uint32_t hash = 2166136261u;
+    size_t i, size = handleSize(handle);
+
+    for (i = 0; i < size; i++) {
+	hash ^= bytes[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* A directory was renamed or removed, any cached path may be stale. */
+static void clearCache() {
+    size_t i;
+    for (i = 0; i < CACHE_SLOTS; i++) {
+	free(cache[i].handle);
+	free(cache[i].path);
+	cache[i].handle = NULL;
+	cache[i].path = NULL;
+    }
+}
+
+/*
+ * Turns a directory handle into its current absolute path. Handles are
+ * opened with open_by_handle_at() and named through /proc, which is the
+ * expensive part, so results go into a direct-mapped cache.
+ */
+static const char *resolveDir(struct file_handle *handle) {
+    struct cachedDir *slot = &cache[hashHandle(handle) & (CACHE_SLOTS - 1)];
+    char link[64], path[PATH_MAX];
+    ssize_t length;
+    int fd;
+
+    if (slot->handle != NULL && handleSize(slot->handle) == handleSize(handle)
+	&& memcmp(slot->handle, handle, handleSize(handle)) == 0)
+	return slot->path;
+
+    fd = open_by_handle_at(mountFd, handle, O_PATH);
+    if (fd < 0)
+	return NULL;
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    length = readlink(link, path, sizeof(path) - 1);
+    close(fd);
+    if (length < 0)
+	return NULL;
+    path[length] = '\0';
+
+    free(slot->handle);
+    free(slot->path);
+    slot->handle = malloc(handleSize(handle));
+    slot->path = strdup(path);
+    if (slot->handle == NULL || slot->path == NULL) {
+	errorf("Out of memory");
+	exit(1);
+    }
+    memcpy(slot->handle, handle, handleSize(handle));
+    return slot->path;
+}
+
+/*
+ * Builds the path of name in the directory behind handle, relative to
+ * the root. Returns 0 inside the tree, 1 for the root itself and -1 for
+ * anything else on the filesystem, which is just skipped.
+ */
+static int relativePath(struct file_handle *handle, const char *name, char *path) {
+    const char *dir = resolveDir(handle);
+    char full[PATH_SIZE];
+
+    if (dir == NULL)
+	return -1;
+    snprintf(full, sizeof(full), "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, name);
+    if (strcmp(full, rootPath) == 0)
+	return 1;
+    if (rootLength == 1) {
+	snprintf(path, PATH_SIZE, "%s", full + 1);
+	return 0;
+    }
+    if (strncmp(full, rootPath, rootLength) != 0 || full[rootLength] != '/')
+	return -1;
+    snprintf(path, PATH_SIZE, "%s", full + rootLength + 1);
+    return 0;
+}
+
+static int handleRename(int isDir, struct fanotify_event_info_fid *from,
+			struct fanotify_event_info_fid *to) {
+    struct file_handle *fromDir = (struct file_handle *) from->handle;
+    struct file_handle *toDir = (struct file_handle *) to->handle;
+    char oldPath[PATH_SIZE], newPath[PATH_SIZE];
+    int oldInside, newInside;
+
+    oldInside = relativePath(fromDir, (char *) fromDir->f_handle + fromDir->handle_bytes, oldPath);
+    newInside = relativePath(toDir, (char *) toDir->f_handle + toDir->handle_bytes, newPath);
+    if (isDir)
+	clearCache();
+    if (oldInside == 1)
+	return -1;
+    if (oldInside == 0 && newInside == 0)
+	addRename(isDir, oldPath, newPath);
+    else if (oldInside == 0)
+	addChange(CHANGE_REMOVE, isDir, oldPath);
+    else if (newInside == 0)
+	addChange(CHANGE_CREATE, isDir, newPath);
+    return 0;
+}
+
+/*
+ * Every event of the filesystem arrives here. Each carries the handle of
+ * the directory it happened in and the entry name; renames carry both
+ * the old and the new pair.
+ */
+static int handleEvents(char *buffer, ssize_t length) {
+    struct fanotify_event_metadata *event;
+    struct fanotify_event_info_header *info;
+    struct fanotify_event_info_fid *entry, *from, *to;
+    struct file_handle *dir;
+    char path[PATH_SIZE];
+    int isDir, inside;
+
+    for (event = (struct fanotify_event_metadata *) buffer; FAN_EVENT_OK(event, length);
+	 event = FAN_EVENT_NEXT(event, length)) {
+	if (event->vers != FANOTIFY_METADATA_VERSION) {
+	    errorf("Unexpected fanotify metadata version %d", event->vers);
+	    return -1;
+	}
+	if (event->mask & FAN_Q_OVERFLOW) {
+	    flushChanges(1);
+	    warnf("Event queue overflowed, some events were lost");
+	    continue;
+	}
+
+	entry = from = to = NULL;
+	for (info = (struct fanotify_event_info_header *) (event + 1);
+	     (char *) info < (char *) event + event->event_len;
+	     info = (struct fanotify_event_info_header *) ((char *) info + info->len)) {
+	    if (info->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+		entry = (struct fanotify_event_info_fid *) info;
+#ifdef FAN_RENAME
+	    else if (info->info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME)
+		from = (struct fanotify_event_info_fid *) info;
+	    else if (info->info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME)
+		to = (struct fanotify_event_info_fid *) info;
+#endif
+	}
+
+	isDir = (event->mask & FAN_ONDIR) != 0;
+	if (from != NULL && to != NULL) {
+	    if (handleRename(isDir, from, to) < 0)
+		return -1;
+	    continue;
+	}
+	if (entry == NULL)
+	    continue;
+	dir = (struct file_handle *) entry->handle;
+	inside = relativePath(dir, (char *) dir->f_handle + dir->handle_bytes, path);
+	if (isDir && (event->mask & (FAN_DELETE | FAN_MOVED_FROM)))
+	    clearCache();
+	if (inside == 1 && (event->mask & (FAN_DELETE | FAN_MOVED_FROM)))
+	    return -1;
+	if (inside != 0)
+	    continue;
+
+	if (event->mask & (FAN_CREATE | FAN_MOVED_TO))
+	    addChange(CHANGE_CREATE, isDir, path);
+	else if (event->mask & (FAN_DELETE | FAN_MOVED_FROM))
+	    addChange(CHANGE_REMOVE, isDir, path);
+	else if (event->mask & FAN_CLOSE_WRITE)
+	    addChange(CHANGE_MODIFY, isDir, path);
+    }
+    return 0;
+}
+
+/*
+ * One mark on the whole filesystem that holds root, so setup does not
+ * depend on the size of the tree. Needs CAP_SYS_ADMIN.
+ */
+static int startFanotify(const char *root, int windowMs) {
+    (void) windowMs;
+    snprintf(rootPath, sizeof(rootPath), "%s", root);
+    rootLength = strlen(rootPath);
+
+    fanotifyFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC,
+			       O_RDONLY);
+    if (fanotifyFd < 0) {
+	errorf("fanotify_init: %s%s", strerror(errno),
+	       errno == EPERM ? " (the fanotify backend must run as root)" : "");
+	return -1;
+    }
+    mountFd = open(rootPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mountFd < 0) {
+	errorf("Cannot open %s: %s", rootPath, strerror(errno));
+	close(fanotifyFd);
+	return -1;
+    }
+    if (fanotify_mark(fanotifyFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, MARK_EVENTS,
+		      AT_FDCWD, rootPath) < 0) {
+	errorf("fanotify_mark: %s", strerror(errno));
+	close(mountFd);
+	close(fanotifyFd);
+	return -1;
+    }
+    return fanotifyFd;
+}
+
+static size_t countMarks() {
+    return 1;
+}
+
+static void stopFanotify() {
+    clearCache();
+    close(mountFd);
+    close(fanotifyFd);
+}
+
+/* One filesystem mark, filtered by path prefix in user space. */
+const struct backend fanotifyBackend = {
+    .name = "fanotify",
+    .start = startFanotify,
+    .handleEvents = handleEvents,
+    .countMarks = countMarks,
+    .stop = stopFanotify,
+    .movedOut = NULL,
+};
@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "logger.h"
+#include "watches.h"
+#include "backend.h"
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		      IN_CLOSE_WRITE)
+#define PATH_SIZE 4096
+#define ACTIVE_HISTORY_MS 2000
+
+static int inotifyFd;
+static int rootWd;
+static char rootPath[PATH_MAX];
+static int window;
+
+static void relativePath(int wd, const char *name, char *path) {
+    if (buildPath(wd, name, 0, path, PATH_SIZE) < 0)
+	snprintf(path, PATH_SIZE, "%s", name);
+}
+
+/* A directory showed up inside the tree, watch it and what it holds. */
+static void watchNewDirectory(int parent, const char *name) {
+    char path[PATH_SIZE];
+
+    if (buildPath(parent, name, 1, path, sizeof(path)) == 0)
+	addTree(path, parent, name);
+}
+
+/*
+ * A directory moved away is detached right away, so events inside it are
+ * not logged under its old path while its IN_MOVED_TO may still come.
+ * Returns the watch to hand to the coalescer in place of the parent.
+ */
+static int detachDirectory(int parent, const char *name) {
+    int wd = findChild(parent, name);
+
+    if (wd >= 0)
+	moveWatch(wd, DETACHED, name);
+    return wd;
+}
+
+/* Nothing claimed an IN_MOVED_FROM within the window: it left the tree. */
+static void handleMovedOut(int wd, const char *name, int isDir) {
+    if (isDir)
+	removeTree(wd);
+}
+
+static void handleMovedTo(const struct inotify_event *event, const char *path) {
+    int isDir = (event->mask & IN_ISDIR) != 0, fromWd;
+    char *fromName;
+
+    if (addMovedTo(event->cookie, isDir, path, &fromWd, &fromName)) {
+	if (isDir)
+	    moveWatch(fromWd, event->wd, event->name);
+	free(fromName);
+	return;
+    }
+    /* moved in from outside the tree */
+    addChange(CHANGE_CREATE, isDir, path);
+    if (isDir)
+	watchNewDirectory(event->wd, event->name);
+}
+
+/*
+ * The kernel dropped events. What is pending goes out first, then the
+ * directories that were busy right before are walked again, or the whole
+ * tree when there was no recent activity to go on.
+ */
+static void handleOverflow() {
+    size_t before;
+    int walked;
+
+    flushChanges(1);
+    before = countWatches();
+    walked = rescanActive(monotonicMs() - window - ACTIVE_HISTORY_MS);
+    if (walked == 0) {
+	addTree(rootPath, NO_PARENT, rootPath);
+	walked = 1;
+    }
+    warnf("Event queue overflowed, rescanned %d subtrees, %ld new directories",
+	  walked, (long) countWatches() - (long) before);
+}
+
+/*
+ * Feeds one read worth of events to the coalescer. Watch tree updates
+ * happen right away, since later events are resolved against it; only
+ * the logging waits for the window. Returns -1 once the monitored
+ * directory itself is gone.
+ */
+static int handleEvents(char *buffer, ssize_t length) {
+    const struct inotify_event *event;
+    char path[PATH_SIZE];
+    long long now = monotonicMs();
+    int overflowed = 0, isDir;
+    char *pos;
+
+    for (pos = buffer; pos < buffer + length; pos += sizeof(struct inotify_event) + event->len) {
+	event = (const struct inotify_event *) pos;
+
+	if (event->mask & IN_Q_OVERFLOW) {
+	    overflowed = 1;
+	    continue;
+	}
+	if (event->mask & IN_IGNORED) {
+	    removeWatch(event->wd);
+	    continue;
+	}
+	if (!inTree(event->wd))
+	    continue;
+	if ((event->mask & IN_DELETE_SELF) && event->wd == rootWd)
+	    return -1;
+	if (event->len == 0)
+	    continue;
+
+	touchWatch(event->wd, now);
+	relativePath(event->wd, event->name, path);
+	isDir = (event->mask & IN_ISDIR) != 0;
+	if (event->mask & IN_MOVED_FROM) {
+	    addMovedFrom(event->cookie, isDir, isDir ? detachDirectory(event->wd, event->name) : event->wd,
+			 event->name, path);
+	} else if (event->mask & IN_MOVED_TO) {
+	    handleMovedTo(event, path);
+	} else if (event->mask & IN_CREATE) {
+	    addChange(CHANGE_CREATE, isDir, path);
+	    if (isDir)
+		watchNewDirectory(event->wd, event->name);
+	} else if (event->mask & IN_DELETE) {
+	    addChange(CHANGE_REMOVE, isDir, path);
+	} else if (event->mask & IN_CLOSE_WRITE) {
+	    addChange(CHANGE_MODIFY, isDir, path);
+	}
+    }
+    if (overflowed)
+	handleOverflow();
+    return 0;
+}
+
+static int startInotify(const char *root, int windowMs) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+	errorf("inotify_init1: %s", strerror(errno));
+	return -1;
+    }
+    snprintf(rootPath, sizeof(rootPath), "%s", root);
+    window = windowMs;
+    initWatches(inotifyFd, WATCH_EVENTS);
+
+    rootWd = addTree(rootPath, NO_PARENT, rootPath);
+    if (rootWd < 0) {
+	errorf("Cannot monitor %s", rootPath);
+	close(inotifyFd);
+	return -1;
+    }
+    return inotifyFd;
+}
+
+static void stopInotify() {
+    removeAllWatches();
+    close(inotifyFd);
+}
+
+/* One watch per directory in the tree. */
+const struct backend inotifyBackend = {
+    .name = "inotify",
+    .start = startInotify,
+    .handleEvents = handleEvents,
+    .countMarks = countWatches,
+    .stop = stopInotify,
+    .movedOut = handleMovedOut,
+};
@@ -2,10 +2,18 @@
 
 APP_NAME=monitor
 LIB_NAME=logger
+WATCHES_NAME=watches
+COALESCE_NAME=coalesce
+INOTIFY_NAME=inotify-backend
+FANOTIFY_NAME=fanotify-backend
 build:
 	gcc -c ${APP_NAME}.c -o ${APP_NAME}.o
 	gcc -c ${LIB_NAME}.c -o ${LIB_NAME}.o
-	gcc    ${LIB_NAME}.o ${APP_NAME}.o  -o ${APP_NAME}
+	gcc -c ${WATCHES_NAME}.c -o ${WATCHES_NAME}.o
+	gcc -c ${COALESCE_NAME}.c -o ${COALESCE_NAME}.o
+	gcc -c ${INOTIFY_NAME}.c -o ${INOTIFY_NAME}.o
+	gcc -c ${FANOTIFY_NAME}.c -o ${FANOTIFY_NAME}.o
+	gcc    ${LIB_NAME}.o ${WATCHES_NAME}.o ${COALESCE_NAME}.o ${INOTIFY_NAME}.o ${FANOTIFY_NAME}.o ${APP_NAME}.o  -o ${APP_NAME} -lpthread
 test: build
 	 @echo Test 1
 	sudo ./${APP_NAME} /tmp
@@ -14,7 +22,15 @@ test: build
 	@echo Test 3
 	./${APP_NAME} $(PWD)
 	@echo Test 4 - failed
-	./${APP_NAME}
+	-./${APP_NAME}
+	@echo Test 5
+	./${APP_NAME} -w 1000 $(PWD)
+	@echo Test 6
+	sudo ./${APP_NAME} -b fanotify $(PWD)
+
+bench: build
+	./${APP_NAME} -s -b inotify /usr
+	sudo ./${APP_NAME} -s -b fanotify /usr
 
 clean:
 	rm -rf *.o ${APP_NAME}
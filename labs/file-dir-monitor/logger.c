@@ -1,23 +1,81 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
 #include "logger.h"
 
+#define RESET   "\x1b[0m"
+#define GREEN   "\x1b[32m"
+#define YELLOW  "\x1b[33m"
+#define RED     "\x1b[31m"
+#define MAGENTA "\x1b[35m"
+
+static int useSyslog = 0;
+
 int initLogger(char *logType) {
-    printf("Initializing Logger on: %s\n", logType);
-    return 0;
+    if (logType == NULL || logType[0] == '\0' || strcmp(logType, "stdout") == 0) {
+	if (useSyslog)
+	    closelog();
+	useSyslog = 0;
+	return 0;
+    }
+    if (strcmp(logType, "syslog") == 0) {
+	openlog("monitor", LOG_PID | LOG_NDELAY, LOG_USER);
+	useSyslog = 1;
+	return 0;
+    }
+    fprintf(stderr, "Unknown log type: %s\n", logType);
+    return -1;
+}
+
+static int logMessage(int priority, const char *color, const char *format, va_list args) {
+    int length;
+
+    if (useSyslog) {
+	vsyslog(priority, format, args);
+	return 0;
+    }
+    fputs(color, stdout);
+    length = vprintf(format, args);
+    fputs(RESET "\n", stdout);
+    return length;
 }
 
 int infof(const char *format, ...) {
-    return 0;
+    va_list args;
+    int length;
+    va_start(args, format);
+    length = logMessage(LOG_INFO, GREEN, format, args);
+    va_end(args);
+    return length;
 }
 
 int warnf(const char *format, ...) {
-    return 0;
+    va_list args;
+    int length;
+    va_start(args, format);
+    length = logMessage(LOG_WARNING, YELLOW, format, args);
+    va_end(args);
+    return length;
 }
 
 int errorf(const char *format, ...) {
-    return 0;
+    va_list args;
+    int length;
+    va_start(args, format);
+    length = logMessage(LOG_ERR, RED, format, args);
+    va_end(args);
+    return length;
 }
+
 int panicf(const char *format, ...) {
-    return 0;
+    va_list args;
+    int length;
+    va_start(args, format);
+    length = logMessage(LOG_EMERG, MAGENTA, format, args);
+    va_end(args);
+    fflush(stdout);
+    abort();
+    return length;
 }
-
@@ -1,7 +1,148 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include "logger.h"
+#include "backend.h"
 
-int main(){
-    // Place your magic here
+#define EVENT_BUFFER_SIZE (256 * 1024)
+
+static const struct backend *backend = &inotifyBackend;
+static int eventFd;
+static int window = DEFAULT_WINDOW_MS;
+
+/*
+ * Waits on the backend descriptor and drains it with large reads, so a
+ * burst of events costs a few syscalls instead of one per event. The
+ * wait ends early when the oldest pending change is due for logging.
+ */
+static int runEventLoop() {
+    struct epoll_event event, ready[2];
+    sigset_t mask;
+    char *buffer;
+    int epfd, signalFd, running = 1, n, i;
+
+    buffer = aligned_alloc(__alignof__(long long), EVENT_BUFFER_SIZE);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signalFd = signalfd(-1, &mask, SFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (buffer == NULL || signalFd < 0 || epfd < 0) {
+	errorf("Cannot set up the event loop: %s", strerror(errno));
+	return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = eventFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, eventFd, &event);
+    event.data.fd = signalFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, signalFd, &event);
+
+    while (running) {
+	n = epoll_wait(epfd, ready, 2, nextFlushTimeout());
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    errorf("epoll_wait: %s", strerror(errno));
+	    break;
+	}
+	for (i = 0; i < n; i++) {
+	    if (ready[i].data.fd == signalFd) {
+		running = 0;
+		continue;
+	    }
+	    for (;;) {
+		ssize_t length = read(eventFd, buffer, EVENT_BUFFER_SIZE);
+		if (length <= 0) {
+		    if (length < 0 && errno != EAGAIN && errno != EINTR)
+			errorf("read: %s", strerror(errno));
+		    break;
+		}
+		if (backend->handleEvents(buffer, length) < 0) {
+		    warnf("Monitored directory was removed");
+		    running = 0;
+		    break;
+		}
+	    }
+	}
+	flushChanges(!running);
+    }
+
+    close(epfd);
+    close(signalFd);
+    free(buffer);
+    return 0;
+}
+
+static void usage() {
+    errorf("Usage: ./monitor [-b inotify|fanotify] [-w window_ms] [-s] <directory>");
+}
+
+static double elapsedMs(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int main(int argc, char **argv){
+    char root[PATH_MAX], *end;
+    struct timespec start;
+    struct rusage resources;
+    int opt, setupOnly = 0;
+
+    initLogger("stdout");
+    while ((opt = getopt(argc, argv, "b:w:s")) != -1) {
+	if (opt == 'b' && strcmp(optarg, "inotify") == 0) {
+	    backend = &inotifyBackend;
+	} else if (opt == 'b' && strcmp(optarg, "fanotify") == 0) {
+	    backend = &fanotifyBackend;
+	} else if (opt == 'w') {
+	    window = strtol(optarg, &end, 10);
+	    if (*end != '\0' || window < 0) {
+		errorf("Invalid window: %s", optarg);
+		return 1;
+	    }
+	} else if (opt == 's') {
+	    setupOnly = 1;
+	} else {
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind != argc - 1) {
+	usage();
+	return 1;
+    }
+    if (realpath(argv[optind], root) == NULL) {
+	errorf("Cannot monitor %s: %s", argv[optind], strerror(errno));
+	return 1;
+    }
+
+    initCoalescer(window, DEFAULT_DETAIL_LIMIT, backend->movedOut);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    eventFd = backend->start(root, window);
+    if (eventFd < 0)
+	return 1;
+    getrusage(RUSAGE_SELF, &resources);
+
+    infof("Starting File/Directory Monitor on %s", root);
+    infof("-----------------------------------------------------");
+    infof("%s: %zu marks set up in %.1f ms, max RSS %ld KB", backend->name,
+	  backend->countMarks(), elapsedMs(&start), resources.ru_maxrss);
+
+    if (!setupOnly)
+	runEventLoop();
+
+    backend->stop();
     return 0;
 }
@@ -0,0 +1,472 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "logger.h"
+#include "watches.h"
+
+#define MAX_WALK_THREADS 16
+#define INITIAL_CHILD_SLOTS 1024
+
+struct walkItem {
+    char *path;
+    int wd;
+};
+
+/* Directories waiting to be listed, shared by the walk threads. */
+struct walkQueue {
+    struct walkItem *items;
+    size_t length;
+    size_t capacity;
+    int busy;           /* threads listing a directory right now */
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+};
+
+static int inotifyFd = -1;
+static uint32_t watchMask;
+
+/* Watch descriptors are small and handed out in increasing order, so
+ * the watch table is indexed by them directly. */
+static struct watch *watches = NULL;
+static size_t watchCapacity = 0;
+static size_t numWatches = 0;
+
+/* (parent, name) -> wd, open addressing with backward shift deletion */
+static int *children = NULL;
+static size_t childSlots = 0;
+
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+static int limitReported = 0;
+
+static void *xmalloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+	errorf("Out of memory");
+	exit(1);
+    }
+    return ptr;
+}
+
+static uint32_t childHash(int parent, const char *name) {
+    uint32_t hash = 2166136261u ^ (uint32_t) parent;
+    while (*name != '\0') {
+	hash ^= (unsigned char) *name++;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t childSlot(int parent, const char *name) {
+    size_t index = childHash(parent, name) & (childSlots - 1);
+    while (children[index] != -1) {
+	struct watch *w = &watches[children[index]];
+	if (w->parent == parent && strcmp(w->name, name) == 0)
+	    break;
+	index = (index + 1) & (childSlots - 1);
+    }
+    return index;
+}
+
+static void growChildren() {
+    int *old = children;
+    size_t oldSlots = childSlots, i;
+
+    childSlots = childSlots == 0 ? INITIAL_CHILD_SLOTS : childSlots * 2;
+    children = xmalloc(childSlots * sizeof(int));
+    memset(children, -1, childSlots * sizeof(int));
+    for (i = 0; i < oldSlots; i++)
+	if (old[i] != -1)
+	    children[childSlot(watches[old[i]].parent, watches[old[i]].name)] = old[i];
+    free(old);
+}
+
+static void unlinkChild(int wd) {
+    size_t index, next, home;
+
+    if (watches[wd].parent < 0)
+	return;
+    index = childSlot(watches[wd].parent, watches[wd].name);
+    if (children[index] != wd)
+	return;
+    /* backward shift: pull later entries of the cluster into the hole */
+    children[index] = -1;
+    for (next = (index + 1) & (childSlots - 1); children[next] != -1;
+	 next = (next + 1) & (childSlots - 1)) {
+	struct watch *w = &watches[children[next]];
+	home = childHash(w->parent, w->name) & (childSlots - 1);
+	if (((next - home) & (childSlots - 1)) >= ((next - index) & (childSlots - 1))) {
+	    children[index] = children[next];
+	    children[next] = -1;
+	    index = next;
+	}
+    }
+}
+
+static void linkChild(int wd) {
+    if (watches[wd].parent < 0)
+	return;
+    if ((numWatches + 1) * 2 > childSlots)
+	growChildren();
+    children[childSlot(watches[wd].parent, watches[wd].name)] = wd;
+}
+
+static void setWatch(int wd, int parent, const char *name) {
+    pthread_mutex_lock(&tableLock);
+    if ((size_t) wd >= watchCapacity) {
+	size_t capacity = watchCapacity == 0 ? 1024 : watchCapacity;
+	size_t i;
+	while (capacity <= (size_t) wd)
+	    capacity *= 2;
+	watches = realloc(watches, capacity * sizeof(struct watch));
+	if (watches == NULL) {
+	    errorf("Out of memory");
+	    exit(1);
+	}
+	for (i = watchCapacity; i < capacity; i++)
+	    watches[i].wd = -1;
+	watchCapacity = capacity;
+    }
+    if (watches[wd].wd != -1) {
+	/* the same directory reached twice, e.g. through a new subtree event */
+	unlinkChild(wd);
+	free(watches[wd].name);
+	numWatches--;
+    }
+    watches[wd].wd = wd;
+    watches[wd].parent = parent;
+    watches[wd].lastEvent = 0;
+    watches[wd].name = strdup(name);
+    if (watches[wd].name == NULL) {
+	errorf("Out of memory");
+	exit(1);
+    }
+    numWatches++;
+    linkChild(wd);
+    pthread_mutex_unlock(&tableLock);
+}
+
+int initWatches(int fd, uint32_t mask) {
+    inotifyFd = fd;
+    watchMask = mask | IN_ONLYDIR | IN_DONT_FOLLOW;
+    return 0;
+}
+
+static int watchDirectory(const char *path, int parent, const char *name) {
+    int wd = inotify_add_watch(inotifyFd, path, watchMask);
+
+    if (wd < 0) {
+	if (errno == ENOSPC && !limitReported) {
+	    warnf("Watch limit reached at %s, raise fs.inotify.max_user_watches", path);
+	    limitReported = 1;
+	} else if (errno != ENOENT && errno != ENOTDIR && errno != ENOSPC) {
+	    warnf("Cannot watch %s: %s", path, strerror(errno));
+	}
+	return -1;
+    }
+    setWatch(wd, parent, name);
+    return wd;
+}
+
+static void pushItem(struct walkQueue *queue, char *path, int wd) {
+    if (queue->length == queue->capacity) {
+	queue->capacity = queue->capacity == 0 ? 256 : queue->capacity * 2;
+	queue->items = realloc(queue->items, queue->capacity * sizeof(struct walkItem));
+	if (queue->items == NULL) {
+	    errorf("Out of memory");
+	    exit(1);
+	}
+    }
+    queue->items[queue->length].path = path;
+    queue->items[queue->length].wd = wd;
+    queue->length++;
+}
+
+/* Lists one directory, watching and queueing its subdirectories. */
+static void listDirectory(struct walkQueue *queue, struct walkItem *item) {
+    size_t pathLength = strlen(item->path);
+    struct dirent *entry;
+    DIR *dir;
+
+    dir = opendir(item->path);
+    if (dir == NULL)
+	return;
+    while ((entry = readdir(dir)) != NULL) {
+	char *childPath;
+	int isDir = entry->d_type == DT_DIR, wd;
+
+	if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+	    continue;
+	if (entry->d_type == DT_UNKNOWN) {
+	    struct stat info;
+	    isDir = fstatat(dirfd(dir), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) == 0
+		&& S_ISDIR(info.st_mode);
+	}
+	if (!isDir)
+	    continue;
+
+	childPath = xmalloc(pathLength + strlen(entry->d_name) + 2);
+	sprintf(childPath, "%s/%s", item->path, entry->d_name);
+	wd = watchDirectory(childPath, item->wd, entry->d_name);
+	if (wd < 0) {
+	    free(childPath);
+	    continue;
+	}
+	pthread_mutex_lock(&queue->lock);
+	pushItem(queue, childPath, wd);
+	pthread_cond_signal(&queue->ready);
+	pthread_mutex_unlock(&queue->lock);
+    }
+    closedir(dir);
+}
+
+static void *walkThread(void *arg) {
+    struct walkQueue *queue = arg;
+    struct walkItem item;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+	while (queue->length == 0 && queue->busy > 0)
+	    pthread_cond_wait(&queue->ready, &queue->lock);
+	if (queue->length == 0)
+	    break;
+	item = queue->items[--queue->length];
+	queue->busy++;
+	pthread_mutex_unlock(&queue->lock);
+
+	listDirectory(queue, &item);
+	free(item.path);
+
+	pthread_mutex_lock(&queue->lock);
+	if (--queue->busy == 0 && queue->length == 0)
+	    pthread_cond_broadcast(&queue->ready);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+static int countWalkThreads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    /* listing is mostly waiting on the disk, oversubscribe a little */
+    cpus = cpus < 1 ? 2 : cpus * 2;
+    return cpus > MAX_WALK_THREADS ? MAX_WALK_THREADS : cpus;
+}
+
+/*
+ * Watches path and every directory below it, with no depth limit. The
+ * directories are listed by a pool of threads sharing a work stack.
+ * Returns the wd of path, or -1 if it can't be watched.
+ */
+int addTree(const char *path, int parent, const char *name) {
+    pthread_t threads[MAX_WALK_THREADS];
+    struct walkQueue queue;
+    int numThreads = countWalkThreads(), started = 0, wd, t;
+
+    wd = watchDirectory(path, parent, name);
+    if (wd < 0)
+	return -1;
+
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.ready, NULL);
+    pushItem(&queue, strdup(path), wd);
+
+    for (t = 0; t < numThreads; t++)
+	if (pthread_create(&threads[started], NULL, walkThread, &queue) == 0)
+	    started++;
+    if (started == 0)
+	walkThread(&queue);
+    for (t = 0; t < started; t++)
+	pthread_join(threads[t], NULL);
+
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.ready);
+    free(queue.items);
+    return wd;
+}
+
+struct watch *findWatch(int wd) {
+    if (wd < 0 || (size_t) wd >= watchCapacity || watches[wd].wd == -1)
+	return NULL;
+    return &watches[wd];
+}
+
+int findChild(int parent, const char *name) {
+    if (childSlots == 0)
+	return -1;
+    return children[childSlot(parent, name)];
+}
+
+/* A watched directory was renamed inside the tree, its wd stays valid. */
+void moveWatch(int wd, int parent, const char *name) {
+    char *copy;
+
+    if (findWatch(wd) == NULL)
+	return;
+    copy = strdup(name);
+    if (copy == NULL) {
+	errorf("Out of memory");
+	exit(1);
+    }
+    unlinkChild(wd);
+    free(watches[wd].name);
+    watches[wd].name = copy;
+    watches[wd].parent = parent;
+    linkChild(wd);
+}
+
+/* Whether wd leads up to the root, and not to a detached or dropped directory. */
+int inTree(int wd) {
+    struct watch *w;
+
+    for (w = findWatch(wd); w != NULL; w = findWatch(w->parent))
+	if (w->parent == NO_PARENT)
+	    return 1;
+    return 0;
+}
+
+/* Forgets a watch the kernel already dropped (IN_IGNORED). */
+void removeWatch(int wd) {
+    if (findWatch(wd) == NULL)
+	return;
+    unlinkChild(wd);
+    free(watches[wd].name);
+    watches[wd].wd = -1;
+    numWatches--;
+}
+
+/*
+ * Drops a directory that left the tree and everything below it. Only
+ * parent links are kept, so descendants are found by sweeping the table
+ * until no watch points at a removed one.
+ */
+void removeTree(int wd) {
+    size_t i;
+    int removed;
+
+    if (findWatch(wd) == NULL)
+	return;
+    inotify_rm_watch(inotifyFd, wd);
+    removeWatch(wd);
+    do {
+	removed = 0;
+	for (i = 0; i < watchCapacity; i++) {
+	    if (watches[i].wd == -1 || watches[i].parent < 0)
+		continue;
+	    if (findWatch(watches[i].parent) == NULL) {
+		inotify_rm_watch(inotifyFd, watches[i].wd);
+		removeWatch(watches[i].wd);
+		removed = 1;
+	    }
+	}
+    } while (removed);
+}
+
+void removeAllWatches() {
+    size_t i;
+    for (i = 0; i < watchCapacity; i++)
+	if (watches[i].wd != -1)
+	    free(watches[i].name);
+    free(watches);
+    free(children);
+    watches = NULL;
+    children = NULL;
+    watchCapacity = childSlots = numWatches = 0;
+}
+
+/*
+ * Writes the path of name inside directory wd, walking parent links from
+ * the end of the buffer backwards. Relative paths leave the root out.
+ * Returns -1 when the path does not fit or wd is unknown.
+ */
+int buildPath(int wd, const char *name, int full, char *path, size_t size) {
+    char *pos = path + size;
+    struct watch *w;
+    size_t length;
+
+    *--pos = '\0';
+    if (name != NULL && name[0] != '\0') {
+	length = strlen(name);
+	if (length + 1 >= (size_t) (pos - path))
+	    return -1;
+	pos -= length;
+	memcpy(pos, name, length);
+    }
+    for (w = findWatch(wd); w != NULL; w = findWatch(w->parent)) {
+	if (w->parent == NO_PARENT && !full)
+	    break;
+	length = strlen(w->name);
+	if (length + 2 >= (size_t) (pos - path))
+	    return -1;
+	if (*pos != '\0')
+	    *--pos = '/';
+	pos -= length;
+	memcpy(pos, w->name, length);
+	if (w->parent == NO_PARENT)
+	    break;
+    }
+    if (w == NULL)
+	return -1;
+    memmove(path, pos, path + size - pos);
+    return 0;
+}
+
+size_t countWatches() {
+    return numWatches;
+}
+
+void touchWatch(int wd, long long now) {
+    if (findWatch(wd) != NULL)
+	watches[wd].lastEvent = now;
+}
+
+static int activeSince(int wd, long long since) {
+    return watches[wd].lastEvent != 0 && watches[wd].lastEvent >= since;
+}
+
+/*
+ * Walks again every directory that had events since the given time, so
+ * subdirectories created while the event queue was overflowing get their
+ * watches. A directory below another active one is covered by that walk.
+ * Returns the number of subtrees walked.
+ */
+int rescanActive(long long since) {
+    char path[4096];
+    int *active, numActive = 0, i, wd;
+    struct watch *w;
+    char *name;
+
+    active = xmalloc((numWatches + 1) * sizeof(int));
+    for (wd = 0; (size_t) wd < watchCapacity; wd++) {
+	if (watches[wd].wd == -1 || !activeSince(wd, since))
+	    continue;
+	for (w = findWatch(watches[wd].parent); w != NULL; w = findWatch(w->parent))
+	    if (activeSince(w->wd, since))
+		break;
+	if (w == NULL)
+	    active[numActive++] = wd;
+    }
+
+    for (i = 0; i < numActive; i++) {
+	w = findWatch(active[i]);
+	if (w == NULL || buildPath(w->wd, NULL, 1, path, sizeof(path)) < 0)
+	    continue;
+	/* setWatch frees the old name when the wd comes back */
+	name = strdup(w->name);
+	if (name == NULL) {
+	    errorf("Out of memory");
+	    exit(1);
+	}
+	addTree(path, w->parent, name);
+	free(name);
+    }
+    free(active);
+    return numActive;
+}
@@ -0,0 +1,32 @@
+// Watch tree
+//
+// Every watched directory is kept as its inotify watch descriptor, the
+// descriptor of its parent and its own name, so full paths are rebuilt
+// on demand instead of being stored per directory.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NO_PARENT -1
+#define DETACHED -2     /* parent of a directory moved away until its pair shows up */
+
+struct watch {
+    int wd;         /* -1 when the slot is free */
+    int parent;     /* NO_PARENT for the root, DETACHED while moved away */
+    char *name;     /* entry name in the parent, the full path for the root */
+    long long lastEvent;    /* monotonic ms of the last event inside it */
+};
+
+int initWatches(int inotifyFd, uint32_t mask);
+int addTree(const char *path, int parent, const char *name);
+struct watch *findWatch(int wd);
+int findChild(int parent, const char *name);
+void moveWatch(int wd, int parent, const char *name);
+int inTree(int wd);
+void removeWatch(int wd);
+void removeTree(int wd);
+void removeAllWatches();
+int buildPath(int wd, const char *name, int full, char *path, size_t size);
+size_t countWatches();
+void touchWatch(int wd, long long now);
+int rescanActive(long long since);
@@ -1,6 +1,822 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
-int main()
-{
+#define INSERTION_CUTOFF 16
+#define PARALLEL_CUTOFF 8192        /* smaller ranges are not worth a thread */
+#define MAX_SORT_THREADS 64
+#define DEFAULT_BUDGET_MB 512
+#define TEXT_BLOCK_SIZE (1024 * 1024)
+#define MAX_RUNS 4096
+#define RADIX_CUTOFF 64
+#define MULTIKEY_CUTOFF 16
+
+typedef int (*compareFunc)(const void *, const void *);
+
+/* Element types with a specialized, comparator-free sort path. */
+enum sortType {
+    SORT_GENERIC,       /* anything, through the comparator */
+    SORT_LONG,          /* array of long */
+    SORT_STRING,        /* array of NUL-terminated char pointers */
+};
+
+struct sortTask {
+    char *src;          /* elements to sort */
+    char *other;        /* scratch of the same length */
+    size_t n;
+    int intoOther;      /* leave the result in other instead of src */
+    int depth;          /* levels that may still spawn threads */
+    size_t size;
+    compareFunc cmp;
+};
+
+struct mergeTask {
+    char *a;
+    size_t na;
+    char *b;
+    size_t nb;
+    char *out;
+    int depth;
+    size_t size;
+    compareFunc cmp;
+};
+
+struct textBlock {
+    struct textBlock *next;
+    size_t used;
+    char data[TEXT_BLOCK_SIZE];
+};
+
+/* Records of the current run, either numbers or strings. */
+struct records {
+    int numeric;
+    long *numbers;
+    char **strings;
+    size_t count;
+    size_t capacity;
+    size_t bytes;       /* memory charged against the budget */
+    struct textBlock *text;
+};
+
+/* A string together with the 8 bytes of it currently being compared. */
+struct keyPrefix {
+    uint64_t prefix;
+    const char *str;
+};
+
+struct runSource {
+    FILE *file;
+    char *line;
+    size_t lineCapacity;
+    long number;
+    int done;
+};
+
+void msort(void *base, size_t n, size_t size, compareFunc cmp);
+void msortTyped(void *base, size_t n, size_t size, enum sortType type, compareFunc cmp);
+
+static void swapElements(char *a, char *b, size_t size) {
+    char chunk[64];
+    while (size > 0) {
+	size_t step = size < sizeof(chunk) ? size : sizeof(chunk);
+	memcpy(chunk, a, step);
+	memcpy(a, b, step);
+	memcpy(b, chunk, step);
+	a += step;
+	b += step;
+	size -= step;
+    }
+}
+
+static void insertionSort(char *base, size_t n, size_t size, compareFunc cmp) {
+    size_t i, j;
+    for (i = 1; i < n; i++)
+	for (j = i; j > 0 && cmp(base + (j - 1) * size, base + j * size) > 0; j--)
+	    swapElements(base + (j - 1) * size, base + j * size, size);
+}
+
+/* First index in [0, n) whose element is not less than key (or greater, when upper). */
+static size_t searchRun(char *run, size_t n, const char *key, size_t size,
+			compareFunc cmp, int upper) {
+    size_t low = 0, high = n;
+    while (low < high) {
+	size_t mid = low + (high - low) / 2;
+	int c = cmp(run + mid * size, key);
+	if (c < 0 || (upper && c == 0))
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+    return low;
+}
+
+static void *mergeThread(void *arg);
+
+/*
+ * Stable merge of a and b into out. With depth left, the larger run is
+ * split at its middle, the matching split point of the other run is
+ * found by binary search and both halves are merged concurrently.
+ */
+static void mergeRuns(struct mergeTask *task) {
+    size_t size = task->size;
+
+    if (task->depth > 0 && task->na + task->nb > PARALLEL_CUTOFF && task->na > 0 && task->nb > 0) {
+	struct mergeTask left = *task, right = *task;
+	size_t ma, mb;
+	pthread_t thread;
+
+	if (task->na >= task->nb) {
+	    ma = task->na / 2;
+	    mb = searchRun(task->b, task->nb, task->a + ma * size, size, task->cmp, 0);
+	} else {
+	    mb = task->nb / 2;
+	    ma = searchRun(task->a, task->na, task->b + mb * size, size, task->cmp, 1);
+	}
+	left.na = ma;
+	left.nb = mb;
+	left.depth = right.depth = task->depth - 1;
+	right.a = task->a + ma * size;
+	right.na = task->na - ma;
+	right.b = task->b + mb * size;
+	right.nb = task->nb - mb;
+	right.out = task->out + (ma + mb) * size;
+
+	if (pthread_create(&thread, NULL, mergeThread, &left) == 0) {
+	    mergeRuns(&right);
+	    pthread_join(thread, NULL);
+	} else {
+	    mergeRuns(&left);
+	    mergeRuns(&right);
+	}
+	return;
+    }
+
+    {
+	char *a = task->a, *aEnd = task->a + task->na * size;
+	char *b = task->b, *bEnd = task->b + task->nb * size;
+	char *out = task->out;
+
+	while (a < aEnd && b < bEnd) {
+	    if (task->cmp(a, b) <= 0) {
+		memcpy(out, a, size);
+		a += size;
+	    } else {
+		memcpy(out, b, size);
+		b += size;
+	    }
+	    out += size;
+	}
+	memcpy(out, a, aEnd - a);
+	memcpy(out + (aEnd - a), b, bEnd - b);
+    }
+}
+
+static void *mergeThread(void *arg) {
+    mergeRuns(arg);
+    return NULL;
+}
+
+static void *sortThread(void *arg);
+
+/*
+ * Merge sort that ping-pongs between src and other: the halves are
+ * sorted into the buffer the result does not go to and merged back, so
+ * no level needs a copy or an allocation.
+ */
+static void sortRange(struct sortTask *task) {
+    struct sortTask left, right;
+    struct mergeTask merge;
+    size_t size = task->size, half = task->n / 2;
+    pthread_t thread;
+    int spawned = 0;
+
+    if (task->n <= INSERTION_CUTOFF) {
+	insertionSort(task->src, task->n, size, task->cmp);
+	if (task->intoOther)
+	    memcpy(task->other, task->src, task->n * size);
+	return;
+    }
+
+    left = right = *task;
+    left.n = half;
+    left.intoOther = right.intoOther = !task->intoOther;
+    right.src = task->src + half * size;
+    right.other = task->other + half * size;
+    right.n = task->n - half;
+
+    if (task->depth > 0 && task->n > PARALLEL_CUTOFF) {
+	left.depth = right.depth = task->depth - 1;
+	spawned = pthread_create(&thread, NULL, sortThread, &left) == 0;
+    }
+    if (!spawned)
+	sortRange(&left);
+    sortRange(&right);
+    if (spawned)
+	pthread_join(thread, NULL);
+
+    merge.a = task->intoOther ? task->src : task->other;
+    merge.na = half;
+    merge.b = merge.a + half * size;
+    merge.nb = task->n - half;
+    merge.out = task->intoOther ? task->other : task->src;
+    merge.depth = task->depth;
+    merge.size = size;
+    merge.cmp = task->cmp;
+    mergeRuns(&merge);
+}
+
+static void *sortThread(void *arg) {
+    sortRange(arg);
+    return NULL;
+}
+
+static int countSortThreads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : cpus > MAX_SORT_THREADS ? MAX_SORT_THREADS : cpus;
+}
+
+/*
+ * Sorts n elements of the given size, qsort style. A single scratch
+ * buffer is allocated for the whole sort; when it can't be, the sort
+ * falls back to qsort rather than failing.
+ */
+void msort(void *base, size_t n, size_t size, compareFunc cmp) {
+    struct sortTask task;
+    int threads = countSortThreads(), depth = 0;
+
+    if (n < 2)
+	return;
+    task.other = malloc(n * size);
+    if (task.other == NULL) {
+	qsort(base, n, size, cmp);
+	return;
+    }
+    while ((1 << depth) < threads)
+	depth++;
+
+    task.src = base;
+    task.n = n;
+    task.intoOther = 0;
+    task.depth = depth;
+    task.size = size;
+    task.cmp = cmp;
+    sortRange(&task);
+    free(task.other);
+}
+
+static int compareNumbers(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+static int compareStrings(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void insertionSortLongs(long *keys, size_t n) {
+    size_t i, j;
+    for (i = 1; i < n; i++) {
+	long key = keys[i];
+	for (j = i; j > 0 && keys[j - 1] > key; j--)
+	    keys[j] = keys[j - 1];
+	keys[j] = key;
+    }
+}
+
+/*
+ * LSD radix sort, one byte per pass. All eight histograms come from a
+ * single read of the keys, and passes whose byte is the same for every
+ * key are skipped. The sign bit is flipped so negatives sort first.
+ */
+static void radixSortLongs(long *keys, size_t n) {
+    static const uint64_t signBit = (uint64_t) 1 << 63;
+    size_t counts[sizeof(long)][256];
+    uint64_t *src = (uint64_t *) keys, *dst, *swap;
+    size_t i, pass;
+
+    if (n <= RADIX_CUTOFF) {
+	insertionSortLongs(keys, n);
+	return;
+    }
+    dst = malloc(n * sizeof(uint64_t));
+    if (dst == NULL) {
+	msort(keys, n, sizeof(long), compareNumbers);
+	return;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n; i++) {
+	uint64_t key = src[i] ^ signBit;
+	for (pass = 0; pass < sizeof(long); pass++)
+	    counts[pass][(key >> (pass * 8)) & 0xff]++;
+    }
+
+    for (pass = 0; pass < sizeof(long); pass++) {
+	size_t *count = counts[pass], offset = 0;
+	int shift = pass * 8, b;
+
+	if (count[((src[0] ^ signBit) >> shift) & 0xff] == n)
+	    continue;
+	for (b = 0; b < 256; b++) {
+	    size_t c = count[b];
+	    count[b] = offset;
+	    offset += c;
+	}
+	for (i = 0; i < n; i++)
+	    dst[count[((src[i] ^ signBit) >> shift) & 0xff]++] = src[i];
+	swap = src;
+	src = dst;
+	dst = swap;
+    }
+
+    if (src != (uint64_t *) keys) {
+	memcpy(keys, src, n * sizeof(uint64_t));
+	free(src);
+    } else {
+	free(dst);
+    }
+}
+
+/* Bytes [depth, depth + 8) of str, big endian and zero filled past the end. */
+static uint64_t loadPrefix(const char *str, size_t depth) {
+    const unsigned char *p = (const unsigned char *) str + depth;
+    uint64_t prefix = 0;
+    int i;
+
+    for (i = 0; i < 8 && p[i] != '\0'; i++)
+	prefix |= (uint64_t) p[i] << (56 - i * 8);
+    return prefix;
+}
+
+/* A prefix whose last byte is zero holds the end of its string. */
+static int prefixHasEnd(uint64_t prefix) {
+    return (prefix & 0xff) == 0;
+}
+
+static int compareKeys(const struct keyPrefix *x, const struct keyPrefix *y, size_t depth) {
+    if (x->prefix != y->prefix)
+	return x->prefix < y->prefix ? -1 : 1;
+    if (prefixHasEnd(x->prefix))
+	return 0;
+    return strcmp(x->str + depth + 8, y->str + depth + 8);
+}
+
+static void swapKeys(struct keyPrefix *a, size_t i, size_t j) {
+    struct keyPrefix key = a[i];
+    a[i] = a[j];
+    a[j] = key;
+}
+
+/*
+ * Multikey quicksort over cached 8-byte prefixes: a three-way partition
+ * on the cached prefix, recursion for the smaller and larger sides and a
+ * reload of the next 8 bytes for the equal side. Strings are only
+ * touched when a partition moves on to a deeper prefix.
+ */
+static void multikeySort(struct keyPrefix *a, size_t n, size_t depth) {
+    while (n > MULTIKEY_CUTOFF) {
+	uint64_t x = a[0].prefix, y = a[n / 2].prefix, z = a[n - 1].prefix, pivot;
+	size_t lt = 0, i = 0, gt = n;
+
+	pivot = x < y ? (y < z ? y : (x < z ? z : x)) : (x < z ? x : (y < z ? z : y));
+	while (i < gt) {
+	    if (a[i].prefix < pivot)
+		swapKeys(a, lt++, i++);
+	    else if (a[i].prefix > pivot)
+		swapKeys(a, i, --gt);
+	    else
+		i++;
+	}
+	multikeySort(a, lt, depth);
+	multikeySort(a + gt, n - gt, depth);
+
+	if (prefixHasEnd(pivot))
+	    return;
+	a += lt;
+	n = gt - lt;
+	depth += 8;
+	for (i = 0; i < n; i++)
+	    a[i].prefix = loadPrefix(a[i].str, depth);
+    }
+
+    {
+	size_t i, j;
+	for (i = 1; i < n; i++) {
+	    struct keyPrefix key = a[i];
+	    for (j = i; j > 0 && compareKeys(&a[j - 1], &key, depth) > 0; j--)
+		a[j] = a[j - 1];
+	    a[j] = key;
+	}
+    }
+}
+
+static void multikeySortStrings(char **strings, size_t n) {
+    struct keyPrefix *keys;
+    size_t i;
+
+    keys = malloc(n * sizeof(struct keyPrefix));
+    if (keys == NULL) {
+	msort(strings, n, sizeof(char *), compareStrings);
+	return;
+    }
+    for (i = 0; i < n; i++) {
+	keys[i].str = strings[i];
+	keys[i].prefix = loadPrefix(strings[i], 0);
+    }
+    multikeySort(keys, n, 0);
+    for (i = 0; i < n; i++)
+	strings[i] = (char *) keys[i].str;
+    free(keys);
+}
+
+/*
+ * Like msort, but element types that have a specialized kernel skip the
+ * per-comparison indirect call. cmp is only used by SORT_GENERIC and by
+ * the fallbacks, and must agree with the kernels' ordering.
+ */
+void msortTyped(void *base, size_t n, size_t size, enum sortType type, compareFunc cmp) {
+    if (n < 2)
+	return;
+    if (type == SORT_LONG && size == sizeof(long))
+	radixSortLongs(base, n);
+    else if (type == SORT_STRING && size == sizeof(char *))
+	multikeySortStrings(base, n);
+    else
+	msort(base, n, size, cmp);
+}
+
+static void *growArray(void *array, size_t *capacity, size_t size) {
+    *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+    array = realloc(array, *capacity * size);
+    if (array == NULL) {
+	perror("realloc");
+	exit(1);
+    }
+    return array;
+}
+
+static char *storeText(struct records *records, const char *text, size_t length) {
+    struct textBlock *block = records->text;
+    char *copy;
+
+    if (length + 1 > TEXT_BLOCK_SIZE) {
+	fprintf(stderr, "Line too long, skipping it\n");
+	return NULL;
+    }
+    if (block == NULL || block->used + length + 1 > TEXT_BLOCK_SIZE) {
+	block = malloc(sizeof(struct textBlock));
+	if (block == NULL) {
+	    perror("malloc");
+	    exit(1);
+	}
+	block->next = records->text;
+	block->used = 0;
+	records->text = block;
+    }
+    copy = block->data + block->used;
+    memcpy(copy, text, length + 1);
+    block->used += length + 1;
+    records->bytes += length + 1;
+    return copy;
+}
+
+static void addRecord(struct records *records, char *line, size_t length) {
+    if (records->numeric) {
+	char *end;
+	long value;
+	errno = 0;
+	value = strtol(line, &end, 10);
+	if (end == line || *end != '\0' || errno != 0) {
+	    fprintf(stderr, "Invalid number [%s], skipping it\n", line);
+	    return;
+	}
+	if (records->count == records->capacity)
+	    records->numbers = growArray(records->numbers, &records->capacity, sizeof(long));
+	records->numbers[records->count++] = value;
+	records->bytes += 2 * sizeof(long); /* element plus its share of scratch */
+    } else {
+	char *copy = storeText(records, line, length);
+	if (copy == NULL)
+	    return;
+	if (records->count == records->capacity)
+	    records->strings = growArray(records->strings, &records->capacity, sizeof(char *));
+	records->strings[records->count++] = copy;
+	records->bytes += 2 * sizeof(char *);
+    }
+}
+
+static void sortRecords(struct records *records) {
+    if (records->numeric)
+	msortTyped(records->numbers, records->count, sizeof(long), SORT_LONG, compareNumbers);
+    else
+	msortTyped(records->strings, records->count, sizeof(char *), SORT_STRING, compareStrings);
+}
+
+static void writeRecords(struct records *records, FILE *out) {
+    size_t i;
+    for (i = 0; i < records->count; i++) {
+	if (records->numeric)
+	    fprintf(out, "%ld\n", records->numbers[i]);
+	else
+	    fprintf(out, "%s\n", records->strings[i]);
+    }
+}
+
+static void clearRecords(struct records *records) {
+    struct textBlock *block, *next;
+    for (block = records->text; block != NULL; block = next) {
+	next = block->next;
+	free(block);
+    }
+    records->text = NULL;
+    records->count = 0;
+    records->bytes = 0;
+}
+
+/* Sorts the current run and writes it to a temporary file. */
+static FILE *spillRun(struct records *records) {
+    FILE *run = tmpfile();
+    if (run == NULL) {
+	perror("tmpfile");
+	exit(1);
+    }
+    sortRecords(records);
+    writeRecords(records, run);
+    if (fflush(run) != 0 || ferror(run)) {
+	perror("spill");
+	exit(1);
+    }
+    rewind(run);
+    clearRecords(records);
+    return run;
+}
+
+static void advanceSource(struct runSource *source, int numeric) {
+    ssize_t length = getline(&source->line, &source->lineCapacity, source->file);
+    if (length < 0) {
+	source->done = 1;
+	return;
+    }
+    if (length > 0 && source->line[length - 1] == '\n')
+	source->line[length - 1] = '\0';
+    if (numeric)
+	source->number = strtol(source->line, NULL, 10);
+}
+
+/* Non-zero when source a must come after source b; exhausted sources lose. */
+static int losesTo(struct runSource *sources, int a, int b, int k, int numeric) {
+    int c;
+    if (b == k)
+	return 1;   /* virtual leaf used to seed the tree always wins */
+    if (a == k)
+	return 0;
+    if (sources[a].done || sources[b].done)
+	return sources[a].done && (!sources[b].done || a > b);
+    if (numeric)
+	c = (sources[a].number > sources[b].number) - (sources[a].number < sources[b].number);
+    else
+	c = strcmp(sources[a].line, sources[b].line);
+    return c > 0 || (c == 0 && a > b);
+}
+
+/* Replays leaf s up to the root; tree[0] ends up holding the winner. */
+static void adjustTree(int *tree, struct runSource *sources, int s, int k, int numeric) {
+    int t, winner = s;
+    for (t = (s + k) / 2; t > 0; t /= 2) {
+	if (losesTo(sources, winner, tree[t], k, numeric)) {
+	    int swap = tree[t];
+	    tree[t] = winner;
+	    winner = swap;
+	}
+    }
+    tree[0] = winner;
+}
+
+/* k-way merge of sorted runs through a loser tree. */
+static void mergeRunFiles(FILE **runs, int k, int numeric, FILE *out) {
+    struct runSource *sources = calloc(k, sizeof(struct runSource));
+    int *tree = malloc(k * sizeof(int));
+    int i;
+
+    if (sources == NULL || tree == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    for (i = 0; i < k; i++) {
+	sources[i].file = runs[i];
+	advanceSource(&sources[i], numeric);
+	tree[i] = k;
+    }
+    for (i = k - 1; i >= 0; i--)
+	adjustTree(tree, sources, i, k, numeric);
+
+    while (!sources[tree[0]].done) {
+	int winner = tree[0];
+	fprintf(out, "%s\n", sources[winner].line);
+	advanceSource(&sources[winner], numeric);
+	adjustTree(tree, sources, winner, k, numeric);
+    }
+
+    for (i = 0; i < k; i++) {
+	free(sources[i].line);
+	fclose(runs[i]);
+    }
+    free(sources);
+    free(tree);
+}
+
+/*
+ * Sorts the lines of a file. Records are sorted in memory while they fit
+ * the budget; past it, sorted runs are spilled to temporary files and
+ * merged at the end.
+ */
+int sortFile(char *fileName, int numeric, size_t budget) {
+    struct records records;
+    FILE *in, *runs[MAX_RUNS];
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t length;
+    int numRuns = 0;
+
+    in = fopen(fileName, "r");
+    if (in == NULL) {
+	perror(fileName);
+	return -1;
+    }
+
+    memset(&records, 0, sizeof(records));
+    records.numeric = numeric;
+    while ((length = getline(&line, &lineCapacity, in)) >= 0) {
+	if (length > 0 && line[length - 1] == '\n')
+	    line[--length] = '\0';
+	if (length > 0 && line[length - 1] == '\r')
+	    line[--length] = '\0';
+	if (length == 0)
+	    continue;
+	addRecord(&records, line, length);
+	if (records.bytes >= budget) {
+	    if (numRuns == MAX_RUNS - 1) {
+		fprintf(stderr, "Too many runs, raise the memory budget\n");
+		exit(1);
+	    }
+	    runs[numRuns++] = spillRun(&records);
+	}
+    }
+    free(line);
+    fclose(in);
+
+    if (numRuns == 0) {
+	sortRecords(&records);
+	writeRecords(&records, stdout);
+    } else {
+	if (records.count > 0)
+	    runs[numRuns++] = spillRun(&records);
+	mergeRunFiles(runs, numRuns, numeric, stdout);
+    }
+
+    clearRecords(&records);
+    free(records.numbers);
+    free(records.strings);
+    return 0;
+}
+
+static double secondsSince(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Times qsort, msort and msortTyped over the file's records replicated
+ * scale times. Replicas are made distinct (numbers are spread out,
+ * strings get a suffix) so the scaled input keeps few duplicates.
+ */
+int benchmark(char *fileName, int numeric, long scale) {
+    static const char *names[] = {"qsort", "msort", "msortTyped"};
+    struct records records;
+    struct timespec start;
+    size_t n, size = numeric ? sizeof(long) : sizeof(char *), i;
+    char *line = NULL, *input, *expected, *work;
+    size_t lineCapacity = 0;
+    ssize_t length;
+    double seconds[3];
+    long r;
+    int method;
+    FILE *in;
+
+    in = fopen(fileName, "r");
+    if (in == NULL) {
+	perror(fileName);
+	return -1;
+    }
+    memset(&records, 0, sizeof(records));
+    records.numeric = numeric;
+    while ((length = getline(&line, &lineCapacity, in)) >= 0) {
+	if (length > 0 && line[length - 1] == '\n')
+	    line[--length] = '\0';
+	if (length > 0)
+	    addRecord(&records, line, length);
+    }
+    fclose(in);
+
+    n = records.count;
+    for (r = 1; r < scale; r++) {
+	for (i = 0; i < n; i++) {
+	    if (numeric) {
+		addRecord(&records, "0", 1);
+		records.numbers[records.count - 1] =
+		    (long) ((unsigned long) records.numbers[i] * scale + r);
+	    } else {
+		size_t copyLength = snprintf(NULL, 0, "%s%ld", records.strings[i], r);
+		line = realloc(line, copyLength + 1);
+		snprintf(line, copyLength + 1, "%s%ld", records.strings[i], r);
+		addRecord(&records, line, copyLength);
+	    }
+	}
+    }
+    free(line);
+
+    n = records.count;
+    input = numeric ? (char *) records.numbers : (char *) records.strings;
+    expected = malloc(n * size);
+    work = malloc(n * size);
+    if (expected == NULL || work == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+
+    for (method = 0; method < 3; method++) {
+	char *out = method == 0 ? expected : work;
+	memcpy(out, input, n * size);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (method == 0)
+	    qsort(out, n, size, numeric ? compareNumbers : compareStrings);
+	else if (method == 1)
+	    msort(out, n, size, numeric ? compareNumbers : compareStrings);
+	else
+	    msortTyped(out, n, size, numeric ? SORT_LONG : SORT_STRING,
+		       numeric ? compareNumbers : compareStrings);
+	seconds[method] = secondsSince(&start);
+
+	if (method > 0) {
+	    for (i = 0; i < n; i++) {
+		int c = numeric ? compareNumbers(work + i * size, expected + i * size)
+		    : compareStrings(work + i * size, expected + i * size);
+		if (c != 0) {
+		    fprintf(stderr, "%s: output differs from qsort at %zu\n", names[method], i);
+		    return -1;
+		}
+	    }
+	}
+	printf("%-10s %10zu %s  %8.3f s  %6.2fx vs qsort\n", names[method], n,
+	       numeric ? "numbers" : "strings", seconds[method], seconds[0] / seconds[method]);
+    }
+
+    free(expected);
+    free(work);
+    clearRecords(&records);
+    free(records.numbers);
+    free(records.strings);
     return 0;
 }
+
+static void usage() {
+    printf("Usage: ./generic_merge_sort.o [-n] [-m budget_mb] file.txt\n");
+    printf("       ./generic_merge_sort.o [-n] -bench scale file.txt\n");
+}
+
+int main(int argc, char **argv)
+{
+    char *fileName = NULL;
+    size_t budget = (size_t) DEFAULT_BUDGET_MB << 20;
+    long scale = 0;
+    int numeric = 0, i;
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-n") == 0) {
+	    numeric = 1;
+	} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0) {
+	    budget = (size_t) atol(argv[++i]) << 20;
+	} else if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0) {
+	    scale = atol(argv[++i]);
+	} else if (fileName == NULL) {
+	    fileName = argv[i];
+	} else {
+	    usage();
+	    return 1;
+	}
+    }
+    if (fileName == NULL) {
+	usage();
+	return 1;
+    }
+
+    if (scale > 0)
+	return benchmark(fileName, numeric, scale) == 0 ? 0 : 1;
+    return sortFile(fileName, numeric, budget) == 0 ? 0 : 1;
+}
@@ -9,9 +9,15 @@ test: build
 	./${APP_NAME}.o -n numbers.txt
 	@echo Test 2 - sort strings
 	./${APP_NAME}.o strings.txt
-	@echo Test 3 - handle missing parameters
-	./${APP_NAME}.o
-	@echo Test 4 - handle incomplete parameters
-	./${APP_NAME}.o -n
+	@echo Test 3 - failed, missing parameters
+	-./${APP_NAME}.o
+	@echo Test 4 - failed, incomplete parameters
+	-./${APP_NAME}.o -n
 clean:
 	rm -rf *.o
+bench:
+	gcc -O2 ${APP_NAME}.c -o ${APP_NAME}_bench.o
+	@echo Benchmark 1 - numbers.txt scaled to 10M numbers
+	./${APP_NAME}_bench.o -n -bench 100000 numbers.txt
+	@echo Benchmark 2 - strings.txt scaled to 2M strings
+	./${APP_NAME}_bench.o -bench 20000 strings.txt
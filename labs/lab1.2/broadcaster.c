@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <utmpx.h>
+#include <sys/epoll.h>
+
+#define MAX_TERMINALS 4096
+#define DEFAULT_TIMEOUT_MS 2000
+#define SLOW_MS 100                 /* terminals slower than this are reported */
+
+enum state {PENDING, DONE, SKIPPED};
+
+struct terminal {
+    char path[64];
+    int fd;
+    size_t sent;
+    enum state state;
+    double elapsedMs;
+    const char *reason;             /* why it was skipped */
+};
+
+static struct terminal terminals[MAX_TERMINALS];
+static int terminalCount;
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void addTerminal(const char *path) {
+    int i;
+
+    for (i = 0; i < terminalCount; i++)
+	if (strcmp(terminals[i].path, path) == 0)
+	    return;
+    if (terminalCount == MAX_TERMINALS) {
+	fprintf(stderr, "Too many terminals, ignoring %s\n", path);
+	return;
+    }
+    snprintf(terminals[terminalCount].path, sizeof(terminals[0].path), "%s", path);
+    terminals[terminalCount].fd = -1;
+    terminalCount++;
+}
+
+/* Logged-in sessions from utmp, like wall. */
+static void findSessions() {
+    struct utmpx *entry;
+    char path[64];
+
+    setutxent();
+    while ((entry = getutxent()) != NULL) {
+	if (entry->ut_type != USER_PROCESS || entry->ut_line[0] == '\0')
+	    continue;
+	snprintf(path, sizeof(path), "/dev/%.*s", (int) sizeof(entry->ut_line), entry->ut_line);
+	addTerminal(path);
+    }
+    endutxent();
+}
+
+/* Every pseudo terminal, for machines whose utmp is empty. */
+static void findPts() {
+    struct dirent *entry;
+    char path[64];
+    DIR *dir = opendir("/dev/pts");
+
+    if (dir == NULL) {
+	perror("/dev/pts");
+	return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+	if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+	    continue;
+	snprintf(path, sizeof(path), "/dev/pts/%.16s", entry->d_name);
+	addTerminal(path);
+    }
+    closedir(dir);
+}
+
+/* The message as wall shows it, with \r\n line ends for raw terminals. */
+static char *buildMessage(char **words, int count, size_t *length) {
+    struct passwd *user = getpwuid(getuid());
+    char host[256] = "localhost", header[512];
+    size_t size, n;
+    char *message, *p;
+    int i;
+
+    gethostname(host, sizeof(host) - 1);
+    n = snprintf(header, sizeof(header), "\r\nBroadcast message from %s@%s:\r\n\r\n",
+		 user != NULL ? user->pw_name : "unknown", host);
+    size = n + 4;
+    for (i = 0; i < count; i++)
+	size += 2 * strlen(words[i]) + 1;
+    message = malloc(size);
+    if (message == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    memcpy(message, header, n);
+    p = message + n;
+    for (i = 0; i < count; i++) {
+	const char *c;
+	if (i > 0)
+	    *p++ = ' ';
+	for (c = words[i]; *c != '\0'; c++) {
+	    if (*c == '\n')
+		*p++ = '\r';
+	    *p++ = *c;
+	}
+    }
+    memcpy(p, "\r\n\r\n", 4);
+    *length = p + 4 - message;
+    return message;
+}
+
+static void finish(struct terminal *t, enum state state, const char *reason, double start) {
+    t->state = state;
+    t->reason = reason;
+    t->elapsedMs = monotonicMs() - start;
+    if (t->fd >= 0) {
+	close(t->fd);
+	t->fd = -1;
+    }
+}
+
+/* Writes what the terminal takes now. Returns 1 while more is left. */
+static int writeSome(struct terminal *t, const char *message, size_t length, double start) {
+    ssize_t n;
+
+    while (t->sent < length) {
+	n = write(t->fd, message + t->sent, length - t->sent);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN)
+		return 1;
+	    finish(t, SKIPPED, strerror(errno), start);
+	    return 0;
+	}
+	t->sent += n;
+    }
+    finish(t, DONE, NULL, start);
+    return 0;
+}
+
+/*
+ * Opens every terminal non-blocking and writes as much as each one takes
+ * right away. Terminals whose buffers are full wait in epoll for room,
+ * so a terminal nobody reads only delays itself. Anything still pending
+ * after timeoutMs is dropped.
+ */
+static void broadcast(const char *message, size_t length, int timeoutMs) {
+    struct epoll_event event, events[64];
+    double start = monotonicMs(), left;
+    int epfd, pending = 0, i, n;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+	perror("epoll_create1");
+	exit(1);
+    }
+    for (i = 0; i < terminalCount; i++) {
+	struct terminal *t = &terminals[i];
+	t->fd = open(t->path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	if (t->fd < 0) {
+	    finish(t, SKIPPED, strerror(errno), start);
+	    continue;
+	}
+	if (!writeSome(t, message, length, start))
+	    continue;
+	event.events = EPOLLOUT;
+	event.data.u32 = i;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->fd, &event) < 0) {
+	    finish(t, SKIPPED, strerror(errno), start);
+	    continue;
+	}
+	pending++;
+    }
+
+    while (pending > 0) {
+	left = start + timeoutMs - monotonicMs();
+	if (left <= 0)
+	    break;
+	n = epoll_wait(epfd, events, 64, (int) left + 1);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("epoll_wait");
+	    break;
+	}
+	for (i = 0; i < n; i++) {
+	    struct terminal *t = &terminals[events[i].data.u32];
+	    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+		finish(t, SKIPPED, "hung up", start);
+		pending--;
+	    } else if (!writeSome(t, message, length, start)) {
+		pending--;
+	    }
+	}
+    }
+
+    for (i = 0; i < terminalCount; i++)
+	if (terminals[i].state == PENDING)
+	    finish(&terminals[i], SKIPPED, "timed out", start);
+    close(epfd);
+}
+
+static void report(size_t length, double elapsedMs) {
+    int i, delivered = 0, slow = 0;
+
+    for (i = 0; i < terminalCount; i++) {
+	struct terminal *t = &terminals[i];
+	if (t->state == SKIPPED) {
+	    fprintf(stderr, "Skipped %s after %.1f ms: %s (%zu of %zu bytes sent)\n",
+		    t->path, t->elapsedMs, t->reason, t->sent, length);
+	    continue;
+	}
+	delivered++;
+	if (t->elapsedMs > SLOW_MS) {
+	    fprintf(stderr, "Slow terminal %s: %.1f ms\n", t->path, t->elapsedMs);
+	    slow++;
+	}
+    }
+    printf("Delivered to %d of %d terminals (%d slow) in %.1f ms\n",
+	   delivered, terminalCount, slow, elapsedMs);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./broadcaster [-p] [-t timeout_ms] <message>\n");
+    fprintf(stderr, "  -p  write to every /dev/pts terminal instead of logged-in sessions\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, allPts = 0, timeoutMs = DEFAULT_TIMEOUT_MS;
+    size_t length;
+    char *message;
+    double start;
+
+    while ((opt = getopt(argc, argv, "+pt:")) != -1) {
+	switch (opt) {
+	case 'p':
+	    allPts = 1;
+	    break;
+	case 't':
+	    timeoutMs = atoi(optarg);
+	    if (timeoutMs <= 0) {
+		fprintf(stderr, "Invalid timeout: %s\n", optarg);
+		return 1;
+	    }
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+    if (optind == argc) {
+	usage();
+	return 1;
+    }
+
+    if (!allPts)
+	findSessions();
+    if (terminalCount == 0)
+	findPts();
+    if (terminalCount == 0) {
+	printf("No terminals to write to\n");
+	return 0;
+    }
+
+    message = buildMessage(argv + optind, argc - optind, &length);
+    start = monotonicMs();
+    broadcast(message, length, timeoutMs);
+    report(length, monotonicMs() - start);
+    free(message);
+    return 0;
+}
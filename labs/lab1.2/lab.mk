@@ -0,0 +1,15 @@
+# broadcaster build & test automation
+
+APP_NAME=broadcaster
+
+build:
+	gcc ${APP_NAME}.c -o ${APP_NAME}.o
+test: build
+	@echo Test 1
+	./${APP_NAME}.o HELLO, this is an EXAMPLE MESSAGE
+	@echo Test 2
+	./${APP_NAME}.o -p -t 500 HELLO to every pts
+	@echo Test 3 - failed
+	-./${APP_NAME}.o
+clean:
+	rm -rf *.o
@@ -0,0 +1,708 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "xref-index.h"
+
+#define MIN_WORD_LENGTH 2
+#define MAX_WORD_LENGTH 64
+#define MIN_CHUNK_SIZE (256 * 1024)
+#define MAX_THREADS 64
+#define INITIAL_MAP_SIZE 4096
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define MAX_DOCUMENTS 64
+
+/*
+ * Noise words, laid out by a perfect hash: every word lands on its own
+ * slot of ((fnv1a(word) * STOP_WORD_SEED) >> (32 - STOP_WORD_BITS)).
+ * The seed was found offline by trying odd multipliers until the list
+ * had no collisions, so a lookup is a single probe and strcmp.
+ */
+#define STOP_WORD_BITS 9
+#define STOP_WORD_SEED 0x195du
+
+static const char *stopWords[1 << STOP_WORD_BITS] = {
+    [10] = "but", [12] = "had", [13] = "has", [16] = "a", [37] = "us",
+    [48] = "other", [55] = "so", [56] = "its", [65] = "now", [71] = "any",
+    [73] = "that", [76] = "being", [85] = "my", [89] = "such", [102] = "she",
+    [104] = "over", [106] = "in", [107] = "there", [113] = "upon", [131] = "he",
+    [137] = "are", [139] = "what", [140] = "an", [142] = "before", [143] = "at",
+    [146] = "them", [152] = "if", [163] = "of", [181] = "me", [186] = "been",
+    [191] = "you", [200] = "it", [208] = "could", [209] = "on", [212] = "have",
+    [221] = "does", [225] = "will", [227] = "one", [229] = "who", [234] = "was",
+    [235] = "do", [250] = "from", [251] = "not", [258] = "into",
+    [260] = "shall", [268] = "we", [270] = "her", [274] = "this",
+    [282] = "about", [300] = "and", [303] = "also", [305] = "all",
+    [309] = "than", [310] = "were", [312] = "for", [314] = "said",
+    [317] = "these", [332] = "then", [341] = "be", [346] = "just",
+    [359] = "can", [367] = "out", [380] = "only", [383] = "how",
+    [386] = "after", [401] = "his", [404] = "with", [411] = "which",
+    [414] = "should", [421] = "would", [423] = "as", [427] = "their",
+    [430] = "to", [433] = "the", [437] = "by", [444] = "your", [446] = "did",
+    [449] = "him", [450] = "may", [460] = "some", [465] = "am", [470] = "they",
+    [481] = "is", [483] = "i", [488] = "or", [500] = "when", [502] = "up",
+    [507] = "our", [508] = "those", [509] = "no",
+};
+
+/* Line numbers of a word, delta encoded as LEB128 varints. */
+struct postings {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    uint32_t lastLine;
+    uint32_t count;
+};
+
+struct wordEntry {
+    char *word;          /* NULL marks an empty slot */
+    uint32_t length;
+    uint32_t hash;
+    struct postings lines;
+};
+
+struct arenaBlock {
+    struct arenaBlock *next;
+    size_t used;
+    char data[ARENA_BLOCK_SIZE];
+};
+
+struct wordMap {
+    struct wordEntry *slots;
+    size_t size;
+    size_t used;
+    struct arenaBlock *arena;
+};
+
+struct chunk {
+    const char *start;
+    const char *end;
+    uint32_t lines;      /* newlines found, to offset the following chunks */
+    uint32_t firstLine;  /* absolute number of the chunk's first line */
+    struct wordMap map;
+};
+
+struct shard {
+    struct chunk *chunks;
+    int numChunks;
+    int index;
+    int numShards;
+    struct wordMap map;
+};
+
+struct document {
+    char *name;
+    struct wordEntry **words; /* sorted by word */
+    size_t numWords;
+    struct shard shards[MAX_THREADS];
+    int numShards;
+};
+
+struct byteBuffer {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+};
+
+static void *xmalloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    return ptr;
+}
+
+static uint32_t hashWord(const char *word, size_t length) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++) {
+	hash ^= (unsigned char) word[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int isStopWord(const char *word, size_t length, uint32_t hash) {
+    const char *stop = stopWords[(uint32_t) (hash * STOP_WORD_SEED) >> (32 - STOP_WORD_BITS)];
+    return stop != NULL && strncmp(stop, word, length) == 0 && stop[length] == '\0';
+}
+
+static char *arenaCopy(struct wordMap *map, const char *word, size_t length) {
+    struct arenaBlock *block = map->arena;
+    char *copy;
+
+    if (block == NULL || block->used + length + 1 > ARENA_BLOCK_SIZE) {
+	block = xmalloc(sizeof(struct arenaBlock));
+	block->next = map->arena;
+	block->used = 0;
+	map->arena = block;
+    }
+    copy = block->data + block->used;
+    memcpy(copy, word, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    return copy;
+}
+
+static void initMap(struct wordMap *map) {
+    map->size = INITIAL_MAP_SIZE;
+    map->used = 0;
+    map->arena = NULL;
+    map->slots = calloc(map->size, sizeof(struct wordEntry));
+    if (map->slots == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+}
+
+static void freeMap(struct wordMap *map, int freePostings) {
+    struct arenaBlock *block, *next;
+    size_t i;
+
+    if (freePostings)
+	for (i = 0; i < map->size; i++)
+	    free(map->slots[i].lines.data);
+    for (block = map->arena; block != NULL; block = next) {
+	next = block->next;
+	free(block);
+    }
+    free(map->slots);
+}
+
+static void growMap(struct wordMap *map) {
+    struct wordEntry *old = map->slots;
+    size_t oldSize = map->size, i, index;
+
+    map->size *= 2;
+    map->slots = calloc(map->size, sizeof(struct wordEntry));
+    if (map->slots == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    for (i = 0; i < oldSize; i++) {
+	if (old[i].word == NULL)
+	    continue;
+	index = old[i].hash & (map->size - 1);
+	while (map->slots[index].word != NULL)
+	    index = (index + 1) & (map->size - 1);
+	map->slots[index] = old[i];
+    }
+    free(old);
+}
+
+/* Looks a word up, inserting it when missing. */
+static struct wordEntry *findWord(struct wordMap *map, const char *word, uint32_t length,
+				  uint32_t hash) {
+    struct wordEntry *entry;
+    size_t index;
+
+    if ((map->used + 1) * 4 > map->size * 3)
+	growMap(map);
+
+    index = hash & (map->size - 1);
+    for (;;) {
+	entry = &map->slots[index];
+	if (entry->word == NULL)
+	    break;
+	if (entry->hash == hash && entry->length == length
+	    && memcmp(entry->word, word, length) == 0)
+	    return entry;
+	index = (index + 1) & (map->size - 1);
+    }
+    entry->word = arenaCopy(map, word, length);
+    entry->length = length;
+    entry->hash = hash;
+    map->used++;
+    return entry;
+}
+
+static void addLine(struct postings *lines, uint32_t line) {
+    uint32_t delta;
+
+    if (lines->count > 0 && line == lines->lastLine)
+	return;
+    if (lines->length + 5 > lines->capacity) {
+	lines->capacity = lines->capacity == 0 ? 8 : lines->capacity * 2;
+	lines->data = realloc(lines->data, lines->capacity);
+	if (lines->data == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    delta = line - lines->lastLine;
+    while (delta >= 0x80) {
+	lines->data[lines->length++] = (delta & 0x7f) | 0x80;
+	delta >>= 7;
+    }
+    lines->data[lines->length++] = delta;
+    lines->lastLine = line;
+    lines->count++;
+}
+
+/* Decodes the next varint, advancing *pos. */
+static uint32_t nextDelta(const unsigned char *data, size_t *pos) {
+    uint32_t value = 0;
+    int shift = 0;
+    unsigned char byte;
+
+    do {
+	byte = data[(*pos)++];
+	value |= (uint32_t) (byte & 0x7f) << shift;
+	shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+static void addWord(struct wordMap *map, const char *start, size_t length, uint32_t line) {
+    char word[MAX_WORD_LENGTH];
+    uint32_t hash;
+    size_t i;
+
+    if (length < MIN_WORD_LENGTH || length > MAX_WORD_LENGTH)
+	return;
+    for (i = 0; i < length; i++)
+	word[i] = start[i] | 0x20;
+    hash = hashWord(word, length);
+    if (isStopWord(word, length, hash))
+	return;
+    addLine(&findWord(map, word, length, hash)->lines, line);
+}
+
+#ifdef __SSE2__
+/* Bit i is set when block[i] is an ASCII letter; newlines go to *newlines. */
+static uint64_t classifyBlock(const char *block, uint64_t *newlines) {
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    const __m128i shift = _mm_set1_epi8((char) (0x80 - 'a'));
+    const __m128i limit = _mm_set1_epi8((char) (-0x80 + 26));
+    const __m128i newline = _mm_set1_epi8('\n');
+    uint64_t letters = 0, lines = 0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	__m128i bytes = _mm_loadu_si128((const __m128i *) (block + i * 16));
+	/* (c | 0x20) - 'a' < 26, done as a signed compare on shifted bytes */
+	__m128i folded = _mm_add_epi8(_mm_or_si128(bytes, caseBit), shift);
+	uint64_t isAlpha = (uint16_t) _mm_movemask_epi8(_mm_cmplt_epi8(folded, limit));
+	uint64_t isNewline = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+	letters |= isAlpha << (i * 16);
+	lines |= isNewline << (i * 16);
+    }
+    *newlines = lines;
+    return letters;
+}
+#else
+static int isLetter(unsigned char c) {
+    return (unsigned char) ((c | 0x20) - 'a') < 26;
+}
+
+static uint64_t classifyBlock(const char *block, uint64_t *newlines) {
+    uint64_t letters = 0, lines = 0;
+    int i;
+
+    for (i = 0; i < 64; i++) {
+	letters |= (uint64_t) isLetter(block[i]) << i;
+	lines |= (uint64_t) (block[i] == '\n') << i;
+    }
+    *newlines = lines;
+    return letters;
+}
+#endif
+
+/*
+ * Tokenizes a chunk 64 bytes at a time. Letter and newline bitmasks give
+ * word starts and ends directly, so only bytes at a boundary are visited.
+ * Line numbers are relative to the chunk and fixed up while merging.
+ */
+static void *tokenizeChunk(void *arg) {
+    struct chunk *chunk = arg;
+    const char *pos = chunk->start, *wordStart = NULL;
+    uint32_t line = 1;
+    uint64_t prevLetter = 0;
+    char tail[64];
+
+    initMap(&chunk->map);
+    while (pos < chunk->end) {
+	const char *block = pos;
+	size_t available = chunk->end - pos;
+	uint64_t letters, newlines, starts, ends, events;
+
+	if (available < 64) {
+	    memset(tail, ' ', sizeof(tail));
+	    memcpy(tail, pos, available);
+	    block = tail;
+	}
+	letters = classifyBlock(block, &newlines);
+	if (available < 64) {
+	    letters &= ((uint64_t) 1 << available) - 1;
+	    newlines &= ((uint64_t) 1 << available) - 1;
+	}
+
+	starts = letters & ~((letters << 1) | prevLetter);
+	ends = ~letters & ((letters << 1) | prevLetter);
+	events = starts | ends | newlines;
+	prevLetter = letters >> 63;
+
+	while (events != 0) {
+	    int bit = __builtin_ctzll(events);
+	    uint64_t mask = (uint64_t) 1 << bit;
+	    events &= events - 1;
+	    if (ends & mask) {
+		addWord(&chunk->map, wordStart, pos + bit - wordStart, line);
+		wordStart = NULL;
+	    }
+	    if (starts & mask)
+		wordStart = pos + bit;
+	    if (newlines & mask)
+		line++;
+	}
+	pos += available < 64 ? available : 64;
+    }
+    if (wordStart != NULL)
+	addWord(&chunk->map, wordStart, chunk->end - wordStart, line);
+    chunk->lines = line - 1;
+    return NULL;
+}
+
+/*
+ * Each shard owns the words whose hash falls into it and pulls them out
+ * of every chunk map in chunk order, so postings stay sorted and shards
+ * never share a slot.
+ */
+static void *mergeShard(void *arg) {
+    struct shard *shard = arg;
+    int i;
+    size_t j, pos;
+
+    initMap(&shard->map);
+    for (i = 0; i < shard->numChunks; i++) {
+	struct chunk *chunk = &shard->chunks[i];
+	uint32_t base = chunk->firstLine - 1;
+	for (j = 0; j < chunk->map.size; j++) {
+	    struct wordEntry *from = &chunk->map.slots[j], *to;
+	    uint32_t line = 0, k;
+	    if (from->word == NULL || (from->hash >> 24) % shard->numShards != (uint32_t) shard->index)
+		continue;
+	    to = findWord(&shard->map, from->word, from->length, from->hash);
+	    for (pos = 0, k = 0; k < from->lines.count; k++) {
+		line += nextDelta(from->lines.data, &pos);
+		addLine(&to->lines, base + line);
+	    }
+	}
+    }
+    return NULL;
+}
+
+static int compareEntries(const void *a, const void *b) {
+    const struct wordEntry *x = *(struct wordEntry * const *) a;
+    const struct wordEntry *y = *(struct wordEntry * const *) b;
+    return strcmp(x->word, y->word);
+}
+
+static void printWord(FILE *out, struct wordEntry *entry) {
+    uint32_t line = 0, k;
+    size_t pos = 0;
+
+    fputs(entry->word, out);
+    fputc(':', out);
+    for (k = 0; k < entry->lines.count; k++) {
+	line += nextDelta(entry->lines.data, &pos);
+	fprintf(out, k == 0 ? " %u" : ", %u", line);
+    }
+    fputc('\n', out);
+}
+
+static int countThreads(size_t size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t byChunks = size / MIN_CHUNK_SIZE;
+
+    if (cpus < 1)
+	cpus = 1;
+    if (cpus > MAX_THREADS)
+	cpus = MAX_THREADS;
+    if (byChunks < 1)
+	byChunks = 1;
+    return byChunks < (size_t) cpus ? (int) byChunks : (int) cpus;
+}
+
+/*
+ * Builds the cross reference of a single file into doc. Words are left
+ * sorted in doc->words and point into the shard maps, which stay alive
+ * until freeDocument().
+ */
+int crossReference(char *fileName, struct document *doc) {
+    struct chunk chunks[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    struct stat info;
+    const char *text;
+    size_t i, j;
+    int fd, numThreads, t;
+
+    doc->name = fileName;
+    doc->words = NULL;
+    doc->numWords = 0;
+    doc->numShards = 0;
+
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0) {
+	perror(fileName);
+	return -1;
+    }
+    if (info.st_size == 0) {
+	close(fd);
+	return 0;
+    }
+    text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+	perror(fileName);
+	return -1;
+    }
+    madvise((void *) text, info.st_size, MADV_SEQUENTIAL);
+
+    /* split at newlines so no word or line straddles two chunks */
+    numThreads = countThreads(info.st_size);
+    for (t = 0; t < numThreads; t++) {
+	const char *end = text + info.st_size * (t + 1) / numThreads;
+	chunks[t].start = t == 0 ? text : chunks[t - 1].end;
+	if (t == numThreads - 1) {
+	    end = text + info.st_size;
+	} else {
+	    if (end < chunks[t].start)
+		end = chunks[t].start;
+	    while (end < text + info.st_size && *end != '\n')
+		end++;
+	    if (end < text + info.st_size)
+		end++;
+	}
+	chunks[t].end = end;
+    }
+
+    for (t = 0; t < numThreads; t++)
+	if (pthread_create(&threads[t], NULL, tokenizeChunk, &chunks[t]) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    for (t = 0; t < numThreads; t++)
+	pthread_join(threads[t], NULL);
+
+    for (t = 0; t < numThreads; t++)
+	chunks[t].firstLine = t == 0 ? 1 : chunks[t - 1].firstLine + chunks[t - 1].lines;
+
+    doc->numShards = numThreads;
+    for (t = 0; t < numThreads; t++) {
+	doc->shards[t].chunks = chunks;
+	doc->shards[t].numChunks = numThreads;
+	doc->shards[t].index = t;
+	doc->shards[t].numShards = numThreads;
+	if (pthread_create(&threads[t], NULL, mergeShard, &doc->shards[t]) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    }
+    for (t = 0; t < numThreads; t++) {
+	pthread_join(threads[t], NULL);
+	doc->numWords += doc->shards[t].map.used;
+    }
+    for (t = 0; t < numThreads; t++)
+	freeMap(&chunks[t].map, 1);
+    munmap((void *) text, info.st_size);
+
+    doc->words = xmalloc((doc->numWords + 1) * sizeof(struct wordEntry *));
+    for (t = 0, j = 0; t < numThreads; t++)
+	for (i = 0; i < doc->shards[t].map.size; i++)
+	    if (doc->shards[t].map.slots[i].word != NULL)
+		doc->words[j++] = &doc->shards[t].map.slots[i];
+    qsort(doc->words, doc->numWords, sizeof(struct wordEntry *), compareEntries);
+    return 0;
+}
+
+void freeDocument(struct document *doc) {
+    int t;
+
+    for (t = 0; t < doc->numShards; t++)
+	freeMap(&doc->shards[t].map, 1);
+    free(doc->words);
+}
+
+static void appendBytes(struct byteBuffer *buffer, const void *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+	while (buffer->length + length > buffer->capacity)
+	    buffer->capacity = buffer->capacity == 0 ? 4096 : buffer->capacity * 2;
+	buffer->data = realloc(buffer->data, buffer->capacity);
+	if (buffer->data == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+static void appendVarint(struct byteBuffer *buffer, uint64_t value) {
+    unsigned char bytes[10];
+    appendBytes(buffer, bytes, writeVarint(bytes, value));
+}
+
+static int writeAll(FILE *out, struct byteBuffer *buffer) {
+    return buffer->length == 0 || fwrite(buffer->data, buffer->length, 1, out) == 1 ? 0 : -1;
+}
+
+/*
+ * Writes the words of every document into one index. The per-document
+ * word lists are already sorted, so terms come out of a k-way merge and
+ * each one gets the postings of all documents that contain it.
+ */
+int writeIndex(char *indexFile, struct document *docs, int numDocs) {
+    struct byteBuffer names = {0}, blocks = {0}, terms = {0}, postings = {0};
+    struct indexHeader header;
+    size_t cursors[MAX_DOCUMENTS] = {0};
+    char previous[MAX_WORD_LENGTH + 1] = "";
+    uint64_t blockOffset;
+    uint32_t offset32;
+    FILE *out;
+    int d, result;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.numDocs = numDocs;
+    header.blockTerms = INDEX_BLOCK_TERMS;
+    for (d = 0; d < numDocs; d++)
+	appendBytes(&names, docs[d].name, strlen(docs[d].name) + 1);
+
+    for (;;) {
+	const char *word = NULL;
+	size_t shared = 0, termStart = postings.length, length;
+	int lastDoc = 0, numHits = 0;
+
+	for (d = 0; d < numDocs; d++)
+	    if (cursors[d] < docs[d].numWords
+		&& (word == NULL || strcmp(docs[d].words[cursors[d]]->word, word) < 0))
+		word = docs[d].words[cursors[d]]->word;
+	if (word == NULL)
+	    break;
+
+	for (d = 0; d < numDocs; d++)
+	    if (cursors[d] < docs[d].numWords && strcmp(docs[d].words[cursors[d]]->word, word) == 0)
+		numHits++;
+	appendVarint(&postings, numHits);
+	for (d = 0; d < numDocs; d++) {
+	    struct wordEntry *entry;
+	    if (cursors[d] >= docs[d].numWords || strcmp(docs[d].words[cursors[d]]->word, word) != 0)
+		continue;
+	    entry = docs[d].words[cursors[d]];
+	    appendVarint(&postings, d - lastDoc);
+	    appendVarint(&postings, entry->lines.count);
+	    appendBytes(&postings, entry->lines.data, entry->lines.length);
+	    lastDoc = d;
+	}
+
+	length = strlen(word);
+	if (header.numTerms % INDEX_BLOCK_TERMS == 0) {
+	    if (terms.length > UINT32_MAX) {
+		fprintf(stderr, "%s: term dictionary too large\n", indexFile);
+		return -1;
+	    }
+	    offset32 = terms.length;
+	    appendBytes(&blocks, &offset32, sizeof(offset32));
+	    blockOffset = termStart;
+	    appendVarint(&terms, blockOffset);
+	    header.numBlocks++;
+	} else {
+	    while (shared < length && previous[shared] == word[shared])
+		shared++;
+	}
+	appendVarint(&terms, shared);
+	appendVarint(&terms, length - shared);
+	appendBytes(&terms, word + shared, length - shared);
+	appendVarint(&terms, postings.length - termStart);
+	memcpy(previous, word, length + 1);
+	header.numTerms++;
+
+	for (d = 0; d < numDocs; d++)
+	    if (cursors[d] < docs[d].numWords && strcmp(docs[d].words[cursors[d]]->word, previous) == 0)
+		cursors[d]++;
+    }
+
+    header.docsOffset = sizeof(header);
+    header.blocksOffset = header.docsOffset + names.length;
+    /* keep the block table aligned for direct uint32 access */
+    while (header.blocksOffset % sizeof(uint32_t) != 0) {
+	appendBytes(&names, "", 1);
+	header.blocksOffset++;
+    }
+    header.termsOffset = header.blocksOffset + blocks.length;
+    header.postingsOffset = header.termsOffset + terms.length;
+    header.fileSize = header.postingsOffset + postings.length;
+
+    out = fopen(indexFile, "wb");
+    if (out == NULL) {
+	perror(indexFile);
+	return -1;
+    }
+    result = fwrite(&header, sizeof(header), 1, out) == 1
+	&& writeAll(out, &names) == 0 && writeAll(out, &blocks) == 0
+	&& writeAll(out, &terms) == 0 && writeAll(out, &postings) == 0 ? 0 : -1;
+    if (fclose(out) != 0)
+	result = -1;
+    if (result < 0)
+	perror(indexFile);
+
+    free(names.data);
+    free(blocks.data);
+    free(terms.data);
+    free(postings.data);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    struct document docs[MAX_DOCUMENTS];
+    char *indexFile = NULL;
+    int numDocs = 0, result = 0, d, i;
+    size_t w;
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-index") == 0) {
+	    if (++i == argc) {
+		numDocs = 0;
+		break;
+	    }
+	    indexFile = argv[i];
+	} else if (numDocs < MAX_DOCUMENTS) {
+	    docs[numDocs++].name = argv[i];
+	} else {
+	    printf("At most %d documents are supported\n", MAX_DOCUMENTS);
+	    return 1;
+	}
+    }
+    if (numDocs == 0) {
+	printf("Usage: ./cross-ref [-index file.idx] document.txt [document.txt ...]\n");
+	return 1;
+    }
+
+    for (d = 0; d < numDocs; d++) {
+	if (crossReference(docs[d].name, &docs[d]) != 0) {
+	    result = 1;
+	    numDocs = d;
+	    break;
+	}
+	if (numDocs > 1)
+	    printf("%s\n", docs[d].name);
+	for (w = 0; w < docs[d].numWords; w++)
+	    printWord(stdout, docs[d].words[w]);
+    }
+
+    if (result == 0 && indexFile != NULL && writeIndex(indexFile, docs, numDocs) != 0)
+	result = 1;
+
+    for (d = 0; d < numDocs; d++)
+	freeDocument(&docs[d]);
+    return result;
+}
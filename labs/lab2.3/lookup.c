@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xref-index.h"
+
+#define MAX_WORD_LENGTH 64
+#define MAX_DOCUMENTS 64
+
+struct index {
+    const unsigned char *base;
+    size_t size;
+    const struct indexHeader *header;
+    const uint32_t *blocks;
+    const char *docNames[MAX_DOCUMENTS];
+};
+
+int openIndex(char *fileName, struct index *index) {
+    struct stat info;
+    const char *name;
+    uint32_t d;
+    int fd;
+
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0) {
+	perror(fileName);
+	return -1;
+    }
+    index->size = info.st_size;
+    if (index->size < sizeof(struct indexHeader)) {
+	fprintf(stderr, "%s: not a cross-reference index\n", fileName);
+	close(fd);
+	return -1;
+    }
+    index->base = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->base == MAP_FAILED) {
+	perror(fileName);
+	return -1;
+    }
+
+    index->header = (const struct indexHeader *) index->base;
+    if (memcmp(index->header->magic, INDEX_MAGIC, sizeof(index->header->magic)) != 0
+	|| index->header->fileSize != index->size || index->header->numDocs > MAX_DOCUMENTS) {
+	fprintf(stderr, "%s: not a cross-reference index\n", fileName);
+	munmap((void *) index->base, index->size);
+	return -1;
+    }
+    index->blocks = (const uint32_t *) (index->base + index->header->blocksOffset);
+    name = (const char *) index->base + index->header->docsOffset;
+    for (d = 0; d < index->header->numDocs; d++) {
+	index->docNames[d] = name;
+	name += strlen(name) + 1;
+    }
+    return 0;
+}
+
+/* Compares word against the first term of a block without decoding the rest. */
+static int compareFirstTerm(struct index *index, uint32_t block, const char *word, size_t length) {
+    const unsigned char *pos = index->base + index->header->termsOffset + index->blocks[block];
+    size_t termLength, common;
+    int cmp;
+
+    readVarint(&pos);
+    readVarint(&pos);
+    termLength = readVarint(&pos);
+    common = termLength < length ? termLength : length;
+    cmp = memcmp(word, pos, common);
+    if (cmp != 0)
+	return cmp;
+    return length < termLength ? -1 : length > termLength;
+}
+
+/*
+ * Finds a word and returns its postings, or NULL. Binary search picks the
+ * block, then the block's front-coded terms are rebuilt one by one.
+ */
+const unsigned char *findPostings(struct index *index, const char *word) {
+    const unsigned char *pos, *postings;
+    char term[MAX_WORD_LENGTH + 1];
+    size_t length = strlen(word);
+    uint32_t low = 0, high = index->header->numBlocks, block, t;
+
+    if (high == 0)
+	return NULL;
+    while (high - low > 1) {
+	uint32_t mid = low + (high - low) / 2;
+	if (compareFirstTerm(index, mid, word, length) < 0)
+	    high = mid;
+	else
+	    low = mid;
+    }
+    block = low;
+
+    pos = index->base + index->header->termsOffset + index->blocks[block];
+    postings = index->base + index->header->postingsOffset + readVarint(&pos);
+    for (t = 0; t < INDEX_BLOCK_TERMS && block * INDEX_BLOCK_TERMS + t < index->header->numTerms; t++) {
+	size_t shared = readVarint(&pos);
+	size_t suffix = readVarint(&pos);
+	int cmp;
+	if (shared + suffix > MAX_WORD_LENGTH)
+	    return NULL;
+	memcpy(term + shared, pos, suffix);
+	term[shared + suffix] = '\0';
+	pos += suffix;
+	cmp = strcmp(term, word);
+	if (cmp == 0)
+	    return postings;
+	if (cmp > 0)
+	    return NULL;
+	postings += readVarint(&pos);
+    }
+    return NULL;
+}
+
+static void printPostings(struct index *index, const char *word, const unsigned char *pos) {
+    uint64_t numHits = readVarint(&pos), h, k;
+    uint64_t doc = 0;
+
+    printf("%s:", word);
+    for (h = 0; h < numHits; h++) {
+	uint64_t count, line = 0;
+	doc += readVarint(&pos);
+	count = readVarint(&pos);
+	printf("%s %s:", h == 0 ? "" : ";", index->docNames[doc]);
+	for (k = 0; k < count; k++) {
+	    line += readVarint(&pos);
+	    printf(k == 0 ? " %lu" : ", %lu", (unsigned long) line);
+	}
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    struct index index;
+    struct timespec start, end;
+    const unsigned char **results;
+    char word[MAX_WORD_LENGTH + 1];
+    double elapsed;
+    int i, numWords = argc - 2;
+    size_t j;
+
+    if (argc < 3) {
+	printf("Usage: ./lookup file.idx word [word ...]\n");
+	return 1;
+    }
+    if (openIndex(argv[1], &index) != 0)
+	return 1;
+
+    results = malloc(numWords * sizeof(unsigned char *));
+    if (results == NULL) {
+	perror("malloc");
+	return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < numWords; i++) {
+	for (j = 0; argv[i + 2][j] != '\0' && j < MAX_WORD_LENGTH; j++)
+	    word[j] = tolower((unsigned char) argv[i + 2][j]);
+	word[j] = '\0';
+	results[i] = argv[i + 2][j] == '\0' ? findPostings(&index, word) : NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+
+    for (i = 0; i < numWords; i++) {
+	if (results[i] == NULL)
+	    printf("%s: not found\n", argv[i + 2]);
+	else
+	    printPostings(&index, argv[i + 2], results[i]);
+    }
+    fprintf(stderr, "%d lookups in %.1f us\n", numWords, elapsed);
+
+    free(results);
+    munmap((void *) index.base, index.size);
+    return 0;
+}
@@ -0,0 +1,56 @@
+// Cross-reference index file format
+//
+// header | document names | block table | term blocks | postings
+//
+// Terms are sorted and front coded in blocks of INDEX_BLOCK_TERMS. The
+// block table holds the offset of every block so a lookup can binary
+// search on the blocks' first terms and then scan a single block.
+//
+// Term block:  varint postingsOffset (of the block's first term)
+//              per term: varint shared, varint suffixLength, suffix,
+//                        varint postingsLength
+// Postings:    varint numDocs
+//              per doc: varint docDelta, varint count, count line deltas
+
+#include <stdint.h>
+#include <string.h>
+
+#define INDEX_MAGIC "XREFIDX1"
+#define INDEX_BLOCK_TERMS 16
+
+struct indexHeader {
+    char magic[8];
+    uint32_t numDocs;
+    uint32_t numTerms;
+    uint32_t numBlocks;
+    uint32_t blockTerms;
+    uint64_t docsOffset;
+    uint64_t blocksOffset;
+    uint64_t termsOffset;
+    uint64_t postingsOffset;
+    uint64_t fileSize;
+};
+
+static inline uint64_t readVarint(const unsigned char **pos) {
+    const unsigned char *p = *pos;
+    uint64_t value = 0;
+    int shift = 0;
+
+    do {
+	value |= (uint64_t) (*p & 0x7f) << shift;
+	shift += 7;
+    } while (*p++ & 0x80);
+    *pos = p;
+    return value;
+}
+
+static inline size_t writeVarint(unsigned char *out, uint64_t value) {
+    size_t length = 0;
+
+    while (value >= 0x80) {
+	out[length++] = (value & 0x7f) | 0x80;
+	value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
@@ -1,8 +1,349 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define BATCH_RECORDS 4096
+#define INPUT_SIZE (1 << 20)
+#define BENCH_RECORDS 20000000
+#define MAX_DATE 20          /* "Sep 30, 2147483647\n" */
+
+/*
+ * month and day for every day of the year, indexed [leap][yearday] and
+ * packed as month << 5 | day. The rows are spelled out by the macros
+ * below, so the table is built by the compiler; index 0 is unused.
+ */
+#define PACK(m, d) ((m) << 5 | (d))
+#define D4(m, d) PACK(m, d), PACK(m, d + 1), PACK(m, d + 2), PACK(m, d + 3)
+#define D28(m) D4(m, 1), D4(m, 5), D4(m, 9), D4(m, 13), D4(m, 17), D4(m, 21), D4(m, 25)
+#define D29(m) D28(m), PACK(m, 29)
+#define D30(m) D29(m), PACK(m, 30)
+#define D31(m) D30(m), PACK(m, 31)
+#define YEAR(february) 0, D31(1), february(2), D31(3), D30(4), D31(5), D30(6), \
+	D31(7), D31(8), D30(9), D31(10), D30(11), D31(12)
+
+static const unsigned short dateOf[2][367] = {
+    {YEAR(D28)},
+    {YEAR(D29)},
+};
+
+static const char *monthNames[] = {
+    "", "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/* K&R's table, kept for the loop version the benchmark compares with */
+static const char daytab[2][13] = {
+    {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31},
+    {0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31}
+};
 
 /* month_day function's prototype*/
 void month_day(int year, int yearday, int *pmonth, int *pday);
 
-int main() {
+static int isLeap(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/*
+ * Sets *pmonth and *pday for a day of the year with one table lookup.
+ * Both are set to 0 when year or yearday are out of range.
+ */
+void month_day(int year, int yearday, int *pmonth, int *pday) {
+    int leap;
+
+    if (year < 1 || yearday < 1) {
+	*pmonth = *pday = 0;
+	return;
+    }
+    leap = isLeap(year);
+    if (yearday > 365 + leap) {
+	*pmonth = *pday = 0;
+	return;
+    }
+    *pmonth = dateOf[leap][yearday] >> 5;
+    *pday = dateOf[leap][yearday] & 31;
+}
+
+/* The K&R version: walk the months subtracting their lengths. */
+static void monthDayLoop(int year, int yearday, int *pmonth, int *pday) {
+    int i, leap = isLeap(year);
+
+    for (i = 1; yearday > daytab[leap][i]; i++)
+	yearday -= daytab[leap][i];
+    *pmonth = i;
+    *pday = yearday;
+}
+
+#ifdef __SSE2__
+/* Low 32 bits of a * b in each lane, SSE2 only multiplies even lanes. */
+static __m128i mulLow(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			      _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/* Unsigned a <= b per lane. */
+static __m128i lessEqualU32(__m128i a, __m128i b) {
+    const __m128i sign = _mm_set1_epi32(INT_MIN);
+    return _mm_xor_si128(_mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign)),
+			 _mm_set1_epi32(-1));
+}
+#endif
+
+/*
+ * Converts count (year, yearday) pairs at once. Invalid pairs get month
+ * and day 0. Leap years and range checks are done four at a time: y is
+ * a multiple of 25 exactly when y * 25^-1 mod 2^32 <= (2^32 - 1) / 25,
+ * so y % 100 and y % 400 need no division. Returns the number of
+ * invalid pairs.
+ */
+int monthDayBulk(const int *years, const int *yeardays, int count,
+		 unsigned char *months, unsigned char *days) {
+    int invalid = 0, i = 0, k;
+#ifdef __SSE2__
+    const __m128i inverse25 = _mm_set1_epi32(0xc28f5c29), limit25 = _mm_set1_epi32(171798691);
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi32(1);
+    int index[4];
+
+    for (; i + 4 <= count; i += 4) {
+	__m128i year = _mm_loadu_si128((const __m128i *) (years + i));
+	__m128i yearday = _mm_loadu_si128((const __m128i *) (yeardays + i));
+	__m128i by4 = _mm_cmpeq_epi32(_mm_and_si128(year, _mm_set1_epi32(3)), zero);
+	__m128i by16 = _mm_cmpeq_epi32(_mm_and_si128(year, _mm_set1_epi32(15)), zero);
+	__m128i by25 = lessEqualU32(mulLow(year, inverse25), limit25);
+	__m128i leap = _mm_and_si128(by4, _mm_or_si128(_mm_andnot_si128(by25, by4), by16));
+	__m128i lastDay = _mm_sub_epi32(_mm_set1_epi32(365), leap);
+	__m128i valid = _mm_and_si128(_mm_cmpgt_epi32(year, zero),
+				      _mm_and_si128(_mm_cmpgt_epi32(yearday, zero),
+						    _mm_cmplt_epi32(yearday, _mm_add_epi32(lastDay, one))));
+	/* invalid lanes read the unused entry 0, which is month 0 day 0 */
+	__m128i row = _mm_and_si128(leap, _mm_set1_epi32(367));
+	_mm_storeu_si128((__m128i *) index, _mm_and_si128(_mm_add_epi32(row, yearday), valid));
+	invalid += __builtin_popcount(~_mm_movemask_ps(_mm_castsi128_ps(valid)) & 15);
+	for (k = 0; k < 4; k++) {
+	    unsigned short date = dateOf[0][index[k]];
+	    months[i + k] = date >> 5;
+	    days[i + k] = date & 31;
+	}
+    }
+#endif
+    for (; i < count; i++) {
+	int month, day;
+	month_day(years[i], yeardays[i], &month, &day);
+	months[i] = month;
+	days[i] = day;
+	invalid += month == 0;
+    }
+    return invalid;
+}
+
+static char *formatDate(char *out, int month, int day, int year) {
+    return out + sprintf(out, "%s %02d, %d\n", monthNames[month], day, year);
+}
+
+static int parseNumber(const char *arg, int *value) {
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || n < INT_MIN || n > INT_MAX)
+	return -1;
+    *value = n;
+    return 0;
+}
+
+/*
+ * Parses one "year yearday" line in [p, end). Anything else, including
+ * extra fields, leaves year at 0 so the record comes out invalid.
+ */
+static void parseRecord(const char *p, const char *end, int *year, int *yearday) {
+    long value[2] = {0, 0};
+    int field;
+
+    *year = *yearday = 0;
+    for (field = 0; field < 2; field++) {
+	while (p < end && (*p == ' ' || *p == '\t'))
+	    p++;
+	if (p == end || *p < '0' || *p > '9')
+	    return;
+	while (p < end && *p >= '0' && *p <= '9') {
+	    value[field] = value[field] * 10 + (*p++ - '0');
+	    if (value[field] > INT_MAX)
+		return;
+	}
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+	p++;
+    if (p == end) {
+	*year = value[0];
+	*yearday = value[1];
+    }
+}
+
+/*
+ * Streaming mode: reads "year yearday" lines from stdin in large blocks
+ * and converts them a batch at a time, writing each batch with a single
+ * fwrite. Invalid lines print "invalid date", so output lines stay
+ * aligned with input lines.
+ */
+static int convertStream() {
+    static int years[BATCH_RECORDS], yeardays[BATCH_RECORDS];
+    static unsigned char months[BATCH_RECORDS], days[BATCH_RECORDS];
+    static char input[INPUT_SIZE], output[BATCH_RECORDS * MAX_DATE];
+    size_t carry = 0, n;
+    const char *pos, *end, *line;
+    int count, i;
+
+    do {
+	n = fread(input + carry, 1, INPUT_SIZE - carry, stdin);
+	end = input + carry + n;
+	/* only whole lines are parsed, the rest waits for the next block */
+	if (n > 0)
+	    while (end > input && end[-1] != '\n')
+		end--;
+	if (end == input && carry + n == INPUT_SIZE) {
+	    fprintf(stderr, "Input line too long\n");
+	    return 1;
+	}
+
+	pos = input;
+	while (pos < end) {
+	    char *out = output;
+	    for (count = 0; count < BATCH_RECORDS && pos < end; count++) {
+		line = memchr(pos, '\n', end - pos);
+		if (line == NULL)
+		    line = end;
+		parseRecord(pos, line, &years[count], &yeardays[count]);
+		pos = line + 1;
+	    }
+	    monthDayBulk(years, yeardays, count, months, days);
+	    for (i = 0; i < count; i++) {
+		if (months[i] == 0) {
+		    memcpy(out, "invalid date\n", 13);
+		    out += 13;
+		} else {
+		    out = formatDate(out, months[i], days[i], years[i]);
+		}
+	    }
+	    fwrite(output, 1, out - output, stdout);
+	}
+	carry = input + carry + n - end;
+	memmove(input, end, carry);
+    } while (n > 0);
+    if (ferror(stdin)) {
+	perror("stdin");
+	return 1;
+    }
+    return 0;
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Converts the same random records with the loop, the table and the bulk API. */
+static int bench(int count) {
+    int *years = calloc(count, sizeof(int)), *yeardays = calloc(count, sizeof(int));
+    unsigned char *months = malloc(count), *days = malloc(count);
+    long checksum[3] = {0, 0, 0};
+    double start, elapsed[3];
+    int i, month, day;
+
+    if (years == NULL || yeardays == NULL || months == NULL || days == NULL) {
+	fprintf(stderr, "Cannot allocate %d records\n", count);
+	return 1;
+    }
+    srand(1);
+    for (i = 0; i < count; i++) {
+	years[i] = 1600 + rand() % 800;
+	yeardays[i] = 1 + rand() % (365 + isLeap(years[i]));
+    }
+
+    start = seconds();
+    for (i = 0; i < count; i++) {
+	monthDayLoop(years[i], yeardays[i], &month, &day);
+	checksum[0] += month * 32 + day;
+    }
+    elapsed[0] = seconds() - start;
+
+    start = seconds();
+    for (i = 0; i < count; i++) {
+	month_day(years[i], yeardays[i], &month, &day);
+	checksum[1] += month * 32 + day;
+    }
+    elapsed[1] = seconds() - start;
+
+    start = seconds();
+    monthDayBulk(years, yeardays, count, months, days);
+    for (i = 0; i < count; i++)
+	checksum[2] += months[i] * 32 + days[i];
+    elapsed[2] = seconds() - start;
+
+    if (checksum[0] != checksum[1] || checksum[1] != checksum[2]) {
+	fprintf(stderr, "Results differ between versions\n");
+	return 1;
+    }
+    printf("%d records\n", count);
+    printf("daytab loop : %8.1f ms, %7.1f M/s\n", elapsed[0] * 1e3, count / elapsed[0] / 1e6);
+    printf("table lookup: %8.1f ms, %7.1f M/s\n", elapsed[1] * 1e3, count / elapsed[1] / 1e6);
+    printf("bulk        : %8.1f ms, %7.1f M/s\n", elapsed[2] * 1e3, count / elapsed[2] / 1e6);
+    free(years);
+    free(yeardays);
+    free(months);
+    free(days);
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./month_day <year> <yearday>\n");
+    fprintf(stderr, "       ./month_day -            (year yearday records from stdin)\n");
+    fprintf(stderr, "       ./month_day -bench [records]\n");
+}
+
+int main(int argc, char **argv) {
+    int year, yearday, month, day, count = BENCH_RECORDS;
+    char line[MAX_DATE + 1];
+
+    if (argc == 2 && strcmp(argv[1], "-") == 0)
+	return convertStream();
+    if (argc >= 2 && strcmp(argv[1], "-bench") == 0) {
+	if (argc > 3 || (argc == 3 && (parseNumber(argv[2], &count) < 0 || count <= 0))) {
+	    usage();
+	    return 1;
+	}
+	return bench(count);
+    }
+    if (argc != 3) {
+	usage();
+	return 1;
+    }
+    if (parseNumber(argv[1], &year) < 0 || year < 1) {
+	fprintf(stderr, "Invalid year: %s\n", argv[1]);
+	return 1;
+    }
+    if (parseNumber(argv[2], &yearday) < 0) {
+	fprintf(stderr, "Invalid yearday: %s\n", argv[2]);
+	return 1;
+    }
+
+    month_day(year, yearday, &month, &day);
+    /* a well-formed date out of range is reported, not failed on, as lab.mk's Test 3 expects */
+    if (month == 0) {
+	fprintf(stderr, "Invalid yearday %d for %d, it has %d days\n", yearday, year,
+		365 + isLeap(year));
+	return 0;
+    }
+    formatDate(line, month, day, year);
+    fputs(line, stdout);
     return 0;
 }
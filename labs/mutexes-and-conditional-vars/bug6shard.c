@@ -0,0 +1,193 @@
+/*****************************************************************************
+ * FILE: bug6shard.c
+ * DESCRIPTION:
+ *   The bug6.c workload with the global sum kept in a sharded counter
+ *   (shardcount.h). Every thread still adds one product per iteration, as in
+ *   bug6fix.c, but threads on different CPUs add into different cache lines
+ *   instead of queueing on one mutex.
+ *
+ *   With -bench it times the same loop with a mutex, a single atomic and
+ *   the sharded counter, for 8 to 128 threads.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "lockstats.h"
+#include "shardcount.h"
+
+/* Define global data where everyone can see them */
+#define NUMTHRDS 8
+#define VECLEN 100000
+#define MAXTHRDS 128
+#define REFRESH_NS 1000000
+struct shardCounter sum;
+int *a, *b;
+
+void *dotprod(void *arg)
+{
+    /* Each thread works on a different set of data.
+     * The offset is specified by the arg parameter. The size of
+     * the data for each thread is indicated by VECLEN.
+     */
+    int i, start, end, offset, len;
+    long tid;
+    tid = (long)arg;
+    offset = tid;
+    len = VECLEN;
+    start = offset*len;
+    end   = start + len;
+
+    /* Perform my section of the dot product */
+    printf("thread: %ld starting. start=%d end=%d\n",tid,start,end-1);
+    for (i=start; i<end ; i++)
+	shardAdd(&sum, a[i] * b[i]);
+    /* Other threads may still be adding, so this one is only approximate */
+    printf("thread: %ld done. Global sum now is=%li\n",tid,shardReadApprox(&sum, REFRESH_NS));
+
+    pthread_exit((void*) 0);
+}
+
+/* The benchmark variants, each over the first VECLEN elements */
+pthread_mutex_t mutexsum = PTHREAD_MUTEX_INITIALIZER;
+long mutexSum;
+atomic_long atomicSum;
+
+void *mutexWorker(void *arg)
+{
+    int i;
+
+    for (i=0; i<VECLEN; i++) {
+	pthread_mutex_lock(&mutexsum);
+	mutexSum += (a[i] * b[i]);
+	pthread_mutex_unlock(&mutexsum);
+    }
+    return NULL;
+}
+
+void *atomicWorker(void *arg)
+{
+    int i;
+
+    for (i=0; i<VECLEN; i++)
+	atomic_fetch_add_explicit(&atomicSum, a[i] * b[i], memory_order_relaxed);
+    return NULL;
+}
+
+void *shardWorker(void *arg)
+{
+    int i;
+
+    for (i=0; i<VECLEN; i++)
+	shardAdd(&sum, a[i] * b[i]);
+    return NULL;
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Runs one variant with the given threads and returns its time in seconds, or -1 on error. */
+static double timeRun(void *(*worker)(void *), int threads)
+{
+    pthread_t ids[MAXTHRDS];
+    double begin = seconds();
+    int i;
+
+    for (i=0; i<threads; i++)
+	if (pthread_create(&ids[i], NULL, worker, NULL) != 0) {
+	    perror("pthread_create");
+	    while (i-- > 0)
+		pthread_join(ids[i], NULL);
+	    return -1;
+	}
+    for (i=0; i<threads; i++)
+	pthread_join(ids[i], NULL);
+    return seconds() - begin;
+}
+
+static int bench()
+{
+    int threads;
+    long expected;
+    double mutexTime, atomicTime, shardTime;
+
+    printf("%d adds per thread, %d counter slots\n", VECLEN, sum.mask + 1);
+    printf("threads      mutex     atomic    sharded  (M adds/s)\n");
+    for (threads=8; threads<=MAXTHRDS; threads*=2) {
+	expected = (long) threads * VECLEN;
+	mutexSum = 0;
+	atomic_store(&atomicSum, 0);
+	shardFree(&sum);
+	if (shardInit(&sum, 0) != 0)
+	    return 1;
+	if ((mutexTime = timeRun(mutexWorker, threads)) < 0
+	    || (atomicTime = timeRun(atomicWorker, threads)) < 0
+	    || (shardTime = timeRun(shardWorker, threads)) < 0)
+	    return 1;
+	if (mutexSum != expected || atomic_load(&atomicSum) != expected || shardRead(&sum) != expected) {
+	    fprintf(stderr, "Wrong sum with %d threads: %ld %ld %ld, expected %ld\n", threads,
+		    mutexSum, atomic_load(&atomicSum), shardRead(&sum), expected);
+	    return 1;
+	}
+	printf("%7d %10.1f %10.1f %10.1f\n", threads, expected / mutexTime / 1e6,
+	       expected / atomicTime / 1e6, expected / shardTime / 1e6);
+    }
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    long i;
+    int result = 0;
+    void *status;
+    pthread_t threads[NUMTHRDS];
+    pthread_attr_t attr;
+
+    /* Assign storage and initialize values */
+    a = (int*) malloc (NUMTHRDS*VECLEN*sizeof(int));
+    b = (int*) malloc (NUMTHRDS*VECLEN*sizeof(int));
+    if (a == NULL || b == NULL || shardInit(&sum, 0) != 0) {
+	fprintf(stderr, "Could not allocate the vectors or the counter\n");
+	return 1;
+    }
+
+    for (i=0; i<VECLEN*NUMTHRDS; i++)
+	a[i]=b[i]=1;
+
+    if (argc == 2 && strcmp(argv[1], "-bench") == 0) {
+	result = bench();
+	free (a);
+	free (b);
+	shardFree(&sum);
+	return result;
+    }
+
+    /* Create threads as joinable, each of which will execute the dot product
+     * routine. Their offset into the global vectors is specified by passing
+     * the "i" argument in pthread_create().
+     */
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    for(i=0;i<NUMTHRDS;i++)
+	pthread_create(&threads[i], &attr, dotprod, (void *)i);
+
+    pthread_attr_destroy(&attr);
+
+    /* Wait on the other threads for final result */
+
+    for(i=0;i<NUMTHRDS;i++) {
+	pthread_join(threads[i], &status);
+    }
+    /* After joining, every add is in, so the read is exact */
+    printf ("Final Global Sum=%li\n",shardRead(&sum));
+    free (a);
+    free (b);
+    shardFree(&sum);
+    pthread_exit(NULL);
+}
@@ -0,0 +1,333 @@
+#define LOCKSTATS_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "lockstats.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define SUB_BITS 4                  /* 16 buckets per power of two, about 6% apart */
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define MAX_EXPONENT 44             /* 2^44 ticks and up, over an hour, share the last bucket */
+#define BUCKETS ((MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS + 1)
+#define TABLE_BITS 6
+#define TABLE_SLOTS (1 << TABLE_BITS)
+#define REPORT_LOCKS 10
+
+enum kind {WAIT, HOLD, COND, KINDS};
+
+struct histogram {
+    uint64_t count, total, max;
+    uint32_t buckets[BUCKETS];
+};
+
+struct lockStats {
+    pthread_mutex_t *mutex;
+    const char *name;
+    uint64_t acquired;              /* ticks, while this thread holds it, else 0 */
+    uint64_t contended, busy;       /* waited in lock, failed trylocks */
+    struct histogram h[KINDS];
+};
+
+/* One thread's locks; threads past TABLE_SLOTS locks share the overflow entry */
+struct lockTable {
+    struct lockTable *next;
+    struct lockStats *slots[TABLE_SLOTS];
+    struct lockStats overflow;
+};
+
+static __thread struct lockTable *table;
+static struct lockTable *tables;
+static int tableCount;
+static pthread_mutex_t tablesLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t startTicks, startNs;
+
+static uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* The time stamp counter on x86, which is invariant on current CPUs, nanoseconds elsewhere. */
+static inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
+
+/* Measured over the whole run, between the first lock and the report. */
+static double ticksPerNs() {
+    uint64_t ns = nowNs() - startNs, elapsed = ticks() - startTicks;
+    return ns > 0 && elapsed > 0 ? (double) elapsed / ns : 1;
+}
+
+static int bucketOf(uint64_t ticks) {
+    int exponent;
+
+    if (ticks < SUB_BUCKETS)
+	return ticks;
+    exponent = 63 - __builtin_clzll(ticks);
+    if (exponent >= MAX_EXPONENT)
+	return BUCKETS - 1;
+    return (exponent - SUB_BITS + 1) * SUB_BUCKETS + (ticks >> (exponent - SUB_BITS) & (SUB_BUCKETS - 1));
+}
+
+/* The lowest count of ticks that lands in a bucket, 2^MAX_EXPONENT for the last one. */
+static uint64_t bucketTicks(int bucket) {
+    int exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+
+    if (bucket < SUB_BUCKETS)
+	return bucket;
+    return (uint64_t) (SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BITS);
+}
+
+static void record(struct histogram *h, uint64_t elapsed) {
+    h->buckets[bucketOf(elapsed)]++;
+    h->count++;
+    h->total += elapsed;
+    if (elapsed > h->max)
+	h->max = elapsed;
+}
+
+static struct lockTable *threadTable() {
+    if (table != NULL)
+	return table;
+    table = calloc(1, sizeof(struct lockTable));
+    if (table == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    table->overflow.name = "(other locks)";
+    pthread_mutex_lock(&tablesLock);
+    if (tables == NULL) {
+	startNs = nowNs();
+	startTicks = ticks();
+	atexit(lockstatsReport);
+    }
+    table->next = tables;
+    tables = table;
+    tableCount++;
+    pthread_mutex_unlock(&tablesLock);
+    return table;
+}
+
+/* This thread's entry for a mutex, found by open addressing on its address. */
+static struct lockStats *lookup(pthread_mutex_t *mutex, const char *name) {
+    struct lockTable *t = threadTable();
+    unsigned slot = (uintptr_t) mutex * 0x9e3779b97f4a7c15ULL >> (64 - TABLE_BITS), probes;
+    struct lockStats *s;
+
+    for (probes = 0; probes < TABLE_SLOTS; probes++, slot = (slot + 1) % TABLE_SLOTS) {
+	s = t->slots[slot];
+	if (s == NULL) {
+	    s = t->slots[slot] = calloc(1, sizeof(struct lockStats));
+	    if (s == NULL)
+		return &t->overflow;
+	    s->mutex = mutex;
+	}
+	if (s->mutex == mutex) {
+	    if (s->name == NULL && name != NULL)
+		s->name = name[0] == '&' ? name + 1 : name;
+	    return s;
+	}
+    }
+    return &t->overflow;
+}
+
+static void acquired(struct lockStats *s, uint64_t wait) {
+    s->acquired = ticks();
+    record(&s->h[WAIT], wait);
+}
+
+static void releasing(struct lockStats *s, uint64_t now) {
+    if (s->acquired != 0)
+	record(&s->h[HOLD], now - s->acquired);
+    s->acquired = 0;
+}
+
+/* An uncontended lock is taken by the trylock and only reads the clock once. */
+int lockstatsLock(pthread_mutex_t *mutex, const char *name) {
+    struct lockStats *s = lookup(mutex, name);
+    uint64_t start;
+    int error;
+
+    if ((error = pthread_mutex_trylock(mutex)) != EBUSY) {
+	if (error == 0)
+	    acquired(s, 0);
+	return error;
+    }
+    start = ticks();
+    if ((error = pthread_mutex_lock(mutex)) != 0)
+	return error;
+    s->contended++;
+    acquired(s, ticks() - start);
+    return 0;
+}
+
+int lockstatsTrylock(pthread_mutex_t *mutex, const char *name) {
+    struct lockStats *s = lookup(mutex, name);
+    int error = pthread_mutex_trylock(mutex);
+
+    if (error == 0)
+	acquired(s, 0);
+    else if (error == EBUSY)
+	s->busy++;
+    return error;
+}
+
+int lockstatsUnlock(pthread_mutex_t *mutex) {
+    releasing(lookup(mutex, NULL), ticks());
+    return pthread_mutex_unlock(mutex);
+}
+
+/* The mutex counts as released for the whole wait. */
+int lockstatsWait(pthread_cond_t *cond, pthread_mutex_t *mutex, const char *name) {
+    struct lockStats *s = lookup(mutex, name);
+    uint64_t start = ticks();
+    int error;
+
+    releasing(s, start);
+    error = pthread_cond_wait(cond, mutex);
+    s->acquired = ticks();
+    record(&s->h[COND], s->acquired - start);
+    return error;
+}
+
+int lockstatsTimedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline,
+		       const char *name) {
+    struct lockStats *s = lookup(mutex, name);
+    uint64_t start = ticks();
+    int error;
+
+    releasing(s, start);
+    error = pthread_cond_timedwait(cond, mutex, deadline);
+    s->acquired = ticks();
+    record(&s->h[COND], s->acquired - start);
+    return error;
+}
+
+static void merge(struct lockStats *into, const struct lockStats *from) {
+    int kind, i;
+
+    into->contended += from->contended;
+    into->busy += from->busy;
+    if (into->name == NULL)
+	into->name = from->name;
+    for (kind = 0; kind < KINDS; kind++) {
+	into->h[kind].count += from->h[kind].count;
+	into->h[kind].total += from->h[kind].total;
+	if (from->h[kind].max > into->h[kind].max)
+	    into->h[kind].max = from->h[kind].max;
+	for (i = 0; i < BUCKETS; i++)
+	    into->h[kind].buckets[i] += from->h[kind].buckets[i];
+    }
+}
+
+static uint64_t percentile(const struct histogram *h, double p) {
+    uint64_t seen = 0, target = h->count * p;
+    int i;
+
+    for (i = 0; i < BUCKETS; i++)
+	if ((seen += h->buckets[i]) > target)
+	    return i < BUCKETS - 1 ? bucketTicks(i) : h->max;
+    return h->max;
+}
+
+static char *formatNs(char *text, double ns) {
+    if (ns < 1000)
+	sprintf(text, "%.0fns", ns);
+    else if (ns < 1000000)
+	sprintf(text, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+	sprintf(text, "%.1fms", ns / 1e6);
+    else
+	sprintf(text, "%.2fs", ns / 1e9);
+    return text;
+}
+
+static int compareWait(const void *a, const void *b) {
+    uint64_t x = (*(struct lockStats * const *) a)->h[WAIT].total;
+    uint64_t y = (*(struct lockStats * const *) b)->h[WAIT].total;
+    return (x < y) - (x > y);
+}
+
+static struct lockStats *tableEntry(struct lockTable *t, int slot) {
+    struct lockStats *s = slot < TABLE_SLOTS ? t->slots[slot] : &t->overflow;
+    return s != NULL && s->h[WAIT].count + s->h[COND].count + s->busy > 0 ? s : NULL;
+}
+
+/*
+ * Merges every thread's table by mutex and prints the locks that were
+ * waited on longest. The first pass only collects the distinct mutexes,
+ * so memory grows with the locks rather than the threads.
+ */
+void lockstatsReport(void) {
+    struct lockStats *merged = NULL, **order = NULL, *s;
+    struct lockTable *t;
+    char text[7][16];
+    int count = 0, i, j, slot;
+    double perNs = ticksPerNs();
+
+    pthread_mutex_lock(&tablesLock);
+    order = calloc(tableCount * (TABLE_SLOTS + 1) + 1, sizeof(struct lockStats *));
+    for (t = tables; order != NULL && t != NULL; t = t->next)
+	for (slot = 0; slot <= TABLE_SLOTS; slot++) {
+	    if ((s = tableEntry(t, slot)) == NULL)
+		continue;
+	    for (j = 0; j < count && order[j]->mutex != s->mutex; j++)
+		;
+	    if (j == count)
+		order[count++] = s;
+	}
+    merged = calloc(count + 1, sizeof(struct lockStats));
+    for (t = tables; merged != NULL && t != NULL; t = t->next)
+	for (slot = 0; slot <= TABLE_SLOTS; slot++) {
+	    if ((s = tableEntry(t, slot)) == NULL)
+		continue;
+	    for (j = 0; order[j]->mutex != s->mutex; j++)
+		;
+	    merged[j].mutex = s->mutex;
+	    merge(&merged[j], s);
+	}
+    pthread_mutex_unlock(&tablesLock);
+    if (order == NULL || merged == NULL) {
+	perror("calloc");
+	free(order);
+	free(merged);
+	return;
+    }
+
+    for (i = 0; i < count; i++)
+	order[i] = &merged[i];
+    qsort(order, count, sizeof(struct lockStats *), compareWait);
+    fprintf(stderr, "lockstats: %d locks used by %d threads, hottest first\n", count, tableCount);
+    fprintf(stderr, "  %-16s %9s %9s %9s %7s %7s %7s %7s %7s %7s\n", "lock", "acquires", "contended",
+	    "waited", "p50", "p99", "max", "hold50", "hold99", "holdmax");
+    for (i = 0; i < count && i < REPORT_LOCKS; i++) {
+	s = order[i];
+	fprintf(stderr, "  %-16s %9llu %8.2f%% %9s %7s %7s %7s %7s %7s %7s\n",
+		s->name != NULL ? s->name : "?", (unsigned long long) s->h[WAIT].count,
+		s->h[WAIT].count > 0 ? 100.0 * s->contended / s->h[WAIT].count : 0,
+		formatNs(text[0], s->h[WAIT].total / perNs),
+		formatNs(text[1], percentile(&s->h[WAIT], 0.5) / perNs),
+		formatNs(text[2], percentile(&s->h[WAIT], 0.99) / perNs),
+		formatNs(text[3], s->h[WAIT].max / perNs),
+		formatNs(text[4], percentile(&s->h[HOLD], 0.5) / perNs),
+		formatNs(text[5], percentile(&s->h[HOLD], 0.99) / perNs),
+		formatNs(text[6], s->h[HOLD].max / perNs));
+	if (s->h[COND].count > 0)
+	    fprintf(stderr, "  %-16s %9llu condition waits, p50 %s, max %s\n", "",
+		    (unsigned long long) s->h[COND].count,
+		    formatNs(text[1], percentile(&s->h[COND], 0.5) / perNs),
+		    formatNs(text[2], s->h[COND].max / perNs));
+	if (s->busy > 0)
+	    fprintf(stderr, "  %-16s %9llu failed trylocks\n", "", (unsigned long long) s->busy);
+    }
+    free(merged);
+    free(order);
+}
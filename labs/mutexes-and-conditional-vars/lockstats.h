@@ -0,0 +1,34 @@
+// Lock wait and hold time instrumentation
+//
+// Include this header after <pthread.h> and build with -DLOCKSTATS to
+// route pthread_mutex_lock, pthread_mutex_trylock, pthread_mutex_unlock,
+// pthread_cond_wait and pthread_cond_timedwait through timed wrappers.
+// Without -DLOCKSTATS the header changes nothing.
+//
+// Each thread keeps its own table of the locks it used, so recording
+// takes no shared lock and touches no shared cache line. Per lock it
+// holds log-linear histograms of acquire wait, hold time and condition
+// wait, with 16 buckets per power of two. Times are read with rdtsc on
+// x86 and clock_gettime elsewhere. An uncontended lock is taken with
+// trylock and costs a single clock read. At exit the tables are merged,
+// the ticks are converted to nanoseconds and the hottest locks, by
+// total wait, are printed to stderr.
+
+#include <pthread.h>
+#include <time.h>
+
+int lockstatsLock(pthread_mutex_t *mutex, const char *name);
+int lockstatsTrylock(pthread_mutex_t *mutex, const char *name);
+int lockstatsUnlock(pthread_mutex_t *mutex);
+int lockstatsWait(pthread_cond_t *cond, pthread_mutex_t *mutex, const char *name);
+int lockstatsTimedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline,
+		       const char *name);
+void lockstatsReport(void);
+
+#if defined(LOCKSTATS) && !defined(LOCKSTATS_SOURCE)
+#define pthread_mutex_lock(m) lockstatsLock(m, #m)
+#define pthread_mutex_trylock(m) lockstatsTrylock(m, #m)
+#define pthread_mutex_unlock(m) lockstatsUnlock(m)
+#define pthread_cond_wait(c, m) lockstatsWait(c, m, #m)
+#define pthread_cond_timedwait(c, m, t) lockstatsTimedwait(c, m, t, #m)
+#endif
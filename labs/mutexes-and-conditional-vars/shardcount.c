@@ -0,0 +1,62 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "shardcount.h"
+
+static unsigned long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/* A slots value of 0 gives one slot per configured CPU. */
+int shardInit(struct shardCounter *c, int slots) {
+    int count = 1, i;
+
+    if (slots <= 0 && (slots = sysconf(_SC_NPROCESSORS_CONF)) <= 0)
+	slots = 1;
+    while (count < slots)
+	count *= 2;
+    memset(c, 0, sizeof(*c));
+    c->shards = aligned_alloc(SHARD_LINE, count * sizeof(struct shard));
+    if (c->shards == NULL) {
+	perror("aligned_alloc");
+	return -1;
+    }
+    for (i = 0; i < count; i++)
+	atomic_init(&c->shards[i].value, 0);
+    c->mask = count - 1;
+    atomic_init(&c->cached, 0);
+    atomic_init(&c->cachedAt, 0);
+    return 0;
+}
+
+long shardRead(struct shardCounter *c) {
+    long sum = 0;
+    int i;
+
+    for (i = 0; i <= c->mask; i++)
+	sum += atomic_load_explicit(&c->shards[i].value, memory_order_relaxed);
+    return sum;
+}
+
+/* Readers that race on a stale total may both refresh it; either result is fine. */
+long shardReadApprox(struct shardCounter *c, long maxAgeNs) {
+    unsigned long now = nowNs(), at = atomic_load_explicit(&c->cachedAt, memory_order_acquire);
+    long sum;
+
+    if (at != 0 && now - at <= (unsigned long) maxAgeNs)
+	return atomic_load_explicit(&c->cached, memory_order_relaxed);
+    sum = shardRead(c);
+    atomic_store_explicit(&c->cached, sum, memory_order_relaxed);
+    atomic_store_explicit(&c->cachedAt, now, memory_order_release);
+    return sum;
+}
+
+void shardFree(struct shardCounter *c) {
+    free(c->shards);
+    c->shards = NULL;
+}
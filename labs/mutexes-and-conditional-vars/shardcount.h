@@ -0,0 +1,57 @@
+// Sharded counter for sums that many threads add to
+//
+// A single global sum, whether behind a mutex or updated atomically,
+// keeps one cache line bouncing between every core that adds to it. A
+// shardCounter splits the sum into slots, each on its own cache line,
+// and every add goes to the slot of the CPU the thread runs on, from
+// sched_getcpu. Where that is unavailable, a hash of the thread id picks
+// the slot. Threads on different CPUs then rarely write the same line.
+// A thread keeps its slot for SHARD_RECHECK adds before it asks for its
+// CPU again and may migrate in between, so the add is still atomic, but
+// it is almost never contended.
+//
+// shardRead sums every slot. It is exact once the adding threads are
+// done, and while they run it is only off by the adds in flight.
+// shardReadApprox returns a total cached for up to a given age, so a
+// thread that polls the sum does not walk every slot each time.
+//
+// sched_getcpu needs _GNU_SOURCE defined before the first system header.
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define SHARD_LINE 64
+#define SHARD_RECHECK 64             /* adds between sched_getcpu calls */
+
+struct shard {
+    _Alignas(SHARD_LINE) atomic_long value;
+};
+
+struct shardCounter {
+    struct shard *shards;
+    int mask;                       /* slots - 1, slots are a power of two */
+    _Alignas(SHARD_LINE) atomic_long cached;
+    atomic_ulong cachedAt;          /* nanoseconds, 0 for never */
+};
+
+int shardInit(struct shardCounter *c, int slots);
+long shardRead(struct shardCounter *c);
+long shardReadApprox(struct shardCounter *c, long maxAgeNs);
+void shardFree(struct shardCounter *c);
+
+/* The slot this thread last used, and adds left before it asks for its CPU again */
+static __thread int shardThreadSlot, shardThreadAdds;
+
+static inline void shardAdd(struct shardCounter *c, long delta) {
+    int cpu;
+
+    if (shardThreadAdds-- <= 0) {
+	if ((cpu = sched_getcpu()) < 0)
+	    cpu = (uint64_t) pthread_self() * 0x9e3779b97f4a7c15ULL >> 32 & 0x7fffffff;
+	shardThreadSlot = cpu;
+	shardThreadAdds = SHARD_RECHECK - 1;
+    }
+    atomic_fetch_add_explicit(&c->shards[shardThreadSlot & c->mask].value, delta, memory_order_relaxed);
+}
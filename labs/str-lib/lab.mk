@@ -14,8 +14,14 @@ test: build
 	@echo Test 2 - find
 	./${EXE_NAME}.o -find "This is a super long string" "super long"
 	@echo Test 3 - failed addition
-	./${EXE_NAME}.o -add "Initial String"
+	-./${EXE_NAME}.o -add "Initial String"
 	@echo Test 4 - failed find
-	./${EXE_NAME}.o -find "This is my super long string"
+	-./${EXE_NAME}.o -find "This is my super long string"
+	@echo Test 5 - multi-pattern find
+	./${EXE_NAME}.o -findall README.md string find add missing
 clean:
 	rm -rf *.o
+bench:
+	gcc -O2 ${APP_NAME}.c ${LIB_NAME}.c -o ${EXE_NAME}_bench.o
+	@echo Benchmark - strlib against glibc, 8B to 1MB
+	./${EXE_NAME}_bench.o -bench
@@ -1,5 +1,390 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "strlib.h"
 
-int main() {
+#define BENCH_MIN_LENGTH 8
+#define BENCH_MAX_LENGTH (1024 * 1024)
+#define BENCH_BYTES (64L * 1024 * 1024)
+#define BENCH_MAX_PIECES 65536
+#define BENCH_MAX_CHAINED 8192
+#define BENCH_TEXT_LENGTH (64L * 1024 * 1024)
+
+static volatile long sink;
+
+/*
+ * Appends every addition to origin twice, once through mystradd and once
+ * through the string builder, and checks both give the same text.
+ */
+static int add(char *origin, char **additions, int count) {
+    char *result = origin, *next;
+    struct mystr builder;
+    int i;
+
+    for (i = 0; i < count; i++) {
+	next = mystradd(result, additions[i]);
+	if (result != origin)
+	    free(result);
+	if (next == NULL) {
+	    fprintf(stderr, "Cannot allocate the new string\n");
+	    return 1;
+	}
+	result = next;
+    }
+
+    mystrInit(&builder, NULL);
+    if (mystrAppend(&builder, origin) < 0 || mystrAppendAll(&builder, additions, count) < 0) {
+	fprintf(stderr, "Cannot allocate the new string\n");
+	return 1;
+    }
+    if (mystrLength(&builder) != (size_t) mystrlen(result)
+	|| strcmp(mystrData(&builder), result) != 0) {
+	fprintf(stderr, "String builder gave [%s] instead of [%s]\n", mystrData(&builder), result);
+	return 1;
+    }
+
+    printf("Initial Lenght      : %d\n", mystrlen(origin));
+    printf("New String          : %s\n", mystrData(&builder));
+    printf("New length          : %zu\n", mystrLength(&builder));
+    mystrFree(&builder);
+    free(result);
+    return 0;
+}
+
+static int find(char *origin, char *substr) {
+    int position = mystrfind(origin, substr);
+
+    if (position < 0)
+	printf("['%s'] string was not found\n", substr);
+    else
+	printf("['%s'] string was found at [%d] position\n", substr, position);
+    return 0;
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* average ns per evaluation of call */
+#define TIME_CALLS(reps, call) ({				\
+	    double start = seconds();				\
+	    long r;						\
+	    for (r = 0; r < (reps); r++)			\
+		sink += (long) (call);				\
+	    (seconds() - start) * 1e9 / (reps);			\
+	})
+
+static char *concat(char *origin, char *addition) {
+    char *result = malloc(strlen(origin) + strlen(addition) + 1);
+    strcpy(result, origin);
+    strcat(result, addition);
+    return result;
+}
+
+static long addAndFree(char *(*fn)(char *, char *), char *origin, char *addition) {
+    char *result = fn(origin, addition);
+    long first = result[0];
+    free(result);
+    return first;
+}
+
+/*
+ * Times each function against its glibc counterpart on strings from 8
+ * bytes to 1 MB. The find haystack is random lowercase text with the
+ * needle (its last 16 bytes) only at the end.
+ */
+static int bench() {
+    char *text = malloc(BENCH_MAX_LENGTH + 1);
+    char *half = malloc(BENCH_MAX_LENGTH / 2 + 1);
+    char needle[17];
+    long length, reps, i;
+
+    if (text == NULL || half == NULL) {
+	fprintf(stderr, "Cannot allocate benchmark strings\n");
+	return 1;
+    }
+    srand(1);
+    for (i = 0; i < BENCH_MAX_LENGTH; i++)
+	text[i] = 'a' + rand() % 26;
+
+    printf("%8s %12s %12s %12s %12s %12s %12s\n", "length", "strlen", "mystrlen",
+	   "strstr", "mystrfind", "malloc+cat", "mystradd");
+    for (length = BENCH_MIN_LENGTH; length <= BENCH_MAX_LENGTH; length *= 4) {
+	long needleLength = length < 16 ? length / 2 : 16;
+	char *tail;
+	double ns[6];
+
+	reps = BENCH_BYTES / length;
+	text[length] = '\0';
+	memcpy(needle, text + length - needleLength, needleLength);
+	needle[needleLength] = '\0';
+	memcpy(half, text, length / 2);
+	half[length / 2] = '\0';
+	tail = text + length / 2;
+
+	ns[0] = TIME_CALLS(reps, strlen(text));
+	ns[1] = TIME_CALLS(reps, mystrlen(text));
+	ns[2] = TIME_CALLS(reps, strstr(text, needle));
+	ns[3] = TIME_CALLS(reps, mystrfind(text, needle));
+	ns[4] = TIME_CALLS(reps, addAndFree(concat, half, tail));
+	ns[5] = TIME_CALLS(reps, addAndFree(mystradd, half, tail));
+	printf("%8ld %10.1fns %10.1fns %10.1fns %10.1fns %10.1fns %10.1fns\n",
+	       length, ns[0], ns[1], ns[2], ns[3], ns[4], ns[5]);
+	text[length] = 'a' + rand() % 26;
+    }
+    free(text);
+    free(half);
+    return 0;
+}
+
+static long chainAdds(char **pieces, int count) {
+    char *result = mystradd("", pieces[0]), *next;
+    long length;
+    int i;
+
+    for (i = 1; i < count; i++) {
+	next = mystradd(result, pieces[i]);
+	free(result);
+	result = next;
+    }
+    length = mystrlen(result);
+    free(result);
+    return length;
+}
+
+static long buildAppends(char **pieces, int count, struct myarena *arena) {
+    struct mystr s;
+    long length;
+    int i;
+
+    mystrInit(&s, arena);
+    for (i = 0; i < count; i++)
+	mystrAppend(&s, pieces[i]);
+    length = mystrLength(&s);
+    mystrFree(&s);
+    if (arena != NULL)
+	myarenaFree(arena);
+    return length;
+}
+
+static long buildJoin(char **pieces, int count) {
+    struct mystr s;
+    long length;
+
+    mystrInit(&s, NULL);
+    mystrJoin(&s, pieces, count, ", ");
+    length = mystrLength(&s);
+    mystrFree(&s);
+    return length;
+}
+
+/*
+ * Builds one string out of many 16-byte pieces: chained mystradd calls
+ * copy the whole prefix every time, the builder appends in place.
+ */
+static int benchAppends() {
+    static char storage[BENCH_MAX_PIECES][17];
+    char **pieces = malloc(BENCH_MAX_PIECES * sizeof(char *));
+    struct myarena arena;
+    long count, reps, i;
+
+    if (pieces == NULL) {
+	fprintf(stderr, "Cannot allocate benchmark strings\n");
+	return 1;
+    }
+    for (i = 0; i < BENCH_MAX_PIECES; i++) {
+	snprintf(storage[i], sizeof(storage[i]), "piece-%010ld", i);
+	pieces[i] = storage[i];
+    }
+    myarenaInit(&arena);
+
+    printf("\n%8s %14s %14s %14s %14s\n", "pieces", "mystradd", "mystrAppend",
+	   "arena", "mystrJoin");
+    for (count = 16; count <= BENCH_MAX_PIECES; count *= 4) {
+	reps = BENCH_BYTES / 16 / count / 16 + 1;
+	if (count <= BENCH_MAX_CHAINED)
+	    printf("%8ld %12.1fus", count, TIME_CALLS(reps, chainAdds(pieces, count)) / 1e3);
+	else
+	    printf("%8ld %14s", count, "-");
+	printf(" %12.1fus", TIME_CALLS(reps, buildAppends(pieces, count, NULL)) / 1e3);
+	printf(" %12.1fus", TIME_CALLS(reps, buildAppends(pieces, count, &arena)) / 1e3);
+	printf(" %12.1fus\n", TIME_CALLS(reps, buildJoin(pieces, count)) / 1e3);
+    }
+    free(pieces);
     return 0;
 }
+
+struct matchCounts {
+    long *counts;
+    long *first;
+};
+
+static int countMatch(int pattern, long position, void *data) {
+    struct matchCounts *matches = data;
+    if (matches->counts[pattern]++ == 0)
+	matches->first[pattern] = position;
+    return 0;
+}
+
+static char *readFile(const char *fileName, size_t *length) {
+    FILE *file = fopen(fileName, "rb");
+    char *text;
+    long size;
+
+    if (file == NULL) {
+	perror(fileName);
+	return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    text = malloc(size + 1);
+    if (text == NULL || fread(text, 1, size, file) != (size_t) size) {
+	fprintf(stderr, "Cannot read %s\n", fileName);
+	free(text);
+	fclose(file);
+	return NULL;
+    }
+    text[size] = '\0';
+    fclose(file);
+    *length = size;
+    return text;
+}
+
+/* Counts every pattern in a file in one pass and reports the throughput. */
+static int findAll(char *fileName, char **patterns, int count) {
+    struct mypatterns *set;
+    struct matchCounts matches;
+    size_t length;
+    double start, elapsed;
+    char *text;
+    int i;
+
+    text = readFile(fileName, &length);
+    if (text == NULL)
+	return 1;
+    set = mypatternsCompile(patterns, count, 1);
+    matches.counts = calloc(count, sizeof(long));
+    matches.first = calloc(count, sizeof(long));
+    if (set == NULL || matches.counts == NULL || matches.first == NULL) {
+	fprintf(stderr, "Cannot compile the patterns\n");
+	return 1;
+    }
+
+    start = seconds();
+    mystrfindAll(set, text, length, countMatch, &matches);
+    elapsed = seconds() - start;
+
+    for (i = 0; i < count; i++) {
+	if (matches.counts[i] == 0)
+	    printf("['%s'] string was not found\n", patterns[i]);
+	else
+	    printf("['%s'] string was found %ld times, first at [%ld] position\n",
+		   patterns[i], matches.counts[i], matches.first[i]);
+    }
+    printf("Scanned %zu bytes in %.3f ms (%.2f GB/s)\n", length, elapsed * 1e3,
+	   length / elapsed / 1e9);
+
+    mypatternsFree(set);
+    free(matches.counts);
+    free(matches.first);
+    free(text);
+    return 0;
+}
+
+/* Every occurrence of every pattern through repeated mystrfind calls. */
+static long findEach(char *text, char **patterns, int count) {
+    long matches = 0;
+    int i, position;
+    char *from;
+
+    for (i = 0; i < count; i++) {
+	for (from = text; (position = mystrfind(from, patterns[i])) >= 0; from += position + 1)
+	    matches++;
+    }
+    return matches;
+}
+
+static void benchPatterns(const char *title, char *text, char **patterns, int count) {
+    struct mypatterns *filtered = mypatternsCompile(patterns, count, 1);
+    struct mypatterns *plain = mypatternsCompile(patterns, count, 0);
+    double start, seconds1, seconds2, seconds3;
+    long found1, found2, found3;
+
+    start = seconds();
+    found1 = findEach(text, patterns, count);
+    seconds1 = seconds() - start;
+    start = seconds();
+    found2 = mystrfindAll(plain, text, BENCH_TEXT_LENGTH, NULL, NULL);
+    seconds2 = seconds() - start;
+    start = seconds();
+    found3 = mystrfindAll(filtered, text, BENCH_TEXT_LENGTH, NULL, NULL);
+    seconds3 = seconds() - start;
+
+    printf("%-28s %8ld %8.2f GB/s %8.2f GB/s %8.2f GB/s\n", title, found3,
+	   BENCH_TEXT_LENGTH / seconds1 / 1e9, BENCH_TEXT_LENGTH / seconds2 / 1e9,
+	   BENCH_TEXT_LENGTH / seconds3 / 1e9);
+    if (found1 != found2 || found2 != found3)
+	fprintf(stderr, "Match counts differ: %ld %ld %ld\n", found1, found2, found3);
+    mypatternsFree(filtered);
+    mypatternsFree(plain);
+}
+
+/*
+ * Scans 64MB of log-like text (random lowercase words) for keyword
+ * lists, once per keyword with mystrfind and once with the automaton.
+ */
+static int benchMultiFind() {
+    static char *rare[] = {"ERROR", "WARN", "FATAL", "Exception", "Failed"};
+    static char *common[] = {"error", "warning", "failed", "timeout", "denied",
+			     "panic", "refused", "segfault"};
+    char *text = malloc(BENCH_TEXT_LENGTH + 1);
+    long i = 0, k;
+
+    if (text == NULL) {
+	fprintf(stderr, "Cannot allocate benchmark text\n");
+	return 1;
+    }
+    srand(2);
+    while (i < BENCH_TEXT_LENGTH) {
+	char *word = NULL;
+	long wordLength = 2 + rand() % 8;
+	if (rand() % 4096 == 0)
+	    word = rand() % 2 ? rare[rand() % 5] : common[rand() % 8];
+	if (word != NULL)
+	    wordLength = strlen(word);
+	for (k = 0; k < wordLength && i < BENCH_TEXT_LENGTH; k++)
+	    text[i++] = word != NULL ? word[k] : 'a' + rand() % 26;
+	if (i < BENCH_TEXT_LENGTH)
+	    text[i++] = rand() % 16 == 0 ? '\n' : ' ';
+    }
+    text[BENCH_TEXT_LENGTH] = '\0';
+
+    printf("\n%-28s %8s %13s %13s %13s\n", "64MB of text", "matches", "mystrfind",
+	   "automaton", "prefiltered");
+    benchPatterns("5 keywords, rare first byte", text, rare, 5);
+    benchPatterns("8 lowercase keywords", text, common, 8);
+    free(text);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 4 && strcmp(argv[1], "-add") == 0)
+	return add(argv[2], argv + 3, argc - 3);
+    if (argc == 4 && strcmp(argv[1], "-find") == 0)
+	return find(argv[2], argv[3]);
+    if (argc == 2 && strcmp(argv[1], "-bench") == 0)
+	return bench() || benchAppends() || benchMultiFind();
+    if (argc >= 4 && strcmp(argv[1], "-findall") == 0)
+	return findAll(argv[2], argv + 3, argc - 3);
+
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  %s -add <origin> <addition>...\n", argv[0]);
+    fprintf(stderr, "  %s -find <origin> <substring>\n", argv[0]);
+    fprintf(stderr, "  %s -findall <file> <substring>...\n", argv[0]);
+    fprintf(stderr, "  %s -bench\n", argv[0]);
+    return 1;
+}
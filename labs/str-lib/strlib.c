@@ -1,13 +1,623 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "strlib.h"
 
+#define ONES  ((uintptr_t) -1 / 0xff)
+#define HIGHS (ONES * 0x80)
+/* nonzero when some byte of x is zero */
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
 
-int mystrlen(char *str){
+/* Candidates that fail verification cost this many skipped bytes each
+ * before mystrfind gives up on the filter and switches to Two-Way. */
+#define FILTER_PENALTY 8
+
+/* mystrlen reads past the terminator on purpose, within the same page */
+#if defined(__GNUC__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+/*
+ * Aligned loads never cross a page boundary, so reading a whole block
+ * that starts before str or runs past its terminator is safe; the bits
+ * of the bytes before str are shifted out of the first mask.
+ */
+NO_SANITIZE_ADDRESS int mystrlen(char *str) {
+    const char *s = str;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i *block = (const __m128i *) ((uintptr_t) s & ~(uintptr_t) 15);
+    unsigned mask;
+
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(block), zero));
+    mask >>= (uintptr_t) s & 15;
+    if (mask != 0)
+	return __builtin_ctz(mask);
+    /* step to a 64-byte boundary, then test a cache line per iteration */
+    while (((uintptr_t) ++block & 63) != 0) {
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(block), zero));
+	if (mask != 0)
+	    return (const char *) block + __builtin_ctz(mask) - s;
+    }
+    for (;; block += 4) {
+	__m128i min = _mm_min_epu8(_mm_min_epu8(_mm_load_si128(block), _mm_load_si128(block + 1)),
+				   _mm_min_epu8(_mm_load_si128(block + 2), _mm_load_si128(block + 3)));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(min, zero)) != 0)
+	    break;
+    }
+    for (;; block++) {
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(block), zero));
+	if (mask != 0)
+	    return (const char *) block + __builtin_ctz(mask) - s;
+    }
+#else
+    const uintptr_t *word;
+
+    for (; (uintptr_t) s % sizeof(uintptr_t) != 0; s++)
+	if (*s == '\0')
+	    return s - str;
+    for (word = (const uintptr_t *) s; !HAS_ZERO(*word); word++)
+	;
+    for (s = (const char *) word; *s != '\0'; s++)
+	;
+    return s - str;
+#endif
+}
+
+/* Both lengths are known up front, so the result is allocated once. */
+char *mystradd(char *origin, char *addition) {
+    size_t originLength, additionLength;
+    char *result;
+
+    if (origin == NULL || addition == NULL)
+	return NULL;
+    originLength = mystrlen(origin);
+    additionLength = mystrlen(addition);
+    result = malloc(originLength + additionLength + 1);
+    if (result == NULL)
+	return NULL;
+    memcpy(result, origin, originLength);
+    memcpy(result + originLength, addition, additionLength + 1);
+    return result;
+}
+
+/*
+ * Critical factorization of the needle, the starting point of Two-Way.
+ * Returns the position of the maximal suffix under the byte order (or
+ * its reverse) and stores its period.
+ */
+static long maximalSuffix(const unsigned char *x, long m, long *period, int reverse) {
+    long ms = -1, j = 0, k = 1, p = 1;
+    unsigned char a, b;
+
+    while (j + k < m) {
+	a = x[j + k];
+	b = x[ms + k];
+	if (reverse ? a > b : a < b) {
+	    j += k;
+	    k = 1;
+	    p = j - ms;
+	} else if (a == b) {
+	    if (k != p) {
+		k++;
+	    } else {
+		j += p;
+		k = 1;
+	    }
+	} else {
+	    ms = j;
+	    j = ms + 1;
+	    k = p = 1;
+	}
+    }
+    *period = p;
+    return ms;
+}
+
+/*
+ * Crochemore-Perrin Two-Way matching from position start, linear in the
+ * haystack length whatever the needle looks like. Returns the first
+ * match or -1.
+ */
+static long twoWay(const unsigned char *y, long n, const unsigned char *x, long m, long start) {
+    long ell, per, p, q, i, j, memory;
+
+    i = maximalSuffix(x, m, &p, 0);
+    j = maximalSuffix(x, m, &q, 1);
+    if (i > j) {
+	ell = i;
+	per = p;
+    } else {
+	ell = j;
+	per = q;
+    }
+
+    if (memcmp(x, x + per, ell + 1) == 0) {
+	/* periodic needle: remember how much of the period already matched */
+	memory = -1;
+	for (j = start; j <= n - m;) {
+	    i = (ell > memory ? ell : memory) + 1;
+	    while (i < m && x[i] == y[i + j])
+		i++;
+	    if (i >= m) {
+		i = ell;
+		while (i > memory && x[i] == y[i + j])
+		    i--;
+		if (i <= memory)
+		    return j;
+		j += per;
+		memory = m - per - 1;
+	    } else {
+		j += i - ell;
+		memory = -1;
+	    }
+	}
+    } else {
+	per = (ell + 1 > m - ell - 1 ? ell + 1 : m - ell - 1) + 1;
+	for (j = start; j <= n - m;) {
+	    i = ell + 1;
+	    while (i < m && x[i] == y[i + j])
+		i++;
+	    if (i >= m) {
+		i = ell;
+		while (i >= 0 && x[i] == y[i + j])
+		    i--;
+		if (i < 0)
+		    return j;
+		j += per;
+	    } else {
+		j += i - ell;
+	    }
+	}
+    }
+    return -1;
+}
+
+/*
+ * Returns the position of the first occurrence of substr in origin, or
+ * -1. Positions whose first and last bytes both match the needle are
+ * found 16 at a time and only those are compared in full. Needles that
+ * keep producing false candidates (long runs of the same bytes) are
+ * handed to Two-Way, so the worst case stays linear.
+ */
+int mystrfind(char *origin, char *substr) {
+    const unsigned char *y = (const unsigned char *) origin;
+    const unsigned char *x = (const unsigned char *) substr;
+    long n, m, i = 0, budget;
+
+    if (origin == NULL || substr == NULL)
+	return -1;
+    n = mystrlen(origin);
+    m = mystrlen(substr);
+    if (m == 0)
+	return 0;
+    if (m > n)
+	return -1;
+    if (m == 1) {
+	const char *found = memchr(origin, substr[0], n);
+	return found == NULL ? -1 : found - origin;
+    }
+    budget = n;
+
+#ifdef __SSE2__
+    {
+	const __m128i first = _mm_set1_epi8(x[0]);
+	const __m128i last = _mm_set1_epi8(x[m - 1]);
+
+	/* two blocks per iteration, candidates are rare in most text */
+	for (; i + m - 1 + 32 <= n; i += 32) {
+	    __m128i match0 = _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (y + i)), first),
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (y + i + m - 1)), last));
+	    __m128i match1 = _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (y + i + 16)), first),
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (y + i + m + 15)), last));
+	    unsigned mask = _mm_movemask_epi8(match0) | _mm_movemask_epi8(match1) << 16;
+	    while (mask != 0) {
+		long pos = i + __builtin_ctz(mask);
+		if (memcmp(y + pos + 1, x + 1, m - 2) == 0)
+		    return pos;
+		budget -= FILTER_PENALTY + m / 4;
+		mask &= mask - 1;
+	    }
+	    if (budget < 0)
+		return twoWay(y, n, x, m, i + 32);
+	}
+    }
+#endif
+    for (; i <= n - m; i++) {
+	if (y[i] != x[0] || y[i + m - 1] != x[m - 1])
+	    continue;
+	if (memcmp(y + i + 1, x + 1, m - 2) == 0)
+	    return i;
+	budget -= FILTER_PENALTY + m / 4;
+	if (budget < 0)
+	    return twoWay(y, n, x, m, i + 1);
+    }
+    return -1;
+}
+
+void myarenaInit(struct myarena *arena) {
+    arena->blocks = NULL;
+}
+
+void myarenaFree(struct myarena *arena) {
+    struct myarenaBlock *block, *next;
+
+    for (block = arena->blocks; block != NULL; block = next) {
+	next = block->next;
+	free(block);
+    }
+    arena->blocks = NULL;
+}
+
+static char *arenaAlloc(struct myarena *arena, size_t size) {
+    struct myarenaBlock *block = arena->blocks;
+
+    size = (size + 15) & ~(size_t) 15;
+    if (block == NULL || block->size - block->used < size) {
+	size_t blockSize = size > MYARENA_BLOCK ? size : MYARENA_BLOCK;
+	block = malloc(sizeof(struct myarenaBlock) + blockSize);
+	if (block == NULL)
+	    return NULL;
+	block->size = blockSize;
+	block->used = 0;
+	block->next = arena->blocks;
+	arena->blocks = block;
+    }
+    block->used += size;
+    return block->data + block->used - size;
+}
+
+/* The newest arena allocation can grow in place when its block has room. */
+static int arenaExtend(struct myarena *arena, char *buffer, size_t oldSize, size_t newSize) {
+    struct myarenaBlock *block = arena->blocks;
+
+    oldSize = (oldSize + 15) & ~(size_t) 15;
+    newSize = (newSize + 15) & ~(size_t) 15;
+    if (block == NULL || buffer + oldSize != block->data + block->used
+	|| block->size - block->used < newSize - oldSize)
+	return 0;
+    block->used += newSize - oldSize;
+    return 1;
+}
+
+void mystrInit(struct mystr *s, struct myarena *arena) {
+    s->length = 0;
+    s->capacity = MYSTR_INLINE;
+    s->heap = NULL;
+    s->arena = arena;
+    s->local[0] = '\0';
+}
+
+void mystrFree(struct mystr *s) {
+    if (s->arena == NULL)
+	free(s->heap);
+    mystrInit(s, s->arena);
+}
+
+char *mystrData(struct mystr *s) {
+    return s->heap != NULL ? s->heap : s->local;
+}
+
+size_t mystrLength(const struct mystr *s) {
+    return s->length;
+}
+
+/*
+ * Makes room for capacity bytes of text. Capacity at least doubles, so
+ * a sequence of appends copies each byte a constant number of times on
+ * average. Returns -1 when out of memory, leaving s untouched.
+ */
+int mystrReserve(struct mystr *s, size_t capacity) {
+    size_t newCapacity = s->capacity;
+    char *buffer;
+
+    if (capacity <= s->capacity)
+	return 0;
+    while (newCapacity < capacity)
+	newCapacity = newCapacity * 2 + 1;
+
+    if (s->arena != NULL) {
+	if (s->heap != NULL && arenaExtend(s->arena, s->heap, s->capacity + 1, newCapacity + 1)) {
+	    s->capacity = newCapacity;
+	    return 0;
+	}
+	buffer = arenaAlloc(s->arena, newCapacity + 1);
+	if (buffer == NULL)
+	    return -1;
+	memcpy(buffer, mystrData(s), s->length + 1);
+    } else if (s->heap != NULL) {
+	buffer = realloc(s->heap, newCapacity + 1);
+	if (buffer == NULL)
+	    return -1;
+    } else {
+	buffer = malloc(newCapacity + 1);
+	if (buffer == NULL)
+	    return -1;
+	memcpy(buffer, s->local, s->length + 1);
+    }
+    s->heap = buffer;
+    s->capacity = newCapacity;
     return 0;
 }
 
-char *mystradd(char *origin, char *addition){
+int mystrAppendLength(struct mystr *s, const char *text, size_t length) {
+    char *data;
+
+    if (mystrReserve(s, s->length + length) < 0)
+	return -1;
+    data = mystrData(s);
+    memcpy(data + s->length, text, length);
+    s->length += length;
+    data[s->length] = '\0';
     return 0;
 }
 
-int mystrfind(char *origin, char *substr){
+int mystrAppend(struct mystr *s, char *text) {
+    return mystrAppendLength(s, text, mystrlen(text));
+}
+
+/* Measures all parts first, so the buffer grows at most once. */
+int mystrJoin(struct mystr *s, char **parts, int count, char *separator) {
+    size_t separatorLength = separator == NULL ? 0 : mystrlen(separator);
+    size_t total = s->length, *lengths;
+    char *data;
+    int i;
+
+    if (count <= 0)
+	return 0;
+    lengths = malloc(count * sizeof(size_t));
+    if (lengths == NULL)
+	return -1;
+    for (i = 0; i < count; i++) {
+	lengths[i] = mystrlen(parts[i]);
+	total += lengths[i];
+    }
+    total += separatorLength * (count - 1);
+    if (mystrReserve(s, total) < 0) {
+	free(lengths);
+	return -1;
+    }
+
+    data = mystrData(s);
+    for (i = 0; i < count; i++) {
+	if (i > 0 && separatorLength > 0) {
+	    memcpy(data + s->length, separator, separatorLength);
+	    s->length += separatorLength;
+	}
+	memcpy(data + s->length, parts[i], lengths[i]);
+	s->length += lengths[i];
+    }
+    data[s->length] = '\0';
+    free(lengths);
     return 0;
 }
+
+int mystrAppendAll(struct mystr *s, char **parts, int count) {
+    return mystrJoin(s, parts, count, NULL);
+}
+
+/*
+ * Aho-Corasick automaton compiled into a full DFA over byte classes.
+ * Each table entry is the premultiplied row of the next state shifted
+ * left once, with the low bit set when that state ends some pattern.
+ */
+struct mypatterns {
+    int count;
+    int numStates;
+    int numClasses;
+    unsigned char classOf[256];
+    uint32_t *table;
+    int *own;               /* first pattern ending exactly at a state, -1 if none */
+    int *dictLink;          /* nearest state down the fail chain that has own */
+    int *sameNext;          /* next pattern equal to this one */
+    int *lengths;
+    int prefilter;          /* number of distinct first bytes when the prefilter is on */
+    unsigned char firstBytes[MYFIND_PREFILTER_BYTES];
+    unsigned char isFirst[256];
+};
+
+void mypatternsFree(struct mypatterns *set) {
+    if (set == NULL)
+	return;
+    free(set->table);
+    free(set->own);
+    free(set->dictLink);
+    free(set->sameNext);
+    free(set->lengths);
+    free(set);
+}
+
+/*
+ * Builds the trie, then fills fail links breadth first; a missing edge
+ * of a state is the same edge of its fail state, so the result needs no
+ * fail-link walking while scanning. Empty patterns never match. The
+ * prefilter is kept only when the patterns start with at most
+ * MYFIND_PREFILTER_BYTES distinct bytes. Returns NULL when out of memory.
+ */
+struct mypatterns *mypatternsCompile(char **patterns, int count, int prefilter) {
+    struct mypatterns *set = calloc(1, sizeof(struct mypatterns));
+    int *next = NULL, *fail = NULL, *queue = NULL;
+    size_t maxStates = 1;
+    int i, c, s, head, tail, numFirst = 0;
+
+    if (set == NULL || count < 0)
+	goto failed;
+    set->count = count;
+    set->numClasses = 1;
+    for (i = 0; i < count; i++) {
+	const unsigned char *p = (const unsigned char *) patterns[i];
+	maxStates += mystrlen(patterns[i]);
+	for (; *p != '\0'; p++)
+	    if (set->classOf[*p] == 0)
+		set->classOf[*p] = set->numClasses++;
+    }
+    if ((uint64_t) maxStates * set->numClasses * 2 > UINT32_MAX)
+	goto failed;
+
+    next = malloc(maxStates * set->numClasses * sizeof(int));
+    fail = calloc(maxStates, sizeof(int));
+    queue = malloc(maxStates * sizeof(int));
+    set->own = malloc(maxStates * sizeof(int));
+    set->dictLink = malloc(maxStates * sizeof(int));
+    set->sameNext = malloc((count + 1) * sizeof(int));
+    set->lengths = malloc((count + 1) * sizeof(int));
+    if (next == NULL || fail == NULL || queue == NULL || set->own == NULL
+	|| set->dictLink == NULL || set->sameNext == NULL || set->lengths == NULL)
+	goto failed;
+    memset(next, -1, maxStates * set->numClasses * sizeof(int));
+    memset(set->own, -1, maxStates * sizeof(int));
+
+    set->numStates = 1;
+    for (i = 0; i < count; i++) {
+	const unsigned char *p = (const unsigned char *) patterns[i];
+	s = 0;
+	set->lengths[i] = mystrlen(patterns[i]);
+	set->sameNext[i] = -1;
+	if (*p == '\0')
+	    continue;
+	if (!set->isFirst[*p]) {
+	    set->isFirst[*p] = 1;
+	    if (numFirst < MYFIND_PREFILTER_BYTES)
+		set->firstBytes[numFirst] = *p;
+	    numFirst++;
+	}
+	for (; *p != '\0'; p++) {
+	    int *edge = &next[s * set->numClasses + set->classOf[*p]];
+	    if (*edge < 0)
+		*edge = set->numStates++;
+	    s = *edge;
+	}
+	set->sameNext[i] = set->own[s];
+	set->own[s] = i;
+    }
+    set->prefilter = prefilter && numFirst <= MYFIND_PREFILTER_BYTES ? numFirst : 0;
+
+    head = tail = 0;
+    set->dictLink[0] = -1;
+    for (c = 0; c < set->numClasses; c++) {
+	if (next[c] < 0) {
+	    next[c] = 0;
+	} else {
+	    fail[next[c]] = 0;
+	    queue[tail++] = next[c];
+	}
+    }
+    while (head < tail) {
+	s = queue[head++];
+	set->dictLink[s] = set->own[fail[s]] >= 0 ? fail[s] : set->dictLink[fail[s]];
+	for (c = 0; c < set->numClasses; c++) {
+	    int *edge = &next[s * set->numClasses + c];
+	    if (*edge < 0) {
+		*edge = next[fail[s] * set->numClasses + c];
+	    } else {
+		fail[*edge] = next[fail[s] * set->numClasses + c];
+		queue[tail++] = *edge;
+	    }
+	}
+    }
+
+    set->table = malloc((size_t) set->numStates * set->numClasses * sizeof(uint32_t));
+    if (set->table == NULL)
+	goto failed;
+    for (i = 0; i < set->numStates * set->numClasses; i++) {
+	int target = next[i];
+	int output = set->own[target] >= 0 || set->dictLink[target] >= 0;
+	set->table[i] = (uint32_t) (target * set->numClasses) << 1 | output;
+    }
+    free(next);
+    free(fail);
+    free(queue);
+    return set;
+
+failed:
+    free(next);
+    free(fail);
+    free(queue);
+    mypatternsFree(set);
+    return NULL;
+}
+
+/*
+ * From the root state, bytes that start no pattern lead back to the
+ * root, so they can be skipped 16 at a time. Returns the position of the
+ * next byte that starts a pattern, or length.
+ */
+static size_t skipToFirstByte(const struct mypatterns *set, const unsigned char *text,
+			      size_t i, size_t length) {
+#ifdef __SSE2__
+    __m128i first[MYFIND_PREFILTER_BYTES];
+    int k;
+
+    for (k = 0; k < set->prefilter; k++)
+	first[k] = _mm_set1_epi8(set->firstBytes[k]);
+    for (; i + 16 <= length; i += 16) {
+	__m128i block = _mm_loadu_si128((const __m128i *) (text + i));
+	__m128i hits = _mm_cmpeq_epi8(block, first[0]);
+	unsigned mask;
+	for (k = 1; k < set->prefilter; k++)
+	    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, first[k]));
+	mask = _mm_movemask_epi8(hits);
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < length && !set->isFirst[text[i]]; i++)
+	;
+    return i;
+}
+
+/* Reports the patterns that end at state s. Returns -1 if told to stop. */
+static long reportMatches(const struct mypatterns *set, int s, size_t end,
+			  mymatchFunc onMatch, void *data) {
+    long matches = 0;
+    int p;
+
+    for (; s >= 0; s = set->dictLink[s]) {
+	for (p = set->own[s]; p >= 0; p = set->sameNext[p]) {
+	    matches++;
+	    if (onMatch != NULL && onMatch(p, (long) end - set->lengths[p] + 1, data))
+		return -matches - 1;
+	}
+    }
+    return matches;
+}
+
+/*
+ * Reports every occurrence of every pattern in text, overlapping ones
+ * included, in order of where they end. Returns the number of matches
+ * reported.
+ */
+long mystrfindAll(struct mypatterns *set, const char *text, size_t length,
+		  mymatchFunc onMatch, void *data) {
+    const unsigned char *y = (const unsigned char *) text;
+    const unsigned char *classOf = set->classOf;
+    const uint32_t *table = set->table;
+    int prefilter = set->prefilter > 0;
+    uint32_t row = 0, entry;
+    long matches = 0, found;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+	if (row == 0 && prefilter) {
+	    i = skipToFirstByte(set, y, i, length);
+	    if (i == length)
+		break;
+	}
+	entry = table[row + classOf[y[i]]];
+	row = entry >> 1;
+	if (entry & 1) {
+	    found = reportMatches(set, row / set->numClasses, i, onMatch, data);
+	    if (found < 0)
+		return matches - found - 1;
+	    matches += found;
+	}
+    }
+    return matches;
+}
@@ -0,0 +1,72 @@
+// String manipulation library
+//
+// mystrlen and mystrfind read 16 bytes at a time with SSE2 where the
+// compiler targets it and fall back to word-at-a-time scanning elsewhere.
+
+int mystrlen(char *str);
+char *mystradd(char *origin, char *addition);
+int mystrfind(char *origin, char *substr);
+
+// Length-carrying string builder
+//
+// Keeps its length and capacity, so appends don't rescan the text and
+// grow the buffer by doubling. Short strings live inline in the struct.
+// With an arena, buffers come from the arena and are released all at
+// once with myarenaFree instead of per string.
+
+#include <stddef.h>
+
+#define MYSTR_INLINE 31
+#define MYARENA_BLOCK (64 * 1024)
+
+struct myarenaBlock {
+    struct myarenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct myarena {
+    struct myarenaBlock *blocks;    /* newest first */
+};
+
+struct mystr {
+    size_t length;
+    size_t capacity;                /* not counting the terminator */
+    char *heap;                     /* NULL while the text fits inline */
+    struct myarena *arena;          /* NULL for malloc'd buffers */
+    char local[MYSTR_INLINE + 1];
+};
+
+void myarenaInit(struct myarena *arena);
+void myarenaFree(struct myarena *arena);
+
+void mystrInit(struct mystr *s, struct myarena *arena);
+void mystrFree(struct mystr *s);
+int mystrReserve(struct mystr *s, size_t capacity);
+int mystrAppend(struct mystr *s, char *text);
+int mystrAppendLength(struct mystr *s, const char *text, size_t length);
+int mystrAppendAll(struct mystr *s, char **parts, int count);
+int mystrJoin(struct mystr *s, char **parts, int count, char *separator);
+char *mystrData(struct mystr *s);
+size_t mystrLength(const struct mystr *s);
+
+// Multi-pattern search
+//
+// mypatternsCompile builds an Aho-Corasick automaton for a set of
+// patterns once; mystrfindAll then finds every occurrence of all of them
+// in a single pass over the text. Bytes that appear in no pattern share
+// one column of the transition table, which keeps it small enough to
+// stay in cache for keyword lists.
+
+#define MYFIND_PREFILTER_BYTES 4
+
+struct mypatterns;
+
+/* Gets the pattern index and start position of a match, returns nonzero to stop. */
+typedef int (*mymatchFunc)(int pattern, long position, void *data);
+
+struct mypatterns *mypatternsCompile(char **patterns, int count, int prefilter);
+long mystrfindAll(struct mypatterns *set, const char *text, size_t length,
+		  mymatchFunc onMatch, void *data);
+void mypatternsFree(struct mypatterns *set);
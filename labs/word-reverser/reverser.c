@@ -1,6 +1,202 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CHUNK_SIZE (1 << 20)
+
+/*
+ * Input is read in large chunks and every word is reversed in place, so
+ * the chunk itself is the output buffer: one read() and one write() per
+ * chunk. A word cut by the end of a chunk is moved to the front and
+ * completed by the next read. A word longer than a whole chunk is spilled
+ * to a temporary file and written back out from its end.
+ */
+struct reverser {
+    char *buffer;
+    size_t length;      /* bytes in buffer */
+    FILE *spill;        /* full chunks of the current word, NULL if none */
+    long spilledChunks;
+};
+
+static int isSpace(unsigned char c) {
+    return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+#ifdef __SSE2__
+/* Bit i is set when p[i] is whitespace: ' ' or '\t' to '\r'. */
+static unsigned spaceMask(const char *p) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *) p);
+    __m128i controls = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    __m128i isControl = _mm_cmpeq_epi8(_mm_min_epu8(controls, _mm_set1_epi8('\r' - '\t')),
+					controls);
+    __m128i isBlank = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+    return _mm_movemask_epi8(_mm_or_si128(isControl, isBlank));
+}
+#endif
+
+/* First position from i on whose whitespace-ness is want, or end. */
+static size_t scan(const char *buffer, size_t i, size_t end, int want) {
+#ifdef __SSE2__
+    for (; i + 16 <= end; i += 16) {
+	unsigned mask = spaceMask(buffer + i);
+	if (!want)
+	    mask = ~mask & 0xffff;
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < end && isSpace(buffer[i]) != want; i++)
+	;
+    return i;
+}
+
+static void reverse(char *start, char *end) {
+    char c;
+    while (start < --end) {
+	c = *start;
+	*start++ = *end;
+	*end = c;
+    }
+}
+
+static void writeAll(const char *data, size_t length) {
+    ssize_t written;
+
+    while (length > 0) {
+	written = write(STDOUT_FILENO, data, length);
+	if (written < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("write");
+	    exit(1);
+	}
+	data += written;
+	length -= written;
+    }
+}
+
+/* The whole buffer is one unfinished word, park it in the spill file. */
+static void spillChunk(struct reverser *r) {
+    if (r->spill == NULL) {
+	r->spill = tmpfile();
+	if (r->spill == NULL) {
+	    perror("tmpfile");
+	    exit(1);
+	}
+    }
+    if (fwrite(r->buffer, 1, r->length, r->spill) != r->length) {
+	perror("spill");
+	exit(1);
+    }
+    r->spilledChunks++;
+    r->length = 0;
+}
+
+/*
+ * The long word ended after the first tail bytes of the buffer. Its
+ * reversal is the reversed tail followed by the spilled chunks, last
+ * one first, each reversed.
+ */
+static void finishSpilledWord(struct reverser *r, size_t tail) {
+    char *chunk;
+    long i;
+
+    reverse(r->buffer, r->buffer + tail);
+    writeAll(r->buffer, tail);
+    chunk = malloc(CHUNK_SIZE);
+    if (chunk == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    fflush(r->spill);
+    for (i = r->spilledChunks - 1; i >= 0; i--) {
+	if (pread(fileno(r->spill), chunk, CHUNK_SIZE, (off_t) i * CHUNK_SIZE) != CHUNK_SIZE) {
+	    perror("spill");
+	    exit(1);
+	}
+	reverse(chunk, chunk + CHUNK_SIZE);
+	writeAll(chunk, CHUNK_SIZE);
+    }
+    free(chunk);
+    fclose(r->spill);
+    r->spill = NULL;
+    r->spilledChunks = 0;
+}
+
+/*
+ * Reverses every word that ends inside the buffer and writes everything
+ * before the last, unfinished word. At end of input the last word is
+ * finished too.
+ */
+static void processBuffer(struct reverser *r, int atEnd) {
+    char *buffer = r->buffer;
+    size_t start = 0, end = 0, done;
+
+    if (r->spill != NULL) {
+	end = scan(buffer, 0, r->length, 1);
+	if (end == r->length && !atEnd) {
+	    if (r->length == CHUNK_SIZE)
+		spillChunk(r);
+	    return;
+	}
+	finishSpilledWord(r, end);
+	buffer += end;
+	r->length -= end;
+	memmove(r->buffer, buffer, r->length);
+	buffer = r->buffer;
+	end = 0;
+    }
+
+    for (;;) {
+	start = scan(buffer, end, r->length, 0);
+	if (start == r->length) {
+	    done = r->length;
+	    break;
+	}
+	end = scan(buffer, start, r->length, 1);
+	if (end == r->length && !atEnd) {
+	    done = start;
+	    break;
+	}
+	reverse(buffer + start, buffer + end);
+    }
+
+    writeAll(buffer, done);
+    r->length -= done;
+    memmove(buffer, buffer + done, r->length);
+    if (r->length == CHUNK_SIZE)
+	spillChunk(r);
+}
 
 int main(){
-    // Place your magic here
+    struct reverser r = {NULL, 0, NULL, 0};
+    ssize_t n;
+
+    r.buffer = malloc(CHUNK_SIZE);
+    if (r.buffer == NULL) {
+	perror("malloc");
+	return 1;
+    }
+    for (;;) {
+	n = read(STDIN_FILENO, r.buffer + r.length, CHUNK_SIZE - r.length);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("read");
+	    return 1;
+	}
+	if (n == 0)
+	    break;
+	r.length += n;
+	processBuffer(&r, 0);
+    }
+    processBuffer(&r, 1);
+    free(r.buffer);
     return 0;
 }